@@ -36,6 +36,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <poll.h>
+#include <fcntl.h>
 #include <string.h>
 #include <time.h>
 #include <errno.h>
@@ -59,13 +60,57 @@
     #endif
 #endif
 
+/* Run the events posted since the last call, oldest first. The pipe is
+ * drained before the list is taken, so an event posted after that wakes
+ * the loop up again. */
+static void aeRunPostedEvents(aeEventLoop *eventLoop, int fd, void *clientData, int mask) {
+    aePostedEvent *ev, *next, *fifo = NULL;
+    char buf[64];
+    AE_NOTUSED(clientData);
+    AE_NOTUSED(mask);
+
+    while (read(fd, buf, sizeof(buf)) > 0);
+    ev = __atomic_exchange_n(&eventLoop->posted, NULL, __ATOMIC_ACQUIRE);
+    while (ev) {
+        next = ev->next;
+        ev->next = fifo;
+        fifo = ev;
+        ev = next;
+    }
+    while (fifo) {
+        ev = fifo;
+        fifo = ev->next;
+        ev->proc(eventLoop, ev->clientData);
+    }
+}
+
+static int aeCreatePostPipe(aeEventLoop *eventLoop) {
+    int j;
+
+    if (pipe(eventLoop->postfd) == -1) return -1;
+    for (j = 0; j < 2; j++) {
+        if (fcntl(eventLoop->postfd[j], F_SETFL, O_NONBLOCK) == -1 ||
+            fcntl(eventLoop->postfd[j], F_SETFD, FD_CLOEXEC) == -1)
+            return -1;
+    }
+    if (aeCreateFileEvent(eventLoop, eventLoop->postfd[0], AE_READABLE,
+                aeRunPostedEvents, NULL) == AE_ERR)
+        return -1;
+    return 0;
+}
+
 aeEventLoop *aeCreateEventLoop(int setsize) {
     aeEventLoop *eventLoop;
     int i;
 
-    if ((eventLoop = nn_malloc(sizeof(*eventLoop))) == NULL) goto err;
-    eventLoop->events = nn_malloc(sizeof(aeFileEvent)*setsize);
-    eventLoop->fired = nn_malloc(sizeof(aeFiredEvent)*setsize);
+    eventLoop = nn_malloc_tagged(sizeof(*eventLoop),NN_ALLOC_TAG_EVENTS);
+    if (eventLoop == NULL) goto err;
+    eventLoop->posted = NULL;
+    eventLoop->postfd[0] = eventLoop->postfd[1] = -1;
+    eventLoop->events = nn_malloc_tagged(sizeof(aeFileEvent)*setsize,
+            NN_ALLOC_TAG_EVENTS);
+    eventLoop->fired = nn_malloc_tagged(sizeof(aeFiredEvent)*setsize,
+            NN_ALLOC_TAG_EVENTS);
     if (eventLoop->events == NULL || eventLoop->fired == NULL) goto err;
     eventLoop->setsize = setsize;
     eventLoop->lastTime = time(NULL);
@@ -79,13 +124,19 @@ aeEventLoop *aeCreateEventLoop(int setsize) {
      * vector with it. */
     for (i = 0; i < setsize; i++)
         eventLoop->events[i].mask = AE_NONE;
+    if (aeCreatePostPipe(eventLoop) == -1) {
+        aeApiFree(eventLoop);
+        goto err;
+    }
     return eventLoop;
 
 err:
     if (eventLoop) {
-        nn_free(eventLoop->events);
-        nn_free(eventLoop->fired);
-        nn_free(eventLoop);
+        if (eventLoop->postfd[0] != -1) close(eventLoop->postfd[0]);
+        if (eventLoop->postfd[1] != -1) close(eventLoop->postfd[1]);
+        nn_free_tagged(eventLoop->events, NN_ALLOC_TAG_EVENTS);
+        nn_free_tagged(eventLoop->fired, NN_ALLOC_TAG_EVENTS);
+        nn_free_tagged(eventLoop, NN_ALLOC_TAG_EVENTS);
     }
     return NULL;
 }
@@ -109,8 +160,10 @@ int aeResizeSetSize(aeEventLoop *eventLoop, int setsize) {
     if (eventLoop->maxfd >= setsize) return AE_ERR;
     if (aeApiResize(eventLoop,setsize) == -1) return AE_ERR;
 
-    eventLoop->events = nn_realloc(eventLoop->events,sizeof(aeFileEvent)*setsize);
-    eventLoop->fired = nn_realloc(eventLoop->fired,sizeof(aeFiredEvent)*setsize);
+    eventLoop->events = nn_realloc_tagged(eventLoop->events,
+            sizeof(aeFileEvent)*setsize,NN_ALLOC_TAG_EVENTS);
+    eventLoop->fired = nn_realloc_tagged(eventLoop->fired,
+            sizeof(aeFiredEvent)*setsize,NN_ALLOC_TAG_EVENTS);
     eventLoop->setsize = setsize;
 
     /* Make sure that if we created new slots, they are initialized with
@@ -121,10 +174,49 @@ int aeResizeSetSize(aeEventLoop *eventLoop, int setsize) {
 }
 
 void aeDeleteEventLoop(aeEventLoop *eventLoop) {
+    aeTimeEvent *next_te, *te = eventLoop->timeEventHead;
+
+    /* Free the time events list, including the ones already deleted but
+     * not reaped yet. */
+    while (te) {
+        next_te = te->next;
+        nn_free_tagged(te, NN_ALLOC_TAG_TIMERS);
+        te = next_te;
+    }
     aeApiFree(eventLoop);
-    nn_free(eventLoop->events);
-    nn_free(eventLoop->fired);
-    nn_free(eventLoop);
+    close(eventLoop->postfd[0]);
+    close(eventLoop->postfd[1]);
+    nn_free_tagged(eventLoop->events, NN_ALLOC_TAG_EVENTS);
+    nn_free_tagged(eventLoop->fired, NN_ALLOC_TAG_EVENTS);
+    nn_free_tagged(eventLoop, NN_ALLOC_TAG_EVENTS);
+}
+
+/* Make the loop call proc(eventLoop, clientData) from its own thread, on
+ * its next iteration. This is the only function that may be called from
+ * other threads, it is lock-free and allocates nothing: 'ev' is linked
+ * into the list of posted events and must stay valid until proc is
+ * called. Events posted by the same thread run in order. */
+void aePostEvent(aeEventLoop *eventLoop, aePostedEvent *ev,
+        aePostedProc *proc, void *clientData)
+{
+    aePostedEvent *head;
+    ssize_t nwritten;
+
+    ev->proc = proc;
+    ev->clientData = clientData;
+    head = __atomic_load_n(&eventLoop->posted, __ATOMIC_RELAXED);
+    do {
+        ev->next = head;
+    } while (!__atomic_compare_exchange_n(&eventLoop->posted, &head, ev, 1,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    /* Only the first event of a batch needs to wake the loop up. 'ev' may
+     * already be run and gone here. */
+    if (head == NULL) {
+        do {
+            nwritten = write(eventLoop->postfd[1], "", 1);
+        } while (nwritten == -1 && errno == EINTR);
+    }
 }
 
 void aeStop(aeEventLoop *eventLoop) {
@@ -206,7 +298,7 @@ long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
     long long id = eventLoop->timeEventNextId++;
     aeTimeEvent *te;
 
-    te = nn_malloc(sizeof(*te));
+    te = nn_malloc_tagged(sizeof(*te), NN_ALLOC_TAG_TIMERS);
     if (te == NULL) return AE_ERR;
     te->id = id;
     aeAddMillisecondsToNow(milliseconds,&te->when_sec,&te->when_ms);
@@ -297,7 +389,7 @@ static int processTimeEvents(aeEventLoop *eventLoop) {
                 prev->next = te->next;
             if (te->finalizerProc)
                 te->finalizerProc(eventLoop, te->clientData);
-            nn_free(te);
+            nn_free_tagged(te, NN_ALLOC_TAG_TIMERS);
             te = next;
             continue;
         }
@@ -35,6 +35,10 @@
 
 #include <time.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define AE_OK 0
 #define AE_ERR -1
 
@@ -60,6 +64,7 @@ typedef void aeFileProc(struct aeEventLoop *eventLoop, int fd, void *clientData,
 typedef int aeTimeProc(struct aeEventLoop *eventLoop, long long id, void *clientData);
 typedef void aeEventFinalizerProc(struct aeEventLoop *eventLoop, void *clientData);
 typedef void aeBeforeSleepProc(struct aeEventLoop *eventLoop);
+typedef void aePostedProc(struct aeEventLoop *eventLoop, void *clientData);
 
 /* File event structure */
 typedef struct aeFileEvent {
@@ -86,6 +91,14 @@ typedef struct aeFiredEvent {
     int mask;
 } aeFiredEvent;
 
+/* Posted event structure, provided by the poster and left alone by the
+ * loop once its proc is called, so the proc may free it. */
+typedef struct aePostedEvent {
+    aePostedProc *proc;
+    void *clientData;
+    struct aePostedEvent *next;
+} aePostedEvent;
+
 /* State of an event based program */
 typedef struct aeEventLoop {
     int maxfd;   /* highest file descriptor currently registered */
@@ -98,6 +111,8 @@ typedef struct aeEventLoop {
     int stop;
     void *apidata; /* This is used for polling API specific data */
     aeBeforeSleepProc *beforesleep;
+    aePostedEvent *posted; /* Posted events not run yet, newest first */
+    int postfd[2]; /* Pipe waking the loop up when an event is posted */
 } aeEventLoop;
 
 /* Prototypes */
@@ -119,5 +134,11 @@ char *aeGetApiName(void);
 void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep);
 int aeGetSetSize(aeEventLoop *eventLoop);
 int aeResizeSetSize(aeEventLoop *eventLoop, int setsize);
+void aePostEvent(aeEventLoop *eventLoop, aePostedEvent *ev,
+        aePostedProc *proc, void *clientData);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
@@ -37,18 +37,19 @@ typedef struct aeApiState {
 } aeApiState;
 
 static int aeApiCreate(aeEventLoop *eventLoop) {
-    aeApiState *state = nn_malloc(sizeof(aeApiState));
+    aeApiState *state = nn_malloc_tagged(sizeof(aeApiState),NN_ALLOC_TAG_EVENTS);
 
     if (!state) return -1;
-    state->events = nn_malloc(sizeof(struct epoll_event)*eventLoop->setsize);
+    state->events = nn_malloc_tagged(sizeof(struct epoll_event)*eventLoop->setsize,
+            NN_ALLOC_TAG_EVENTS);
     if (!state->events) {
-        nn_free(state);
+        nn_free_tagged(state, NN_ALLOC_TAG_EVENTS);
         return -1;
     }
     state->epfd = epoll_create(1024); /* 1024 is just a hint for the kernel */
     if (state->epfd == -1) {
-        nn_free(state->events);
-        nn_free(state);
+        nn_free_tagged(state->events, NN_ALLOC_TAG_EVENTS);
+        nn_free_tagged(state, NN_ALLOC_TAG_EVENTS);
         return -1;
     }
     eventLoop->apidata = state;
@@ -58,7 +59,8 @@ static int aeApiCreate(aeEventLoop *eventLoop) {
 static int aeApiResize(aeEventLoop *eventLoop, int setsize) {
     aeApiState *state = eventLoop->apidata;
 
-    state->events = nn_realloc(state->events, sizeof(struct epoll_event)*setsize);
+    state->events = nn_realloc_tagged(state->events,
+            sizeof(struct epoll_event)*setsize, NN_ALLOC_TAG_EVENTS);
     return 0;
 }
 
@@ -66,8 +68,8 @@ static void aeApiFree(aeEventLoop *eventLoop) {
     aeApiState *state = eventLoop->apidata;
 
     close(state->epfd);
-    nn_free(state->events);
-    nn_free(state);
+    nn_free_tagged(state->events, NN_ALLOC_TAG_EVENTS);
+    nn_free_tagged(state, NN_ALLOC_TAG_EVENTS);
 }
 
 static int aeApiAddEvent(aeEventLoop *eventLoop, int fd, int mask) {
@@ -74,12 +74,12 @@ typedef struct aeApiState {
 
 static int aeApiCreate(aeEventLoop *eventLoop) {
     int i;
-    aeApiState *state = nn_malloc(sizeof(aeApiState));
+    aeApiState *state = nn_malloc_tagged(sizeof(aeApiState),NN_ALLOC_TAG_EVENTS);
     if (!state) return -1;
 
     state->portfd = port_create();
     if (state->portfd == -1) {
-        nn_free(state);
+        nn_free_tagged(state, NN_ALLOC_TAG_EVENTS);
         return -1;
     }
 
@@ -103,7 +103,7 @@ static void aeApiFree(aeEventLoop *eventLoop) {
     aeApiState *state = eventLoop->apidata;
 
     close(state->portfd);
-    nn_free(state);
+    nn_free_tagged(state, NN_ALLOC_TAG_EVENTS);
 }
 
 static int aeApiLookupPending(aeApiState *state, int fd) {
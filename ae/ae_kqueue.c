@@ -39,18 +39,19 @@ typedef struct aeApiState {
 } aeApiState;
 
 static int aeApiCreate(aeEventLoop *eventLoop) {
-    aeApiState *state = nn_malloc(sizeof(aeApiState));
+    aeApiState *state = nn_malloc_tagged(sizeof(aeApiState),NN_ALLOC_TAG_EVENTS);
 
     if (!state) return -1;
-    state->events = nn_malloc(sizeof(struct kevent)*eventLoop->setsize);
+    state->events = nn_malloc_tagged(sizeof(struct kevent)*eventLoop->setsize,
+            NN_ALLOC_TAG_EVENTS);
     if (!state->events) {
-        nn_free(state);
+        nn_free_tagged(state, NN_ALLOC_TAG_EVENTS);
         return -1;
     }
     state->kqfd = kqueue();
     if (state->kqfd == -1) {
-        nn_free(state->events);
-        nn_free(state);
+        nn_free_tagged(state->events, NN_ALLOC_TAG_EVENTS);
+        nn_free_tagged(state, NN_ALLOC_TAG_EVENTS);
         return -1;
     }
     eventLoop->apidata = state;
@@ -68,8 +69,8 @@ static void aeApiFree(aeEventLoop *eventLoop) {
     aeApiState *state = eventLoop->apidata;
 
     close(state->kqfd);
-    nn_free(state->events);
-    nn_free(state);
+    nn_free_tagged(state->events, NN_ALLOC_TAG_EVENTS);
+    nn_free_tagged(state, NN_ALLOC_TAG_EVENTS);
 }
 
 static int aeApiAddEvent(aeEventLoop *eventLoop, int fd, int mask) {
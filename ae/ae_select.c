@@ -40,7 +40,7 @@ typedef struct aeApiState {
 } aeApiState;
 
 static int aeApiCreate(aeEventLoop *eventLoop) {
-    aeApiState *state = nn_malloc(sizeof(aeApiState));
+    aeApiState *state = nn_malloc_tagged(sizeof(aeApiState),NN_ALLOC_TAG_EVENTS);
 
     if (!state) return -1;
     FD_ZERO(&state->rfds);
@@ -56,7 +56,7 @@ static int aeApiResize(aeEventLoop *eventLoop, int setsize) {
 }
 
 static void aeApiFree(aeEventLoop *eventLoop) {
-    nn_free(eventLoop->apidata);
+    nn_free_tagged(eventLoop->apidata, NN_ALLOC_TAG_EVENTS);
 }
 
 static int aeApiAddEvent(aeEventLoop *eventLoop, int fd, int mask) {
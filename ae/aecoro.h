@@ -0,0 +1,452 @@
+#ifndef NN_AECORO_INCLUDED
+#define NN_AECORO_INCLUDED
+
+#if !defined __cplusplus || __cplusplus < 202002L
+#error "aecoro.h needs C++20"
+#endif
+
+/*  C++20 coroutines on top of aeEventLoop and nn_threadpool, so that code
+    waiting for a socket, a timer or a backend gives its thread back instead
+    of blocking it.
+
+        nn::task<int> fetch (aeEventLoop *el, int fd, char *buf, size_t len)
+        {
+            ssize_t n = co_await nn::write_all (el, fd, "GET\r\n", 5, 1000);
+            if (n < 0)
+                co_return (int) n;
+            n = co_await nn::read_some (el, fd, buf, len, 1000);
+            co_return (int) n;
+        }
+
+        nn::spawn (handle (link));
+
+    nn::task<T> is a lazy coroutine: it starts when awaited and resumes its
+    awaiter when it ends, without going through the loop. nn::spawn starts
+    a task<void> at once and frees it once it has finished, which is how a
+    command handler is started. A suspended coroutine costs its frame, so
+    thousands of requests can be in flight on a few threads.
+
+    The waits on a descriptor and the timers register ae events and must be
+    awaited on the thread running the loop. Only one coroutine may wait on
+    a given descriptor at a time, and not on one the loop watches for other
+    reasons, since ae keeps one callback and one clientData per descriptor.
+    A timeout in milliseconds, or -1 for none, bounds every single wait.
+
+    co_await nn::resume_on (el) moves the coroutine to the loop thread,
+    co_await nn::resume_on (pool) to a worker of the pool. nn::completion
+    adapts callback based backends: its set() may be called from any
+    thread and the coroutine awaiting it resumes on the loop.
+
+    Errors are returned as negative errno values, like in the C code.
+    Exceptions escaping a coroutine terminate the program. */
+
+#include <errno.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#include "ae.h"
+#include "err.h"
+#include "threadpool.h"
+
+namespace nn {
+
+template <typename T = void>
+class task;
+
+namespace aecoro_detail {
+
+struct promise_base {
+    std::coroutine_handle<> continuation;
+
+    /*  Resumes the awaiter in place, a chain of tasks ending does not grow
+        the stack. */
+    struct final_awaiter {
+        bool await_ready () const noexcept { return false; }
+        template <typename P>
+        std::coroutine_handle<> await_suspend (
+            std::coroutine_handle<P> h) noexcept
+        {
+            std::coroutine_handle<> c = h.promise ().continuation;
+            return c ? c : std::noop_coroutine ();
+        }
+        void await_resume () const noexcept {}
+    };
+
+    std::suspend_always initial_suspend () const noexcept { return {}; }
+    final_awaiter final_suspend () const noexcept { return {}; }
+    void unhandled_exception () const noexcept { std::terminate (); }
+};
+
+template <typename T>
+struct promise : promise_base {
+    std::optional<T> value;
+
+    task<T> get_return_object () noexcept;
+    template <typename U>
+    void return_value (U &&v) { value.emplace (std::forward<U> (v)); }
+    T result () { return std::move (*value); }
+};
+
+template <>
+struct promise<void> : promise_base {
+    task<void> get_return_object () noexcept;
+    void return_void () const noexcept {}
+    void result () const noexcept {}
+};
+
+/*  Started at once and destroyed when it ends, see spawn(). */
+struct detached {
+    struct promise_type {
+        detached get_return_object () const noexcept { return {}; }
+        std::suspend_never initial_suspend () const noexcept { return {}; }
+        std::suspend_never final_suspend () const noexcept { return {}; }
+        void return_void () const noexcept {}
+        void unhandled_exception () const noexcept { std::terminate (); }
+    };
+};
+
+}
+
+template <typename T>
+class task {
+public:
+    using promise_type = aecoro_detail::promise<T>;
+
+    explicit task (std::coroutine_handle<promise_type> h) : h (h) {}
+    task (task &&other) noexcept : h (std::exchange (other.h, nullptr)) {}
+    task (const task&) = delete;
+    task &operator= (const task&) = delete;
+    ~task ()
+    {
+        if (h)
+            h.destroy ();
+    }
+
+    bool await_ready () const noexcept { return false; }
+    std::coroutine_handle<> await_suspend (
+        std::coroutine_handle<> awaiter) noexcept
+    {
+        h.promise ().continuation = awaiter;
+        return h;
+    }
+    T await_resume () { return h.promise ().result (); }
+
+private:
+    std::coroutine_handle<promise_type> h;
+};
+
+namespace aecoro_detail {
+
+template <typename T>
+task<T> promise<T>::get_return_object () noexcept
+{
+    return task<T> (std::coroutine_handle<promise<T>>::from_promise (*this));
+}
+
+inline task<void> promise<void>::get_return_object () noexcept
+{
+    return task<void> (
+        std::coroutine_handle<promise<void>>::from_promise (*this));
+}
+
+}
+
+/*  Run 't' on the current thread until its first suspension. It keeps
+    running wherever it is resumed and is freed when it ends. */
+inline aecoro_detail::detached spawn (task<void> t)
+{
+    co_await std::move (t);
+}
+
+/*  co_await sleep (el, ms): resume on the loop after 'ms' milliseconds.
+    Returns 0, or -ENOMEM if the timer could not be created. */
+class timer_wait {
+public:
+    timer_wait (aeEventLoop *el, long long ms) : el (el), ms (ms) {}
+
+    bool await_ready () const noexcept { return false; }
+    bool await_suspend (std::coroutine_handle<> h) noexcept
+    {
+        this->h = h;
+        if (aeCreateTimeEvent (el, ms, fire, this, NULL) != AE_ERR)
+            return true;
+        rc = -ENOMEM;
+        return false;
+    }
+    int await_resume () const noexcept { return rc; }
+
+private:
+    static int fire (aeEventLoop *el, long long id, void *data)
+    {
+        AE_NOTUSED (el);
+        AE_NOTUSED (id);
+        ((timer_wait*) data)->h.resume ();
+        return AE_NOMORE;
+    }
+
+    aeEventLoop *el;
+    long long ms;
+    std::coroutine_handle<> h;
+    int rc = 0;
+};
+
+inline timer_wait sleep (aeEventLoop *el, long long ms)
+{
+    return timer_wait (el, ms);
+}
+
+/*  co_await readable (el, fd, ms) or writable (el, fd, ms): resume on the
+    loop once 'fd' is ready. Returns 0, -ETIMEDOUT, or the error of
+    aeCreateFileEvent. */
+class fd_wait {
+public:
+    fd_wait (aeEventLoop *el, int fd, int mask, long long ms) :
+        el (el), fd (fd), mask (mask), ms (ms) {}
+
+    bool await_ready () const noexcept { return false; }
+    bool await_suspend (std::coroutine_handle<> h) noexcept
+    {
+        this->h = h;
+        if (aeCreateFileEvent (el, fd, mask, ready, this) == AE_ERR) {
+            rc = errno ? -errno : -EINVAL;
+            return false;
+        }
+        if (ms >= 0) {
+            timer = aeCreateTimeEvent (el, ms, expire, this, NULL);
+            if (timer == AE_ERR) {
+                aeDeleteFileEvent (el, fd, mask);
+                rc = -ENOMEM;
+                return false;
+            }
+        }
+        return true;
+    }
+    int await_resume () const noexcept { return rc; }
+
+private:
+    static void ready (aeEventLoop *el, int fd, void *data, int mask)
+    {
+        fd_wait *self = (fd_wait*) data;
+
+        AE_NOTUSED (mask);
+        aeDeleteFileEvent (el, fd, self->mask);
+        if (self->timer != AE_ERR)
+            aeDeleteTimeEvent (el, self->timer);
+        self->h.resume ();
+    }
+
+    static int expire (aeEventLoop *el, long long id, void *data)
+    {
+        fd_wait *self = (fd_wait*) data;
+
+        AE_NOTUSED (id);
+        aeDeleteFileEvent (el, self->fd, self->mask);
+        self->rc = -ETIMEDOUT;
+        self->h.resume ();
+        return AE_NOMORE;
+    }
+
+    aeEventLoop *el;
+    int fd;
+    int mask;
+    long long ms;
+    long long timer = AE_ERR;
+    std::coroutine_handle<> h;
+    int rc = 0;
+};
+
+inline fd_wait readable (aeEventLoop *el, int fd, long long ms = -1)
+{
+    return fd_wait (el, fd, AE_READABLE, ms);
+}
+
+inline fd_wait writable (aeEventLoop *el, int fd, long long ms = -1)
+{
+    return fd_wait (el, fd, AE_WRITABLE, ms);
+}
+
+/*  Read what is available from the non-blocking 'fd', waiting for it if
+    nothing is. Returns the bytes read, 0 at end of file, or -errno. */
+inline task<ssize_t> read_some (aeEventLoop *el, int fd, void *buf,
+    size_t len, long long ms = -1)
+{
+    ssize_t n;
+    int rc;
+
+    for (;;) {
+        n = ::read (fd, buf, len);
+        if (n >= 0)
+            co_return n;
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            co_return -errno;
+        rc = co_await readable (el, fd, ms);
+        if (rc != 0)
+            co_return rc;
+    }
+}
+
+/*  Write all of 'buf' to the non-blocking 'fd'. Returns 'len' or -errno;
+    on error an unknown part of 'buf' was written. */
+inline task<ssize_t> write_all (aeEventLoop *el, int fd, const void *buf,
+    size_t len, long long ms = -1)
+{
+    size_t done = 0;
+    ssize_t n;
+    int rc;
+
+    while (done < len) {
+        n = ::write (fd, (const char*) buf + done, len - done);
+        if (n >= 0) {
+            done += n;
+            continue;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            co_return -errno;
+        rc = co_await writable (el, fd, ms);
+        if (rc != 0)
+            co_return rc;
+    }
+    co_return (ssize_t) len;
+}
+
+/*  co_await resume_on (el): continue on the thread running 'el'. May be
+    awaited from any thread. */
+class loop_hop {
+public:
+    explicit loop_hop (aeEventLoop *el) : el (el) {}
+
+    bool await_ready () const noexcept { return false; }
+    void await_suspend (std::coroutine_handle<> h) noexcept
+    {
+        /*  The loop may resume, and free, the frame before aePostEvent
+            returns. */
+        aePostEvent (el, &ev, run, h.address ());
+    }
+    void await_resume () const noexcept {}
+
+private:
+    static void run (aeEventLoop *el, void *data)
+    {
+        AE_NOTUSED (el);
+        std::coroutine_handle<>::from_address (data).resume ();
+    }
+
+    aeEventLoop *el;
+    aePostedEvent ev;
+};
+
+/*  co_await resume_on (pool): continue on a worker of 'pool'. Returns 0,
+    or -EAGAIN if the pool was full and the coroutine went on where it
+    was. */
+class pool_hop {
+public:
+    explicit pool_hop (struct nn_threadpool *pool) : pool (pool) {}
+
+    bool await_ready () const noexcept { return false; }
+    bool await_suspend (std::coroutine_handle<> h) noexcept
+    {
+        int r;
+
+        this->h = h;
+        r = nn_threadpool_submit (pool, &task, run);
+        if (r == 0)
+            return true;
+        rc = r;
+        return false;
+    }
+    int await_resume () const noexcept { return rc; }
+
+private:
+    static void run (struct nn_threadpool_task *t)
+    {
+        nn_cont (t, pool_hop, task)->h.resume ();
+    }
+
+    struct nn_threadpool *pool;
+    struct nn_threadpool_task task;
+    std::coroutine_handle<> h;
+    int rc = 0;
+};
+
+inline loop_hop resume_on (aeEventLoop *el)
+{
+    return loop_hop (el);
+}
+
+inline pool_hop resume_on (struct nn_threadpool *pool)
+{
+    return pool_hop (pool);
+}
+
+/*  A value delivered once, by set() from any thread, to the coroutine
+    awaiting it. That coroutine resumes on the loop, even if set() runs on
+    the loop thread, and immediately if the value arrived first. Typically
+    the object lives in the frame of the awaiting coroutine and is passed
+    as the context of a callback.
+
+        nn::completion<int> done (el);
+        backend_get (key, on_reply, &done);
+        int rc = co_await done;
+*/
+template <typename T>
+class completion {
+public:
+    explicit completion (aeEventLoop *el) : el (el) {}
+    completion (const completion&) = delete;
+    completion &operator= (const completion&) = delete;
+
+    void set (T v)
+    {
+        aeEventLoop *loop = el;
+        int prev;
+
+        value.emplace (std::move (v));
+        prev = __atomic_exchange_n (&state, DONE, __ATOMIC_ACQ_REL);
+        nn_assert (prev != DONE);
+        if (prev == WAITING)
+            aePostEvent (loop, &ev, run, this);
+    }
+
+    bool await_ready () const noexcept
+    {
+        return __atomic_load_n (&state, __ATOMIC_ACQUIRE) == DONE;
+    }
+    bool await_suspend (std::coroutine_handle<> h) noexcept
+    {
+        int expected = EMPTY;
+
+        this->h = h;
+        return __atomic_compare_exchange_n (&state, &expected, WAITING, 0,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    }
+    T await_resume () { return std::move (*value); }
+
+private:
+    enum { EMPTY, WAITING, DONE };
+
+    static void run (aeEventLoop *el, void *data)
+    {
+        AE_NOTUSED (el);
+        ((completion*) data)->h.resume ();
+    }
+
+    aeEventLoop *el;
+    aePostedEvent ev;
+    std::coroutine_handle<> h;
+    std::optional<T> value;
+    int state = EMPTY;
+};
+
+}
+
+#endif
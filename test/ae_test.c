@@ -10,6 +10,8 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
 #include <netdb.h>
 #include <errno.h>
 #include <stdarg.h>
@@ -22,9 +24,17 @@
 #include "sds.h"
 #include "thread.h"
 #include "queue.h"
-#include "sem.h"
+#include "threadpool.h"
 #include "hash.h"
 #include "mutex.h"
+#include "memmon.h"
+#include "numa.h"
+#include "iobuf.h"
+#include "intern.h"
+#include "chash.h"
+#include "hash64.h"
+#include "util.h"
+#include "err.h"
 
 #define C_OK                    0
 #define C_ERR                   -1
@@ -34,12 +44,25 @@
 #define CONFIG_DEFAULT_TCP_BACKLOG       511     /* TCP listen backlog */
 #define CONFIG_DEFAULT_SERVER_PORT       12318     /* TCP port */
 #define CONFIG_BINDADDR_MAX 16
+#define CONFIG_DEFAULT_MAXMEMORY 0             /* No memory limit */
+#define CONFIG_DEFAULT_MEMMON_INTERVAL 100     /* Memory sampling period in ms */
+#define CONFIG_DEFAULT_IOBUF_HUGEPAGES 0       /* Socket buffers on huge pages */
+#define CONFIG_DEFAULT_NUMA 0                  /* NUMA aware placement */
+#define CONFIG_DEFAULT_LOOP_CPUS ""            /* Event loop cpus, "" for any */
+#define CONFIG_DEFAULT_WORKER_CPUS ""          /* Worker cpus, "" for any */
+#define CONFIG_DEFAULT_ACTIVE_DEFRAG 0         /* Active defragmentation */
+#define CONFIG_DEFAULT_DEFRAG_THRESHOLD 10     /* Min rss/used excess in % */
+#define CONFIG_DEFAULT_DEFRAG_IGNORE_BYTES (100<<20) /* Min rss-used bytes */
+#define CONFIG_DEFAULT_DEFRAG_CYCLE_US 1000    /* Time budget of one step */
+#define CONFIG_DEFAULT_DEFRAG_PERIOD 100       /* ms between two steps */
 
 #define PROTO_MAX_QUERYBUF_LEN  (1024*1024*1024) /* 1GB max query buffer. */
 #define PROTO_IOBUF_LEN         (1024*16)  /* Generic I/O buffer size */
 #define PROTO_REPLY_CHUNK_BYTES (16*1024) /* 16k output buffer */
 #define PROTO_INLINE_MAX_SIZE   (1024*64) /* Max size of inline reads */
 #define PROTO_MBULK_BIG_ARG     (1024*32)
+#define PROTO_TMPBUF_LEN        (1024*1024) /* Per link temp buffer */
+#define PROTO_IOVCNT            64         /* Max writev() pieces per call */
 #define LONG_STR_SIZE           21          /* Bytes needed for long -> str + '\0' */
 #define AOF_AUTOSYNC_BYTES      (1024*1024*32) /* fdatasync every 32MB */
 #define NET_IP_STR_LEN          46 /* INET6_ADDRSTRLEN is 46, but we need to be sure */
@@ -49,6 +72,11 @@
 #define SOCKET_IDLE -1
 #define SOCKET_WORKING 1
 #define SOCKET_CLOSE 0
+/* Command completion, see blockLink() */
+#define BLOCK_NONE 0            /* Reply sent when the proc returns */
+#define BLOCK_PENDING 1         /* Proc running, reply comes later */
+#define BLOCK_PARKED 2          /* Proc returned, reply not ready */
+#define BLOCK_DONE 3            /* Reply ready before the proc returned */
 /* Log levels */
 #define LL_DEBUG 0
 #define LL_VERBOSE 1
@@ -62,9 +90,20 @@ typedef struct socketLink {
     int fd;                     /* TCP socket file descriptor */
     sds sndbuf;                 /* Packet send buffer */
     sds rcvbuf;                 /* Packet reception buffer */
+    size_t sndpos;              /* Bytes of sndbuf already written */
+    size_t rcvpos;              /* Bytes of rcvbuf already processed */
+    size_t reqlen;              /* Bytes of input the running command
+                                   serves, rcvbuf first, then rcvchain */
+    struct nn_iobuf rcvchain;   /* Large request, replaces rcvbuf */
+    struct nn_iobuf sndchain;   /* Large reply, sent after sndbuf */
     sds tmpbuf;                 /* Packet temp buffer */
     int status;                 /* Socket status */
+    int node;                   /* NUMA node of the link buffers */
     struct nn_queue_item item;  /* Queue of task */
+    struct nn_threadpool_task task; /* Request run on the pool */
+    int submitted;              /* Owned by a worker until finishLink() */
+    int blocked;                /* BLOCK_*, atomic */
+    aePostedEvent done;         /* Completion of the request */
 } socketLink;
 
 /* Return the UNIX time in microseconds */
@@ -89,27 +128,47 @@ struct redisServer {
     char *protocol;             /* Header of protocol */
     int protocol_len;           /* Length of protocol header */
     int client_max_querybuf_len;/* Max len of query buf */
-    struct nn_queue qthreads;   /* threads queue */
-    struct nn_queue qtasks;     /* task queue */
+    int iobuf_hugepages;        /* Allocate socket buffers from huge pages */
+    int numa;                   /* Bind workers and link buffers to nodes */
+    int numa_nodes;             /* Number of nodes in use, 1 if !numa */
+    char *loop_cpus;            /* Cpu list the event loop is pinned to */
+    char *worker_cpus;          /* Cpu list, worker n pinned to the n-th
+                                   cpu of it, wrapping around */
+    /* Memory limits */
+    size_t maxmemory;           /* Max number of memory bytes to use */
+    int memmon_interval;        /* Memory sampling period in ms */
+    struct nn_memmon memmon;    /* Background memory monitor */
+    volatile int mem_pressure;  /* Set by the monitor thread */
+    int mem_paused;             /* Reads are paused because of pressure */
+    /* Active defragmentation */
+    int active_defrag;          /* Enabled */
+    int defrag_threshold;       /* Start when rss exceeds used by this % */
+    size_t defrag_ignore_bytes; /* ... and by at least this many bytes */
+    int defrag_cycle_us;        /* Time budget of one step */
+    int defrag_period;          /* ms between two steps */
+    int defrag_running;         /* A pass is in progress */
+    int defrag_cursor;          /* Next link to visit in the pass */
+    long long defrag_hits;      /* Allocations moved */
+    long long defrag_misses;    /* Allocations visited but left in place */
+    struct nn_threadpool pool;  /* Workers, stealing from each other */
+    int inflight;               /* Requests submitted and not done, atomic */
+    struct nn_queue qtasks;     /* tasks the pool had no room for */
     struct nn_queue unuse;      /* idle socket queue */
-    struct hash     hlist;      /* command list */
-    nn_mutex_t mutex;           /* mutex */
+    struct nn_chash hlist;      /* command list, keyed by name ignoring
+                                   case, read by the workers without
+                                   locking */
+    struct nn_intern names;     /* interned command names */
     socketLink *sockets;
     int quit;
 };
 
-typedef struct queue_thread_info{
-    struct nn_sem sem;
-    socketLink *link;
-    struct nn_queue_item item;
-} queue_thread_info;
-
 typedef void redisCommandProc(socketLink *c);
 typedef struct redisCommand {
     char *name;
     redisCommandProc *proc;
     ssize_t  commandNum;
     long long microseconds, calls;
+    sds iname;                  /* Interned name */
 }redisCommand;
 /////////////////////////////////////////////////////////////////////////////////
 struct redisServer server; /* server global state */
@@ -117,13 +176,50 @@ long long counter = 0;
 
 void testCommand(socketLink *link);
 void quitCommand(socketLink *link);
+void memoryCommand(socketLink *link);
+int submitLink(socketLink *link, long long ntime);
 struct redisCommand redisCommandTable[] = {
     {"test",testCommand,1,0,0},
-    {"quit",quitCommand,2,0,0}
+    {"quit",quitCommand,2,0,0},
+    {"memory",memoryCommand,3,0,0}
 }; 
 
+/* Key of the command table. Requests are looked up where they are, in
+ * rcvbuf, so the name is not NUL terminated. Case is ignored by both the
+ * hash and the comparison. */
+typedef struct cmdKey {
+    const char *name;
+    size_t len;
+    uint64_t hash;
+} cmdKey;
+
+static void cmdKeyInit(cmdKey *key, const char *name, size_t len) {
+    key->name = name;
+    key->len = len;
+    key->hash = nn_hash64_case(name, len);
+}
+
+static uint64_t cmdKeyGen(const void *key) {
+    return ((const cmdKey *)key)->hash;
+}
+
+static int cmdKeyCmp(const void *key1, const void *key2) {
+    const cmdKey *k1 = key1, *k2 = key2;
+    size_t j;
+
+    if (k1->hash != k2->hash || k1->len != k2->len) return 0;
+    for (j = 0; j < k1->len; j++)
+        if (tolower((unsigned char)k1->name[j]) !=
+                tolower((unsigned char)k2->name[j]))
+            return 0;
+    return 1;
+}
+
+static hash_func cmdFunc = {cmdKeyGen, cmdKeyCmp, NULL};
+
 typedef struct cmd_entry { 
     struct redisCommand *cmd;
+    cmdKey key;
     hash_item item;    
 } cmd_entry;
 
@@ -138,26 +234,52 @@ void initCommandTable(void) {
         nn_hash_item_init(&item->item);
         item->cmd = cmd;
 
-        nn_hash_insert(&server.hlist, (void *)cmd->commandNum, &item->item);
+        cmd->iname = nn_intern_get(&server.names, cmd->name, strlen(cmd->name));
+        alloc_assert(cmd->iname);
+        cmdKeyInit(&item->key, cmd->iname, sds_len(cmd->iname));
+        nn_chash_insert(&server.hlist, &item->key, &item->item);
     }
 }
 
 void termCommandTable(void) {
     hash_item *it; 
     cmd_entry *item;
+    cmdKey key;
     int j, numcommands;
 
     numcommands= sizeof(redisCommandTable)/sizeof(struct redisCommand);
     for (j = 0; j < numcommands; j++) {
         struct redisCommand *cmd = redisCommandTable+j;
 
-        it = nn_hash_get(&server.hlist, (void *)cmd->commandNum);
-        nn_hash_erase(&server.hlist, it);
+        cmdKeyInit(&key, cmd->iname, sds_len(cmd->iname));
+        nn_chash_enter(&server.hlist);
+        it = nn_chash_get(&server.hlist, &key);
+        nn_chash_exit(&server.hlist);
+        nn_chash_erase(&server.hlist, it);
         item = nn_cont (it, struct cmd_entry, item);
         nn_free(item);
+        nn_intern_release(&server.names, cmd->iname);
+        cmd->iname = NULL;
     }
 }
 
+/* Map the request to a command. A request made of a command name alone
+ * selects that command, anything else is echoed by "test". The request is
+ * hashed once, in place, and looked up without taking any lock. */
+struct redisCommand *lookupCommand(const char *query, size_t len) {
+    struct redisCommand *cmd;
+    hash_item *it;
+    cmdKey key;
+
+    while (len && isspace((unsigned char)query[len-1])) len--;
+    cmdKeyInit(&key, query, len);
+    nn_chash_enter(&server.hlist);
+    it = nn_chash_get(&server.hlist, &key);
+    cmd = it ? nn_cont (it, struct cmd_entry, item)->cmd : redisCommandTable;
+    nn_chash_exit(&server.hlist);
+    return cmd;
+}
+
 long long ustime(void) {
     struct timeval tv;
     long long ust;
@@ -237,14 +359,29 @@ void serverLog(int level, const char *fmt, ...) {
     serverLogRaw(level,msg);
 }
 
-void socketLink_init(socketLink *link) {
+void socketLink_init(socketLink *link, int node) {
     link->ctime = mstime();
-    link->rcvbuf = sds_empty();
-    link->sndbuf = sds_empty();
-    link->tmpbuf = sds_empty();
-    link->tmpbuf = sds_make_room_for(link->tmpbuf, 1<<20);
+    link->node = node;
+    link->sndbuf = sds_new_len_tagged("", 0, NN_ALLOC_TAG_REPLYBUF);
+    if (server.iobuf_hugepages || server.numa) {
+        link->rcvbuf = sds_new_iobuf(PROTO_TMPBUF_LEN, node);
+        link->rcvbuf = sds_set_tag(link->rcvbuf, NN_ALLOC_TAG_QUERYBUF);
+        link->tmpbuf = sds_new_iobuf(PROTO_TMPBUF_LEN, node);
+        link->tmpbuf = sds_set_tag(link->tmpbuf, NN_ALLOC_TAG_QUERYBUF);
+    } else {
+        link->rcvbuf = sds_new_len_tagged("", 0, NN_ALLOC_TAG_QUERYBUF);
+        link->tmpbuf = sds_new_len_tagged("", 0, NN_ALLOC_TAG_QUERYBUF);
+        link->tmpbuf = sds_make_room_for(link->tmpbuf, PROTO_TMPBUF_LEN);
+    }
+    link->sndpos = 0;
+    link->rcvpos = 0;
+    link->reqlen = 0;
+    nn_iobuf_init(&link->rcvchain, 0, NN_ALLOC_TAG_QUERYBUF);
+    nn_iobuf_init(&link->sndchain, 0, NN_ALLOC_TAG_REPLYBUF);
     link->fd = -1;
     link->status = SOCKET_IDLE;
+    link->submitted = 0;
+    link->blocked = BLOCK_NONE;
     nn_queue_item_init(&link->item);
 }
 
@@ -256,11 +393,14 @@ void socketLink_term(socketLink *link) {
     sds_free(link->rcvbuf);
     sds_free(link->sndbuf);
     sds_free(link->tmpbuf);
+    nn_iobuf_term(&link->rcvchain);
+    nn_iobuf_term(&link->sndchain);
     close(link->fd);
     link->fd = SOCKET_CLOSE;
 }
 
 void initServerConfig(void) {
+    uint64_t seed;
     int j;
     server.pid = 0;
     server.working_thread = 16;
@@ -274,22 +414,56 @@ void initServerConfig(void) {
     server.protocol = "MERGE3.0";
     server.protocol_len = 8;
     server.client_max_querybuf_len = 1<<20;
+    server.iobuf_hugepages = CONFIG_DEFAULT_IOBUF_HUGEPAGES;
+    server.numa = CONFIG_DEFAULT_NUMA;
+    server.loop_cpus = CONFIG_DEFAULT_LOOP_CPUS;
+    server.worker_cpus = CONFIG_DEFAULT_WORKER_CPUS;
+    server.active_defrag = CONFIG_DEFAULT_ACTIVE_DEFRAG;
+    server.defrag_threshold = CONFIG_DEFAULT_DEFRAG_THRESHOLD;
+    server.defrag_ignore_bytes = CONFIG_DEFAULT_DEFRAG_IGNORE_BYTES;
+    server.defrag_cycle_us = CONFIG_DEFAULT_DEFRAG_CYCLE_US;
+    server.defrag_period = CONFIG_DEFAULT_DEFRAG_PERIOD;
+    server.defrag_running = 0;
+    server.defrag_cursor = 0;
+    server.defrag_hits = 0;
+    server.defrag_misses = 0;
+    server.inflight = 0;
     server.send_timeout = 5000;
     server.recv_timeout = 5000;
+    server.maxmemory = CONFIG_DEFAULT_MAXMEMORY;
+    server.memmon_interval = CONFIG_DEFAULT_MEMMON_INTERVAL;
+    server.mem_pressure = 0;
+    server.mem_paused = 0;
     server.quit = 0;
-    nn_queue_init(&server.qthreads);
+    server.numa_nodes = server.numa ? nn_numa_nodes() : 1;
     nn_queue_init(&server.qtasks);
     nn_queue_init(&server.unuse);
-    nn_hash_init(&server.hlist);
-    nn_mutex_init(&server.mutex);
-    server.sockets = nn_malloc(sizeof(socketLink)*server.working_socket);
+    /* Random hash seed so that clients cannot pick colliding keys. It has
+     * to be set before the first table is filled. */
+    nn_random_seed();
+    nn_random_generate(&seed, sizeof(seed));
+    nn_hash64_set_seed(seed);
+    nn_chash_init(&server.hlist, &cmdFunc);
+    nn_intern_init(&server.names, NN_INTERN_NOCASE, NN_ALLOC_TAG_NONE);
+    /* Query and temp buffers of every link come from the I/O buffer class,
+     * one chunk each, on huge pages if configured and from the pool of the
+     * link's node when NUMA placement is on. */
+    if ((server.iobuf_hugepages || server.numa) &&
+        nn_alloc_iobuf_init_nodes(PROTO_TMPBUF_LEN,
+            (server.working_socket+server.numa_nodes-1)/server.numa_nodes*2,
+            server.iobuf_hugepages, server.numa_nodes) == -1)
+    {
+        serverLog(LL_WARNING, "Unable to map the I/O buffer arena, using malloc");
+    }
+    server.sockets = nn_malloc_tagged(sizeof(socketLink)*server.working_socket,
+            NN_ALLOC_TAG_CLIENTS);
     if(server.sockets == 0)
     {
         serverLog(LL_WARNING, "malloc sockets error %s \n", "!!!!!");
         return;
     }
     for(j=0; j<server.working_socket; j++) {
-        socketLink_init(&server.sockets[j]);
+        socketLink_init(&server.sockets[j], j % server.numa_nodes);
         nn_queue_push(&server.unuse, &server.sockets[j].item);
     }
 }
@@ -297,15 +471,15 @@ void initServerConfig(void) {
 void termServerConfig(void) {
     int j;
 
-    nn_queue_term(&server.qthreads);
     nn_queue_term(&server.qtasks);
     nn_queue_term(&server.unuse);
-    nn_hash_term(&server.hlist);
-    nn_mutex_term(&server.mutex);
+    nn_chash_term(&server.hlist);
+    nn_intern_term(&server.names);
     for(j=0; j<server.working_socket; j++) {
         socketLink_term(&server.sockets[j]);
     }
-    nn_free(server.sockets);
+    nn_free_tagged(server.sockets, NN_ALLOC_TAG_CLIENTS);
+    nn_alloc_iobuf_term();
 }
 
 socketLink *createSocketLink() {
@@ -319,6 +493,10 @@ socketLink *createSocketLink() {
         link->status = SOCKET_IDLE;
         sds_set_len(link->rcvbuf, 0);
         sds_set_len(link->sndbuf, 0);
+        link->rcvpos = 0;
+        link->sndpos = 0;
+        nn_iobuf_clear(&link->rcvchain);
+        nn_iobuf_clear(&link->sndchain);
         sds_set_len(link->tmpbuf, 0);
     }
     return link;
@@ -330,21 +508,36 @@ void freeSocketLink(socketLink *link) {
         aeDeleteFileEvent(server.el, link->fd, AE_READABLE);
     }
     close(link->fd);
+    link->fd = -1;
     if(!nn_queue_item_isinqueue(&link->item))
         nn_queue_push(&server.unuse, &link->item);
 }
 
-void queue_thread_info_init(queue_thread_info *thread)
-{
-    nn_sem_init(&thread->sem);
-    thread->link = 0;
-    nn_queue_item_init(&thread->item);
+/* Bytes of the reply still to be written. */
+static size_t pendingReplyLen(socketLink *link) {
+    return sds_len(link->sndbuf)-link->sndpos+nn_iobuf_len(&link->sndchain);
 }
 
-void queue_thread_info_term(queue_thread_info *thread)
-{
-    nn_sem_term(&thread->sem);
-    nn_queue_item_term(&thread->item);
+/* Write as much of the reply as the socket takes with a single writev(),
+ * sndbuf first and then the chain. */
+static ssize_t writePendingReply(socketLink *link, int fd) {
+    struct iovec iov[PROTO_IOVCNT];
+    size_t buflen = sds_len(link->sndbuf)-link->sndpos, n;
+    ssize_t nwritten;
+    int iovcnt = 0;
+
+    if (buflen) {
+        iov[0].iov_base = link->sndbuf+link->sndpos;
+        iov[0].iov_len = buflen;
+        iovcnt = 1;
+    }
+    iovcnt += nn_iobuf_iovec(&link->sndchain, iov+iovcnt, PROTO_IOVCNT-iovcnt);
+    nwritten = writev(fd, iov, iovcnt);
+    if (nwritten <= 0) return nwritten;
+    n = (size_t)nwritten < buflen ? (size_t)nwritten : buflen;
+    sds_consume(link->sndbuf,&link->sndpos,n);
+    nn_iobuf_consume(&link->sndchain,nwritten-n);
+    return nwritten;
 }
 
 void writeMessageToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
@@ -353,20 +546,24 @@ void writeMessageToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     UNUSED(el);
     UNUSED(mask);
 
-    if (sds_len(link->sndbuf) == 0) {
+    /* A worker is writing the next reply, finishLink() sends it. */
+    if (link->submitted) {
+        aeDeleteFileEvent(server.el, fd, AE_WRITABLE);
+        return;
+    }
+    if (pendingReplyLen(link) == 0) {
         aeDeleteFileEvent(server.el, link->fd, AE_WRITABLE);
         if(fd == link->fd)freeSocketLink(link);
         return;
     }
-    nwritten = write(fd, link->sndbuf, sds_len(link->sndbuf));
+    nwritten = writePendingReply(link, fd);
     if (nwritten <= 0) {
         serverLog(LL_WARNING,"write I/O error writing to node link: %s",
                 strerror(errno));
         if(fd == link->fd)freeSocketLink(link);
         return;
     }
-    sds_range(link->sndbuf,nwritten,-1);
-    if (sds_len(link->sndbuf) == 0) {
+    if (pendingReplyLen(link) == 0) {
         aeDeleteFileEvent(server.el, link->fd, AE_WRITABLE);
         if(fd == link->fd)freeSocketLink(link);
     }
@@ -374,11 +571,8 @@ void writeMessageToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
 
 void sendMessageToClient(socketLink *link)
 {
-    ssize_t nwritten;
-    nwritten = write(link->fd, link->sndbuf, sds_len(link->sndbuf));
-    if (nwritten > 0) {
-        sds_range(link->sndbuf,nwritten,-1);
-    }
+    if (pendingReplyLen(link))
+        writePendingReply(link, link->fd);
     aeCreateFileEvent(server.el,link->fd, AE_WRITABLE, writeMessageToClient,link);
 }
 
@@ -386,16 +580,49 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask)
 {
     ssize_t nread;
     socketLink *link = (socketLink*) privdata;
-    unsigned int readlen, rcvbuflen;
+    size_t readlen, pending;
+    char *buf;
     UNUSED(el);
     UNUSED(mask);
 
-    readlen = PROTO_IOBUF_LEN;
-    rcvbuflen = sds_len(link->rcvbuf);
-    if (sds_avail(link->rcvbuf) < readlen)
-        link->rcvbuf = sds_make_room_for(link->rcvbuf, readlen);
+    /* The worker running the request may be reading the buffers, the rest
+     * of the input is read once the reply is sent. */
+    if (link->submitted) {
+        aeDeleteFileEvent(server.el, fd, AE_READABLE);
+        return;
+    }
+
+    /* Once a request gets big it is read into the segment chain, growing
+     * rcvbuf further would copy the whole payload on every reallocation. */
+    pending = sds_len(link->rcvbuf)-link->rcvpos;
+    if (!nn_iobuf_len(&link->rcvchain) && pending >= PROTO_MBULK_BIG_ARG) {
+        if (nn_iobuf_append(&link->rcvchain, link->rcvbuf+link->rcvpos,
+                    pending) != 0)
+        {
+            serverLog(LL_WARNING,"Out of memory reading from node link");
+            nn_iobuf_clear(&link->rcvchain);
+            if(fd == link->fd && link->status == SOCKET_IDLE)freeSocketLink(link);
+            else link->status = SOCKET_CLOSE;
+            return;
+        }
+        sds_consume(link->rcvbuf,&link->rcvpos,pending);
+    }
+    if (nn_iobuf_len(&link->rcvchain)) {
+        buf = nn_iobuf_tail(&link->rcvchain,&readlen);
+        if (buf == NULL) {
+            serverLog(LL_WARNING,"Out of memory reading from node link");
+            if(fd == link->fd && link->status == SOCKET_IDLE)freeSocketLink(link);
+            else link->status = SOCKET_CLOSE;
+            return;
+        }
+    } else {
+        readlen = PROTO_IOBUF_LEN;
+        if (sds_avail(link->rcvbuf) < readlen)
+            link->rcvbuf = sds_make_room_for(link->rcvbuf, readlen);
+        buf = link->rcvbuf+sds_len(link->rcvbuf);
+    }
 
-    nread = read(fd, link->rcvbuf+rcvbuflen,readlen);
+    nread = read(fd, buf, readlen);
     if (nread == -1 && errno == EAGAIN) return; /* No more data ready. */
 
     if (nread <= 0) {
@@ -407,9 +634,14 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask)
         else link->status = SOCKET_CLOSE;
         return;
     } 
-    sds_inc_len(link->rcvbuf,nread);
+    if (nn_iobuf_len(&link->rcvchain))
+        nn_iobuf_commit(&link->rcvchain,nread);
+    else
+        sds_inc_len(link->rcvbuf,nread);
 
-    if (sds_len(link->rcvbuf) > server.client_max_querybuf_len) {
+    if (sds_len(link->rcvbuf)-link->rcvpos+nn_iobuf_len(&link->rcvchain) >
+        server.client_max_querybuf_len)
+    {
         serverLog(LL_WARNING,"Closing client that reached max query buffer length");
         if(fd == link->fd && link->status == SOCKET_IDLE)freeSocketLink(link);
         else link->status = SOCKET_CLOSE;
@@ -417,7 +649,8 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask)
     }
 
     link->status = SOCKET_WORKING;
-    if(!nn_queue_item_isinqueue(&link->item))
+    if(!nn_queue_item_isinqueue(&link->item) &&
+            submitLink(link, mstime()) != 0)
         nn_queue_push(&server.qtasks, &link->item);
 }
 
@@ -427,76 +660,197 @@ void quitCommand(socketLink *link)
     aeStop(server.el);
 }
 
+/* Reply with the memory breakdown per allocation tag. */
+void memoryCommand(socketLink *link)
+{
+    const char *name;
+    int tag;
+
+    link->sndbuf = sds_append_printf(link->sndbuf,
+            "used_memory:%zu\r\nused_memory_rss:%zu\r\n",
+            nn_alloc_memory_state(NN_USED_MEMORY), nn_alloc_get_rss());
+    link->sndbuf = sds_append_printf(link->sndbuf,
+            "active_defrag_running:%d\r\nactive_defrag_hits:%lld\r\n"
+            "active_defrag_misses:%lld\r\n", server.defrag_running,
+            server.defrag_hits, server.defrag_misses);
+    for (tag = 0; tag < NN_ALLOC_TAGS; tag++) {
+        size_t bytes = nn_alloc_tag_state(tag, NN_USED_MEMORY);
+        size_t blocks = nn_alloc_tag_state(tag, NN_USED_BLOCKS);
+
+        if (tag > NN_ALLOC_TAG_NONE && !blocks) continue;
+        name = nn_alloc_tag_name(tag);
+        if (tag == NN_ALLOC_TAG_NONE) name = "other";
+        if (name)
+            link->sndbuf = sds_append_printf(link->sndbuf,
+                    "mem.%s:%zu blocks=%zu\r\n", name, bytes, blocks);
+        else
+            link->sndbuf = sds_append_printf(link->sndbuf,
+                    "mem.tag%d:%zu blocks=%zu\r\n", tag, bytes, blocks);
+    }
+}
+
 void testCommand(socketLink *link)
 {
-    link->sndbuf = sds_copy(link->sndbuf, link->rcvbuf);
+    size_t len = sds_len(link->rcvbuf)-link->rcvpos;
+
+    /* A large request is echoed by sharing its segments, not copying them. */
+    if (nn_iobuf_len(&link->rcvchain)) {
+        if (nn_iobuf_slice(&link->sndchain, &link->rcvchain, 0,
+                    nn_iobuf_len(&link->rcvchain)) != 0)
+            serverLog(LL_WARNING,"Out of memory queueing the reply");
+        counter ++;
+        printf("recvbuf :<%zu bytes> counter: %lld\n",
+                nn_iobuf_len(&link->rcvchain), counter);
+        return;
+    }
+    link->sndbuf = sds_append_len(link->sndbuf, link->rcvbuf+link->rcvpos, len);
     counter ++;
-    printf("recvbuf :%s counter: %lld\n", link->rcvbuf, counter);
+    printf("recvbuf :%.*s counter: %lld\n", (int)len,
+            link->rcvbuf+link->rcvpos, counter);
+}
+
+/* Bytes of input received and not consumed yet. */
+static size_t pendingQueryLen(socketLink *link) {
+    return sds_len(link->rcvbuf)-link->rcvpos+nn_iobuf_len(&link->rcvchain);
 }
 
-void thread_process(void *this)
+/* Consume the request that was served and send its reply. Runs on the
+ * event loop, which gets the link back from the worker here: reading
+ * resumes, and input left after the request is submitted again. A big
+ * request may have moved from rcvbuf to the chain, the chain always
+ * continues rcvbuf. */
+static void finishLink(aeEventLoop *el, void *clientData)
+{
+    socketLink *link = clientData;
+    size_t buflen = sds_len(link->rcvbuf)-link->rcvpos;
+    size_t n = link->reqlen < buflen ? link->reqlen : buflen;
+    UNUSED(el);
+
+    sds_consume(link->rcvbuf, &link->rcvpos, n);
+    nn_iobuf_consume(&link->rcvchain, link->reqlen-n);
+    link->reqlen = 0;
+    sendMessageToClient(link);
+    link->submitted = 0;
+    __atomic_sub_fetch(&server.inflight, 1, __ATOMIC_RELEASE);
+
+    if (link->fd == -1 || link->status == SOCKET_CLOSE) return;
+    if (!server.mem_paused)
+        aeCreateFileEvent(server.el, link->fd, AE_READABLE,
+                readQueryFromClient, link);
+    if (pendingQueryLen(link) && !nn_queue_item_isinqueue(&link->item) &&
+            submitLink(link, mstime()) != 0)
+        nn_queue_push(&server.qtasks, &link->item);
+}
+
+static void finishBlockedLink(aeEventLoop *el, void *clientData)
+{
+    socketLink *link = clientData;
+
+    __atomic_store_n(&link->blocked, BLOCK_NONE, __ATOMIC_RELEASE);
+    finishLink(el, link);
+}
+
+/* Called by a command proc that waits for I/O, a timer or a backend: the
+ * reply is not sent when the proc returns, which frees the worker, but
+ * when unblockLink() is called. The proc starts the wait and returns at
+ * once, a C++ handler for instance starts its coroutine with nn::spawn()
+ * and calls unblockLink() when it is done. The link is not timed out
+ * meanwhile, and input that arrives is read after the reply is sent. */
+void blockLink(socketLink *link)
+{
+    __atomic_store_n(&link->blocked, BLOCK_PENDING, __ATOMIC_RELAXED);
+}
+
+/* The reply of a blocked link is in sndbuf: consume the request and send
+ * the reply from the event loop. May be called from any thread, even
+ * before the proc returned. */
+void unblockLink(socketLink *link)
+{
+    if (__atomic_exchange_n(&link->blocked, BLOCK_DONE, __ATOMIC_ACQ_REL) ==
+            BLOCK_PARKED)
+        aePostEvent(server.el, &link->done, finishBlockedLink, link);
+}
+
+/* Run the request of a link on a pool worker. The worker does not touch
+ * the link buffers once the proc returned, the reply is sent from the
+ * event loop. */
+void processLink(struct nn_threadpool_task *task)
 {
-    struct queue_thread_info *thread;
     struct socketLink *link;
-    struct cmd_entry *command;
-    struct hash_item *it;
-    ssize_t cmdnum = 1;
+    struct redisCommand *cmd;
+    int blocked;
 
-    thread = (queue_thread_info *)this; 
-    while(!server.quit)
+    link = nn_cont(task, struct socketLink, task);
+    link->reqlen = 0;
+    if(link->status != SOCKET_CLOSE) 
     {
-        thread->link = 0;
-        if(!nn_queue_item_isinqueue(&thread->item))
-        {
-            nn_mutex_lock(&server.mutex);
-            nn_queue_push(&server.qthreads, &thread->item);
-            nn_mutex_unlock(&server.mutex);
-        }
-        nn_sem_wait(&thread->sem);
+        ////////////////////////////////
+        /* No command name is long enough to need the chain, large
+         * requests always go to the default (test) command. */
+        if (nn_iobuf_len(&link->rcvchain))
+            cmd = redisCommandTable;
+        else
+            cmd = lookupCommand(link->rcvbuf+link->rcvpos,
+                    sds_len(link->rcvbuf)-link->rcvpos);
+        /* The whole pending input is one request. */
+        link->reqlen = pendingQueryLen(link);
+        cmd->proc(link);
+
+        /* A blocked command finishes in unblockLink(), unless it did
+         * already. */
+        blocked = BLOCK_PENDING;
+        if (__atomic_compare_exchange_n(&link->blocked, &blocked,
+                    BLOCK_PARKED, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return;
+        if (blocked == BLOCK_DONE)
+            __atomic_store_n(&link->blocked, BLOCK_NONE, __ATOMIC_RELAXED);
+    }
+    aePostEvent(server.el, &link->done, finishLink, link);
+}
 
-        if((link = thread->link) == NULL)
-            continue;
+/* Hand the link to the pool, on the queue of its node so that the link
+ * buffers stay local. Links timed out or closed meanwhile are freed
+ * instead. A link already with a worker, blocked or not, is left alone,
+ * finishLink() submits it again if needed. So is a link whose reply is
+ * still being written, it is closed once the reply is out. Returns -EAGAIN
+ * if the pool has no room. */
+int submitLink(socketLink *link, long long ntime)
+{
+    if(link->submitted || pendingReplyLen(link))
+        return 0;
+    if(ntime-link->ctime > server.send_timeout || link->status == SOCKET_CLOSE) {
+        freeSocketLink(link);
+        return 0;
+    }
 
-        if(link->status != SOCKET_CLOSE) 
-        {
-            ////////////////////////////////
-            it = nn_hash_get(&server.hlist, (void *)cmdnum);
-            command = nn_cont (it, struct cmd_entry, item);
-            command->cmd->proc(link);
-        }
-        sendMessageToClient(link);
+    link->submitted = 1;
+    __atomic_add_fetch(&server.inflight, 1, __ATOMIC_RELAXED);
+    if(nn_threadpool_submit_node(&server.pool, &link->task, processLink,
+                link->node) != 0) {
+        __atomic_sub_fetch(&server.inflight, 1, __ATOMIC_RELAXED);
+        link->submitted = 0;
+        return -EAGAIN;
     }
+    return 0;
 }
 
 void queue_task_exec()
 {
-    struct queue_thread_info *thread;
+    struct nn_queue_item *titem;
     long long ntime;
     socketLink *link;
     ntime = mstime();
     /*任务分发 超时检查  */
     while(1) {
-        struct nn_queue_item *titem = nn_queue_pop (&server.qtasks);
+        titem = nn_queue_pop (&server.qtasks);
         if(titem == 0)
-            return;
+            break;
 
         link = nn_cont(titem, struct socketLink,  item);
-        if(ntime-link->ctime > server.send_timeout || link->status == SOCKET_CLOSE) {
-            freeSocketLink(link);
-            continue;
-        }
-
-        nn_mutex_lock(&server.mutex);
-        struct nn_queue_item *item = nn_queue_pop (&server.qthreads);
-        nn_mutex_unlock(&server.mutex);
-        if(item != 0) {
-            thread = nn_cont(item, struct queue_thread_info, item);
-            thread->link = link;
-            nn_sem_post(&thread->sem);  
-        } else {
+        if(submitLink(link, ntime) != 0) {
             nn_queue_item_init(titem);
             nn_queue_push(&server.qtasks, titem);
-            return;
+            break;
         }
     }
 }
@@ -511,7 +865,7 @@ int check_timeout(struct aeEventLoop *eventLoop, long long id, void *clientData)
     for(j=0; j<server.working_socket; j++) {
         link = &server.sockets[j];
 
-        if(!nn_queue_item_isinqueue(&link->item) 
+        if(!nn_queue_item_isinqueue(&link->item) && !link->submitted
                 &&(ntime-link->ctime > server.send_timeout *2))
         {
             freeSocketLink(link);
@@ -526,8 +880,115 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     queue_task_exec();
 }
 
+/* Called by the memory monitor thread when used memory crosses maxmemory.
+ * Only raise a flag here, the event loop reacts to it in serverCron(). */
+void memoryPressureHandler(int state, size_t used, size_t maxmemory, void *arg) {
+    UNUSED(arg);
+    server.mem_pressure = (state == NN_MEMMON_PRESSURE);
+}
+
+/* Stop reading from the clients and give back the idle buffers while the
+ * memory is above the limit, resume once the monitor reports it is back
+ * to normal. */
+void handleMemoryPressure(void) {
+    socketLink *link;
+    int j;
+
+    if (server.mem_pressure == server.mem_paused) return;
+
+    if (server.mem_pressure) {
+        struct nn_memmon_stats stats;
+
+        nn_memmon_stats(&server.memmon, &stats);
+        serverLog(LL_WARNING,
+                "Used memory %zu above maxmemory %zu (rss %zu, frag %.2f), pausing reads",
+                stats.used, stats.maxmemory, stats.rss, stats.frag_ratio);
+        for(j=0; j<server.working_socket; j++) {
+            link = &server.sockets[j];
+            if (link->fd != -1) {
+                aeDeleteFileEvent(server.el, link->fd, AE_READABLE);
+            } else {
+                link->rcvbuf = sds_remove_free_space(link->rcvbuf);
+                link->sndbuf = sds_remove_free_space(link->sndbuf);
+                link->tmpbuf = sds_remove_free_space(link->tmpbuf);
+                nn_iobuf_clear(&link->rcvchain);
+                nn_iobuf_clear(&link->sndchain);
+            }
+        }
+    } else {
+        serverLog(LL_NOTICE,"Memory usage back to normal, resuming reads");
+        for(j=0; j<server.working_socket; j++) {
+            link = &server.sockets[j];
+            if (link->fd != -1)
+                aeCreateFileEvent(server.el, link->fd, AE_READABLE, readQueryFromClient, link);
+        }
+    }
+    server.mem_paused = server.mem_pressure;
+}
+
+/* Move one long lived string if the allocator finds it worth it. */
+sds defragSds(sds s) {
+    sds moved = sds_defrag(s);
+
+    if (moved) {
+        server.defrag_hits++;
+        return moved;
+    }
+    server.defrag_misses++;
+    return s;
+}
+
+/* One step of active defragmentation. A pass starts when the monitor sees
+ * RSS above used memory by both the configured ratio and byte count, then
+ * walks the links a batch at a time within 'defrag_cycle_us', resuming
+ * where the previous step stopped. A link submitted to the pool belongs to
+ * its worker until finishLink(), even while its command is blocked, and is
+ * skipped. The event loop owns all the others. The intern pool slots are
+ * moved last, when no worker is running a command. */
+int activeDefragCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
+    struct nn_memmon_stats stats;
+    socketLink *link;
+    long long deadline;
+    int idle;
+
+    if (!server.defrag_running) {
+        nn_memmon_stats(&server.memmon, &stats);
+        if (stats.rss < stats.used + server.defrag_ignore_bytes ||
+            stats.frag_ratio*100 < 100 + server.defrag_threshold)
+            return server.defrag_period;
+        serverLog(LL_VERBOSE,
+                "Starting active defrag, frag %.2f (rss %zu, used %zu)",
+                stats.frag_ratio, stats.rss, stats.used);
+        server.defrag_running = 1;
+        server.defrag_cursor = 0;
+    }
+
+    deadline = ustime() + server.defrag_cycle_us;
+    while (server.defrag_cursor < server.working_socket) {
+        link = &server.sockets[server.defrag_cursor++];
+        if (!link->submitted) {
+            link->rcvbuf = defragSds(link->rcvbuf);
+            link->sndbuf = defragSds(link->sndbuf);
+            link->tmpbuf = defragSds(link->tmpbuf);
+        }
+        if ((server.defrag_cursor & 15) == 0 && ustime() > deadline)
+            return server.defrag_period;
+    }
+
+    idle = (__atomic_load_n(&server.inflight, __ATOMIC_ACQUIRE) == 0);
+    if (!idle) return server.defrag_period;
+    if (nn_hash_defrag(&server.names.h)) server.defrag_hits++;
+    else server.defrag_misses++;
+
+    server.defrag_running = 0;
+    serverLog(LL_VERBOSE, "Active defrag pass done, %lld moved, %lld kept",
+            server.defrag_hits, server.defrag_misses);
+    return server.defrag_period;
+}
+
 int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
     //printf("hello server \n");
+    handleMemoryPressure();
     //retun AE_NOMORE -1 stop the task >0 间隔时间
     return 1;
 }
@@ -548,6 +1009,13 @@ void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask)
         return;
     }
 
+    if (server.mem_paused) {
+        serverLog(LL_WARNING,
+                "Rejecting client connection, used memory above maxmemory");
+        close(cfd);
+        return;
+    }
+
     anetNonBlock(NULL,cfd);
     anetSendTimeout(NULL,cfd,server.send_timeout);
 
@@ -620,27 +1088,77 @@ int listenToPort(int port, int *fds, int *count) {
     return C_OK;
 }
 
+/* Start the pool. With worker_cpus set, every worker is pinned to one cpu
+ * of the list, in increasing order and wrapping around, so placement does
+ * not change from a run to the next. With numa on as well, the pool has
+ * each worker serve the node of its cpu. */
+int startWorkers(void) {
+    struct nn_thread_attr *attrs = NULL, list;
+    int cpus[NN_THREAD_MAX_CPUS];
+    int ncpus = 0, cpu, j, rc;
+
+    if (server.worker_cpus[0]) {
+        nn_thread_attr_init(&list);
+        if (nn_thread_attr_set_cpulist(&list, server.worker_cpus) <= 0) {
+            serverLog(LL_WARNING, "Invalid worker cpu list '%s'",
+                    server.worker_cpus);
+            return C_ERR;
+        }
+        for (cpu = 0; cpu < NN_THREAD_MAX_CPUS; cpu++)
+            if (nn_thread_attr_has_cpu(&list, cpu)) cpus[ncpus++] = cpu;
+        attrs = nn_malloc(sizeof(*attrs)*server.working_thread);
+        if (attrs == NULL) return C_ERR;
+        for (j = 0; j < server.working_thread; j++) {
+            nn_thread_attr_init(&attrs[j]);
+            nn_thread_attr_set_cpu(&attrs[j], cpus[j % ncpus]);
+        }
+    }
+    rc = nn_threadpool_init_attr(&server.pool, server.working_thread,
+            server.numa ? server.numa_nodes : 0, server.working_socket, attrs);
+    nn_free(attrs);
+    if (rc != 0) {
+        serverLog(LL_WARNING, "Unable to start the workers on cpus '%s': %s",
+                server.worker_cpus, strerror(-rc));
+        return C_ERR;
+    }
+    return C_OK;
+}
+
+/* Name the calling thread after the event loop and pin it to loop_cpus. */
+int placeEventLoop(void) {
+    struct nn_thread_attr attr;
+    int rc;
+
+    nn_thread_attr_init(&attr);
+    nn_thread_attr_set_name(&attr, "event-loop");
+    if (server.loop_cpus[0] &&
+            nn_thread_attr_set_cpulist(&attr, server.loop_cpus) <= 0) {
+        serverLog(LL_WARNING, "Invalid event loop cpu list '%s'",
+                server.loop_cpus);
+        return C_ERR;
+    }
+    rc = nn_thread_place(&attr);
+    if (rc != 0) {
+        serverLog(LL_WARNING, "Unable to pin the event loop to cpus '%s': %s",
+                server.loop_cpus, strerror(-rc));
+        return C_ERR;
+    }
+    return C_OK;
+}
+
 int aeTest(void) {
     int j, sfd;
-    struct nn_thread *threads;
-    struct queue_thread_info *thread_info;
-    initServerConfig();
+    /* Before anything is allocated, enabling the thread safe counters
+     * resets them. */
     nn_alloc_init(1,0);
+    initServerConfig();
     initCommandTable();
+    nn_memmon_init(&server.memmon, server.maxmemory, server.memmon_interval);
+    nn_memmon_register(&server.memmon, memoryPressureHandler, NULL);
 
-    threads = nn_malloc(sizeof(*threads)*server.working_thread);
-    if(threads == 0)
+    if(startWorkers() == C_ERR)
         return -1;
 
-    thread_info = nn_malloc(sizeof(*thread_info)*server.working_thread);
-    if(thread_info == 0)
-        goto clean_threads;
-
-    for(j=0; j<server.working_thread; j++) {
-        queue_thread_info_init(&thread_info[j]);
-        nn_thread_init(&threads[j], thread_process, &thread_info[j]);
-    }
-
     server.el = aeCreateEventLoop(1000);
     if (server.port != 0 && listenToPort(server.port,server.ipfd,&server.ipfd_count) == C_ERR)
         return -1;
@@ -651,6 +1169,16 @@ int aeTest(void) {
     if(aeCreateTimeEvent(server.el, server.send_timeout, check_timeout, NULL, NULL) == AE_ERR) 
         return -1;
 
+    if (server.active_defrag) {
+        if (!nn_alloc_defrag_supported()) {
+            serverLog(LL_WARNING,
+                    "Active defrag needs jemalloc with utilization hints, disabled");
+        } else if (aeCreateTimeEvent(server.el, server.defrag_period,
+                    activeDefragCron, NULL, NULL) == AE_ERR) {
+            return -1;
+        }
+    }
+
     for (j = 0; j < server.ipfd_count; j++) {
         if (aeCreateFileEvent(server.el, server.ipfd[j], AE_READABLE, acceptTcpHandler,NULL) == AE_ERR) {
             printf("Unrecoverable error creating server.ipfd file event.");
@@ -658,16 +1186,16 @@ int aeTest(void) {
     }
 
     aeSetBeforeSleepProc(server.el,beforeSleep);
+    nn_memmon_start(&server.memmon);
+    /* Last, so that no other thread inherits the event loop cpus. */
+    if(placeEventLoop() == C_ERR)
+        return -1;
     aeMain(server.el);
+    nn_memmon_term(&server.memmon);
+    /* The workers post to the loop, stop them first. */
+    nn_threadpool_term(&server.pool);
     aeDeleteEventLoop(server.el);
 
-    for(j=0; j<server.working_thread; j++) {
-        nn_thread_term(&threads[j]);
-        queue_thread_info_term(&thread_info[j]);
-    }
-    nn_free(thread_info);
-clean_threads:
-    nn_free(threads);
     termCommandTable();
     termServerConfig();
     return 0;
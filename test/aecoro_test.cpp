@@ -0,0 +1,261 @@
+#if defined(AECORO_TEST_MAIN)
+/* Tests of the coroutines on aeEventLoop.
+ *
+ * gcc -c utils/[a-z]*.c ae/ae.c -Iutils -Iae -DNN_HAVE_SEMAPHORE -DHAVE_EPOLL
+ * g++ -std=c++20 -o aecoro_test test/aecoro_test.cpp *.o -Iutils -Iae
+ *     -lpthread -DAECORO_TEST_MAIN
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "aecoro.h"
+#include "thread.h"
+#include "testhelp.h"
+
+#define INFLIGHT 5000
+
+static aeEventLoop *el;
+static struct nn_threadpool pool;
+static pthread_t loopThread;
+
+static long long mstime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec)*1000 + tv.tv_usec/1000;
+}
+
+static int onLoop(void) {
+    return pthread_equal(pthread_self(), loopThread);
+}
+
+static int stopLater(struct aeEventLoop *eventLoop, long long id, void *data) {
+    (void)id;
+    (void)data;
+    aeStop(eventLoop);
+    return AE_NOMORE;
+}
+
+/* Run the loop until 'done' reaches 'want', at most 'ms' milliseconds. */
+static void runUntil(int *done, int want, long long ms) {
+    long long deadline = mstime()+ms;
+
+    while (__atomic_load_n(done, __ATOMIC_ACQUIRE) < want &&
+            mstime() < deadline) {
+        aeCreateTimeEvent(el, 10, stopLater, NULL, NULL);
+        aeMain(el);
+    }
+}
+
+/* ---------------------------------------------------------------- Posting */
+
+static aePostedEvent posted[3];
+static int order[3], ordered;
+
+static void record(aeEventLoop *eventLoop, void *data) {
+    (void)eventLoop;
+    order[ordered++] = (int)(long)data;
+}
+
+static aePostedEvent farEvent;
+static int farDone;
+
+static void fromFar(aeEventLoop *eventLoop, void *data) {
+    (void)eventLoop;
+    (void)data;
+    __atomic_store_n(&farDone, onLoop() ? 1 : -1, __ATOMIC_RELEASE);
+}
+
+static void postFromThread(void *arg) {
+    (void)arg;
+    aePostEvent(el, &farEvent, fromFar, NULL);
+}
+
+/* ------------------------------------------------------------- Coroutines */
+
+static int done;
+static long long slept[3];
+
+static nn::task<void> sleeper(int j, long long ms) {
+    long long start = mstime();
+
+    int rc = co_await nn::sleep(el, ms);
+    slept[j] = rc == 0 && onLoop() ? mstime()-start : -1;
+    done++;
+}
+
+static nn::task<int> add(int a, int b) {
+    co_await nn::sleep(el, 1);
+    co_return a+b;
+}
+
+static int sum;
+
+static nn::task<void> nested(void) {
+    int a = co_await add(1, 2);
+    int b = co_await add(a, 4);
+    sum = b;
+    done++;
+}
+
+static ssize_t echoed, sent;
+static char echoBuf[64];
+
+static nn::task<void> echoServer(int fd) {
+    ssize_t n = co_await nn::read_some(el, fd, echoBuf, sizeof(echoBuf), 1000);
+    if (n > 0) n = co_await nn::write_all(el, fd, echoBuf, n, 1000);
+    echoed = n;
+    done++;
+}
+
+static nn::task<void> echoClient(int fd) {
+    char buf[64];
+
+    co_await nn::sleep(el, 20);
+    sent = co_await nn::write_all(el, fd, "ping", 4, 1000);
+    ssize_t n = co_await nn::read_some(el, fd, buf, sizeof(buf), 1000);
+    if (n != 4 || memcmp(buf, "ping", 4) != 0) sent = -1;
+    done++;
+}
+
+static int timedOut;
+static long long waited;
+
+static nn::task<void> silentPeer(int fd) {
+    long long start = mstime();
+
+    timedOut = co_await nn::readable(el, fd, 50);
+    waited = mstime()-start;
+    done++;
+}
+
+static int hopsOk;
+
+static nn::task<void> hopper(void) {
+    int rc = co_await nn::resume_on(&pool);
+    int ok = rc == 0 && !onLoop();
+
+    co_await nn::resume_on(el);
+    if (ok && onLoop()) hopsOk++;
+    done++;
+}
+
+static int fromBackend, backendOnLoop;
+
+static void backend(void *arg) {
+    usleep(20000);
+    ((nn::completion<int> *)arg)->set(42);
+}
+
+static nn::task<void> callBackend(void) {
+    nn::completion<int> reply(el);
+    struct nn_thread t;
+
+    nn_thread_init(&t, backend, &reply);
+    fromBackend = co_await reply;
+    backendOnLoop = onLoop();
+    nn_thread_term(&t);
+    done++;
+}
+
+static nn::task<void> readyFirst(void) {
+    nn::completion<int> reply(el);
+
+    reply.set(7);
+    fromBackend = co_await reply;
+    done++;
+}
+
+static int finished;
+
+/* A request: some work on the pool, a wait on the loop, more work. */
+static nn::task<void> request(int j) {
+    co_await nn::resume_on(&pool);
+    co_await nn::resume_on(el);
+    co_await nn::sleep(el, j % 10);
+    co_await nn::resume_on(&pool);
+    __atomic_add_fetch(&finished, 1, __ATOMIC_RELEASE);
+}
+
+int main(void) {
+    struct nn_thread t;
+    int sv[2], j;
+
+    loopThread = pthread_self();
+    el = aeCreateEventLoop(1024);
+    nn_threadpool_init(&pool, 2, 0, 1024);
+
+    for (j = 0; j < 3; j++)
+        aePostEvent(el, &posted[j], record, (void *)(long)j);
+    aeProcessEvents(el, AE_FILE_EVENTS|AE_DONT_WAIT);
+    test_cond("Posted events run in order on the next iteration",
+        ordered == 3 && order[0] == 0 && order[1] == 1 && order[2] == 2);
+
+    nn_thread_init(&t, postFromThread, NULL);
+    nn_thread_term(&t);
+    runUntil(&farDone, 1, 1000);
+    test_cond("An event posted by another thread wakes the loop up",
+        farDone == 1);
+
+    done = 0;
+    nn::spawn(sleeper(0, 60));
+    nn::spawn(sleeper(1, 20));
+    nn::spawn(sleeper(2, 40));
+    test_cond("Spawned coroutines run until their first wait", done == 0);
+    runUntil(&done, 3, 1000);
+    test_cond("Timers resume on the loop after their delay",
+        done == 3 && slept[0] >= 60 && slept[1] >= 20 && slept[2] >= 40 &&
+        slept[1] < slept[2] && slept[2] < slept[0]);
+
+    done = 0;
+    nn::spawn(nested());
+    runUntil(&done, 1, 1000);
+    test_cond("Tasks return their value to their awaiter", sum == 7);
+
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    fcntl(sv[0], F_SETFL, O_NONBLOCK);
+    fcntl(sv[1], F_SETFL, O_NONBLOCK);
+    done = 0;
+    nn::spawn(echoServer(sv[0]));
+    nn::spawn(echoClient(sv[1]));
+    runUntil(&done, 2, 2000);
+    test_cond("Reads and writes wait for the socket",
+        done == 2 && echoed == 4 && sent == 4);
+
+    done = 0;
+    nn::spawn(silentPeer(sv[0]));
+    runUntil(&done, 1, 1000);
+    test_cond("A wait times out",
+        timedOut == -ETIMEDOUT && waited >= 50 &&
+        aeGetFileEvents(el, sv[0]) == AE_NONE);
+    close(sv[0]);
+    close(sv[1]);
+
+    done = 0;
+    for (j = 0; j < 10; j++) nn::spawn(hopper());
+    runUntil(&done, 10, 2000);
+    test_cond("Coroutines move between the pool and the loop", hopsOk == 10);
+
+    done = 0;
+    nn::spawn(callBackend());
+    nn::spawn(readyFirst());
+    test_cond("A completion set before the wait does not suspend",
+        done == 1 && fromBackend == 7);
+    runUntil(&done, 2, 2000);
+    test_cond("A completion set by another thread resumes on the loop",
+        done == 2 && fromBackend == 42 && backendOnLoop);
+
+    for (j = 0; j < INFLIGHT; j++) nn::spawn(request(j));
+    runUntil(&finished, INFLIGHT, 10000);
+    test_cond("Thousands of requests in flight on two workers",
+        finished == INFLIGHT);
+
+    nn_threadpool_term(&pool);
+    aeDeleteEventLoop(el);
+    test_report()
+}
+#endif
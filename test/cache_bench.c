@@ -0,0 +1,128 @@
+#if defined(CACHE_BENCH_MAIN)
+/* Cache replay benchmark.
+ *
+ * Generates a Zipfian trace of key ids (Gray et al.'s generator, as in
+ * YCSB), then replays it against nn_cache with LRU and LFU eviction and
+ * budgets of several fractions of the bytes the whole key space would
+ * take. Every request is a get followed, on a miss, by a put of the
+ * value, as a cache-aside client does. A second trace mixes in one-off
+ * keys (a scan) that are never requested again. Reports the hit ratio,
+ * the evictions and the replay rate.
+ *
+ * gcc -O2 -o cache_bench test/cache_bench.c utils/[a-z]*.c -Iutils
+ *     -lpthread -lm -DNN_HAVE_SEMAPHORE -DCACHE_BENCH_MAIN
+ * ./cache_bench [keys] [requests] [theta]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+#include "alloc.h"
+#include "cache.h"
+
+#define VALLEN 100
+
+static long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec)*1000000 + tv.tv_usec;
+}
+
+static uint64_t benchRand(void) {
+    static uint64_t x = 88172645463325252ULL;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return x;
+}
+
+static double benchRand01(void) {
+    return (benchRand() >> 11) * (1.0/9007199254740992.0);
+}
+
+/* Zipfian ids in [0, n), 0 the most popular. */
+static void zipfTrace(long *trace, long len, long n, double theta) {
+    double zetan = 0, zeta2, alpha, eta, u, uz;
+    long j;
+
+    for (j = 1; j <= n; j++) zetan += 1/pow((double)j, theta);
+    zeta2 = 1 + 1/pow(2, theta);
+    alpha = 1/(1-theta);
+    eta = (1-pow(2.0/n, 1-theta))/(1-zeta2/zetan);
+    for (j = 0; j < len; j++) {
+        u = benchRand01();
+        uz = u*zetan;
+        if (uz < 1) trace[j] = 0;
+        else if (uz < zeta2) trace[j] = 1;
+        else trace[j] = (long)(n*pow(eta*u-eta+1, alpha));
+        if (trace[j] >= n) trace[j] = n-1;
+    }
+}
+
+/* Make one request in 'every' a key outside of the Zipfian key space. */
+static void addScan(long *trace, long len, long n, int every) {
+    long j, next = n;
+
+    for (j = 0; j < len; j += every) trace[j] = next++;
+}
+
+static void replay(const char *name, long *trace, long len, int policy,
+    size_t budget) {
+    struct nn_cache c;
+    char key[32], val[VALLEN];
+    const void *v;
+    size_t vlen, klen;
+    long long t;
+    long j;
+
+    memset(val, 'v', sizeof(val));
+    nn_cache_init(&c, policy, budget, NN_ALLOC_TAG_NONE);
+    t = ustime();
+    for (j = 0; j < len; j++) {
+        klen = snprintf(key, sizeof(key), "object:%ld", trace[j]);
+        if (nn_cache_get(&c, key, klen, &v, &vlen) != 0)
+            nn_cache_put(&c, key, klen, val, sizeof(val));
+    }
+    t = ustime()-t;
+    printf("  %-5s %-5s %10zu KB  hit %6.2f%%  evictions %9llu  %6.2f Mreq/s\n",
+        name, policy == NN_CACHE_LRU ? "LRU" : "LFU", budget >> 10,
+        100.0*c.hits/(c.hits+c.misses), (unsigned long long)c.evictions,
+        (double)len/t);
+    nn_cache_term(&c);
+}
+
+int main(int argc, char **argv) {
+    static const double fractions[] = {0.01, 0.05, 0.10, 0.25};
+    long n = argc > 1 ? atol(argv[1]) : 1000000;
+    long len = argc > 2 ? atol(argv[2]) : 10000000;
+    double theta = argc > 3 ? atof(argv[3]) : 0.99;
+    struct nn_cache probe;
+    size_t entry, i;
+    long *trace;
+
+    /* Charge of one entry, to express the budgets in key space terms. */
+    nn_cache_init(&probe, NN_CACHE_LRU, 1 << 20, NN_ALLOC_TAG_NONE);
+    nn_cache_put(&probe, "object:1000000", 14, probe.lists, VALLEN);
+    entry = nn_cache_bytes(&probe);
+    nn_cache_term(&probe);
+
+    printf("%ld keys, %ld requests, theta %.2f, %zu bytes per entry\n",
+        n, len, theta, entry);
+    trace = malloc(sizeof(long)*len);
+    zipfTrace(trace, len, n, theta);
+    for (i = 0; i < sizeof(fractions)/sizeof(fractions[0]); i++) {
+        replay("zipf", trace, len, NN_CACHE_LRU, entry*n*fractions[i]);
+        replay("zipf", trace, len, NN_CACHE_LFU, entry*n*fractions[i]);
+    }
+    addScan(trace, len, n, 4);
+    for (i = 0; i < sizeof(fractions)/sizeof(fractions[0]); i++) {
+        replay("+scan", trace, len, NN_CACHE_LRU, entry*n*fractions[i]);
+        replay("+scan", trace, len, NN_CACHE_LFU, entry*n*fractions[i]);
+    }
+    free(trace);
+    return 0;
+}
+#endif
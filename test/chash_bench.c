@@ -0,0 +1,200 @@
+#if defined(CHASH_BENCH_MAIN)
+/* nn_chash against nn_hash behind one nn_mutex.
+ *
+ * Both tables hold the same keys. For 1, 2, 4, ... threads up to the
+ * number of online CPUs (or the first argument), every thread runs a mix
+ * of lookups and writes for a fixed time. A write replaces the item of a
+ * key owned by that thread with a fresh one. Reports the total Mops/s of
+ * each mix.
+ *
+ * gcc -O2 -o chash_bench test/chash_bench.c utils/[a-z]*.c -Iutils
+ *     -lpthread -DNN_HAVE_SEMAPHORE -DCHASH_BENCH_MAIN
+ * ./chash_bench [max_threads] [keys] [ms]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "alloc.h"
+#include "hash.h"
+#include "std.h"
+#include "chash.h"
+#include "mutex.h"
+#include "thread.h"
+
+#define BENCH_MAX_THREADS 128
+
+typedef struct benchEntry {
+    long key;
+    hash_item item;
+} benchEntry;
+
+typedef struct benchWorker {
+    struct nn_thread thread;
+    int id;
+    long ops;
+} benchWorker;
+
+static struct nn_chash ctable;
+static hash htable;
+static nn_mutex_t hlock;
+static int useChash;
+static int writePct;
+static int nthreads;
+static long nkeys;
+static volatile int stop;
+
+static long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec)*1000000 + tv.tv_usec;
+}
+
+static benchEntry *newEntry(long key) {
+    benchEntry *e = nn_malloc(sizeof(*e));
+
+    e->key = key;
+    nn_hash_item_init(&e->item);
+    return e;
+}
+
+static void freeEntry(void *e) {
+    nn_free(e);
+}
+
+/* Keys are 1..nkeys, stored as pointers. */
+static void replaceKey(long key) {
+    hash_item *it;
+
+    if (useChash) {
+        nn_chash_enter(&ctable);
+        it = nn_chash_get(&ctable, (void *)key);
+        nn_chash_erase(&ctable, it);
+        nn_chash_retire(&ctable, nn_cont(it, benchEntry, item), freeEntry);
+        nn_chash_exit(&ctable);
+        nn_chash_insert(&ctable, (void *)key, &newEntry(key)->item);
+    } else {
+        nn_mutex_lock(&hlock);
+        it = nn_hash_get(&htable, (void *)key);
+        nn_hash_erase(&htable, it);
+        nn_free(nn_cont(it, benchEntry, item));
+        nn_hash_insert(&htable, (void *)key, &newEntry(key)->item);
+        nn_mutex_unlock(&hlock);
+    }
+}
+
+static long lookupKey(long key) {
+    hash_item *it;
+    long v;
+
+    if (useChash) {
+        nn_chash_enter(&ctable);
+        it = nn_chash_get(&ctable, (void *)key);
+        /* Missing while its owner replaces it. */
+        v = it ? nn_cont(it, benchEntry, item)->key : 0;
+        nn_chash_exit(&ctable);
+    } else {
+        nn_mutex_lock(&hlock);
+        it = nn_hash_get(&htable, (void *)key);
+        v = nn_cont(it, benchEntry, item)->key;
+        nn_mutex_unlock(&hlock);
+    }
+    return v;
+}
+
+static void benchRun(void *arg) {
+    benchWorker *w = arg;
+    unsigned long long x = 88172645463325252ULL + w->id;
+    long ops = 0, sum = 0, key;
+
+    while (!stop) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        if ((long)(x % 100) < writePct) {
+            /* Each thread only replaces the keys it owns. */
+            key = (long)((x >> 8) % (nkeys / nthreads)) * nthreads + w->id + 1;
+            replaceKey(key);
+        } else {
+            sum += lookupKey((long)((x >> 8) % nkeys) + 1);
+        }
+        ops++;
+    }
+    w->ops = ops + (sum == -1);
+}
+
+static double benchMix(int threads, int ms) {
+    benchWorker w[BENCH_MAX_THREADS];
+    long long start;
+    long total = 0;
+    int j;
+
+    nthreads = threads;
+    stop = 0;
+    start = ustime();
+    for (j = 0; j < threads; j++) {
+        w[j].id = j;
+        nn_thread_init(&w[j].thread, benchRun, &w[j]);
+    }
+    usleep(ms*1000);
+    stop = 1;
+    for (j = 0; j < threads; j++) {
+        nn_thread_term(&w[j].thread);
+        total += w[j].ops;
+    }
+    return (double)total/(ustime()-start);
+}
+
+int main(int argc, char **argv) {
+    static const int mixes[] = {0, 5, 50};
+    long maxThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    int ms = 1000, m, t;
+    hash_item *it;
+    long k;
+
+    if (argc > 1) maxThreads = atol(argv[1]);
+    nkeys = argc > 2 ? atol(argv[2]) : 1000000;
+    if (argc > 3) ms = atoi(argv[3]);
+    if (maxThreads > BENCH_MAX_THREADS) maxThreads = BENCH_MAX_THREADS;
+
+    nn_chash_init(&ctable, NULL);
+    nn_hash_init(&htable);
+    nn_mutex_init(&hlock);
+    for (k = 1; k <= nkeys; k++) {
+        nn_chash_insert(&ctable, (void *)k, &newEntry(k)->item);
+        nn_hash_insert(&htable, (void *)k, &newEntry(k)->item);
+    }
+
+    printf("Mops/s, %ld keys, %d ms per run\n", nkeys, ms);
+    for (m = 0; m < (int)(sizeof(mixes)/sizeof(mixes[0])); m++) {
+        writePct = mixes[m];
+        printf("%d%% writes\n", writePct);
+        for (t = 1; t <= maxThreads; t *= 2) {
+            double c, h;
+
+            useChash = 0;
+            h = benchMix(t, ms);
+            useChash = 1;
+            c = benchMix(t, ms);
+            printf("  %3d threads  nn_hash+mutex %6.2f  nn_chash %6.2f\n",
+                t, h, c);
+        }
+    }
+
+    for (k = 1; k <= nkeys; k++) {
+        nn_chash_enter(&ctable);
+        it = nn_chash_get(&ctable, (void *)k);
+        nn_chash_exit(&ctable);
+        nn_chash_erase(&ctable, it);
+        nn_chash_retire(&ctable, nn_cont(it, benchEntry, item), freeEntry);
+        it = nn_hash_get(&htable, (void *)k);
+        nn_hash_erase(&htable, it);
+        nn_free(nn_cont(it, benchEntry, item));
+    }
+    nn_chash_synchronize(&ctable);
+    nn_chash_term(&ctable);
+    nn_hash_term(&htable);
+    nn_mutex_term(&hlock);
+    return 0;
+}
+#endif
@@ -0,0 +1,146 @@
+#if defined(FILTER_BENCH_MAIN)
+/* Negative lookup benchmark.
+ *
+ * Fills an nn_hash with 'n' string keys, then looks up a stream in which
+ * nine lookups out of ten miss, directly and behind an nn_bloom (10 and 16
+ * bits per key) or an nn_cuckoo pre-check. The filters are fed the key's
+ * nn_hash64(), which is also what the table's key_gen returns, so a lookup
+ * that gets past the filter reuses it. Reports the time per lookup, the
+ * filter size and its measured and estimated false positive rates.
+ *
+ * gcc -O2 -o filter_bench test/filter_bench.c utils/[a-z]*.c -Iutils
+ *     -lpthread -DNN_HAVE_SEMAPHORE -DFILTER_BENCH_MAIN
+ * ./filter_bench [n]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "alloc.h"
+#include "bloom.h"
+#include "cuckoo.h"
+#include "hash.h"
+#include "hash64.h"
+#include "std.h"
+
+#define BLOOM 0
+#define CUCKOO 1
+#define NONE 2
+
+struct entry {
+    hash_item item;
+    uint64_t hash;
+    size_t keylen;
+    char key[24];
+};
+
+static uint64_t entryKeyGen(const void *key) {
+    return ((const struct entry *)key)->hash;
+}
+
+static int entryKeyCmp(const void *key1, const void *key2) {
+    const struct entry *a = key1, *b = key2;
+    return a->keylen == b->keylen && memcmp(a->key, b->key, a->keylen) == 0;
+}
+
+static hash_func entryFunc = {entryKeyGen, entryKeyCmp, NULL};
+
+static long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec)*1000000 + tv.tv_usec;
+}
+
+static uint64_t benchRand(void) {
+    static uint64_t x = 88172645463325252ULL;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return x;
+}
+
+static void fillEntry(struct entry *e, const char *prefix, long i) {
+    e->keylen = snprintf(e->key, sizeof(e->key), "%s:%ld", prefix, i);
+    e->hash = nn_hash64(e->key, e->keylen);
+}
+
+static void run(const char *name, hash *h, int kind, struct nn_bloom *b,
+    struct nn_cuckoo *c, long n, long lookups, double est, size_t bytes) {
+    struct entry probe;
+    long j, found, passed, misses;
+    long long t;
+    int maybe;
+
+    t = ustime();
+    for (j = found = passed = misses = 0; j < lookups; j++) {
+        if (benchRand() % 10 == 0) {
+            fillEntry(&probe, "key", benchRand() % n);
+        } else {
+            fillEntry(&probe, "miss", j);
+            misses++;
+        }
+        if (kind == BLOOM) maybe = nn_bloom_check(b, probe.hash);
+        else if (kind == CUCKOO) maybe = nn_cuckoo_check(c, probe.hash);
+        else maybe = 1;
+        if (!maybe) continue;
+        passed++;
+        found += nn_hash_get(h, &probe) != NULL;
+    }
+    t = ustime()-t;
+    printf("%-12s %7.1f ns/lookup %6.2f bits/key", name,
+        t*1000.0/lookups, bytes*8.0/n);
+    if (kind != NONE)
+        printf("  fpr measured %.5f estimated %.5f",
+            (double)(passed-found)/misses, est);
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    long n = argc > 1 ? atol(argv[1]) : 1000000;
+    long lookups = 5000000, j;
+    struct nn_bloom b10, b16;
+    struct nn_cuckoo c;
+    hash_iterator *iter;
+    hash_item *it;
+    struct entry *e;
+    hash h;
+
+    printf("%ld keys, %ld lookups, 90%% misses\n", n, lookups);
+    nn_hash_init(&h);
+    nn_hash_set_op(&h, &entryFunc);
+    nn_bloom_init(&b10, n, 10, NN_ALLOC_TAG_NONE);
+    nn_bloom_init(&b16, n, 16, NN_ALLOC_TAG_NONE);
+    nn_cuckoo_init(&c, n, NN_ALLOC_TAG_NONE);
+    for (j = 0; j < n; j++) {
+        e = nn_malloc(sizeof(*e));
+        nn_hash_item_init(&e->item);
+        fillEntry(e, "key", j);
+        nn_hash_insert(&h, e, &e->item);
+        nn_bloom_add(&b10, e->hash);
+        nn_bloom_add(&b16, e->hash);
+        nn_cuckoo_insert(&c, e->hash);
+    }
+
+    run("nn_hash", &h, NONE, NULL, NULL, n, lookups, 0, 0);
+    run("bloom/10", &h, BLOOM, &b10, NULL, n, lookups, nn_bloom_fpr(&b10),
+        nn_bloom_bytes(&b10));
+    run("bloom/16", &h, BLOOM, &b16, NULL, n, lookups, nn_bloom_fpr(&b16),
+        nn_bloom_bytes(&b16));
+    run("cuckoo", &h, CUCKOO, NULL, &c, n, lookups, nn_cuckoo_fpr(&c),
+        nn_cuckoo_bytes(&c));
+
+    nn_bloom_term(&b10);
+    nn_bloom_term(&b16);
+    nn_cuckoo_term(&c);
+    iter = nn_hash_iter_init(&h);
+    while ((it = nn_hash_item_next(iter)) != NULL) {
+        nn_hash_erase(&h, it);
+        nn_free(nn_cont(it, struct entry, item));
+    }
+    nn_hash_iter_term(iter);
+    nn_hash_term(&h);
+    return 0;
+}
+#endif
@@ -0,0 +1,133 @@
+#if defined(FLATHASH_BENCH_MAIN)
+/* nn_flathash against nn_hash.
+ *
+ * For each size from 1K items up to the limit (10M by default, 100M needs
+ * about 4GB of memory) both tables are filled with the same keys, then
+ * every key is looked up in a different order, as many absent keys are
+ * looked up and every key is erased. nn_hash items come from one array so
+ * that malloc is not timed. Reports ns per operation and table bytes per
+ * item.
+ *
+ * gcc -O2 -o flathash_bench test/flathash_bench.c utils/[a-z]*.c -Iutils
+ *     -lpthread -DNN_HAVE_SEMAPHORE -DFLATHASH_BENCH_MAIN
+ * ./flathash_bench [max_items]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include "alloc.h"
+#include "hash.h"
+#include "flathash.h"
+
+static long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec)*1000000 + tv.tv_usec;
+}
+
+/* A bijection on 32 bits: distinct, scattered keys that nn_hash, which
+ * hashes only the low 32 bits of a pointer key, can tell apart. */
+static uint64_t benchKey(size_t i) {
+    return (uint32_t)(i*2654435761u) ^ 0x5bd1e995u;
+}
+
+/* Visit 0..n-1 in a scattered order (n and the step are coprime). */
+#define BENCH_STEP 40503
+
+static size_t benchOrder(size_t j, size_t n) {
+    return (size_t)(((unsigned long long)j*BENCH_STEP) % n);
+}
+
+static volatile uint64_t sink;
+
+static double nsPerOp(long long start, size_t n) {
+    return (double)(ustime()-start)*1000/n;
+}
+
+static void benchHash(size_t n) {
+    hash_item *items;
+    hash h;
+    long long start;
+    double ins, hit, miss, del;
+    size_t j, mem;
+    uint64_t sum = 0;
+
+    items = nn_malloc(sizeof(hash_item)*n);
+    nn_hash_init(&h);
+    start = ustime();
+    for (j = 0; j < n; j++) {
+        nn_hash_item_init(&items[j]);
+        nn_hash_insert(&h, (void*)(uintptr_t)benchKey(j), &items[j]);
+    }
+    ins = nsPerOp(start, n);
+    mem = nn_alloc_tag_state(NN_ALLOC_TAG_HASH, NN_USED_MEMORY) +
+        sizeof(hash_item)*n;
+    start = ustime();
+    for (j = 0; j < n; j++)
+        sum += (uintptr_t)nn_hash_get(&h,
+            (void*)(uintptr_t)benchKey(benchOrder(j, n)));
+    hit = nsPerOp(start, n);
+    start = ustime();
+    for (j = 0; j < n; j++)
+        sum += (uintptr_t)nn_hash_get(&h, (void*)(uintptr_t)benchKey(n+j));
+    miss = nsPerOp(start, n);
+    start = ustime();
+    for (j = 0; j < n; j++)
+        nn_hash_erase(&h, &items[benchOrder(j, n)]);
+    del = nsPerOp(start, n);
+    sink = sum;
+    nn_hash_term(&h);
+    nn_free(items);
+    printf("  nn_hash      insert %6.1f  get %6.1f  miss %6.1f  erase %6.1f"
+        "  %5.1f B/item\n", ins, hit, miss, del, (double)mem/n);
+}
+
+static void benchFlat(size_t n) {
+    struct nn_flathash h;
+    long long start;
+    double ins, hit, miss, del;
+    size_t j, mem;
+    uint64_t sum = 0, *v;
+
+    nn_flathash_init(&h, 0, NN_ALLOC_TAG_USER);
+    start = ustime();
+    for (j = 0; j < n; j++)
+        nn_flathash_insert(&h, benchKey(j), j);
+    ins = nsPerOp(start, n);
+    mem = nn_alloc_tag_state(NN_ALLOC_TAG_USER, NN_USED_MEMORY);
+    start = ustime();
+    for (j = 0; j < n; j++) {
+        v = nn_flathash_get(&h, benchKey(benchOrder(j, n)));
+        sum += *v;
+    }
+    hit = nsPerOp(start, n);
+    start = ustime();
+    for (j = 0; j < n; j++)
+        sum += (uintptr_t)nn_flathash_get(&h, benchKey(n+j));
+    miss = nsPerOp(start, n);
+    start = ustime();
+    for (j = 0; j < n; j++)
+        nn_flathash_erase(&h, benchKey(benchOrder(j, n)));
+    del = nsPerOp(start, n);
+    sink = sum;
+    nn_flathash_term(&h);
+    printf("  nn_flathash  insert %6.1f  get %6.1f  miss %6.1f  erase %6.1f"
+        "  %5.1f B/item\n", ins, hit, miss, del, (double)mem/n);
+}
+
+int main(int argc, char **argv) {
+    size_t max = argc > 1 ? strtoull(argv[1], NULL, 10) : 10000000;
+    size_t n;
+
+    printf("ns/op, %s\n", NN_MALLOC_LIB);
+    for (n = 1000; n <= max; n *= 10) {
+        if (n % BENCH_STEP == 0) n++;
+        printf("%zu items\n", n);
+        benchHash(n);
+        benchFlat(n);
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,250 @@
+#if defined(HASH64_BENCH_MAIN)
+/* Hash function benchmark.
+ *
+ * Compares the nn_hash64 family with the functions nn_hash used before:
+ * MurmurHash2 for strings, djb for case-insensitive strings and Thomas
+ * Wang's 32 bit mix for pointers truncated to 32 bits.
+ *
+ * Throughput is reported in bytes per cycle (TSC cycles, so scaled by the
+ * ratio of the TSC to the core clock) and ns per hash for a range of key
+ * lengths. Distribution is measured on key sets shaped like real ones:
+ * sequential "user:%d" keys, mixed-case command names with numeric
+ * suffixes, and heap addresses returned by nn_alloc. For each set the low
+ * bits of the hash index 2^16 buckets, as nn_hash does; chi2/df is about
+ * 1.0 for a uniform hash. 'collide' counts keys whose full hash equals
+ * another key's: around n^2/2^33 is expected of a 32-bit hash, 0 of a
+ * 64-bit one. 'avalanche' is the worst deviation from 50% of the
+ * probability that an output bit flips when one input bit does, over
+ * random 16 byte keys (0 is ideal).
+ *
+ * gcc -O2 -o hash64_bench test/hash64_bench.c utils/[a-z]*.c -Iutils
+ *     -lpthread -lm -DNN_HAVE_SEMAPHORE -DHASH64_BENCH_MAIN
+ * ./hash64_bench [keys]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+#include "alloc.h"
+#include "hash.h"
+#include "hash64.h"
+
+#if defined __x86_64__ || defined __i386__
+#include <x86intrin.h>
+#define cycles() __rdtsc()
+#else
+#define cycles() 0ULL
+#endif
+
+#define BUCKET_BITS 16
+#define BUCKETS (1 << BUCKET_BITS)
+
+typedef uint64_t hashFn(const void *p, size_t len);
+
+static uint64_t murmur2(const void *p, size_t len) {
+    return hash_string_func(p, (int)len);
+}
+
+static uint64_t djb(const void *p, size_t len) {
+    return hash_string_case_func(p, (int)len);
+}
+
+static uint64_t wang(const void *p, size_t len) {
+    uint64_t k;
+
+    (void)len;
+    memcpy(&k, p, sizeof(k));
+    return hash_int_func((uint32_t)k);
+}
+
+static uint64_t hash64int(const void *p, size_t len) {
+    uint64_t k;
+
+    (void)len;
+    memcpy(&k, p, sizeof(k));
+    return nn_hash64_int(k);
+}
+
+static struct {
+    const char *name;
+    hashFn *fn;
+    int bits;
+    int nocase;
+} funcs[] = {
+    {"murmur2", murmur2, 32, 0},
+    {"nn_hash64", nn_hash64, 64, 0},
+    {"djb nocase", djb, 32, 1},
+    {"nn_hash64_case", nn_hash64_case, 64, 1},
+};
+
+static long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec)*1000000 + tv.tv_usec;
+}
+
+static uint64_t benchRand(void) {
+    static uint64_t x = 88172645463325252ULL;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return x;
+}
+
+static volatile uint64_t sink;
+
+/* Hash 'n' keys of 'len' bytes starting at successive offsets of 'buf' so
+ * that the hashes do not depend on each other through the input. */
+static void throughput(hashFn *fn, const char *buf, size_t len, long n) {
+    unsigned long long c;
+    long long t;
+    uint64_t acc = 0;
+    long j;
+
+    t = ustime();
+    c = cycles();
+    for (j = 0; j < n; j++) acc += fn(buf + (j & 63), len);
+    c = cycles() - c;
+    t = ustime() - t;
+    sink = acc;
+    printf("  %6.2f B/c %6.1f ns", c ? (double)len*n/c : 0.0,
+        (double)t*1000/n);
+}
+
+static int cmpU64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Print chi2/df of the low bits and the number of full hash collisions. */
+static void distribution(hashFn *fn, char **keys, size_t *lens, long n) {
+    static long buckets[BUCKETS];
+    uint64_t *h = malloc(sizeof(uint64_t)*n);
+    double e = (double)n/BUCKETS, chi = 0;
+    long j, collide = 0;
+
+    memset(buckets, 0, sizeof(buckets));
+    for (j = 0; j < n; j++) {
+        h[j] = fn(keys[j], lens[j]);
+        buckets[h[j] & (BUCKETS-1)]++;
+    }
+    for (j = 0; j < BUCKETS; j++) chi += (buckets[j]-e)*(buckets[j]-e)/e;
+    qsort(h, n, sizeof(uint64_t), cmpU64);
+    for (j = 1; j < n; j++) collide += h[j] == h[j-1];
+    printf("  %7.3f %7ld", chi/(BUCKETS-1), collide);
+    free(h);
+}
+
+/* Case-insensitive functions ignore bit 5 of letters: their keys have the
+ * top bit of every byte set, so no byte is ever ASCII, and it is not
+ * flipped. */
+static double avalanche(hashFn *fn, int bits, int nocase) {
+    static long flips[128][64];
+    unsigned char key[16];
+    uint64_t h, d;
+    double worst = 0, p;
+    int trials = 20000, t, i, o;
+
+    memset(flips, 0, sizeof(flips));
+    for (t = 0; t < trials; t++) {
+        for (i = 0; i < 16; i += 8) {
+            h = benchRand();
+            memcpy(key+i, &h, 8);
+        }
+        if (nocase) for (i = 0; i < 16; i++) key[i] |= 0x80;
+        h = fn(key, 16);
+        for (i = 0; i < 128; i++) {
+            if (nocase && i%8 == 7) continue;
+            key[i/8] ^= 1 << (i%8);
+            d = fn(key, 16) ^ h;
+            key[i/8] ^= 1 << (i%8);
+            for (o = 0; o < bits; o++) flips[i][o] += (d >> o) & 1;
+        }
+    }
+    for (i = 0; i < 128; i++) {
+        if (nocase && i%8 == 7) continue;
+        for (o = 0; o < bits; o++) {
+            p = fabs((double)flips[i][o]/trials - 0.5);
+            if (p > worst) worst = p;
+        }
+    }
+    return worst;
+}
+
+int main(int argc, char **argv) {
+    static const char *commands[] = {"GET", "Set", "hgetall", "ZADD",
+        "lrange", "Expire", "MULTI", "subscribe"};
+    static size_t lengths[] = {3, 8, 16, 24, 48, 64, 256, 4096};
+    long n = argc > 1 ? atol(argv[1]) : 1000000;
+    long reps, j;
+    char *buf, **keys;
+    size_t *lens, i, f;
+    void **ptrs;
+
+    buf = malloc(4096+64);
+    for (i = 0; i < 4096+64; i++) buf[i] = 'A' + benchRand() % 58;
+    printf("Throughput\n%6s", "bytes");
+    for (f = 0; f < sizeof(funcs)/sizeof(funcs[0]); f++)
+        printf("  %-21s", funcs[f].name);
+    printf("\n");
+    for (i = 0; i < sizeof(lengths)/sizeof(lengths[0]); i++) {
+        reps = 200000000 / (lengths[i] + 32);
+        printf("%6zu", lengths[i]);
+        for (f = 0; f < sizeof(funcs)/sizeof(funcs[0]); f++)
+            throughput(funcs[f].fn, buf, lengths[i], reps);
+        printf("\n");
+    }
+    printf("%6s", "int");
+    throughput(wang, buf, 8, 100000000);
+    throughput(hash64int, buf, 8, 100000000);
+    printf("   (Thomas Wang on 32 bits, nn_hash64_int)\n");
+
+    keys = malloc(sizeof(char *)*n);
+    lens = malloc(sizeof(size_t)*n);
+    printf("\nDistribution, %ld keys: chi2/df of the low %d bits, full hash "
+        "collisions\n%-12s", n, BUCKET_BITS, "keys");
+    for (f = 0; f < sizeof(funcs)/sizeof(funcs[0]); f++)
+        printf("  %-15s", funcs[f].name);
+    printf("\n%-12s", "user:%d");
+    for (j = 0; j < n; j++) {
+        keys[j] = malloc(32);
+        lens[j] = snprintf(keys[j], 32, "user:%ld", j);
+    }
+    for (f = 0; f < sizeof(funcs)/sizeof(funcs[0]); f++)
+        distribution(funcs[f].fn, keys, lens, n);
+    printf("\n%-12s", "command:%d");
+    for (j = 0; j < n; j++)
+        lens[j] = snprintf(keys[j], 32, "%s:%ld", commands[j % 8], j / 8);
+    for (f = 0; f < sizeof(funcs)/sizeof(funcs[0]); f++)
+        distribution(funcs[f].fn, keys, lens, n);
+
+    /* Pointer keys as nn_hash sees them: the address is the key. */
+    ptrs = malloc(sizeof(void *)*n);
+    for (j = 0; j < n; j++) {
+        ptrs[j] = nn_alloc(48);
+        memcpy(keys[j], &ptrs[j], sizeof(void *));
+        lens[j] = 8;
+    }
+    printf("\n%-12s  %-15s  %-15s", "pointers", "wang 32", "nn_hash64_int");
+    printf("\n%-12s", "");
+    distribution(wang, keys, lens, n);
+    distribution(hash64int, keys, lens, n);
+    printf("\n\nAvalanche, worst bias over 16 byte keys\n");
+    for (f = 0; f < sizeof(funcs)/sizeof(funcs[0]); f++)
+        printf("  %-15s %.3f\n", funcs[f].name,
+            avalanche(funcs[f].fn, funcs[f].bits, funcs[f].nocase));
+
+    for (j = 0; j < n; j++) {
+        nn_free(ptrs[j]);
+        free(keys[j]);
+    }
+    free(ptrs);
+    free(keys);
+    free(lens);
+    free(buf);
+    return 0;
+}
+#endif
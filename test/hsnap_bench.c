@@ -0,0 +1,154 @@
+#if defined(HSNAP_BENCH_MAIN)
+/* Warm restart benchmark.
+ *
+ * Compares two ways of getting 'n' key/value pairs back after a restart:
+ * rebuilding an nn_hash with one allocation per entry, which is what a
+ * restart did before, and mapping an nn_hsnap snapshot. It then times
+ * random lookups in both. The snapshot is read through the page cache, so
+ * the load figure is for a warm restart; a cold one also pays to read the
+ * pages the lookups touch.
+ *
+ * gcc -O2 -o hsnap_bench test/hsnap_bench.c utils/[a-z]*.c -Iutils
+ *     -lpthread -DNN_HAVE_SEMAPHORE -DHSNAP_BENCH_MAIN
+ * ./hsnap_bench [n] [path]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "alloc.h"
+#include "hash.h"
+#include "hash64.h"
+#include "hsnap.h"
+#include "std.h"
+
+#define VALLEN 32
+
+struct entry {
+    hash_item item;
+    size_t keylen;
+    char key[24];
+    char val[VALLEN];
+};
+
+static uint64_t entryKeyGen(const void *key) {
+    const struct entry *e = key;
+    return nn_hash64(e->key, e->keylen);
+}
+
+static int entryKeyCmp(const void *key1, const void *key2) {
+    const struct entry *a = key1, *b = key2;
+    return a->keylen == b->keylen && memcmp(a->key, b->key, a->keylen) == 0;
+}
+
+static hash_func entryFunc = {entryKeyGen, entryKeyCmp, NULL};
+
+static long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec)*1000000 + tv.tv_usec;
+}
+
+static uint64_t benchRand(void) {
+    static uint64_t x = 88172645463325252ULL;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return x;
+}
+
+static void fillEntry(struct entry *e, long i) {
+    e->keylen = snprintf(e->key, sizeof(e->key), "key:%ld", i);
+    memset(e->val, 'a' + i % 26, VALLEN);
+}
+
+int main(int argc, char **argv) {
+    long n = argc > 1 ? atol(argv[1]) : 2000000;
+    const char *path = argc > 2 ? argv[2] : "/tmp/hsnap_bench.snap";
+    long lookups = 1000000, j, found;
+    struct nn_hsnap_writer w;
+    struct nn_hsnap snap;
+    struct entry *e, probe;
+    hash_iterator *iter;
+    hash_item *it;
+    const void *val;
+    size_t vallen;
+    long long t;
+    hash h;
+
+    printf("%ld entries, %d byte values\n", n, VALLEN);
+
+    t = ustime();
+    nn_hash_init(&h);
+    nn_hash_set_op(&h, &entryFunc);
+    for (j = 0; j < n; j++) {
+        e = nn_malloc(sizeof(*e));
+        nn_hash_item_init(&e->item);
+        fillEntry(e, j);
+        nn_hash_insert(&h, e, &e->item);
+    }
+    printf("rebuild nn_hash      %8.1f ms\n", (ustime()-t)/1000.0);
+
+    t = ustime();
+    nn_hsnap_writer_init(&w, path, n, nn_hash64_get_seed());
+    iter = nn_hash_iter_init(&h);
+    while ((it = nn_hash_item_next(iter)) != NULL) {
+        e = nn_cont(it, struct entry, item);
+        nn_hsnap_writer_add(&w, e->key, e->keylen, e->val, VALLEN);
+    }
+    nn_hash_iter_term(iter);
+    if (nn_hsnap_writer_commit(&w) != 0) {
+        perror("save");
+        return 1;
+    }
+    printf("save snapshot        %8.1f ms\n", (ustime()-t)/1000.0);
+
+    t = ustime();
+    nn_hsnap_init(&snap);
+    if (nn_hsnap_load(&snap, path) != 0) {
+        perror("load");
+        return 1;
+    }
+    printf("load snapshot        %8.3f ms (%.1f MB)\n", (ustime()-t)/1000.0,
+        snap.size/1048576.0);
+
+    t = ustime();
+    for (j = found = 0; j < lookups; j++) {
+        fillEntry(&probe, benchRand() % n);
+        it = nn_hash_get(&h, &probe);
+        found += it != NULL;
+    }
+    printf("lookup nn_hash       %8.1f ns (%ld found)\n",
+        (ustime()-t)*1000.0/lookups, found);
+
+    t = ustime();
+    for (j = found = 0; j < lookups; j++) {
+        fillEntry(&probe, benchRand() % n);
+        found += nn_hsnap_get(&snap, probe.key, probe.keylen, &val,
+            &vallen) == 0;
+    }
+    printf("lookup nn_hsnap      %8.1f ns (%ld found)\n",
+        (ustime()-t)*1000.0/lookups, found);
+
+    t = ustime();
+    for (j = 0; j < n/10; j++) {
+        fillEntry(&probe, benchRand() % n);
+        nn_hsnap_set(&snap, probe.key, probe.keylen, "promoted", 8);
+    }
+    printf("promote %ld writes %8.1f ms\n", n/10, (ustime()-t)/1000.0);
+
+    nn_hsnap_term(&snap);
+    iter = nn_hash_iter_init(&h);
+    while ((it = nn_hash_item_next(iter)) != NULL) {
+        nn_hash_erase(&h, it);
+        nn_free(nn_cont(it, struct entry, item));
+    }
+    nn_hash_iter_term(iter);
+    nn_hash_term(&h);
+    unlink(path);
+    return 0;
+}
+#endif
@@ -0,0 +1,137 @@
+#if defined(HUGEPAGE_BENCH_MAIN)
+/* Huge page I/O buffer benchmark.
+ *
+ * Compares buffers taken from the I/O buffer class (nn_malloc_iobuf) with
+ * plain nn_malloc() buffers of the same size. Two workloads are measured:
+ * random 8 byte touches spread over all the buffers, which is dominated by
+ * TLB reach, and 16k block copies into random buffers, which is what the
+ * socket read path does. dTLB load misses are read through perf_event_open
+ * when the kernel allows it (see /proc/sys/kernel/perf_event_paranoid).
+ *
+ * gcc -O2 -o hugepage_bench test/hugepage_bench.c utils/[a-z]*.c -Iutils
+ *     -lpthread -DNN_HAVE_SEMAPHORE -DHUGEPAGE_BENCH_MAIN
+ * ./hugepage_bench [nbufs] [bufsize] [touches]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "alloc.h"
+
+#define BENCH_COPY_LEN (16*1024)
+
+static long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec)*1000000 + tv.tv_usec;
+}
+
+static int tlbCounterOpen(void) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB |
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void tlbCounterStart(int fd) {
+    if (fd == -1) return;
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+static long long tlbCounterStop(int fd) {
+    long long count;
+
+    if (fd == -1) return -1;
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &count, sizeof(count)) != sizeof(count)) return -1;
+    return count;
+}
+
+static void report(const char *name, const char *workload, long long us,
+        long long ops, long long bytes, long long misses) {
+    printf("%-8s %-7s %8.2f ns/op", name, workload, us*1000.0/ops);
+    if (bytes) printf(" %7.2f GB/s", bytes/(us*1000.0));
+    else printf("             ");
+    if (misses >= 0) printf(" %12lld dTLB misses (%.4f/op)\n", misses, (double)misses/ops);
+    else printf("  dTLB misses n/a\n");
+}
+
+static void run(const char *name, char **bufs, int nbufs, size_t bufsize,
+        long long touches, int tlbfd) {
+    unsigned long long x = 88172645463325252ULL, sum = 0;
+    char block[BENCH_COPY_LEN];
+    long long start, j, copies;
+    int i;
+
+    /* Fault everything in first, we measure steady state. */
+    for (i = 0; i < nbufs; i++) memset(bufs[i], i, bufsize);
+
+    tlbCounterStart(tlbfd);
+    start = ustime();
+    for (j = 0; j < touches; j++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        char *p = bufs[x % nbufs] + ((x >> 20) % (bufsize - 8));
+        sum += *(volatile unsigned long long *)p;
+    }
+    report(name, "random", ustime()-start, touches, 0, tlbCounterStop(tlbfd));
+
+    memset(block, 'x', sizeof(block));
+    copies = touches / 64;
+    tlbCounterStart(tlbfd);
+    start = ustime();
+    for (j = 0; j < copies; j++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        memcpy(bufs[x % nbufs] + ((x >> 20) % (bufsize - BENCH_COPY_LEN)),
+                block, BENCH_COPY_LEN);
+    }
+    report(name, "copy16k", ustime()-start, copies, copies*BENCH_COPY_LEN,
+            tlbCounterStop(tlbfd));
+    if (sum == 42) printf("\n"); /* keep the loads alive */
+}
+
+int main(int argc, char **argv) {
+    static const char *modes[] = {"none", "small", "thp", "hugetlb"};
+    int nbufs = argc > 1 ? atoi(argv[1]) : 256;
+    size_t bufsize = argc > 2 ? (size_t)atol(argv[2]) : 1024*1024;
+    long long touches = argc > 3 ? atoll(argv[3]) : 20000000;
+    char **bufs = nn_malloc(sizeof(char*)*nbufs);
+    int tlbfd = tlbCounterOpen();
+    int i;
+
+    printf("%d buffers of %zu bytes, %lld touches\n", nbufs, bufsize, touches);
+    if (tlbfd == -1) printf("perf_event_open failed, TLB misses not reported\n");
+
+    for (i = 0; i < nbufs; i++) bufs[i] = nn_malloc(bufsize);
+    run("malloc", bufs, nbufs, bufsize, touches, tlbfd);
+    for (i = 0; i < nbufs; i++) nn_free(bufs[i]);
+
+    if (nn_alloc_iobuf_init(bufsize, nbufs, 1) == -1) {
+        printf("I/O buffer arena unavailable\n");
+        return 1;
+    }
+    printf("arena page mode: %s\n",
+            modes[nn_alloc_iobuf_state(NN_IOBUF_PAGE_MODE)]);
+    for (i = 0; i < nbufs; i++) bufs[i] = nn_malloc_iobuf(bufsize);
+    run("iobuf", bufs, nbufs, bufsize, touches, tlbfd);
+    for (i = 0; i < nbufs; i++) nn_free(bufs[i]);
+    nn_alloc_iobuf_term();
+
+    nn_free(bufs);
+    if (tlbfd != -1) close(tlbfd);
+    return 0;
+}
+#endif
@@ -0,0 +1,296 @@
+#if defined(INTRUSIVE_BENCH_MAIN)
+/* Typed containers benchmark.
+ *
+ * Runs the same work on nn_hash / nn_list through the C API, where every
+ * probe calls key_gen and key_cmp through the hash_func table, and through
+ * nn::IntrusiveHash / nn::IntrusiveList, where they are inlined. Both use
+ * the same hash functions, so the difference is the dispatch and what the
+ * compiler can do once it sees the comparison. Integer keys show the
+ * overhead at its largest; string keys spend more time hashing.
+ *
+ * gcc -O2 -c utils/[a-z]*.c -Iutils -DNN_HAVE_SEMAPHORE
+ * g++ -O2 -std=c++17 -o intrusive_bench test/intrusive_bench.cpp *.o -Iutils
+ *     -lpthread -DINTRUSIVE_BENCH_MAIN
+ * ./intrusive_bench [n]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <string_view>
+#include "intrusive.h"
+#include "hash64.h"
+#include "std.h"
+
+struct entry {
+    hash_item item;
+    nn_list_item lru;
+    uint64_t id;
+    size_t namelen;
+    char name[24];
+};
+
+/* The C side: one hash_func table per key kind. */
+static uint64_t idKeyGen(const void *key) {
+    return nn_hash64_int(((const entry *)key)->id);
+}
+
+static int idKeyCmp(const void *key1, const void *key2) {
+    return ((const entry *)key1)->id == ((const entry *)key2)->id;
+}
+
+static uint64_t nameKeyGen(const void *key) {
+    const entry *e = (const entry *)key;
+    return nn_hash64(e->name, e->namelen);
+}
+
+static int nameKeyCmp(const void *key1, const void *key2) {
+    const entry *a = (const entry *)key1, *b = (const entry *)key2;
+    return a->namelen == b->namelen && memcmp(a->name, b->name, a->namelen) == 0;
+}
+
+static hash_func idFunc = {idKeyGen, idKeyCmp, NULL};
+static hash_func nameFunc = {nameKeyGen, nameKeyCmp, NULL};
+
+/* The C++ side: the same functions as hasher and comparison. */
+struct idHasher {
+    uint64_t operator()(const entry &e) const { return nn_hash64_int(e.id); }
+    uint64_t operator()(uint64_t id) const { return nn_hash64_int(id); }
+};
+
+struct idEq {
+    bool operator()(const entry &a, const entry &b) const { return a.id == b.id; }
+    bool operator()(const entry &a, uint64_t id) const { return a.id == id; }
+};
+
+struct nameHasher {
+    uint64_t operator()(const entry &e) const {
+        return nn_hash64(e.name, e.namelen);
+    }
+    uint64_t operator()(std::string_view k) const {
+        return nn_hash64(k.data(), k.size());
+    }
+};
+
+struct nameEq {
+    bool operator()(const entry &a, const entry &b) const {
+        return a.namelen == b.namelen && memcmp(a.name, b.name, a.namelen) == 0;
+    }
+    bool operator()(const entry &a, std::string_view k) const {
+        return a.namelen == k.size() && memcmp(a.name, k.data(), a.namelen) == 0;
+    }
+};
+
+typedef nn::IntrusiveHash<entry, &entry::item, idHasher, idEq> idHash;
+typedef nn::IntrusiveHash<entry, &entry::item, nameHasher, nameEq> nameHash;
+typedef nn::IntrusiveList<entry, &entry::lru> entryList;
+
+static long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec)*1000000 + tv.tv_usec;
+}
+
+static uint64_t benchRand(void) {
+    static uint64_t x = 88172645463325252ULL;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return x;
+}
+
+static void report(const char *what, long long c, long long cpp, long ops) {
+    printf("%-24s C %7.1f ns  C++ %7.1f ns  %5.2fx\n", what,
+        c*1000.0/ops, cpp*1000.0/ops, (double)c/cpp);
+}
+
+static void fillEntries(entry *entries, long n) {
+    long j;
+
+    for (j = 0; j < n; j++) {
+        nn_hash_item_init(&entries[j].item);
+        nn_list_item_init(&entries[j].lru);
+        entries[j].id = j*2;            /* Odd ids miss */
+        entries[j].namelen = snprintf(entries[j].name,
+            sizeof(entries[j].name), "user:%ld", j*2);
+    }
+}
+
+/* Lookups of ids, one in two present, the keys drawn up front. */
+static void benchIds(entry *entries, long n, uint64_t *keys, long ops) {
+    entry probe;
+    long long t1, t2;
+    long j, found1 = 0, found2 = 0;
+    hash h;
+
+    nn_hash_init(&h);
+    nn_hash_set_op(&h, &idFunc);
+    for (j = 0; j < n; j++)
+        nn_hash_insert(&h, &entries[j], &entries[j].item);
+    t1 = ustime();
+    for (j = 0; j < ops; j++) {
+        probe.id = keys[j];
+        found1 += nn_hash_get(&h, &probe) != NULL;
+    }
+    t1 = ustime()-t1;
+    for (j = 0; j < n; j++)
+        nn_hash_erase(&h, &entries[j].item);
+    nn_hash_term(&h);
+
+    {
+        idHash th;
+
+        for (j = 0; j < n; j++)
+            th.insert(entries[j]);
+        t2 = ustime();
+        for (j = 0; j < ops; j++)
+            found2 += th.get(keys[j]) != nullptr;
+        t2 = ustime()-t2;
+        th.clear([](entry &) {});
+    }
+    if (found1 != found2) printf("mismatch %ld %ld\n", found1, found2);
+    report("get, integer keys", t1, t2, ops);
+}
+
+static void benchNames(entry *entries, long n, uint64_t *keys, long ops) {
+    entry probe;
+    long long t1, t2;
+    long j, found1 = 0, found2 = 0;
+    char buf[24];
+    size_t len;
+    hash h;
+
+    nn_hash_init(&h);
+    nn_hash_set_op(&h, &nameFunc);
+    for (j = 0; j < n; j++)
+        nn_hash_insert(&h, &entries[j], &entries[j].item);
+    t1 = ustime();
+    for (j = 0; j < ops; j++) {
+        probe.namelen = snprintf(probe.name, sizeof(probe.name), "user:%lu",
+            (unsigned long)keys[j]);
+        found1 += nn_hash_get(&h, &probe) != NULL;
+    }
+    t1 = ustime()-t1;
+    for (j = 0; j < n; j++)
+        nn_hash_erase(&h, &entries[j].item);
+    nn_hash_term(&h);
+
+    {
+        nameHash th;
+
+        for (j = 0; j < n; j++)
+            th.insert(entries[j]);
+        t2 = ustime();
+        for (j = 0; j < ops; j++) {
+            len = snprintf(buf, sizeof(buf), "user:%lu", (unsigned long)keys[j]);
+            found2 += th.get(std::string_view(buf, len)) != nullptr;
+        }
+        t2 = ustime()-t2;
+        th.clear([](entry &) {});
+    }
+    if (found1 != found2) printf("mismatch %ld %ld\n", found1, found2);
+    report("get, string keys", t1, t2, ops);
+}
+
+/* Insert everything, then erase everything, growing and shrinking. */
+static void benchChurn(entry *entries, long n) {
+    long long t1, t2;
+    long j;
+    hash h;
+
+    nn_hash_init(&h);
+    nn_hash_set_op(&h, &idFunc);
+    t1 = ustime();
+    for (j = 0; j < n; j++)
+        nn_hash_insert(&h, &entries[j], &entries[j].item);
+    for (j = 0; j < n; j++)
+        nn_hash_erase(&h, &entries[j].item);
+    t1 = ustime()-t1;
+    nn_hash_term(&h);
+
+    {
+        idHash th;
+
+        t2 = ustime();
+        for (j = 0; j < n; j++)
+            th.insert(entries[j]);
+        for (j = 0; j < n; j++)
+            th.erase(entries[j]);
+        t2 = ustime()-t2;
+    }
+    report("insert + erase", t1, t2, 2*n);
+}
+
+/* Move random entries to the back of an LRU list, then walk it. */
+static void benchList(entry *entries, long n, uint64_t *keys, long ops) {
+    struct nn_list l;
+    struct nn_list_item *it;
+    long long t1, t2, w1, w2;
+    uint64_t sum1 = 0, sum2 = 0;
+    entry *e;
+    long j;
+
+    nn_list_init(&l);
+    for (j = 0; j < n; j++)
+        nn_list_insert(&l, &entries[j].lru, nn_list_end(&l));
+    t1 = ustime();
+    for (j = 0; j < ops; j++) {
+        e = &entries[keys[j] % n];
+        nn_list_erase(&l, &e->lru);
+        nn_list_insert(&l, &e->lru, nn_list_end(&l));
+    }
+    t1 = ustime()-t1;
+    w1 = ustime();
+    for (it = nn_list_begin(&l); it != nn_list_end(&l); it = nn_list_next(&l, it))
+        sum1 += nn_cont(it, entry, lru)->id;
+    w1 = ustime()-w1;
+    while (!nn_list_empty(&l))
+        nn_list_erase(&l, nn_list_begin(&l));
+    nn_list_term(&l);
+
+    {
+        entryList tl;
+
+        for (j = 0; j < n; j++)
+            tl.push_back(entries[j]);
+        t2 = ustime();
+        for (j = 0; j < ops; j++) {
+            e = &entries[keys[j] % n];
+            tl.erase(*e);
+            tl.push_back(*e);
+        }
+        t2 = ustime()-t2;
+        w2 = ustime();
+        for (entry &x : tl)
+            sum2 += x.id;
+        w2 = ustime()-w2;
+        while (tl.pop_front());
+    }
+    if (sum1 != sum2) printf("mismatch\n");
+    report("list move to back", t1, t2, ops);
+    report("list walk", w1, w2, n);
+}
+
+int main(int argc, char **argv) {
+    long n = argc > 1 ? atol(argv[1]) : 100000;
+    long ops = 10000000, j;
+    entry *entries;
+    uint64_t *keys;
+
+    printf("%ld entries, %ld operations\n", n, ops);
+    entries = (entry *)malloc(sizeof(entry)*n);
+    keys = (uint64_t *)malloc(sizeof(uint64_t)*ops);
+    fillEntries(entries, n);
+    for (j = 0; j < ops; j++)
+        keys[j] = benchRand() % (2*n);
+    benchIds(entries, n, keys, ops);
+    benchNames(entries, n, keys, ops);
+    benchChurn(entries, n);
+    benchList(entries, n, keys, ops);
+    free(keys);
+    free(entries);
+    return 0;
+}
+#endif
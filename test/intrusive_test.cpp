@@ -0,0 +1,146 @@
+#if defined(INTRUSIVE_TEST_MAIN)
+/* Tests of the typed C++ views of nn_hash and nn_list.
+ *
+ * gcc -c utils/[a-z]*.c -Iutils -DNN_HAVE_SEMAPHORE
+ * g++ -std=c++17 -o intrusive_test test/intrusive_test.cpp *.o -Iutils
+ *     -lpthread -DINTRUSIVE_TEST_MAIN
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string_view>
+#include "intrusive.h"
+#include "hash64.h"
+#include "testhelp.h"
+
+#define N 20000
+
+struct entry {
+    hash_item item;
+    nn_list_item lru;
+    char name[16];
+    int value;
+};
+
+struct entryHasher {
+    uint64_t operator()(const entry &e) const {
+        return nn_hash64(e.name, strlen(e.name));
+    }
+    uint64_t operator()(std::string_view k) const {
+        return nn_hash64(k.data(), k.size());
+    }
+};
+
+struct entryEq {
+    bool operator()(const entry &a, const entry &b) const {
+        return strcmp(a.name, b.name) == 0;
+    }
+    bool operator()(const entry &a, std::string_view k) const {
+        return k == a.name;
+    }
+};
+
+typedef nn::IntrusiveHash<entry, &entry::item, entryHasher, entryEq> entryHash;
+typedef nn::IntrusiveList<entry, &entry::lru> entryList;
+
+static entry entries[N];
+
+static void initEntry(entry *e, int i) {
+    nn_hash_item_init(&e->item);
+    nn_list_item_init(&e->lru);
+    snprintf(e->name, sizeof(e->name), "e%d", i);
+    e->value = i;
+}
+
+static void countItem(void *arg, hash_item *item) {
+    (void)item;
+    (*(int *)arg)++;
+}
+
+int main(void) {
+    entryHash h;
+    entryList l;
+    entry a, b, *e;
+    uint64_t cursor;
+    int j, ok, count;
+
+    initEntry(&a, 1);
+    initEntry(&b, 1);
+    test_cond("Insert and get",
+        h.insert(a) && !h.insert(b) && h.size() == 1 &&
+        h.get(std::string_view("e1")) == &a &&
+        h.get(std::string_view("e2")) == nullptr && h.get(b) == &a);
+    test_cond("Set replaces the equal object",
+        h.set(b) == &a && a.item.next == NN_HASH_NOTINHASH &&
+        h.get(std::string_view("e1")) == &b && h.size() == 1);
+    h.erase(b);
+    test_cond("Erase", h.empty() && h.get(std::string_view("e1")) == nullptr &&
+        b.item.next == NN_HASH_NOTINHASH);
+
+    /* Enough entries to grow several times, with lookups while the table
+     * is rehashing. */
+    for (j = 0, ok = 1; j < N && ok; j++) {
+        initEntry(&entries[j], j);
+        ok = h.insert(entries[j]) &&
+            h.get(std::string_view(entries[j/2].name)) == &entries[j/2];
+    }
+    test_cond("Grow", ok && h.size() == N && h.c_hash()->slots >= N/2);
+
+    count = 0;
+    cursor = 0;
+    do {
+        cursor = nn_hash_scan(h.c_hash(), cursor, countItem, &count, 100);
+    } while (cursor);
+    test_cond("The C API sees the same table",
+        count == N && nn_hash_get(h.c_hash(), &b) == &entries[1].item);
+
+    for (j = 0, ok = 1; j < N && ok; j += 2)
+        ok = h.erase_key(std::string_view(entries[j].name)) == &entries[j];
+    for (j = 0; j < N && ok; j++)
+        ok = (h.get(std::string_view(entries[j].name)) != nullptr) == (j % 2);
+    test_cond("Erase by key", ok && h.size() == N/2 &&
+        h.erase_key(std::string_view("e0")) == nullptr);
+
+    h.for_each([&](entry &e) { if (e.value % 4 == 1) h.erase(e); });
+    test_cond("Erase while iterating", h.size() == N/4 &&
+        h.get(std::string_view("e1")) == nullptr &&
+        h.get(std::string_view("e3")) == &entries[3]);
+
+    /* Shrinking back leaves a sparse table behind. */
+    count = 0;
+    h.clear([&](entry &e) { count++; e.value = -1; });
+    while (nn_hash_rehash_ms(h.c_hash(), 100));
+    test_cond("Clear", count == N/4 && h.empty() && entries[3].value == -1 &&
+        entries[3].item.next == NN_HASH_NOTINHASH && h.c_hash()->slots == 32);
+
+    for (j = 0; j < 5; j++) {
+        initEntry(&entries[j], j);
+        l.push_back(entries[j]);
+    }
+    initEntry(&a, 100);
+    l.push_front(a);
+    l.insert(b, &entries[2]);
+    count = 0;
+    ok = 1;
+    for (entry &e : l) {
+        static const int order[] = {100, 0, 1, 1, 2, 3, 4};
+        ok = ok && e.value == order[count++];
+    }
+    test_cond("List order", ok && count == 7 && l.front() == &a &&
+        l.back() == &entries[4] && entryList::next(b) == &entries[2] &&
+        entryList::prev(b) == &entries[1]);
+
+    test_cond("List erase", l.erase(b) == &entries[2] && !entryList::linked(b) &&
+        entryList::next(entries[1]) == &entries[2] && l.pop_front() == &a &&
+        l.front() == &entries[0]);
+
+    e = entryList::object(nn_list_begin(l.c_list()));
+    test_cond("The C API sees the same list", e == &entries[0] &&
+        entryList::object(nn_list_prev(l.c_list(), NULL)) == &entries[4]);
+
+    while (l.pop_front());
+    test_cond("Empty list", l.empty() && l.front() == nullptr &&
+        l.back() == nullptr);
+    test_report()
+}
+#endif
@@ -0,0 +1,265 @@
+#if defined(LOCK_BENCH_MAIN)
+/* Synchronisation primitives benchmark.
+ *
+ * Handoff: two threads pass a token back and forth, each waking the other
+ * and going to sleep, as the event loop and a worker do. Reports the time
+ * of one handoff (half a round trip) with nn_sem against a POSIX sem_t,
+ * and with nn_mutex + nn_condvar against pthread_mutex + pthread_cond.
+ *
+ * Contention: 1 to 16 threads increment a shared counter under a lock,
+ * with a little work outside it. Reports the increments per second with
+ * nn_mutex, pthread_mutex, the ticket and MCS locks, and, with nine reads
+ * for every write, nn_rwlock against pthread_rwlock.
+ *
+ * gcc -O2 -o lock_bench test/lock_bench.c utils/[a-z]*.c -Iutils
+ *     -lpthread -DNN_HAVE_SEMAPHORE -DLOCK_BENCH_MAIN
+ * ./lock_bench [rounds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/time.h>
+#include "condvar.h"
+#include "mutex.h"
+#include "rwlock.h"
+#include "sem.h"
+#include "spinlock.h"
+#include "thread.h"
+
+static long rounds;
+static volatile long counter;
+static volatile long sink;
+
+static long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec)*1000000 + tv.tv_usec;
+}
+
+/* ---------------------------------------------------------------- Handoff */
+
+static struct nn_sem nnSem[2];
+static sem_t posixSem[2];
+static nn_mutex_t nnMutex;
+static nn_condvar_t nnCond;
+static pthread_mutex_t pMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pCond = PTHREAD_COND_INITIALIZER;
+static volatile long turn;
+
+static void nnSemSide(void *arg) {
+    long me = (long)arg, j;
+
+    for (j = 0; j < rounds; j++) {
+        nn_sem_wait(&nnSem[me]);
+        nn_sem_post(&nnSem[!me]);
+    }
+}
+
+static void posixSemSide(void *arg) {
+    long me = (long)arg, j;
+
+    for (j = 0; j < rounds; j++) {
+        sem_wait(&posixSem[me]);
+        sem_post(&posixSem[!me]);
+    }
+}
+
+static void nnCondSide(void *arg) {
+    long me = (long)arg, j;
+
+    for (j = 0; j < rounds; j++) {
+        nn_mutex_lock(&nnMutex);
+        while (turn % 2 != me) nn_condvar_wait(&nnCond, &nnMutex, -1);
+        turn++;
+        nn_condvar_signal(&nnCond);
+        nn_mutex_unlock(&nnMutex);
+    }
+}
+
+static void pCondSide(void *arg) {
+    long me = (long)arg, j;
+
+    for (j = 0; j < rounds; j++) {
+        pthread_mutex_lock(&pMutex);
+        while (turn % 2 != me) pthread_cond_wait(&pCond, &pMutex);
+        turn++;
+        pthread_cond_signal(&pCond);
+        pthread_mutex_unlock(&pMutex);
+    }
+}
+
+/* Nanoseconds per handoff. The first post starts the token moving. */
+static double handoff(nn_thread_routine *side, int sem) {
+    struct nn_thread t[2];
+    long long start;
+
+    turn = 0;
+    start = ustime();
+    nn_thread_init(&t[0], side, (void *)0);
+    nn_thread_init(&t[1], side, (void *)1);
+    if (sem == 1) nn_sem_post(&nnSem[0]);
+    if (sem == 2) sem_post(&posixSem[0]);
+    nn_thread_term(&t[0]);
+    nn_thread_term(&t[1]);
+    if (sem == 1) nn_sem_wait(&nnSem[0]);
+    if (sem == 2) sem_wait(&posixSem[0]);
+    return (ustime()-start)*1000.0/(2*rounds);
+}
+
+/* ------------------------------------------------------------- Contention */
+
+static struct nn_ticketlock ticket;
+static struct nn_mcslock mcs;
+static struct nn_rwlock nnRw;
+static pthread_rwlock_t pRw = PTHREAD_RWLOCK_INITIALIZER;
+static long perThread;
+
+static void outside(long j) {
+    long k, x = j;
+
+    for (k = 0; k < 20; k++) x = x*31+k;
+    sink = x;
+}
+
+static void nnMutexWorker(void *arg) {
+    long j;
+
+    (void)arg;
+    for (j = 0; j < perThread; j++) {
+        nn_mutex_lock(&nnMutex);
+        counter++;
+        nn_mutex_unlock(&nnMutex);
+        outside(j);
+    }
+}
+
+static void pMutexWorker(void *arg) {
+    long j;
+
+    (void)arg;
+    for (j = 0; j < perThread; j++) {
+        pthread_mutex_lock(&pMutex);
+        counter++;
+        pthread_mutex_unlock(&pMutex);
+        outside(j);
+    }
+}
+
+static void ticketWorker(void *arg) {
+    long j;
+
+    (void)arg;
+    for (j = 0; j < perThread; j++) {
+        nn_ticketlock_lock(&ticket);
+        counter++;
+        nn_ticketlock_unlock(&ticket);
+        outside(j);
+    }
+}
+
+static void mcsWorker(void *arg) {
+    struct nn_mcslock_node node;
+    long j;
+
+    (void)arg;
+    for (j = 0; j < perThread; j++) {
+        nn_mcslock_lock(&mcs, &node);
+        counter++;
+        nn_mcslock_unlock(&mcs, &node);
+        outside(j);
+    }
+}
+
+static void nnRwWorker(void *arg) {
+    long j;
+
+    (void)arg;
+    for (j = 0; j < perThread; j++) {
+        if (j % 10 == 0) {
+            nn_rwlock_wrlock(&nnRw);
+            counter++;
+            nn_rwlock_wrunlock(&nnRw);
+        } else {
+            nn_rwlock_rdlock(&nnRw);
+            sink = counter;
+            nn_rwlock_rdunlock(&nnRw);
+        }
+        outside(j);
+    }
+}
+
+static void pRwWorker(void *arg) {
+    long j;
+
+    (void)arg;
+    for (j = 0; j < perThread; j++) {
+        if (j % 10 == 0) {
+            pthread_rwlock_wrlock(&pRw);
+            counter++;
+            pthread_rwlock_unlock(&pRw);
+        } else {
+            pthread_rwlock_rdlock(&pRw);
+            sink = counter;
+            pthread_rwlock_unlock(&pRw);
+        }
+        outside(j);
+    }
+}
+
+/* Millions of critical sections per second. */
+static double contend(nn_thread_routine *worker, int threads) {
+    struct nn_thread t[16];
+    long long start;
+    int j;
+
+    perThread = rounds*4/threads;
+    counter = 0;
+    start = ustime();
+    for (j = 0; j < threads; j++) nn_thread_init(&t[j], worker, NULL);
+    for (j = 0; j < threads; j++) nn_thread_term(&t[j]);
+    return (double)perThread*threads/(ustime()-start);
+}
+
+int main(int argc, char **argv) {
+    int threads;
+
+    rounds = argc > 1 ? atol(argv[1]) : 200000;
+    nn_sem_init(&nnSem[0]);
+    nn_sem_init(&nnSem[1]);
+    sem_init(&posixSem[0], 0, 0);
+    sem_init(&posixSem[1], 0, 0);
+    nn_mutex_init(&nnMutex);
+    nn_condvar_init(&nnCond);
+    nn_ticketlock_init(&ticket);
+    nn_mcslock_init(&mcs);
+    nn_rwlock_init(&nnRw);
+
+    printf("%ld handoffs\n", rounds);
+    printf("nn_sem                  %8.0f ns\n", handoff(nnSemSide, 1));
+    printf("sem_t                   %8.0f ns\n", handoff(posixSemSide, 2));
+    printf("nn_mutex + nn_condvar   %8.0f ns\n", handoff(nnCondSide, 0));
+    printf("pthread mutex + cond    %8.0f ns\n", handoff(pCondSide, 0));
+
+    printf("\nthreads  nn_mutex  pthread   ticket      mcs  nn_rwlock  "
+        "pthread_rw (Mops/s)\n");
+    for (threads = 1; threads <= 16; threads *= 2) {
+        printf("%7d %9.2f %8.2f %8.2f %8.2f %10.2f %11.2f\n", threads,
+            contend(nnMutexWorker, threads), contend(pMutexWorker, threads),
+            contend(ticketWorker, threads), contend(mcsWorker, threads),
+            contend(nnRwWorker, threads), contend(pRwWorker, threads));
+    }
+
+    nn_rwlock_term(&nnRw);
+    nn_mcslock_term(&mcs);
+    nn_ticketlock_term(&ticket);
+    nn_condvar_term(&nnCond);
+    nn_mutex_term(&nnMutex);
+    sem_destroy(&posixSem[0]);
+    sem_destroy(&posixSem[1]);
+    nn_sem_term(&nnSem[0]);
+    nn_sem_term(&nnSem[1]);
+    return 0;
+}
+#endif
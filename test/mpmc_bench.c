@@ -0,0 +1,133 @@
+#if defined(MPMC_BENCH_MAIN)
+/* Producer/consumer benchmark.
+ *
+ * Moves a fixed number of items from producer threads to consumer threads
+ * through an nn_mpmc ring and through an nn_queue guarded by an
+ * nn_mutex, as the server's dispatch did, with 1 to 64 threads in total,
+ * half of them on each side (a single thread pushes and pops in turn).
+ * A side that finds the queue full or empty yields and retries. Reports
+ * the items moved per second.
+ *
+ * gcc -O2 -o mpmc_bench test/mpmc_bench.c utils/[a-z]*.c -Iutils
+ *     -lpthread -DNN_HAVE_SEMAPHORE -DMPMC_BENCH_MAIN
+ * ./mpmc_bench [items] [capacity]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <sys/time.h>
+#include "mutex.h"
+#include "queue.h"
+#include "thread.h"
+
+#define MPMC 0
+#define LOCKED 1
+
+static struct nn_mpmc ring;
+static struct nn_queue list;
+static nn_mutex_t mutex;
+static struct nn_queue_item *items;
+static long perThread;
+static int kind;
+
+static long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec)*1000000 + tv.tv_usec;
+}
+
+static void push(struct nn_queue_item *item) {
+    if (kind == MPMC) {
+        while (nn_mpmc_push(&ring, item) != 0) sched_yield();
+        return;
+    }
+    nn_mutex_lock(&mutex);
+    nn_queue_push(&list, item);
+    nn_mutex_unlock(&mutex);
+}
+
+static struct nn_queue_item *pop(void) {
+    struct nn_queue_item *item;
+
+    if (kind == MPMC) return nn_mpmc_pop(&ring);
+    nn_mutex_lock(&mutex);
+    item = nn_queue_pop(&list);
+    nn_mutex_unlock(&mutex);
+    return item;
+}
+
+static void producer(void *arg) {
+    struct nn_queue_item *mine = items + (long)arg*perThread;
+    long j;
+
+    for (j = 0; j < perThread; j++) push(&mine[j]);
+}
+
+static void consumer(void *arg) {
+    long j;
+
+    (void)arg;
+    for (j = 0; j < perThread; j++)
+        while (pop() == NULL) sched_yield();
+}
+
+/* A lone thread keeps the queue short, as there is nobody to drain it. */
+static void alone(void *arg) {
+    long j;
+
+    (void)arg;
+    for (j = 0; j < perThread; j++) {
+        push(&items[j]);
+        pop();
+    }
+}
+
+static double run(int threads, long n) {
+    struct nn_thread t[64];
+    long long start;
+    long j;
+    int sides = threads > 1 ? threads/2 : 1;
+
+    perThread = n/sides;
+    for (j = 0; j < perThread*sides; j++) nn_queue_item_init(&items[j]);
+    start = ustime();
+    if (threads == 1) {
+        alone(NULL);
+    } else {
+        for (j = 0; j < sides; j++) {
+            nn_thread_init(&t[j], consumer, NULL);
+            nn_thread_init(&t[sides+j], producer, (void *)j);
+        }
+        for (j = 0; j < 2*sides; j++) nn_thread_term(&t[j]);
+    }
+    return (double)perThread*sides/(ustime()-start);
+}
+
+int main(int argc, char **argv) {
+    long n = argc > 1 ? atol(argv[1]) : 2000000;
+    long capacity = argc > 2 ? atol(argv[2]) : 1024;
+    int threads;
+
+    items = malloc(sizeof(*items)*n);
+    nn_mpmc_init(&ring, capacity);
+    nn_queue_init(&list);
+    nn_mutex_init(&mutex);
+    printf("%ld items, ring of %ld\n", n, capacity);
+    printf("threads   nn_mpmc   nn_queue+nn_mutex (Mitems/s)\n");
+    for (threads = 1; threads <= 64; threads *= 2) {
+        double a, b;
+
+        kind = MPMC;
+        a = run(threads, n);
+        kind = LOCKED;
+        b = run(threads, n);
+        printf("%7d %9.2f %9.2f\n", threads, a, b);
+    }
+    nn_mutex_term(&mutex);
+    nn_queue_term(&list);
+    nn_mpmc_term(&ring);
+    free(items);
+    return 0;
+}
+#endif
@@ -0,0 +1,138 @@
+#if defined(NUMA_BENCH_MAIN)
+/* NUMA placement benchmark.
+ *
+ * Prints the node topology, then starts one thread per node bound with
+ * nn_thread_init_node(). Every thread takes a buffer from the per-node I/O
+ * buffer pools and one from nn_malloc(), faults both in, reports the node it
+ * runs on and the node actually holding the pages, and measures the copy
+ * bandwidth into each buffer. On a single node machine everything reports
+ * node 0, which still validates the binding paths.
+ *
+ * gcc -O2 -o numa_bench test/numa_bench.c utils/[a-z]*.c -Iutils
+ *     -lpthread -DNN_HAVE_SEMAPHORE -DNUMA_BENCH_MAIN
+ * ./numa_bench [bufsize] [rounds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "alloc.h"
+#include "numa.h"
+#include "thread.h"
+
+#define BENCH_MAX_CPUS 1024
+#define BENCH_COPY_LEN (64*1024)
+
+typedef struct benchThread {
+    int node;
+    size_t bufsize;
+    int rounds;
+    int cpu_node;               /* Node seen via getcpu() */
+    int iobuf_node;             /* Node holding the iobuf pages */
+    int malloc_node;            /* Node holding the malloc pages */
+    double iobuf_gbs;
+    double malloc_gbs;
+} benchThread;
+
+static long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec)*1000000 + tv.tv_usec;
+}
+
+static double copyBandwidth(char *buf, size_t bufsize, int rounds) {
+    char block[BENCH_COPY_LEN];
+    long long start, us;
+    size_t off, copied = 0;
+    int j;
+
+    memset(block, 'x', sizeof(block));
+    start = ustime();
+    for (j = 0; j < rounds; j++) {
+        for (off = 0; off + BENCH_COPY_LEN <= bufsize; off += BENCH_COPY_LEN) {
+            memcpy(buf + off, block, BENCH_COPY_LEN);
+            copied += BENCH_COPY_LEN;
+        }
+    }
+    us = ustime() - start;
+    return us ? copied/(us*1000.0) : 0;
+}
+
+static void benchRoutine(void *arg) {
+    benchThread *t = arg;
+    char *iobuf, *mbuf;
+
+    t->cpu_node = nn_numa_current_node();
+    iobuf = nn_malloc_iobuf_node(t->bufsize, t->node);
+    mbuf = nn_malloc(t->bufsize);
+    memset(iobuf, 0, t->bufsize);
+    memset(mbuf, 0, t->bufsize);
+    t->iobuf_node = nn_numa_page_node(iobuf);
+    t->malloc_node = nn_numa_page_node(mbuf);
+    t->iobuf_gbs = copyBandwidth(iobuf, t->bufsize, t->rounds);
+    t->malloc_gbs = copyBandwidth(mbuf, t->bufsize, t->rounds);
+    nn_free(iobuf);
+    nn_free(mbuf);
+}
+
+int main(int argc, char **argv) {
+    static const char *modes[] = {"none", "small", "thp", "hugetlb"};
+    size_t bufsize = argc > 1 ? (size_t)atol(argv[1]) : 16*1024*1024;
+    int rounds = argc > 2 ? atoi(argv[2]) : 20;
+    int nodes = nn_numa_nodes();
+    struct nn_thread *threads;
+    benchThread *info;
+    int node, cpu, first, last;
+
+    printf("%d node(s)\n", nodes);
+    for (node = 0; node < nodes; node++) {
+        printf("node %d cpus:", node);
+        first = last = -1;
+        for (cpu = 0; cpu <= BENCH_MAX_CPUS; cpu++) {
+            if (cpu < BENCH_MAX_CPUS && nn_numa_node_of_cpu(cpu) == node) {
+                if (first == -1) first = cpu;
+                last = cpu;
+                continue;
+            }
+            if (first == -1) continue;
+            if (first == last) printf(" %d", first);
+            else printf(" %d-%d", first, last);
+            first = -1;
+        }
+        printf("\n");
+    }
+
+    if (nn_alloc_iobuf_init_nodes(bufsize, 1, 1, nodes) == -1) {
+        printf("I/O buffer arena unavailable\n");
+        return 1;
+    }
+    printf("arena page mode: %s, %zu pool(s)\n",
+            modes[nn_alloc_iobuf_state(NN_IOBUF_PAGE_MODE)],
+            nn_alloc_iobuf_state(NN_IOBUF_NODES));
+
+    threads = nn_malloc(sizeof(*threads)*nodes);
+    info = nn_malloc(sizeof(*info)*nodes);
+    for (node = 0; node < nodes; node++) {
+        memset(&info[node], 0, sizeof(info[node]));
+        info[node].node = node;
+        info[node].bufsize = bufsize;
+        info[node].rounds = rounds;
+        nn_thread_init_node(&threads[node], benchRoutine, &info[node], node);
+    }
+    for (node = 0; node < nodes; node++) nn_thread_term(&threads[node]);
+
+    printf("bound  running  iobuf-pages  malloc-pages  iobuf GB/s  malloc GB/s\n");
+    for (node = 0; node < nodes; node++) {
+        printf("%5d  %7d  %11d  %12d  %10.2f  %11.2f\n", node,
+                info[node].cpu_node, info[node].iobuf_node,
+                info[node].malloc_node, info[node].iobuf_gbs,
+                info[node].malloc_gbs);
+    }
+
+    nn_free(info);
+    nn_free(threads);
+    nn_alloc_iobuf_term();
+    return 0;
+}
+#endif
@@ -0,0 +1,174 @@
+#if defined(NUMCONV_BENCH_MAIN)
+/* Numeric conversion benchmark.
+ *
+ * Times the numconv codec against the conversions it replaced: the old
+ * digit-by-digit sds_from_long() that reverses its output, the old serial
+ * sds_to_ll() parser, printf style "%.17g" for doubles and
+ * sds_append_printf("%lld") against the sds_append_format("%I") fast path.
+ * Inputs are random with a mix of lengths.
+ *
+ * gcc -O2 -o numconv_bench test/numconv_bench.c utils/[a-z]*.c -Iutils
+ *     -lpthread -DNN_HAVE_SEMAPHORE -DNUMCONV_BENCH_MAIN
+ * ./numconv_bench [count]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/time.h>
+#include "alloc.h"
+#include "numconv.h"
+#include "sds.h"
+
+static long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec)*1000000 + tv.tv_usec;
+}
+
+static unsigned long long benchRand(void) {
+    static unsigned long long x = 88172645463325252ULL;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return x;
+}
+
+/* The implementations sds used before the codec. */
+static __attribute__((noinline)) int legacyFromLong(char *s, long long value) {
+    char *p, aux;
+    unsigned long long v;
+    size_t l;
+
+    v = (value < 0) ? -value : value;
+    p = s;
+    do {
+        *p++ = '0'+(v%10);
+        v /= 10;
+    } while(v);
+    if (value < 0) *p++ = '-';
+    l = p-s;
+    *p = '\0';
+    p--;
+    while(s < p) {
+        aux = *s;
+        *s = *p;
+        *p = aux;
+        s++;
+        p--;
+    }
+    return l;
+}
+
+static __attribute__((noinline)) int legacyToLL(const char *s, size_t slen,
+                                                long long *value) {
+    const char *p = s;
+    size_t plen = 0;
+    int negative = 0;
+    unsigned long long v;
+
+    if (plen == slen) return 0;
+    if (slen == 1 && p[0] == '0') {
+        if (value != NULL) *value = 0;
+        return 1;
+    }
+    if (p[0] == '-') {
+        negative = 1;
+        p++; plen++;
+        if (plen == slen) return 0;
+    }
+    if (p[0] >= '1' && p[0] <= '9') {
+        v = p[0]-'0';
+        p++; plen++;
+    } else {
+        return 0;
+    }
+    while (plen < slen && p[0] >= '0' && p[0] <= '9') {
+        if (v > (ULLONG_MAX / 10)) return 0;
+        v *= 10;
+        if (v > (ULLONG_MAX - (p[0]-'0'))) return 0;
+        v += p[0]-'0';
+        p++; plen++;
+    }
+    if (plen < slen) return 0;
+    if (negative) {
+        if (v > ((unsigned long long)(-(LLONG_MIN+1))+1)) return 0;
+        if (value != NULL) *value = -v;
+    } else {
+        if (v > LLONG_MAX) return 0;
+        if (value != NULL) *value = v;
+    }
+    return 1;
+}
+
+static void report(const char *name, long long us, int count, long long sum) {
+    printf("%-34s %8.1f ns/op   (%lld)\n", name, us*1000.0/count, sum & 0xff);
+}
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 100000;
+    long long *ints = nn_malloc(sizeof(long long)*count);
+    double *dbls = nn_malloc(sizeof(double)*count);
+    char (*strs)[NN_NUM_LLSTR_SIZE] = nn_malloc(NN_NUM_LLSTR_SIZE*count);
+    char buf[64];
+    long long start, sum, v = 0;
+    int64_t v64;
+    int j;
+    sds s;
+
+    for (j = 0; j < count; j++) {
+        ints[j] = (long long)benchRand() >> (benchRand() % 64);
+        dbls[j] = (double)(benchRand() >> 11) / (double)(1ULL << (benchRand()%40));
+        nn_num_i64_to_str(strs[j], ints[j]);
+    }
+
+    sum = 0; start = ustime();
+    for (j = 0; j < count; j++) sum += legacyFromLong(buf, ints[j]);
+    report("format int64, reverse (old)", ustime()-start, count, sum);
+    sum = 0; start = ustime();
+    for (j = 0; j < count; j++) sum += nn_num_i64_to_str(buf, ints[j]);
+    report("format int64, digit pairs", ustime()-start, count, sum);
+
+    sum = 0; start = ustime();
+    for (j = 0; j < count; j++) {
+        legacyToLL(strs[j], strlen(strs[j]), &v);
+        sum += v;
+    }
+    report("parse int64, serial (old)", ustime()-start, count, sum);
+    sum = 0; start = ustime();
+    for (j = 0; j < count; j++) {
+        nn_num_str_to_i64(strs[j], strlen(strs[j]), &v64);
+        sum += v64;
+    }
+    report("parse int64, SWAR", ustime()-start, count, sum);
+
+    sum = 0; start = ustime();
+    for (j = 0; j < count; j++) sum += snprintf(buf, sizeof(buf), "%.17g", dbls[j]);
+    report("format double, %.17g", ustime()-start, count, sum);
+    sum = 0; start = ustime();
+    for (j = 0; j < count; j++) sum += nn_num_double_to_str(buf, dbls[j]);
+    report("format double, shortest (Grisu3)", ustime()-start, count, sum);
+
+    s = sds_empty();
+    start = ustime();
+    for (j = 0; j < count; j++) {
+        sds_clear(s);
+        s = sds_append_printf(s, "%lld:%lld", ints[j], (long long)j);
+    }
+    report("sds_append_printf %lld:%lld", ustime()-start, count, sds_len(s));
+    start = ustime();
+    for (j = 0; j < count; j++) {
+        sds_clear(s);
+        s = sds_append_format(s, "%I:%I", ints[j], (long long)j);
+    }
+    report("sds_append_format %I:%I", ustime()-start, count, sds_len(s));
+
+    sds_free(s);
+    nn_free(strs);
+    nn_free(dbls);
+    nn_free(ints);
+    return 0;
+}
+#endif
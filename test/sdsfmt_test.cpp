@@ -0,0 +1,51 @@
+#if defined(SDSFMT_TEST_MAIN)
+/* Tests of the C++ sds formatting layer.
+ *
+ * gcc -c utils/[a-z]*.c -Iutils -DNN_HAVE_SEMAPHORE
+ * g++ -std=c++20 -o sdsfmt_test test/sdsfmt_test.cpp *.o -Iutils
+ *     -lpthread -DSDSFMT_TEST_MAIN
+ */
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <string>
+#include "sdsfmt.h"
+#include "testhelp.h"
+
+int main(void) {
+    sds s = sds_new("--");
+    sds t = sds_new_len("a\0b", 3);
+    std::string str("std");
+
+    s = nn::sds_append_fmt(s, "Hello {} World {},{}--", "Hi!", LLONG_MIN,
+                           LLONG_MAX);
+    test_cond("Same output as sds_append_format()",
+        sds_len(s) == 60 &&
+        memcmp(s,"--Hello Hi! World -9223372036854775808,"
+                 "9223372036854775807--",60) == 0);
+    sds_free(s);
+
+    s = nn::sds_fmt("{}|{}|{}|{}|{}|{}", 0.1, true, 'c', (unsigned char)200,
+                    ULLONG_MAX, -1.5e300);
+    test_cond("Numbers, bool and char",
+        strcmp(s, "0.1|true|c|200|18446744073709551615|-1.5e+300") == 0);
+    sds_free(s);
+
+    s = nn::sds_fmt("{{{}}} {} {} {}", nn::sds_arg(t), str,
+                    std::string_view("view"), (const char *)NULL);
+    test_cond("Escapes and string types",
+        sds_len(s) == 21 && memcmp(s, "{a\0b} std view (null)", 21) == 0);
+    sds_free(s);
+
+    s = sds_new_len_tagged("", 0, 1);
+    s = nn::sds_append_fmt(s, "{}", 42);
+    s = nn::sds_append_fmt(s, "");
+    s = nn::sds_append_fmt(s, "-{}", 42);
+    test_cond("Appends to an existing tagged string",
+        strcmp(s, "42-42") == 0 && sds_len(s) == 5 && sds_tag(s) == 1);
+    sds_free(s);
+    sds_free(t);
+    test_report()
+    return 0;
+}
+#endif
@@ -0,0 +1,198 @@
+#if defined(THREADPOOL_BENCH_MAIN)
+/* Thread pool benchmark.
+ *
+ * Dispatch: one thread hands out small jobs, as the event loop does with
+ * requests. "handoff" is the server's previous scheme, where idle workers
+ * wait on their own nn_sem and push themselves to an nn_mpmc ring from
+ * which the dispatcher pops one and posts its semaphore; the dispatcher
+ * yields when no worker is idle. "pool" submits the jobs to an
+ * nn_threadpool instead.
+ *
+ * Fork-join: a root task splits a range in halves, submitting both halves
+ * from inside the task, down to leaves doing the same small job. The
+ * tasks land on the deque of the worker that made them and spread by
+ * stealing. Reports the jobs run per second and how many were stolen.
+ *
+ * gcc -O2 -o threadpool_bench test/threadpool_bench.c utils/[a-z]*.c -Iutils
+ *     -lpthread -DNN_HAVE_SEMAPHORE -DTHREADPOOL_BENCH_MAIN
+ * ./threadpool_bench [jobs] [work]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <sys/time.h>
+#include "err.h"
+#include "queue.h"
+#include "sem.h"
+#include "thread.h"
+#include "threadpool.h"
+#include "std.h"
+
+typedef struct handoffWorker {
+    struct nn_sem sem;
+    struct nn_thread thread;
+    int job;                    /* 1 when posted a job, -1 to stop */
+} handoffWorker;
+
+typedef struct job {
+    struct nn_threadpool_task task;
+    long lo, hi;                /* Leaves covered, fork-join only */
+} job;
+
+static struct nn_mpmc idle;
+static long work;
+static volatile long sink;
+static volatile long remaining;
+
+static long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec)*1000000 + tv.tv_usec;
+}
+
+static void doWork(void) {
+    long j, x = 0;
+
+    for (j = 0; j < work; j++) x += j ^ (x >> 3);
+    sink = x;
+    __atomic_sub_fetch(&remaining, 1, __ATOMIC_RELEASE);
+}
+
+static void waitDone(void) {
+    while (__atomic_load_n(&remaining, __ATOMIC_ACQUIRE)) sched_yield();
+}
+
+static void handoffMain(void *arg) {
+    handoffWorker *self = arg;
+
+    while (1) {
+        nn_assert(nn_mpmc_push(&idle, self) == 0);
+        nn_sem_wait(&self->sem);
+        if (self->job < 0) return;
+        doWork();
+    }
+}
+
+static double runHandoff(int threads, long jobs) {
+    handoffWorker *w = malloc(sizeof(*w)*threads);
+    handoffWorker *one;
+    long long start;
+    long j;
+
+    nn_mpmc_init(&idle, threads);
+    for (j = 0; j < threads; j++) {
+        nn_sem_init(&w[j].sem);
+        nn_thread_init(&w[j].thread, handoffMain, &w[j]);
+    }
+    remaining = jobs;
+    start = ustime();
+    for (j = 0; j < jobs; j++) {
+        while ((one = nn_mpmc_pop(&idle)) == NULL) sched_yield();
+        one->job = 1;
+        nn_sem_post(&one->sem);
+    }
+    waitDone();
+    start = ustime()-start;
+    for (j = 0; j < threads; j++) {
+        while ((one = nn_mpmc_pop(&idle)) == NULL) sched_yield();
+        one->job = -1;
+        nn_sem_post(&one->sem);
+    }
+    for (j = 0; j < threads; j++) {
+        nn_thread_term(&w[j].thread);
+        nn_sem_term(&w[j].sem);
+    }
+    nn_mpmc_term(&idle);
+    free(w);
+    return (double)jobs/start;
+}
+
+static void leaf(struct nn_threadpool_task *task) {
+    (void)task;
+    doWork();
+}
+
+static double runPool(int threads, long jobs) {
+    struct nn_threadpool pool;
+    job *all = malloc(sizeof(*all)*jobs);
+    long long start;
+    long j;
+
+    nn_threadpool_init(&pool, threads, 0, 4096);
+    remaining = jobs;
+    start = ustime();
+    for (j = 0; j < jobs; j++)
+        while (nn_threadpool_submit(&pool, &all[j].task, leaf) != 0)
+            sched_yield();
+    waitDone();
+    start = ustime()-start;
+    nn_threadpool_term(&pool);
+    free(all);
+    return (double)jobs/start;
+}
+
+/* Nodes of the split tree, in heap order: node i covers [lo,hi) and its
+ * halves are nodes 2i+1 and 2i+2. */
+static job *tree;
+static struct nn_threadpool *forkPool;
+
+static void split(struct nn_threadpool_task *task) {
+    job *self = nn_cont(task, job, task);
+    long i = self-tree, mid;
+
+    if (self->hi-self->lo == 1) {
+        doWork();
+        return;
+    }
+    mid = self->lo+(self->hi-self->lo)/2;
+    tree[2*i+1].lo = self->lo;
+    tree[2*i+1].hi = mid;
+    tree[2*i+2].lo = mid;
+    tree[2*i+2].hi = self->hi;
+    nn_threadpool_submit(forkPool, &tree[2*i+1].task, split);
+    nn_threadpool_submit(forkPool, &tree[2*i+2].task, split);
+}
+
+static double runForkJoin(int threads, long leaves, uint64_t *stolen) {
+    struct nn_threadpool pool;
+    uint64_t executed;
+    long long start;
+
+    tree = malloc(sizeof(*tree)*4*leaves);
+    forkPool = &pool;
+    nn_threadpool_init(&pool, threads, 0, 16);
+    remaining = leaves;
+    tree[0].lo = 0;
+    tree[0].hi = leaves;
+    start = ustime();
+    while (nn_threadpool_submit(&pool, &tree[0].task, split) != 0)
+        sched_yield();
+    waitDone();
+    start = ustime()-start;
+    nn_threadpool_stats(&pool, &executed, stolen);
+    nn_threadpool_term(&pool);
+    free(tree);
+    return (double)leaves/start;
+}
+
+int main(int argc, char **argv) {
+    long jobs = argc > 1 ? atol(argv[1]) : 200000;
+    int threads;
+
+    work = argc > 2 ? atol(argv[2]) : 200;
+    printf("%ld jobs of %ld iterations\n", jobs, work);
+    printf("threads   handoff      pool   fork-join (Mjobs/s)   stolen\n");
+    for (threads = 1; threads <= 32; threads *= 2) {
+        uint64_t stolen;
+        double a, b, c;
+
+        a = runHandoff(threads, jobs);
+        b = runPool(threads, jobs);
+        c = runForkJoin(threads, jobs, &stolen);
+        printf("%7d %9.3f %9.3f %11.3f %20llu\n", threads, a, b, c,
+            (unsigned long long)stolen);
+    }
+    return 0;
+}
+#endif
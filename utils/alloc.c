@@ -1,9 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "std.h"
 #include "atomic.h"
+#include "mutex.h"
+#include "numa.h"
 #include "alloc.h"
 
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
 #ifdef HAVE_MALLOC_SIZE
 #define PREFIX_SIZE (0)
 #else
@@ -66,6 +73,32 @@ static void nn_malloc_default_oom(size_t size)
 
 static void (*nn_malloc_oom_handler)(size_t) = nn_malloc_default_oom;
 
+/* Large I/O buffer arena. One mapping split in 'nnodes' equal pools, pool
+ * 'n' being bound to NUMA node 'n'. 'base' and 'end' are read without the
+ * lock by nn_free()/nn_realloc() to recognise chunk pointers, they only
+ * change in nn_alloc_iobuf_init_nodes()/nn_alloc_iobuf_term(). */
+struct nn_alloc_pool {
+    size_t nfree;
+    size_t *freelist;           /* stack of free chunk indexes */
+    nn_mutex_t sync;
+};
+
+static struct nn_alloc_arena {
+    char *base;
+    char *end;
+    size_t maplen;
+    size_t chunk_size;
+    size_t node_chunks;         /* chunks per pool */
+    int nnodes;
+    int mode;
+    struct nn_alloc_pool pools[NN_NUMA_MAX_NODES];
+} nn_iobuf_arena;
+
+#define nn_iobuf_owns(p) \
+    ((char*)(p) >= nn_iobuf_arena.base && (char*)(p) < nn_iobuf_arena.end)
+
+static void nn_iobuf_release(void *ptr);
+
 void nn_alloc_init(int safe, void(*oom_handler)(size_t))
 {
     if(safe)
@@ -125,6 +158,15 @@ void *nn_realloc(void *ptr, size_t size)
     void *newptr;
 
     if (ptr == NULL) return nn_malloc(size);
+    if (nn_slow(nn_iobuf_owns(ptr))) {
+        /* Chunks never shrink, and only move out of the arena when the
+         * new size no longer fits. */
+        if (size <= nn_iobuf_arena.chunk_size) return ptr;
+        newptr = nn_malloc(size);
+        memcpy(newptr, ptr, nn_iobuf_arena.chunk_size);
+        nn_iobuf_release(ptr);
+        return newptr;
+    }
 #ifdef HAVE_MALLOC_SIZE
     oldsize = nn_alloc_size(ptr);
     newptr = realloc(ptr,size);
@@ -168,6 +210,10 @@ void nn_free(void *ptr)
     size_t oldsize;
 #endif
     if (ptr == NULL) return;
+    if (nn_slow(nn_iobuf_owns(ptr))) {
+        nn_iobuf_release(ptr);
+        return;
+    }
 #ifdef HAVE_MALLOC_SIZE
     update_alloc_stat_free(nn_alloc_size(ptr));
     free(ptr);
@@ -206,6 +252,483 @@ size_t nn_alloc_memory_state(int option)
     return um;
 }
 
+/* Per tag counters. Every thread counts into its own shard, so tagged
+ * allocations never bounce a shared cache line between cores; readers sum
+ * all the shards under 'sync'. A block freed by another thread than the one
+ * that allocated it drives the counters of the freeing shard negative, only
+ * the sums are meaningful. Shards of exited threads are folded into
+ * 'retired'. */
+struct nn_alloc_shard {
+    long long bytes[NN_ALLOC_TAGS];
+    long long blocks[NN_ALLOC_TAGS];
+    struct nn_alloc_shard *next;
+};
+
+static struct nn_alloc_registry {
+    nn_mutex_t sync;
+    struct nn_alloc_shard *shards;
+    struct nn_alloc_shard retired;
+#if !defined NN_HAVE_WINDOWS
+    pthread_key_t key;
+#endif
+} nn_alloc_tags;
+
+#if defined NN_HAVE_WINDOWS
+static __declspec(thread) struct nn_alloc_shard *nn_alloc_shard;
+static INIT_ONCE nn_alloc_tags_once = INIT_ONCE_STATIC_INIT;
+#else
+static __thread struct nn_alloc_shard *nn_alloc_shard;
+static pthread_once_t nn_alloc_tags_once = PTHREAD_ONCE_INIT;
+#endif
+
+static const char *nn_alloc_tag_names[NN_ALLOC_TAG_USER] = {
+    "none", "querybuf", "replybuf", "hash", "events", "timers", "clients", NULL
+};
+
+#if defined NN_HAVE_WINDOWS
+static BOOL CALLBACK nn_alloc_tags_setup(PINIT_ONCE once, PVOID arg,
+    PVOID *ctx)
+{
+    nn_mutex_init(&nn_alloc_tags.sync);
+    return TRUE;
+}
+#else
+/* Thread exit: keep the counts of the thread, drop its shard. */
+static void nn_alloc_shard_retire(void *arg)
+{
+    struct nn_alloc_shard *shard = arg, **pp;
+    int tag;
+
+    nn_mutex_lock(&nn_alloc_tags.sync);
+    for (pp = &nn_alloc_tags.shards; *pp != shard; pp = &(*pp)->next);
+    *pp = shard->next;
+    for (tag = 0; tag < NN_ALLOC_TAGS; tag++) {
+        nn_alloc_tags.retired.bytes[tag] += shard->bytes[tag];
+        nn_alloc_tags.retired.blocks[tag] += shard->blocks[tag];
+    }
+    nn_mutex_unlock(&nn_alloc_tags.sync);
+    nn_alloc_shard = NULL;
+    free(shard);
+}
+
+static void nn_alloc_tags_setup(void)
+{
+    nn_mutex_init(&nn_alloc_tags.sync);
+    pthread_key_create(&nn_alloc_tags.key, nn_alloc_shard_retire);
+}
+#endif
+
+static void nn_alloc_tags_init(void)
+{
+#if defined NN_HAVE_WINDOWS
+    InitOnceExecuteOnce(&nn_alloc_tags_once, nn_alloc_tags_setup, NULL, NULL);
+#else
+    pthread_once(&nn_alloc_tags_once, nn_alloc_tags_setup);
+#endif
+}
+
+static struct nn_alloc_shard *nn_alloc_shard_get(void)
+{
+    struct nn_alloc_shard *shard = nn_alloc_shard;
+
+    if (nn_fast(shard != NULL)) return shard;
+    nn_alloc_tags_init();
+    shard = calloc(1, sizeof(*shard));
+    if (!shard) nn_malloc_oom_handler(sizeof(*shard));
+    nn_mutex_lock(&nn_alloc_tags.sync);
+    shard->next = nn_alloc_tags.shards;
+    nn_alloc_tags.shards = shard;
+    nn_mutex_unlock(&nn_alloc_tags.sync);
+#if !defined NN_HAVE_WINDOWS
+    pthread_setspecific(nn_alloc_tags.key, shard);
+#endif
+    nn_alloc_shard = shard;
+    return shard;
+}
+
+static void nn_alloc_tag_update(int tag, long long bytes, long long blocks)
+{
+    struct nn_alloc_shard *shard;
+
+    if (tag <= NN_ALLOC_TAG_NONE || tag >= NN_ALLOC_TAGS) return;
+    shard = nn_alloc_shard_get();
+    shard->bytes[tag] += bytes;
+    shard->blocks[tag] += blocks;
+}
+
+/* Bytes the global counters charged for 'ptr', padding included. */
+static size_t nn_alloc_accounted(void *ptr)
+{
+    size_t n;
+
+    if (nn_slow(nn_iobuf_owns(ptr))) return nn_iobuf_arena.chunk_size;
+#ifdef HAVE_MALLOC_SIZE
+    n = nn_alloc_size(ptr);
+#else
+    n = *((size_t*)((char*)ptr-PREFIX_SIZE)) + PREFIX_SIZE;
+#endif
+    if (n&(sizeof(long)-1)) n += sizeof(long)-(n&(sizeof(long)-1));
+    return n;
+}
+
+void *nn_malloc_tagged(size_t size, int tag)
+{
+    void *ptr = nn_malloc(size);
+
+    nn_alloc_tag_update(tag, nn_alloc_accounted(ptr), 1);
+    return ptr;
+}
+
+void *nn_calloc_tagged(size_t size, int tag)
+{
+    void *ptr = nn_calloc(size);
+
+    nn_alloc_tag_update(tag, nn_alloc_accounted(ptr), 1);
+    return ptr;
+}
+
+void *nn_realloc_tagged(void *ptr, size_t size, int tag)
+{
+    long long oldsize = ptr ? nn_alloc_accounted(ptr) : 0;
+    void *newptr = nn_realloc(ptr, size);
+
+    nn_alloc_tag_update(tag, (long long)nn_alloc_accounted(newptr) - oldsize,
+            ptr ? 0 : 1);
+    return newptr;
+}
+
+void nn_free_tagged(void *ptr, int tag)
+{
+    if (ptr == NULL) return;
+    nn_alloc_tag_update(tag, -(long long)nn_alloc_accounted(ptr), -1);
+    nn_free(ptr);
+}
+
+void nn_alloc_retag(void *ptr, int from, int to)
+{
+    size_t n;
+
+    if (ptr == NULL || from == to) return;
+    n = nn_alloc_accounted(ptr);
+    nn_alloc_tag_update(from, -(long long)n, -1);
+    nn_alloc_tag_update(to, n, 1);
+}
+
+size_t nn_alloc_tag_state(int tag, int option)
+{
+    struct nn_alloc_shard *shard;
+    long long bytes = 0, blocks = 0;
+    int t;
+
+    if (tag < 0 || tag >= NN_ALLOC_TAGS) return -1;
+    nn_alloc_tags_init();
+    nn_mutex_lock(&nn_alloc_tags.sync);
+    for (t = 0; t < NN_ALLOC_TAGS; t++) {
+        if (tag != NN_ALLOC_TAG_NONE && t != tag) continue;
+        bytes += nn_alloc_tags.retired.bytes[t];
+        blocks += nn_alloc_tags.retired.blocks[t];
+        for (shard = nn_alloc_tags.shards; shard; shard = shard->next) {
+            bytes += shard->bytes[t];
+            blocks += shard->blocks[t];
+        }
+    }
+    nn_mutex_unlock(&nn_alloc_tags.sync);
+
+    /* The untagged share is whatever the tags do not explain. */
+    if (tag == NN_ALLOC_TAG_NONE) {
+        bytes = (long long)nn_alloc_bytes.n - bytes;
+        blocks = (long long)nn_alloc_blocks.n - blocks;
+    }
+    switch (option)
+    {
+        case NN_USED_MEMORY:
+            return bytes > 0 ? bytes : 0;
+        case NN_USED_BLOCKS:
+            return blocks > 0 ? blocks : 0;
+        default:
+            return -1;
+    }
+}
+
+const char *nn_alloc_tag_name(int tag)
+{
+    if (tag < 0 || tag >= NN_ALLOC_TAG_USER) return NULL;
+    return nn_alloc_tag_names[tag];
+}
+
+#if defined(USE_JEMALLOC)
+/* Result of the experimental.utilization.query mallctl for one pointer:
+ * the free and total regions of its slab, the region size and the free
+ * and total regions of all the slabs of its bin. */
+struct nn_alloc_util {
+    void *slabcur;              /* slab the bin currently allocates from */
+    size_t nfree;
+    size_t nregs;
+    size_t size;
+    size_t bin_nfree;
+    size_t bin_nregs;
+};
+
+static int nn_alloc_util_query(void *ptr, struct nn_alloc_util *util)
+{
+    size_t len = sizeof(*util);
+
+    return je_mallctl("experimental.utilization.query", util, &len,
+            &ptr, sizeof(ptr));
+}
+
+static int nn_alloc_defrag_hint(void *ptr)
+{
+    struct nn_alloc_util u;
+
+    if (nn_alloc_util_query(ptr, &u) != 0) return 0;
+    /* Large extents and full slabs gain nothing from a move, and the slab
+     * the bin is filling is where a new region would come from anyway. */
+    if (u.nregs <= 1 || u.nfree == 0) return 0;
+    if ((char*)ptr >= (char*)u.slabcur &&
+        (char*)ptr < (char*)u.slabcur + u.nregs*u.size) return 0;
+    /* Move out of slabs used less than the bin average. */
+    return (u.nregs-u.nfree)*u.bin_nregs < (u.bin_nregs-u.bin_nfree)*u.nregs;
+}
+
+int nn_alloc_defrag_supported(void)
+{
+    static int supported = -1;
+    struct nn_alloc_util u;
+    void *probe;
+
+    if (supported == -1) {
+        probe = je_malloc(16);
+        supported = probe && nn_alloc_util_query(probe, &u) == 0;
+        je_free(probe);
+    }
+    return supported;
+}
+
+void *nn_alloc_defrag(void *ptr, int tag)
+{
+    size_t oldsize, newsize;
+    void *newptr;
+
+    if (ptr == NULL || nn_iobuf_owns(ptr) || !nn_alloc_defrag_hint(ptr))
+        return NULL;
+    oldsize = nn_alloc_size(ptr);
+    /* Bypass the thread cache, it would most likely hand back a region of
+     * the very slab being emptied. */
+    newptr = je_mallocx(oldsize, MALLOCX_TCACHE_NONE);
+    if (newptr == NULL) return NULL;
+    memcpy(newptr, ptr, oldsize);
+    je_dallocx(ptr, MALLOCX_TCACHE_NONE);
+    newsize = nn_alloc_size(newptr);
+    update_alloc_stat_free(oldsize);
+    update_alloc_stat_alloc(newsize);
+    nn_alloc_tag_update(tag, (long long)newsize - (long long)oldsize, 0);
+    return newptr;
+}
+#else
+int nn_alloc_defrag_supported(void)
+{
+    return 0;
+}
+
+void *nn_alloc_defrag(void *ptr, int tag)
+{
+    return NULL;
+}
+#endif
+
+#if defined(__linux__)
+/* Map 'len' bytes aligned to the huge page size. Explicit huge pages need
+ * pages reserved in /proc/sys/vm/nr_hugepages, when there are none we over
+ * map, trim to the alignment and ask for transparent huge pages instead. */
+static void *nn_iobuf_map(size_t len, int hugepages, int *mode)
+{
+    char *p, *aligned;
+    size_t head, tail;
+
+    if (hugepages) {
+        p = mmap(NULL, len, PROT_READ|PROT_WRITE,
+                MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            *mode = NN_IOBUF_PAGES_HUGETLB;
+            return p;
+        }
+    }
+
+    p = mmap(NULL, len+NN_IOBUF_HUGEPAGE_SIZE, PROT_READ|PROT_WRITE,
+            MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return NULL;
+    aligned = (char*)(((uintptr_t)p + NN_IOBUF_HUGEPAGE_SIZE - 1) &
+            ~((uintptr_t)NN_IOBUF_HUGEPAGE_SIZE - 1));
+    head = aligned - p;
+    tail = NN_IOBUF_HUGEPAGE_SIZE - head;
+    if (head) munmap(p, head);
+    if (tail) munmap(aligned+len, tail);
+
+    *mode = NN_IOBUF_PAGES_SMALL;
+#ifdef MADV_HUGEPAGE
+    if (hugepages && madvise(aligned, len, MADV_HUGEPAGE) == 0)
+        *mode = NN_IOBUF_PAGES_THP;
+#endif
+    return aligned;
+}
+
+int nn_alloc_iobuf_init_nodes(size_t chunk_size, size_t nchunks,
+        int hugepages, int nnodes)
+{
+    struct nn_alloc_arena *a = &nn_iobuf_arena;
+    size_t len, j;
+    char *base;
+    int mode, n;
+
+    if (a->base != NULL || chunk_size == 0 || nchunks == 0 ||
+        nnodes < 1 || nnodes > NN_NUMA_MAX_NODES) return -1;
+
+    /* Keep every chunk cache line aligned, and round every pool up to whole
+     * huge pages as MAP_HUGETLB requires and so that no page straddles two
+     * nodes. */
+    chunk_size = (chunk_size + 63) & ~(size_t)63;
+    len = chunk_size * nchunks;
+    len = (len + NN_IOBUF_HUGEPAGE_SIZE - 1) & ~((size_t)NN_IOBUF_HUGEPAGE_SIZE - 1);
+    nchunks = len / chunk_size;
+
+    base = nn_iobuf_map(len*nnodes, hugepages, &mode);
+    if (base == NULL) return -1;
+
+    for (n = 0; n < nnodes; n++) {
+        struct nn_alloc_pool *pool = &a->pools[n];
+
+        pool->freelist = malloc(sizeof(size_t)*nchunks);
+        if (pool->freelist == NULL) {
+            while (n--) {
+                free(a->pools[n].freelist);
+                nn_mutex_term(&a->pools[n].sync);
+            }
+            munmap(base, len*nnodes);
+            return -1;
+        }
+        /* Nothing is faulted in yet, so binding now places every page on
+         * its node at first touch. */
+        if (nnodes > 1) nn_numa_bind_memory(base+len*n, len, n);
+
+        /* Hand out the lowest addresses first so that a lightly loaded
+         * server only touches the first few huge pages. */
+        for (j = 0; j < nchunks; j++)
+            pool->freelist[j] = n*nchunks + nchunks-1-j;
+        pool->nfree = nchunks;
+        nn_mutex_init(&pool->sync);
+    }
+    a->maplen = len*nnodes;
+    a->chunk_size = chunk_size;
+    a->node_chunks = nchunks;
+    a->nnodes = nnodes;
+    a->mode = mode;
+    a->end = base + len*nnodes;
+    a->base = base;
+    return 0;
+}
+
+void nn_alloc_iobuf_term(void)
+{
+    struct nn_alloc_arena *a = &nn_iobuf_arena;
+    int n;
+
+    if (a->base == NULL) return;
+    munmap(a->base, a->maplen);
+    for (n = 0; n < a->nnodes; n++) {
+        free(a->pools[n].freelist);
+        nn_mutex_term(&a->pools[n].sync);
+    }
+    memset(a, 0, sizeof(*a));
+}
+#else
+int nn_alloc_iobuf_init_nodes(size_t chunk_size, size_t nchunks,
+        int hugepages, int nnodes)
+{
+    return -1;
+}
+
+void nn_alloc_iobuf_term(void)
+{
+}
+#endif
+
+int nn_alloc_iobuf_init(size_t chunk_size, size_t nchunks, int hugepages)
+{
+    return nn_alloc_iobuf_init_nodes(chunk_size, nchunks, hugepages, 1);
+}
+
+void *nn_malloc_iobuf_node(size_t size, int node)
+{
+    struct nn_alloc_arena *a = &nn_iobuf_arena;
+    struct nn_alloc_pool *pool;
+    void *ptr = NULL;
+
+    if (a->base == NULL || size > a->chunk_size) return nn_malloc(size);
+
+    if (node < 0) node = a->nnodes > 1 ? nn_numa_current_node() : 0;
+    pool = &a->pools[node % a->nnodes];
+    nn_mutex_lock(&pool->sync);
+    if (pool->nfree)
+        ptr = a->base + pool->freelist[--pool->nfree]*a->chunk_size;
+    nn_mutex_unlock(&pool->sync);
+    /* An exhausted pool falls back to the heap rather than to a remote
+     * node, malloc'ed pages are at least placed by first touch. */
+    if (ptr == NULL) return nn_malloc(size);
+    update_alloc_stat_alloc(a->chunk_size);
+    return ptr;
+}
+
+void *nn_malloc_iobuf(size_t size)
+{
+    return nn_malloc_iobuf_node(size, -1);
+}
+
+static void nn_iobuf_release(void *ptr)
+{
+    struct nn_alloc_arena *a = &nn_iobuf_arena;
+    size_t idx = ((char*)ptr - a->base) / a->chunk_size;
+    struct nn_alloc_pool *pool = &a->pools[idx / a->node_chunks];
+
+    if (a->base + idx*a->chunk_size != (char*)ptr) {
+        fprintf(stderr, "nn_free: %p is not the start of an I/O buffer\n", ptr);
+        fflush(stderr);
+        abort();
+    }
+    update_alloc_stat_free(a->chunk_size);
+    nn_mutex_lock(&pool->sync);
+    pool->freelist[pool->nfree++] = idx;
+    nn_mutex_unlock(&pool->sync);
+}
+
+size_t nn_alloc_iobuf_state(int option)
+{
+    struct nn_alloc_arena *a = &nn_iobuf_arena;
+
+    switch (option)
+    {
+        case NN_IOBUF_CHUNK_SIZE:
+            return a->chunk_size;
+        case NN_IOBUF_CHUNKS:
+            return a->node_chunks*a->nnodes;
+        case NN_IOBUF_USED_CHUNKS:
+        {
+            size_t used = 0;
+            int n;
+
+            for (n = 0; n < a->nnodes; n++)
+                used += a->node_chunks - a->pools[n].nfree;
+            return used;
+        }
+        case NN_IOBUF_PAGE_MODE:
+            return a->mode;
+        case NN_IOBUF_NODES:
+            return a->nnodes;
+        default:
+            return -1;
+    }
+}
+
 #if defined(HAVE_PROC_STAT)
 #include <unistd.h>
 #include <sys/types.h>
@@ -45,7 +45,95 @@ void nn_free(void *ptr);
 size_t nn_alloc_memory_state(int option); 
 size_t nn_alloc_get_rss(void);
 
+/*  Memory tags. Blocks allocated through the *_tagged() variants are counted
+    per tag as well as in the global totals, so that the memory used by each
+    subsystem can be told apart. The counters live in per-thread shards and
+    are summed on read. A tagged block must be reallocated and freed with the
+    tag it was allocated with, or moved to another tag with nn_alloc_retag().
+    NN_ALLOC_TAG_NONE is what plain nn_malloc() uses; it has no counters of
+    its own and reads as the part of the totals not covered by other tags.
+    Tags from NN_ALLOC_TAG_USER up to NN_ALLOC_TAGS-1 are free for the
+    application. */
+#define NN_ALLOC_TAG_NONE 0
+#define NN_ALLOC_TAG_QUERYBUF 1     /* client query buffers */
+#define NN_ALLOC_TAG_REPLYBUF 2     /* client reply buffers */
+#define NN_ALLOC_TAG_HASH 3         /* hash table slot arrays */
+#define NN_ALLOC_TAG_EVENTS 4       /* event loop and poller state */
+#define NN_ALLOC_TAG_TIMERS 5       /* event loop timers */
+#define NN_ALLOC_TAG_CLIENTS 6      /* connection structures */
+#define NN_ALLOC_TAG_USER 8
+#define NN_ALLOC_TAGS 32
+
+void *nn_malloc_tagged(size_t size, int tag);
+void *nn_calloc_tagged(size_t size, int tag);
+void *nn_realloc_tagged(void *ptr, size_t size, int tag);
+void nn_free_tagged(void *ptr, int tag);
+
+/*  Move the accounting of an allocated block from tag 'from' to tag 'to'. */
+void nn_alloc_retag(void *ptr, int from, int to);
+
+/*  NN_USED_MEMORY or NN_USED_BLOCKS of a single tag. */
+size_t nn_alloc_tag_state(int tag, int option);
+
+/*  Name of a predefined tag, NULL for application tags. */
+const char *nn_alloc_tag_name(int tag);
+
+/*  Active defragmentation. jemalloc can tell whether a block sits in a slab
+    that is less used than the average slab of its size class; moving such
+    blocks into fuller slabs lets the sparse ones be given back to the
+    system. nn_alloc_defrag_supported() returns 0 when that hint is not
+    available (libc, or a jemalloc without the experimental.utilization
+    mallctl), in which case nn_alloc_defrag() never moves anything. */
+int nn_alloc_defrag_supported(void);
+
+/*  Move 'ptr' if the allocator hints that it is worth it. Returns the new
+    pointer, 'ptr' having been freed, or NULL if the block was left in
+    place. The block stays charged to 'tag'. I/O buffer chunks never move. */
+void *nn_alloc_defrag(void *ptr, int tag);
+
 char *nn_strdup(const char *s);
+
+/*  Large I/O buffer class. A single mapping, backed by explicit 2MB huge
+    pages (MAP_HUGETLB) when the system has them reserved and by transparent
+    huge pages (madvise(MADV_HUGEPAGE)) otherwise, is carved into fixed-size
+    chunks that are handed out by nn_malloc_iobuf(). Chunks are returned with
+    the regular nn_free() and survive nn_realloc() as long as the new size
+    fits in the chunk. nn_alloc_size() must not be used on them. */
+#define NN_IOBUF_HUGEPAGE_SIZE (2*1024*1024)
+
+/*  Page modes reported by nn_alloc_iobuf_state(NN_IOBUF_PAGE_MODE). */
+#define NN_IOBUF_PAGES_NONE 0       /* class not initialised */
+#define NN_IOBUF_PAGES_SMALL 1      /* regular pages, hugepages disabled */
+#define NN_IOBUF_PAGES_THP 2        /* madvise(MADV_HUGEPAGE) */
+#define NN_IOBUF_PAGES_HUGETLB 3    /* explicit MAP_HUGETLB pages */
+
+/*  Options of nn_alloc_iobuf_state(). */
+#define NN_IOBUF_CHUNK_SIZE 1
+#define NN_IOBUF_CHUNKS 2
+#define NN_IOBUF_USED_CHUNKS 3
+#define NN_IOBUF_PAGE_MODE 4
+#define NN_IOBUF_NODES 5
+
+/*  Map 'nchunks' chunks of 'chunk_size' bytes. With 'hugepages' set explicit
+    huge pages are tried first, falling back to transparent huge pages.
+    Returns 0 on success, -1 if the class is unavailable; nn_malloc_iobuf()
+    then falls back to nn_malloc(). */
+int nn_alloc_iobuf_init(size_t chunk_size, size_t nchunks, int hugepages);
+
+/*  NUMA flavour of nn_alloc_iobuf_init(): the mapping is split in 'nnodes'
+    pools of 'nchunks' chunks each, pool 'n' being bound to node 'n'. */
+int nn_alloc_iobuf_init_nodes(size_t chunk_size, size_t nchunks,
+    int hugepages, int nnodes);
+void nn_alloc_iobuf_term(void);
+
+/*  Allocate a large I/O buffer. Requests that do not fit in a chunk, or that
+    arrive when all the chunks are taken, are served by nn_malloc(). */
+void *nn_malloc_iobuf(size_t size);
+
+/*  Allocate a large I/O buffer from the pool of 'node'. A negative 'node'
+    selects the node the calling thread runs on. */
+void *nn_malloc_iobuf_node(size_t size, int node);
+size_t nn_alloc_iobuf_state(int option);
 #ifndef HAVE_MALLOC_SIZE
 size_t nn_alloc_size(void *ptr);
 #endif
@@ -58,6 +58,57 @@ uint32_t nn_atomic_inc (struct nn_atomic *self, uint32_t n)
 #endif
 }
 
+uint32_t nn_atomic_inc_nonzero (struct nn_atomic *self, uint32_t n)
+{
+#if defined NN_ATOMIC_WINAPI
+    LONG old;
+    LONG prev;
+
+    old = (LONG) self->n;
+    while (old != 0) {
+        prev = InterlockedCompareExchange ((LONG*) &self->n, old + n, old);
+        if (prev == old)
+            break;
+        old = prev;
+    }
+    return (uint32_t) old;
+#elif defined NN_ATOMIC_SOLARIS
+    uint32_t old;
+    uint32_t prev;
+
+    old = self->n;
+    while (old != 0) {
+        prev = atomic_cas_32 (&self->n, old, old + n);
+        if (prev == old)
+            break;
+        old = prev;
+    }
+    return old;
+#elif defined NN_ATOMIC_GCC_BUILTINS
+    uint32_t old;
+    uint32_t prev;
+
+    old = __atomic_load_n (&self->n, __ATOMIC_RELAXED);
+    while (old != 0) {
+        prev = __sync_val_compare_and_swap (&self->n, old, old + n);
+        if (prev == old)
+            break;
+        old = prev;
+    }
+    return old;
+#elif defined NN_ATOMIC_MUTEX
+    uint32_t res;
+    nn_mutex_lock (&self->sync);
+    res = self->n;
+    if (res != 0)
+        self->n += n;
+    nn_mutex_unlock (&self->sync);
+    return res;
+#else
+#error
+#endif
+}
+
 uint32_t nn_atomic_dec (struct nn_atomic *self, uint32_t n)
 {
 #if defined NN_ATOMIC_WINAPI
@@ -54,6 +54,10 @@ void nn_atomic_term (struct nn_atomic *self);
 /*  Atomically add n to the object, return old value of the object. */
 uint32_t nn_atomic_inc (struct nn_atomic *self, uint32_t n);
 
+/*  Atomically add n to the object unless it is zero. Return old value of the
+    object, zero if nothing was added. */
+uint32_t nn_atomic_inc_nonzero (struct nn_atomic *self, uint32_t n);
+
 /*  Atomically subtract n from the object, return old value of the object. */
 uint32_t nn_atomic_dec (struct nn_atomic *self, uint32_t n);
 
@@ -0,0 +1,189 @@
+#include <errno.h>
+#include <string.h>
+
+#include "bloom.h"
+#include "alloc.h"
+#include "err.h"
+#include "hash64.h"
+#include "std.h"
+
+#if defined __AVX2__
+#include <immintrin.h>
+#endif
+
+/*  Words per block and bytes per cache line. */
+#define NN_BLOOM_WORDS 8
+#define NN_BLOOM_LINE 64
+
+/*  One odd multiplier per word. */
+static const uint32_t nn_bloom_salt [NN_BLOOM_WORDS] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+int nn_bloom_init (struct nn_bloom *self, size_t nkeys, int bits_per_key,
+    int tag)
+{
+    size_t bits;
+
+    nn_assert (bits_per_key > 0);
+    bits = nkeys * bits_per_key;
+    self->nblocks = (bits + NN_BLOOM_WORDS * 32 - 1) / (NN_BLOOM_WORDS * 32);
+    if (self->nblocks == 0)
+        self->nblocks = 1;
+    self->tag = tag;
+    self->mem = nn_malloc_tagged (nn_bloom_bytes (self) + NN_BLOOM_LINE - 1,
+        tag);
+    if (nn_slow (!self->mem))
+        return -ENOMEM;
+    self->blocks = (uint32_t*) (((uintptr_t) self->mem + NN_BLOOM_LINE - 1) &
+        ~(uintptr_t) (NN_BLOOM_LINE - 1));
+    nn_bloom_clear (self);
+    return 0;
+}
+
+void nn_bloom_term (struct nn_bloom *self)
+{
+    nn_free_tagged (self->mem, self->tag);
+    self->mem = NULL;
+    self->blocks = NULL;
+}
+
+void nn_bloom_clear (struct nn_bloom *self)
+{
+    memset (self->blocks, 0, nn_bloom_bytes (self));
+    self->items = 0;
+}
+
+/*  Block of 'hash': the upper half scaled to the block count, which need
+    not be a power of two. */
+static inline uint32_t *nn_bloom_block (const struct nn_bloom *self,
+    uint64_t hash)
+{
+    return self->blocks + ((hash >> 32) * self->nblocks >> 32) *
+        NN_BLOOM_WORDS;
+}
+
+void nn_bloom_add (struct nn_bloom *self, uint64_t hash)
+{
+    uint32_t *block = nn_bloom_block (self, hash);
+#if defined __AVX2__
+    __m256i m;
+
+    m = _mm256_mullo_epi32 (_mm256_set1_epi32 ((uint32_t) hash),
+        _mm256_loadu_si256 ((const __m256i*) nn_bloom_salt));
+    m = _mm256_sllv_epi32 (_mm256_set1_epi32 (1), _mm256_srli_epi32 (m, 27));
+    _mm256_store_si256 ((__m256i*) block,
+        _mm256_or_si256 (_mm256_load_si256 ((__m256i*) block), m));
+#else
+    int i;
+
+    for (i = 0; i != NN_BLOOM_WORDS; i++)
+        block [i] |= 1U << (((uint32_t) hash * nn_bloom_salt [i]) >> 27);
+#endif
+    self->items++;
+}
+
+int nn_bloom_check (const struct nn_bloom *self, uint64_t hash)
+{
+    const uint32_t *block = nn_bloom_block (self, hash);
+#if defined __AVX2__
+    __m256i m;
+
+    m = _mm256_mullo_epi32 (_mm256_set1_epi32 ((uint32_t) hash),
+        _mm256_loadu_si256 ((const __m256i*) nn_bloom_salt));
+    m = _mm256_sllv_epi32 (_mm256_set1_epi32 (1), _mm256_srli_epi32 (m, 27));
+    return _mm256_testc_si256 (_mm256_load_si256 ((const __m256i*) block), m);
+#else
+    uint32_t miss = 0;
+    int i;
+
+    /*  No early exit: the eight words are tested independently. */
+    for (i = 0; i != NN_BLOOM_WORDS; i++)
+        miss |= ~block [i] & (1U << (((uint32_t) hash * nn_bloom_salt [i]) >>
+            27));
+    return miss == 0;
+#endif
+}
+
+void nn_bloom_add_key (struct nn_bloom *self, const void *key, size_t len)
+{
+    nn_bloom_add (self, nn_hash64 (key, len));
+}
+
+int nn_bloom_check_key (const struct nn_bloom *self, const void *key,
+    size_t len)
+{
+    return nn_bloom_check (self, nn_hash64 (key, len));
+}
+
+double nn_bloom_fpr (const struct nn_bloom *self)
+{
+    const uint32_t *block;
+    double sum = 0, p;
+    size_t b;
+    int i;
+
+    /*  A key that was not added passes if the bit it picks in each word of
+        its block is set. */
+    for (b = 0; b != self->nblocks; b++) {
+        block = self->blocks + b * NN_BLOOM_WORDS;
+        p = 1;
+        for (i = 0; i != NN_BLOOM_WORDS; i++)
+            p *= __builtin_popcount (block [i]) / 32.0;
+        sum += p;
+    }
+    return sum / self->nblocks;
+}
+
+#if defined BLOOM_TEST_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+#include "testhelp.h"
+
+int main(void) {
+    struct nn_bloom b;
+    char key[32];
+    int j, ok, fp, len, n = 100000;
+    double est;
+
+    test_cond("Init", nn_bloom_init(&b, n, 10, NN_ALLOC_TAG_NONE) == 0 &&
+        ((uintptr_t)b.blocks & 63) == 0 && nn_bloom_fpr(&b) == 0 &&
+        nn_bloom_check_key(&b, "nothing", 7) == 0);
+
+    for (j = 0; j < n; j++) {
+        len = snprintf(key, sizeof(key), "key:%d", j);
+        nn_bloom_add_key(&b, key, len);
+    }
+    for (j = 0, ok = 1; j < n && ok; j++) {
+        len = snprintf(key, sizeof(key), "key:%d", j);
+        ok = nn_bloom_check_key(&b, key, len);
+    }
+    test_cond("No false negatives", ok && nn_bloom_count(&b) == (size_t)n);
+
+    /* 10 bits per key give about 1%; allow for the sample. */
+    for (j = fp = 0; j < n; j++) {
+        len = snprintf(key, sizeof(key), "other:%d", j);
+        fp += nn_bloom_check_key(&b, key, len);
+    }
+    est = nn_bloom_fpr(&b);
+    printf("measured %.4f estimated %.4f\n", (double)fp/n, est);
+    test_cond("False positive rate near 1%",
+        fp > n/500 && fp < n/50);
+    test_cond("Estimate matches the measured rate",
+        est > (double)fp/n*0.8 && est < (double)fp/n*1.25);
+
+    nn_bloom_clear(&b);
+    test_cond("Clear", nn_bloom_check_key(&b, "key:1", 5) == 0 &&
+        nn_bloom_count(&b) == 0 && nn_bloom_fpr(&b) == 0);
+
+    /* A tiny filter still has a block. */
+    nn_bloom_term(&b);
+    test_cond("Empty sizing", nn_bloom_init(&b, 0, 10, NN_ALLOC_TAG_NONE) == 0 &&
+        b.nblocks == 1);
+    nn_bloom_add(&b, 42);
+    test_cond("Raw hashes", nn_bloom_check(&b, 42) == 1);
+    nn_bloom_term(&b);
+    test_report()
+}
+#endif
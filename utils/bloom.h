@@ -0,0 +1,65 @@
+#ifndef NN_BLOOM_INCLUDED
+#define NN_BLOOM_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  Blocked Bloom filter over 64-bit key hashes, meant as a pre-check in
+    front of lookups that mostly miss: a 0 from nn_bloom_check() means the
+    key was never added, so the lookup can be skipped. It answers 1 for every
+    added key and, with a small probability, for others.
+
+    The filter is split into 256-bit blocks aligned so that none straddles a
+    cache line. The upper half of the hash picks the block and the lower half
+    sets one bit in each of the block's eight 32-bit words, the bit being the
+    top five bits of the product with a per-word odd constant (the layout of
+    Parquet's split block filters). A check therefore touches one cache line
+    and is eight independent multiplies and a compare, done in one AVX2
+    register where the compiler targets it. With 10 bits per key the false
+    positive rate is about 1%, with 16 about 0.1%.
+
+    Keys can be hashed with nn_hash64() or by the key_gen of the nn_hash
+    the filter guards; the filter has to be rebuilt if the hash seed
+    changes. Keys cannot be removed, see nn_cuckoo for that. The filter is
+    not thread-safe. */
+
+struct nn_bloom {
+    uint32_t *blocks;
+    void *mem;
+    size_t nblocks;
+    size_t items;
+    int tag;
+};
+
+/*  Size the filter for 'nkeys' keys at 'bits_per_key' bits each. Memory is
+    accounted to allocation tag 'tag'. Returns 0 or -ENOMEM. */
+int nn_bloom_init (struct nn_bloom *self, size_t nkeys, int bits_per_key,
+    int tag);
+void nn_bloom_term (struct nn_bloom *self);
+
+/*  Forget every key. */
+void nn_bloom_clear (struct nn_bloom *self);
+
+/*  Add the key with hash 'hash'. */
+void nn_bloom_add (struct nn_bloom *self, uint64_t hash);
+
+/*  Return 0 if the key with hash 'hash' was never added, 1 if it may have
+    been. */
+int nn_bloom_check (const struct nn_bloom *self, uint64_t hash);
+
+/*  The same for 'len' bytes at 'key', hashed with nn_hash64(). */
+void nn_bloom_add_key (struct nn_bloom *self, const void *key, size_t len);
+int nn_bloom_check_key (const struct nn_bloom *self, const void *key,
+    size_t len);
+
+/*  Estimated false positive rate of a check for a key that was not added,
+    from the share of bits set in each block. Walks the whole filter. */
+double nn_bloom_fpr (const struct nn_bloom *self);
+
+/*  Number of adds since the filter was initialised or cleared. */
+#define nn_bloom_count(self) ((self)->items)
+
+/*  Size of the filter in bytes. */
+#define nn_bloom_bytes(self) ((self)->nblocks * 32)
+
+#endif
@@ -0,0 +1,434 @@
+#include <errno.h>
+#include <string.h>
+
+#include "cache.h"
+#include "alloc.h"
+#include "clock.h"
+#include "err.h"
+#include "hash64.h"
+#include "std.h"
+
+/*  Counter of a new entry, so that it is not the first to go. */
+#define NN_CACHE_LFU_INIT 5
+
+struct nn_cache_key {
+    const void *ptr;
+    size_t len;
+    uint64_t hash;
+};
+
+/*  The key and the value follow. */
+struct nn_cache_entry {
+    hash_item item;
+    struct nn_list_item lru;
+    struct nn_cache_key key;
+    size_t vallen;
+    size_t charge;
+    uint32_t ldt;                   /* Decay periods at the last decrement */
+    uint8_t counter;                /* LFU access counter */
+};
+
+#define nn_cache_entry_key(e) ((char*) ((e) + 1))
+#define nn_cache_entry_val(e) (nn_cache_entry_key (e) + (e)->key.len)
+
+static uint64_t nn_cache_key_gen (const void *key)
+{
+    return ((const struct nn_cache_key*) key)->hash;
+}
+
+static int nn_cache_key_cmp (const void *key1, const void *key2)
+{
+    const struct nn_cache_key *k1 = key1;
+    const struct nn_cache_key *k2 = key2;
+
+    return k1->hash == k2->hash && k1->len == k2->len &&
+        memcmp (k1->ptr, k2->ptr, k1->len) == 0;
+}
+
+void nn_cache_init (struct nn_cache *self, int policy, size_t maxbytes,
+    int tag)
+{
+    int i;
+
+    nn_assert (policy == NN_CACHE_LRU || policy == NN_CACHE_LFU);
+    self->op.key_gen = nn_cache_key_gen;
+    self->op.key_cmp = nn_cache_key_cmp;
+    self->op.item_term = NULL;
+    nn_hash_init (&self->h);
+    nn_hash_set_op (&self->h, &self->op);
+    for (i = 0; i != NN_CACHE_LEVELS; i++)
+        nn_list_init (&self->lists [i]);
+    memset (self->nonempty, 0, sizeof (self->nonempty));
+    self->policy = policy;
+    self->tag = tag;
+    self->maxbytes = maxbytes;
+    self->bytes = 0;
+    self->items = 0;
+    self->lfu_log_factor = 10;
+    self->lfu_decay_ms = 60000;
+    self->rand = 0x9e3779b97f4a7c15ULL;
+    self->sweep = 0;
+    self->hits = 0;
+    self->misses = 0;
+    self->evictions = 0;
+}
+
+/*  Append 'e' to the list of its counter. */
+static void nn_cache_link (struct nn_cache *self, struct nn_cache_entry *e)
+{
+    nn_list_insert (&self->lists [e->counter], &e->lru,
+        nn_list_end (&self->lists [e->counter]));
+    self->nonempty [e->counter / 64] |= 1ULL << (e->counter % 64);
+}
+
+static void nn_cache_unlink (struct nn_cache *self, struct nn_cache_entry *e)
+{
+    struct nn_list *list = &self->lists [e->counter];
+
+    nn_list_erase (list, &e->lru);
+    if (nn_list_empty (list))
+        self->nonempty [e->counter / 64] &= ~(1ULL << (e->counter % 64));
+}
+
+static void nn_cache_free (struct nn_cache *self, struct nn_cache_entry *e)
+{
+    nn_hash_erase (&self->h, &e->item);
+    nn_cache_unlink (self, e);
+    self->bytes -= e->charge;
+    self->items--;
+    nn_list_item_term (&e->lru);
+    nn_free_tagged (e, self->tag);
+}
+
+/*  First non-empty list at or after 'level', wrapping around. The cache
+    must not be empty. */
+static int nn_cache_next_level (struct nn_cache *self, int level)
+{
+    uint64_t bits;
+    int i, w;
+
+    for (i = 0; i <= NN_CACHE_LEVELS / 64; i++) {
+        w = (level / 64 + i) % (NN_CACHE_LEVELS / 64);
+        bits = self->nonempty [w];
+        if (i == 0)
+            bits &= ~0ULL << (level % 64);
+        if (bits)
+            return w * 64 + __builtin_ctzll (bits);
+    }
+    nn_assert (0);
+    return -1;
+}
+
+#define nn_cache_front(self, level) nn_cont (nn_list_begin ( \
+    &(self)->lists [level]), struct nn_cache_entry, lru)
+
+void nn_cache_term (struct nn_cache *self)
+{
+    int i;
+
+    while (self->items)
+        nn_cache_free (self, nn_cache_front (self,
+            nn_cache_next_level (self, 0)));
+    for (i = 0; i != NN_CACHE_LEVELS; i++)
+        nn_list_term (&self->lists [i]);
+    while (nn_hash_rehash_ms (&self->h, 1))
+        ;
+    nn_hash_term (&self->h);
+}
+
+void nn_cache_set_lfu (struct nn_cache *self, int log_factor,
+    uint64_t decay_ms)
+{
+    self->lfu_log_factor = log_factor;
+    self->lfu_decay_ms = decay_ms;
+}
+
+/*  Decay periods elapsed since an arbitrary origin, 0 if decay is off. */
+static uint32_t nn_cache_lfu_time (struct nn_cache *self)
+{
+    if (!self->lfu_decay_ms)
+        return 0;
+    return (uint32_t) (nn_clock_ms () / self->lfu_decay_ms);
+}
+
+/*  Take the periods without hits off the counter of 'e', moving it to the
+    list of its new value. Returns 1 if it moved. */
+static int nn_cache_lfu_decay (struct nn_cache *self,
+    struct nn_cache_entry *e, uint32_t now)
+{
+    uint32_t periods = now - e->ldt;
+
+    if (!periods)
+        return 0;
+    e->ldt = now;
+    if (!e->counter)
+        return 0;
+    nn_cache_unlink (self, e);
+    e->counter = periods >= e->counter ? 0 : e->counter - periods;
+    nn_cache_link (self, e);
+    return 1;
+}
+
+static void nn_cache_lfu_hit (struct nn_cache *self, struct nn_cache_entry *e)
+{
+    uint64_t base;
+    double p;
+
+    nn_cache_lfu_decay (self, e, nn_cache_lfu_time (self));
+    nn_cache_unlink (self, e);
+    if (e->counter != 255) {
+        base = e->counter > NN_CACHE_LFU_INIT ?
+            e->counter - NN_CACHE_LFU_INIT : 0;
+        p = 1.0 / (base * self->lfu_log_factor + 1);
+
+        /*  xorshift64, the top 53 bits as a fraction. */
+        self->rand ^= self->rand << 13;
+        self->rand ^= self->rand >> 7;
+        self->rand ^= self->rand << 17;
+        if ((double) (self->rand >> 11) * (1.0 / 9007199254740992.0) < p)
+            e->counter++;
+    }
+    nn_cache_link (self, e);
+}
+
+/*  Pick the entry to evict. */
+static struct nn_cache_entry *nn_cache_victim (struct nn_cache *self)
+{
+    struct nn_cache_entry *e;
+    uint32_t now;
+    int level;
+
+    if (self->policy == NN_CACHE_LRU)
+        return nn_cache_front (self, 0);
+
+    now = nn_cache_lfu_time (self);
+    if (now) {
+        self->sweep = nn_cache_next_level (self, self->sweep);
+        nn_cache_lfu_decay (self, nn_cache_front (self, self->sweep), now);
+        self->sweep = (self->sweep + 1) % NN_CACHE_LEVELS;
+    }
+
+    /*  Counters only go down here, so this ends. */
+    do {
+        level = nn_cache_next_level (self, 0);
+        e = nn_cache_front (self, level);
+    } while (nn_cache_lfu_decay (self, e, now));
+    return e;
+}
+
+static void nn_cache_evict (struct nn_cache *self, size_t need)
+{
+    while (self->items && self->bytes + need > self->maxbytes) {
+        nn_cache_free (self, nn_cache_victim (self));
+        self->evictions++;
+    }
+}
+
+void nn_cache_set_maxbytes (struct nn_cache *self, size_t maxbytes)
+{
+    self->maxbytes = maxbytes;
+    nn_cache_evict (self, 0);
+}
+
+static struct nn_cache_entry *nn_cache_find (struct nn_cache *self,
+    struct nn_cache_key *key, const void *ptr, size_t len)
+{
+    hash_item *it;
+
+    key->ptr = ptr;
+    key->len = len;
+    key->hash = nn_hash64 (ptr, len);
+    it = nn_hash_get (&self->h, key);
+    return it ? nn_cont (it, struct nn_cache_entry, item) : NULL;
+}
+
+int nn_cache_get (struct nn_cache *self, const void *key, size_t keylen,
+    const void **val, size_t *vallen)
+{
+    struct nn_cache_entry *e;
+    struct nn_cache_key k;
+
+    e = nn_cache_find (self, &k, key, keylen);
+    if (!e) {
+        self->misses++;
+        return -ENOENT;
+    }
+    self->hits++;
+    if (self->policy == NN_CACHE_LRU) {
+        nn_cache_unlink (self, e);
+        nn_cache_link (self, e);
+    }
+    else
+        nn_cache_lfu_hit (self, e);
+    *val = nn_cache_entry_val (e);
+    *vallen = e->vallen;
+    return 0;
+}
+
+int nn_cache_put (struct nn_cache *self, const void *key, size_t keylen,
+    const void *val, size_t vallen)
+{
+    struct nn_cache_entry *e;
+    struct nn_cache_entry *old;
+    struct nn_cache_key k;
+
+    old = nn_cache_find (self, &k, key, keylen);
+    e = nn_malloc_tagged (sizeof (struct nn_cache_entry) + keylen + vallen,
+        self->tag);
+    if (nn_slow (!e))
+        return -ENOMEM;
+    e->charge = nn_alloc_size (e);
+    if (nn_slow (e->charge > self->maxbytes)) {
+        nn_free_tagged (e, self->tag);
+        return -E2BIG;
+    }
+    e->key.ptr = nn_cache_entry_key (e);
+    e->key.len = keylen;
+    e->key.hash = k.hash;
+    memcpy (nn_cache_entry_key (e), key, keylen);
+    memcpy (nn_cache_entry_val (e), val, vallen);
+    e->vallen = vallen;
+    nn_hash_item_init (&e->item);
+    nn_list_item_init (&e->lru);
+
+    /*  A replaced value keeps the frequency of the key. */
+    e->counter = self->policy == NN_CACHE_LFU ? NN_CACHE_LFU_INIT : 0;
+    e->ldt = nn_cache_lfu_time (self);
+    if (old) {
+        if (self->policy == NN_CACHE_LFU) {
+            nn_cache_lfu_decay (self, old, e->ldt);
+            e->counter = old->counter;
+        }
+        nn_cache_free (self, old);
+    }
+
+    nn_cache_evict (self, e->charge);
+    nn_hash_insert (&self->h, &e->key, &e->item);
+    nn_cache_link (self, e);
+    self->bytes += e->charge;
+    self->items++;
+    return 0;
+}
+
+int nn_cache_del (struct nn_cache *self, const void *key, size_t keylen)
+{
+    struct nn_cache_entry *e;
+    struct nn_cache_key k;
+
+    e = nn_cache_find (self, &k, key, keylen);
+    if (!e)
+        return -ENOENT;
+    nn_cache_free (self, e);
+    return 0;
+}
+
+#if defined CACHE_TEST_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "testhelp.h"
+
+static int has(struct nn_cache *c, int i) {
+    char key[16];
+    const void *val;
+    size_t len;
+    uint64_t hits = c->hits, misses = c->misses;
+    int rc;
+
+    rc = nn_cache_get(c, key, snprintf(key, sizeof(key), "k%d", i),
+        &val, &len);
+    /* Probing must not count. */
+    c->hits = hits;
+    c->misses = misses;
+    return rc == 0;
+}
+
+static void put(struct nn_cache *c, int i) {
+    char key[16], val[40];
+
+    memset(val, 'v', sizeof(val));
+    nn_cache_put(c, key, snprintf(key, sizeof(key), "k%d", i), val,
+        sizeof(val));
+}
+
+static void get(struct nn_cache *c, int i) {
+    char key[16];
+    const void *val;
+    size_t len;
+
+    nn_cache_get(c, key, snprintf(key, sizeof(key), "k%d", i), &val, &len);
+}
+
+int main(void) {
+    struct nn_cache c;
+    const void *val;
+    size_t len, one, budget;
+    int i, j, ok;
+
+    /* Find the charge of one entry, then allow ten. */
+    nn_cache_init(&c, NN_CACHE_LRU, 1 << 20, NN_ALLOC_TAG_NONE);
+    put(&c, 0);
+    one = nn_cache_bytes(&c);
+    nn_cache_term(&c);
+    budget = one*10;
+
+    nn_cache_init(&c, NN_CACHE_LRU, budget, NN_ALLOC_TAG_NONE);
+    for (i = 0; i < 10; i++) put(&c, i);
+    get(&c, 0);
+    put(&c, 10);
+    test_cond("LRU evicts the least recently used entry",
+        nn_cache_count(&c) == 10 && has(&c, 0) && !has(&c, 1) &&
+        has(&c, 10) && c.evictions == 1 && nn_cache_bytes(&c) <= budget);
+
+    get(&c, 1);
+    get(&c, 2);
+    nn_cache_put(&c, "k2", 2, "new", 3);
+    ok = nn_cache_get(&c, "k2", 2, &val, &len) == 0 && len == 3 &&
+        memcmp(val, "new", 3) == 0;
+    test_cond("Counters and replacement",
+        ok && c.hits == 3 && c.misses == 1 && nn_cache_count(&c) == 10 &&
+        nn_cache_del(&c, "k2", 2) == 0 && nn_cache_del(&c, "k2", 2) == -ENOENT);
+
+    nn_cache_set_maxbytes(&c, one*3);
+    test_cond("Shrinking the budget evicts",
+        nn_cache_count(&c) == 3 && nn_cache_bytes(&c) <= one*3);
+    {
+        char big[1024];
+        test_cond("An entry over the budget is refused",
+            nn_cache_put(&c, "big", 3, big, sizeof(big)) == -E2BIG);
+    }
+    nn_cache_term(&c);
+
+    /* Hot keys 0-4 are read often, a scan of one-off keys must not push
+     * them out. */
+    nn_cache_init(&c, NN_CACHE_LFU, budget, NN_ALLOC_TAG_NONE);
+    nn_cache_set_lfu(&c, 1, 0);
+    for (i = 0; i < 5; i++) put(&c, i);
+    for (j = 0; j < 50; j++) for (i = 0; i < 5; i++) get(&c, i);
+    for (i = 100; i < 200; i++) put(&c, i);
+    for (i = 0, ok = 1; i < 5; i++) ok &= has(&c, i);
+    test_cond("LFU keeps frequently used entries through a scan",
+        ok && nn_cache_count(&c) == 10 && c.evictions == 95);
+    nn_cache_term(&c);
+
+    nn_cache_init(&c, NN_CACHE_LRU, budget, NN_ALLOC_TAG_NONE);
+    for (i = 0; i < 5; i++) put(&c, i);
+    for (j = 0; j < 50; j++) for (i = 0; i < 5; i++) get(&c, i);
+    for (i = 100; i < 200; i++) put(&c, i);
+    test_cond("... where LRU loses them", !has(&c, 0));
+    nn_cache_term(&c);
+
+    /* Once they stop being used they decay below new entries. */
+    nn_cache_init(&c, NN_CACHE_LFU, budget, NN_ALLOC_TAG_NONE);
+    nn_cache_set_lfu(&c, 1, 1);
+    for (i = 0; i < 5; i++) put(&c, i);
+    for (j = 0; j < 50; j++) for (i = 0; i < 5; i++) get(&c, i);
+    usleep(100000);
+    for (i = 100; i < 120; i++) put(&c, i);
+    for (i = 0, ok = 1; i < 5; i++) ok &= !has(&c, i);
+    test_cond("LFU counters decay", ok && nn_cache_count(&c) == 10);
+    nn_cache_term(&c);
+    test_report()
+    return 0;
+}
+#endif
@@ -0,0 +1,94 @@
+#ifndef NN_CACHE_INCLUDED
+#define NN_CACHE_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hash.h"
+#include "list.h"
+
+/*  Bounded key/value cache. Entries hold copies of the key and the value in
+    a single allocation, are indexed by an nn_hash and linked in nn_lists
+    that order them for eviction, so get, put and del are O(1). The memory
+    charged for an entry is what nn_alloc_size() reports for its block;
+    whenever a put would take the total past 'maxbytes', entries are evicted
+    first. The slot array of the index is not charged.
+
+    NN_CACHE_LRU evicts the least recently used entry: a hit moves the entry
+    to the back of the list and eviction takes the front.
+
+    NN_CACHE_LFU evicts the least frequently used entry. Every entry has an
+    8-bit logarithmic access counter, as in Redis: a hit increments it with
+    a probability that falls as it grows, so 255 stands for about a million
+    hits, and it loses one point per 'decay_ms' without hits. There is one
+    list per counter value, in LRU order, and a bitmap of the non-empty
+    ones; eviction takes the front of the lowest. Decay is applied lazily
+    when an entry is hit or about to be evicted, and each eviction also
+    ages the front entry of one other list in turn, so that entries which
+    stopped being used sink even if nothing touches them.
+
+    The cache is not thread-safe. */
+
+#define NN_CACHE_LRU 0
+#define NN_CACHE_LFU 1
+
+/*  Counter values, one list each. LRU uses the first only. */
+#define NN_CACHE_LEVELS 256
+
+struct nn_cache {
+    hash h;
+    hash_func op;
+    struct nn_list lists [NN_CACHE_LEVELS];
+    uint64_t nonempty [NN_CACHE_LEVELS / 64];
+    int policy;
+    int tag;
+    size_t maxbytes;
+    size_t bytes;                   /* Charged for the current entries */
+    size_t items;
+
+    /*  LFU parameters, see nn_cache_set_lfu(). */
+    int lfu_log_factor;
+    uint64_t lfu_decay_ms;
+    uint64_t rand;
+    int sweep;                      /* Next list to age */
+
+    /*  Counters since initialisation. */
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+/*  Initialise an empty cache. Entries are allocated with tag 'tag'. */
+void nn_cache_init (struct nn_cache *self, int policy, size_t maxbytes,
+    int tag);
+
+/*  Free every entry. */
+void nn_cache_term (struct nn_cache *self);
+
+/*  Tune the LFU counters. A larger 'log_factor' makes the counter grow more
+    slowly (10 by default); 'decay_ms' is the time without hits that costs
+    one point (60000 by default, 0 disables decay). */
+void nn_cache_set_lfu (struct nn_cache *self, int log_factor,
+    uint64_t decay_ms);
+
+/*  Change the budget, evicting entries until the cache fits. */
+void nn_cache_set_maxbytes (struct nn_cache *self, size_t maxbytes);
+
+/*  Look 'key' up and count a hit or a miss. On a hit stores the value in
+    'val' and 'vallen' and returns 0; the value stays valid until the next
+    put, del or resize. Returns -ENOENT on a miss. */
+int nn_cache_get (struct nn_cache *self, const void *key, size_t keylen,
+    const void **val, size_t *vallen);
+
+/*  Add or replace 'key', evicting as needed. Returns 0, -ENOMEM, or -E2BIG
+    if the entry alone is larger than the budget. */
+int nn_cache_put (struct nn_cache *self, const void *key, size_t keylen,
+    const void *val, size_t vallen);
+
+/*  Remove 'key'. Returns 0 or -ENOENT. */
+int nn_cache_del (struct nn_cache *self, const void *key, size_t keylen);
+
+#define nn_cache_count(self) ((self)->items)
+#define nn_cache_bytes(self) ((self)->bytes)
+
+#endif
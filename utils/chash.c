@@ -0,0 +1,307 @@
+#include <stddef.h>
+
+#include "chash.h"
+#include "hash64.h"
+#include "alloc.h"
+#include "err.h"
+#include "std.h"
+
+#define NN_CHASH_INITIAL_SLOTS NN_CHASH_STRIPES
+
+/*  The number of slots is a power of two and at least NN_CHASH_STRIPES, so
+    the stripe of a key does not change when the table grows. */
+struct nn_chash_table {
+    uint32_t slots;
+    hash_item *buckets [];
+};
+
+#define nn_chash_load(p) __atomic_load_n ((p), __ATOMIC_ACQUIRE)
+#define nn_chash_store(p, v) __atomic_store_n ((p), (v), __ATOMIC_RELEASE)
+
+static uint64_t nn_chash_key_gen (const void *key)
+{
+    return nn_hash64_int ((uint64_t) (uintptr_t) key);
+}
+
+static hash_func nn_chash_default_func = {
+    nn_chash_key_gen,
+    NULL,
+    NULL,
+};
+
+static struct nn_chash_table *nn_chash_table_alloc (uint32_t slots)
+{
+    struct nn_chash_table *t;
+
+    t = nn_calloc_tagged (sizeof (struct nn_chash_table) +
+        sizeof (hash_item*) * slots, NN_ALLOC_TAG_HASH);
+    alloc_assert (t);
+    t->slots = slots;
+    return t;
+}
+
+static void nn_chash_table_free (void *t)
+{
+    nn_free_tagged (t, NN_ALLOC_TAG_HASH);
+}
+
+void nn_chash_init (struct nn_chash *self, hash_func *op)
+{
+    int i;
+
+    self->table = nn_chash_table_alloc (NN_CHASH_INITIAL_SLOTS);
+    self->op = op ? op : &nn_chash_default_func;
+    self->items = 0;
+    self->resizing = 0;
+    for (i = 0; i != NN_CHASH_STRIPES; i++)
+        nn_mutex_init (&self->stripes [i]);
+    nn_epoch_init (&self->epoch);
+}
+
+void nn_chash_term (struct nn_chash *self)
+{
+    uint32_t i;
+
+    for (i = 0; i != self->table->slots; i++)
+        nn_assert (self->table->buckets [i] == NULL);
+    nn_epoch_term (&self->epoch);
+    for (i = 0; i != NN_CHASH_STRIPES; i++)
+        nn_mutex_term (&self->stripes [i]);
+    nn_chash_table_free (self->table);
+}
+
+hash_item *nn_chash_get (struct nn_chash *self, void *key)
+{
+    struct nn_chash_table *t;
+    hash_item *it;
+    uint32_t resizing;
+    uint64_t h;
+
+    h = hash_key (self, key);
+    for (;;) {
+        resizing = nn_chash_load (&self->resizing);
+        t = nn_chash_load (&self->table);
+        for (it = nn_chash_load (&t->buckets [h & (t->slots - 1)]);
+              it != NULL; it = nn_chash_load (&it->next)) {
+            if (hash_compare_keys (self, key, it->key))
+                return it;
+        }
+
+        /*  A resize moving items between chains may have led the search
+            past the item; only a miss outside of one is certain. */
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+        if (nn_fast (!(resizing & 1) &&
+              nn_chash_load (&self->resizing) == resizing))
+            return NULL;
+    }
+}
+
+/*  Double the table unless someone else already did. */
+static void nn_chash_grow (struct nn_chash *self, uint32_t slots)
+{
+    struct nn_chash_table *old;
+    struct nn_chash_table *t;
+    hash_item *it;
+    uint32_t i, j;
+
+    for (i = 0; i != NN_CHASH_STRIPES; i++)
+        nn_mutex_lock (&self->stripes [i]);
+    old = self->table;
+    if (old->slots != slots) {
+        for (i = NN_CHASH_STRIPES; i != 0; i--)
+            nn_mutex_unlock (&self->stripes [i - 1]);
+        return;
+    }
+
+    t = nn_chash_table_alloc (slots * 2);
+    nn_chash_store (&self->resizing, self->resizing + 1);
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+
+    /*  Readers may be walking the old chains while the items are relinked.
+        They can end up in a new chain, which is complete and terminated,
+        and retry if that made them miss. */
+    for (i = 0; i != old->slots; i++) {
+        while ((it = old->buckets [i]) != NULL) {
+            nn_chash_store (&old->buckets [i], it->next);
+            j = hash_key (self, it->key) & (t->slots - 1);
+            nn_chash_store (&it->next, t->buckets [j]);
+            nn_chash_store (&t->buckets [j], it);
+        }
+    }
+    nn_chash_store (&self->table, t);
+    nn_chash_store (&self->resizing, self->resizing + 1);
+
+    for (i = NN_CHASH_STRIPES; i != 0; i--)
+        nn_mutex_unlock (&self->stripes [i - 1]);
+    nn_epoch_retire (&self->epoch, old, nn_chash_table_free);
+}
+
+int nn_chash_insert (struct nn_chash *self, void *key, hash_item *item)
+{
+    struct nn_chash_table *t;
+    nn_mutex_t *stripe;
+    hash_item **bucket;
+    hash_item *it;
+    uint32_t slots;
+    uint64_t h;
+
+    nn_assert (item->next == NN_HASH_NOTINHASH);
+    h = hash_key (self, key);
+    stripe = &self->stripes [h & (NN_CHASH_STRIPES - 1)];
+
+    nn_mutex_lock (stripe);
+    t = self->table;
+    bucket = &t->buckets [h & (t->slots - 1)];
+    for (it = *bucket; it != NULL; it = it->next) {
+        if (hash_compare_keys (self, key, it->key)) {
+            nn_mutex_unlock (stripe);
+            return -1;
+        }
+    }
+    item->key = key;
+    item->next = *bucket;
+    nn_chash_store (bucket, item);
+    slots = t->slots;
+    nn_mutex_unlock (stripe);
+
+    if (nn_slow (__atomic_add_fetch (&self->items, 1, __ATOMIC_RELAXED) >
+          slots * 2 && slots < 0x80000000))
+        nn_chash_grow (self, slots);
+    return 0;
+}
+
+int nn_chash_erase (struct nn_chash *self, hash_item *item)
+{
+    struct nn_chash_table *t;
+    nn_mutex_t *stripe;
+    hash_item **link;
+    uint64_t h;
+
+    h = hash_key (self, item->key);
+    stripe = &self->stripes [h & (NN_CHASH_STRIPES - 1)];
+
+    nn_mutex_lock (stripe);
+    t = self->table;
+    for (link = &t->buckets [h & (t->slots - 1)];
+          *link != NULL && *link != item; link = &(*link)->next)
+        ;
+    if (*link == NULL) {
+        nn_mutex_unlock (stripe);
+        return -1;
+    }
+
+    /*  item->next is left alone for the readers standing on the item. */
+    nn_chash_store (link, item->next);
+    nn_mutex_unlock (stripe);
+    __atomic_sub_fetch (&self->items, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+#if defined CHASH_TEST_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+#include "thread.h"
+#include "testhelp.h"
+
+#define KEYS 4096
+
+struct entry {
+    long v;
+    hash_item item;
+};
+
+static struct nn_chash table;
+static volatile int stop;
+static volatile int bad;
+
+static void freeEntry(void *p) {
+    ((struct entry *)p)->v = -1;
+    free(p);
+}
+
+/* Keys below KEYS/2 are never erased and must always be found. Entries of
+ * the others come and go and must read back their own key when found. */
+static void reader(void *arg) {
+    hash_item *it;
+    long k = 0;
+
+    (void)arg;
+    while (!stop) {
+        k = (k + 7) % KEYS;
+        nn_chash_enter(&table);
+        it = nn_chash_get(&table, (void *)(k + 1));
+        if (it ? nn_cont(it, struct entry, item)->v != k : k < KEYS/2)
+            bad = 1;
+        nn_chash_exit(&table);
+    }
+}
+
+static void writer(void *arg) {
+    struct entry *e;
+    hash_item *it;
+    long k, j;
+
+    for (j = 0; j < 100000; j++) {
+        k = KEYS/2 + (j*13 + (long)arg) % (KEYS/2);
+        /* The other writer may erase and retire the item, it is only safe
+         * to use inside the section. */
+        nn_chash_enter(&table);
+        it = nn_chash_get(&table, (void *)(k + 1));
+        if (it && nn_chash_erase(&table, it) == 0)
+            nn_chash_retire(&table, nn_cont(it, struct entry, item),
+                freeEntry);
+        nn_chash_exit(&table);
+        if (!it) {
+            e = malloc(sizeof(*e));
+            e->v = k;
+            nn_hash_item_init(&e->item);
+            if (nn_chash_insert(&table, (void *)(k + 1), &e->item) != 0)
+                free(e);
+        }
+    }
+}
+
+int main(void) {
+    struct nn_thread threads[4];
+    struct entry *e;
+    hash_item *it, dup;
+    long k;
+    int j, ok = 1;
+
+    nn_chash_init(&table, NULL);
+    nn_hash_item_init(&dup);
+    for (k = 0; k < KEYS/2; k++) {
+        e = malloc(sizeof(*e));
+        e->v = k;
+        nn_hash_item_init(&e->item);
+        ok &= nn_chash_insert(&table, (void *)(k + 1), &e->item) == 0;
+    }
+    test_cond("Inserts grow the table",
+        ok && nn_chash_count(&table) == KEYS/2 &&
+        nn_chash_insert(&table, (void *)1, &dup) == -1);
+
+    for (j = 0; j < 2; j++) nn_thread_init(&threads[j], reader, NULL);
+    for (j = 2; j < 4; j++) nn_thread_init(&threads[j], writer, (void *)(long)j);
+    for (j = 2; j < 4; j++) nn_thread_term(&threads[j]);
+    stop = 1;
+    for (j = 0; j < 2; j++) nn_thread_term(&threads[j]);
+    test_cond("Readers see consistent items during writes", !bad);
+
+    for (k = 0; k < KEYS; k++) {
+        nn_chash_enter(&table);
+        it = nn_chash_get(&table, (void *)(k + 1));
+        nn_chash_exit(&table);
+        if (it) {
+            nn_chash_erase(&table, it);
+            nn_chash_retire(&table, nn_cont(it, struct entry, item),
+                freeEntry);
+        }
+    }
+    nn_chash_synchronize(&table);
+    test_cond("Erasing everything empties the table",
+        nn_chash_count(&table) == 0);
+    nn_chash_term(&table);
+    test_report()
+    return 0;
+}
+#endif
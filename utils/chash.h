@@ -0,0 +1,67 @@
+#ifndef NN_CHASH_INCLUDED
+#define NN_CHASH_INCLUDED
+
+#include <stdint.h>
+
+#include "hash.h"
+#include "epoch.h"
+#include "mutex.h"
+
+/*  Concurrent variant of nn_hash for tables shared between threads. It takes
+    the same intrusive hash_item and hash_func. Lookups take no lock: they
+    run inside an epoch section (nn_chash_enter/nn_chash_exit) and follow
+    the chains with acquire loads. Writers lock one of NN_CHASH_STRIPES
+    mutexes picked by the low bits of the key's hash, so writers to
+    different stripes do not contend. Growing the table takes every stripe;
+    a lookup that misses while the table is being resized tries again.
+
+    An erased item may still be in use by a reader. It must not be freed or
+    reused until nn_chash_retire() calls back or nn_chash_synchronize()
+    returns. */
+
+#define NN_CHASH_STRIPES 64
+
+struct nn_chash_table;
+
+struct nn_chash {
+    struct nn_chash_table *table;
+    hash_func *op;
+    volatile uint32_t items;
+    volatile uint32_t resizing;     /* Odd while items are relinked */
+    nn_mutex_t stripes [NN_CHASH_STRIPES];
+    struct nn_epoch epoch;
+};
+
+/*  Initialise an empty table. 'op' may be NULL for pointer keys compared
+    by value. */
+void nn_chash_init (struct nn_chash *self, hash_func *op);
+
+/*  Destroy the table. It must be empty. */
+void nn_chash_term (struct nn_chash *self);
+
+/*  Bracket lookups and any use of the items they return. */
+#define nn_chash_enter(self) nn_epoch_enter (&(self)->epoch)
+#define nn_chash_exit(self) nn_epoch_exit (&(self)->epoch)
+
+/*  Find the item with 'key' or return NULL. Must be called inside
+    nn_chash_enter()/nn_chash_exit(); the item stays valid until exit. */
+hash_item *nn_chash_get (struct nn_chash *self, void *key);
+
+/*  Add 'item' under 'key'. Return 0 or -1 if the key is already there. */
+int nn_chash_insert (struct nn_chash *self, void *key, hash_item *item);
+
+/*  Remove 'item'. Return 0 or -1 if it is not in the table. */
+int nn_chash_erase (struct nn_chash *self, hash_item *item);
+
+/*  Call 'fn' with 'ptr', typically the structure holding an erased item,
+    once no reader can see it. */
+#define nn_chash_retire(self, ptr, fn) nn_epoch_retire (&(self)->epoch, \
+    (ptr), (fn))
+
+/*  Wait until no reader can see the items erased so far. */
+#define nn_chash_synchronize(self) nn_epoch_synchronize (&(self)->epoch)
+
+/*  Number of items. */
+#define nn_chash_count(self) ((self)->items)
+
+#endif
@@ -24,6 +24,8 @@
 #include "condvar.h"
 #include "err.h"
 
+#include <limits.h>
+
 #if WINDOWS_PLATFORM
 
 int nn_condvar_init (nn_condvar_t *cond)
@@ -72,6 +74,56 @@ void nn_condvar_broadcast (nn_condvar_t *cond)
     WakeAllConditionVariable (&cond->cv);
 }
 
+#elif defined NN_HAVE_FUTEX
+
+#include "futex.h"
+
+int nn_condvar_init (nn_condvar_t *cond)
+{
+    cond->seq = 0;
+    cond->waiters = 0;
+    return (0);
+}
+
+void nn_condvar_term (nn_condvar_t *cond)
+{
+    /*  Outstanding waiters would be a serious bug of the caller. */
+    nn_assert (cond->waiters == 0);
+}
+
+int nn_condvar_wait (nn_condvar_t *cond, nn_mutex_t *lock, int timeout)
+{
+    int seq;
+    int rc;
+
+    /*  The sequence is read under the lock, so a signal sent after the
+        caller checked its predicate changes it and the sleep returns at
+        once. */
+    __atomic_add_fetch (&cond->waiters, 1, __ATOMIC_SEQ_CST);
+    seq = __atomic_load_n (&cond->seq, __ATOMIC_SEQ_CST);
+    nn_mutex_unlock (lock);
+    rc = nn_futex_wait (&cond->seq, seq, timeout);
+    __atomic_sub_fetch (&cond->waiters, 1, __ATOMIC_RELAXED);
+    nn_mutex_lock (lock);
+    return rc == -ETIMEDOUT ? -ETIMEDOUT : 0;
+}
+
+void nn_condvar_signal (nn_condvar_t *cond)
+{
+    __atomic_add_fetch (&cond->seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n (&cond->waiters, __ATOMIC_SEQ_CST))
+        nn_futex_wake (&cond->seq, 1);
+}
+
+void nn_condvar_broadcast (nn_condvar_t *cond)
+{
+    /*  The woken threads all go for the mutex. Requeueing them onto it
+        would need the mutex here, which the API does not pass. */
+    __atomic_add_fetch (&cond->seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n (&cond->waiters, __ATOMIC_SEQ_CST))
+        nn_futex_wake (&cond->seq, INT_MAX);
+}
+
 #else /* !WINDOWS_PLATFORM */
 
 #include <sys/time.h>
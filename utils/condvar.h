@@ -31,6 +31,14 @@ struct nn_condvar {
     CONDITION_VARIABLE cv;
 };
 
+#elif defined NN_HAVE_FUTEX
+
+struct nn_condvar {
+    /*  Bumped by every signal, the waiters sleep on it. */
+    volatile int seq;
+    volatile int waiters;
+};
+
 #else /* !WINDOWS_PLATFORM */
 
 #include <pthread.h>
@@ -0,0 +1,280 @@
+#include <errno.h>
+#include <string.h>
+
+#include "cuckoo.h"
+#include "alloc.h"
+#include "err.h"
+#include "hash64.h"
+#include "std.h"
+
+#define NN_CUCKOO_SLOTS 4
+#define NN_CUCKOO_LINE 64
+
+/*  Evictions tried before an insert gives up. */
+#define NN_CUCKOO_MAX_KICKS 500
+
+/*  The lowest and the highest bit of each 16-bit lane. */
+#define NN_CUCKOO_LO 0x0001000100010001ULL
+#define NN_CUCKOO_HI 0x8000800080008000ULL
+
+/*  High bit set in the lanes of 'x' that are zero. Borrows can also flag a
+    lane above a zero one, so only the lowest flag is exact; it is the only
+    one used. */
+#define nn_cuckoo_zero(x) (((x) - NN_CUCKOO_LO) & ~(x) & NN_CUCKOO_HI)
+
+/*  Lanes of bucket 'b' that hold fingerprint 'fp'. */
+#define nn_cuckoo_match(b, fp) nn_cuckoo_zero ((b) ^ ((fp) * NN_CUCKOO_LO))
+
+int nn_cuckoo_init (struct nn_cuckoo *self, size_t nkeys, int tag)
+{
+    size_t nbuckets = 1;
+
+    while (nbuckets * NN_CUCKOO_SLOTS * 9 / 10 < nkeys)
+        nbuckets *= 2;
+    self->mask = nbuckets - 1;
+    self->items = 0;
+    self->rand = 0x9e3779b97f4a7c15ULL;
+    self->tag = tag;
+    self->stashed = 0;
+    self->mem = nn_malloc_tagged (nn_cuckoo_bytes (self) + NN_CUCKOO_LINE - 1,
+        tag);
+    if (nn_slow (!self->mem))
+        return -ENOMEM;
+    self->buckets = (uint64_t*) (((uintptr_t) self->mem + NN_CUCKOO_LINE - 1) &
+        ~(uintptr_t) (NN_CUCKOO_LINE - 1));
+    memset (self->buckets, 0, nn_cuckoo_bytes (self));
+    return 0;
+}
+
+void nn_cuckoo_term (struct nn_cuckoo *self)
+{
+    nn_free_tagged (self->mem, self->tag);
+    self->mem = NULL;
+    self->buckets = NULL;
+}
+
+/*  Fingerprint of 'hash', never 0 as that marks an empty slot. The low bits
+    of the hash pick the bucket, so it takes the top ones. */
+static inline uint16_t nn_cuckoo_fp (uint64_t hash)
+{
+    uint16_t fp = hash >> 48;
+
+    return fp ? fp : 1;
+}
+
+/*  The other bucket of fingerprint 'fp' in bucket 'i'. */
+static inline size_t nn_cuckoo_alt (const struct nn_cuckoo *self, size_t i,
+    uint16_t fp)
+{
+    return (i ^ (size_t) ((fp * 0xc6a4a7935bd1e995ULL) >> 32)) & self->mask;
+}
+
+/*  Store 'fp' in a free slot of bucket 'i'. Returns 0 or -ENOSPC. */
+static inline int nn_cuckoo_put (struct nn_cuckoo *self, size_t i,
+    uint16_t fp)
+{
+    uint64_t free = nn_cuckoo_zero (self->buckets [i]);
+
+    if (!free)
+        return -ENOSPC;
+    self->buckets [i] |= (uint64_t) fp << (__builtin_ctzll (free) & ~15);
+    return 0;
+}
+
+/*  Clear one copy of 'fp' from bucket 'i'. Returns 0 or -ENOENT. */
+static inline int nn_cuckoo_take (struct nn_cuckoo *self, size_t i,
+    uint16_t fp)
+{
+    uint64_t m = nn_cuckoo_match (self->buckets [i], fp);
+
+    if (!m)
+        return -ENOENT;
+    self->buckets [i] &= ~(0xffffULL << (__builtin_ctzll (m) & ~15));
+    return 0;
+}
+
+int nn_cuckoo_insert (struct nn_cuckoo *self, uint64_t hash)
+{
+    uint16_t fp = nn_cuckoo_fp (hash);
+    size_t i = hash & self->mask;
+    uint64_t *b;
+    uint16_t old;
+    int n, shift;
+
+    if (nn_slow (self->stashed))
+        return -ENOSPC;
+    if (nn_cuckoo_put (self, i, fp) == 0 ||
+          nn_cuckoo_put (self, i = nn_cuckoo_alt (self, i, fp), fp) == 0) {
+        self->items++;
+        return 0;
+    }
+
+    /*  Both buckets are full: displace a random fingerprint to its other
+        bucket until one has room. */
+    for (n = 0; n != NN_CUCKOO_MAX_KICKS; n++) {
+        self->rand ^= self->rand << 13;
+        self->rand ^= self->rand >> 7;
+        self->rand ^= self->rand << 17;
+        b = &self->buckets [i];
+        shift = (self->rand & (NN_CUCKOO_SLOTS - 1)) * 16;
+        old = *b >> shift;
+        *b = (*b & ~(0xffffULL << shift)) | ((uint64_t) fp << shift);
+        fp = old;
+        i = nn_cuckoo_alt (self, i, fp);
+        if (nn_cuckoo_put (self, i, fp) == 0) {
+            self->items++;
+            return 0;
+        }
+    }
+
+    /*  The new key is in, the last one displaced is not. Keep it aside so
+        that it is still found. */
+    self->stashed = 1;
+    self->stash_fp = fp;
+    self->stash_index = i;
+    self->items++;
+    return 0;
+}
+
+int nn_cuckoo_check (const struct nn_cuckoo *self, uint64_t hash)
+{
+    uint16_t fp = nn_cuckoo_fp (hash);
+    size_t i1 = hash & self->mask;
+    size_t i2 = nn_cuckoo_alt (self, i1, fp);
+
+    if (nn_slow (self->stashed && fp == self->stash_fp &&
+          (i1 == self->stash_index || i2 == self->stash_index)))
+        return 1;
+    return (nn_cuckoo_match (self->buckets [i1], fp) |
+        nn_cuckoo_match (self->buckets [i2], fp)) != 0;
+}
+
+int nn_cuckoo_remove (struct nn_cuckoo *self, uint64_t hash)
+{
+    uint16_t fp = nn_cuckoo_fp (hash);
+    size_t i1 = hash & self->mask;
+    size_t i2 = nn_cuckoo_alt (self, i1, fp);
+
+    if (self->stashed && fp == self->stash_fp &&
+          (i1 == self->stash_index || i2 == self->stash_index)) {
+        self->stashed = 0;
+        self->items--;
+        return 0;
+    }
+    if (nn_cuckoo_take (self, i1, fp) != 0 &&
+          nn_cuckoo_take (self, i2, fp) != 0)
+        return -ENOENT;
+    self->items--;
+
+    /*  A slot was freed, maybe in a bucket of the stashed fingerprint. */
+    if (self->stashed && (nn_cuckoo_put (self, self->stash_index,
+          self->stash_fp) == 0 || nn_cuckoo_put (self, nn_cuckoo_alt (self,
+          self->stash_index, self->stash_fp), self->stash_fp) == 0))
+        self->stashed = 0;
+    return 0;
+}
+
+int nn_cuckoo_insert_key (struct nn_cuckoo *self, const void *key,
+    size_t len)
+{
+    return nn_cuckoo_insert (self, nn_hash64 (key, len));
+}
+
+int nn_cuckoo_check_key (const struct nn_cuckoo *self, const void *key,
+    size_t len)
+{
+    return nn_cuckoo_check (self, nn_hash64 (key, len));
+}
+
+int nn_cuckoo_remove_key (struct nn_cuckoo *self, const void *key,
+    size_t len)
+{
+    return nn_cuckoo_remove (self, nn_hash64 (key, len));
+}
+
+double nn_cuckoo_fpr (const struct nn_cuckoo *self)
+{
+    /*  A check compares its fingerprint with the ones in two buckets, on
+        average twice the mean occupancy, and each of the 65535 values is
+        equally likely. */
+    return 2.0 * self->items / (self->mask + 1) / 65535;
+}
+
+#if defined CUCKOO_TEST_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+#include "testhelp.h"
+
+static int keyOf(char *buf, size_t size, const char *prefix, int j) {
+    return snprintf(buf, size, "%s:%d", prefix, j);
+}
+
+int main(void) {
+    struct nn_cuckoo c;
+    char key[32];
+    int j, ok, fp, len, n = 100000, added;
+    double est;
+
+    test_cond("Init", nn_cuckoo_init(&c, n, NN_ALLOC_TAG_NONE) == 0 &&
+        ((uintptr_t)c.buckets & 63) == 0 &&
+        (c.mask + 1) * 4 * 9 / 10 >= (size_t)n &&
+        nn_cuckoo_check_key(&c, "nothing", 7) == 0);
+
+    for (j = 0, ok = 1; j < n && ok; j++) {
+        len = keyOf(key, sizeof(key), "key", j);
+        ok = nn_cuckoo_insert_key(&c, key, len) == 0;
+    }
+    test_cond("Insert", ok && nn_cuckoo_count(&c) == (size_t)n);
+    for (j = 0, ok = 1; j < n && ok; j++) {
+        len = keyOf(key, sizeof(key), "key", j);
+        ok = nn_cuckoo_check_key(&c, key, len);
+    }
+    test_cond("No false negatives", ok);
+
+    for (j = fp = 0; j < n; j++) {
+        len = keyOf(key, sizeof(key), "other", j);
+        fp += nn_cuckoo_check_key(&c, key, len);
+    }
+    est = nn_cuckoo_fpr(&c);
+    printf("measured %.6f estimated %.6f\n", (double)fp/n, est);
+    test_cond("False positive rate", (double)fp/n < 4*est + 0.0001);
+
+    /* Remove the even keys: the odd ones must stay. */
+    for (j = 0, ok = 1; j < n && ok; j += 2) {
+        len = keyOf(key, sizeof(key), "key", j);
+        ok = nn_cuckoo_remove_key(&c, key, len) == 0;
+    }
+    for (j = 1; j < n && ok; j += 2) {
+        len = keyOf(key, sizeof(key), "key", j);
+        ok = nn_cuckoo_check_key(&c, key, len);
+    }
+    for (j = fp = 0; j < n; j += 2) {
+        len = keyOf(key, sizeof(key), "key", j);
+        fp += nn_cuckoo_check_key(&c, key, len);
+    }
+    test_cond("Remove", ok && nn_cuckoo_count(&c) == (size_t)n/2 &&
+        fp < n/1000);
+    test_cond("Remove a missing key", nn_cuckoo_remove(&c, 12345) == -ENOENT);
+
+    test_cond("Duplicates",
+        nn_cuckoo_insert(&c, 77) == 0 && nn_cuckoo_insert(&c, 77) == 0 &&
+        nn_cuckoo_remove(&c, 77) == 0 && nn_cuckoo_check(&c, 77) &&
+        nn_cuckoo_remove(&c, 77) == 0);
+    nn_cuckoo_term(&c);
+
+    /* Fill a small filter past its nominal size until it refuses. */
+    nn_cuckoo_init(&c, 1000, NN_ALLOC_TAG_NONE);
+    for (added = 0; nn_cuckoo_insert(&c, nn_hash64_int(added)) == 0; added++);
+    for (j = 0, ok = 1; j < added && ok; j++)
+        ok = nn_cuckoo_check(&c, nn_hash64_int(j));
+    printf("%d of %zu slots\n", added, (c.mask + 1) * 4);
+    test_cond("Full", ok && c.stashed && added > (int)(c.mask + 1) * 4 * 9 / 10 &&
+        nn_cuckoo_count(&c) == (size_t)added);
+    for (j = 0, ok = 1; j < added && ok; j++)
+        ok = nn_cuckoo_remove(&c, nn_hash64_int(j)) == 0;
+    test_cond("Empty again", ok && !c.stashed && nn_cuckoo_count(&c) == 0 &&
+        nn_cuckoo_insert(&c, 1) == 0);
+    nn_cuckoo_term(&c);
+    test_report()
+}
+#endif
@@ -0,0 +1,76 @@
+#ifndef NN_CUCKOO_INCLUDED
+#define NN_CUCKOO_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  Cuckoo filter over 64-bit key hashes: like nn_bloom a pre-check that
+    answers 0 only for keys that are not in the set, but keys can also be
+    removed. It stores a 16-bit fingerprint per key in buckets of four.
+    A key can live in two buckets: one picked by its hash, the other by
+    xoring that index with a hash of the fingerprint, so either bucket and
+    the fingerprint give the other one. An insert that finds both full
+    evicts a random fingerprint to its alternative bucket, and so on.
+
+    A bucket is a 64-bit word and the array is aligned to cache lines, so a
+    check loads two words and matches the four fingerprints of each at once
+    with word arithmetic. Buckets fill to about 95% before inserts start to
+    fail, and the false positive rate stays under about 0.012% (eight
+    fingerprints compared, each matching one time in 65535).
+
+    Only keys that were inserted may be removed: removing another key can
+    drop the fingerprint of one that collides with it. A key inserted twice
+    has to be removed twice, and at most eight copies fit. When an insert
+    runs out of evictions, the last fingerprint displaced is kept aside and
+    further inserts fail until a removal makes room. Not thread-safe. */
+
+struct nn_cuckoo {
+    uint64_t *buckets;
+    void *mem;
+    size_t mask;
+    size_t items;
+    uint64_t rand;
+    int tag;
+
+    /*  Fingerprint displaced by a failed insert and one of its buckets. */
+    int stashed;
+    uint16_t stash_fp;
+    size_t stash_index;
+};
+
+/*  Size the filter so that 'nkeys' keys fill at most 90% of the slots,
+    rounding the bucket count up to a power of two. Memory is accounted to
+    allocation tag 'tag'. Returns 0 or -ENOMEM. */
+int nn_cuckoo_init (struct nn_cuckoo *self, size_t nkeys, int tag);
+void nn_cuckoo_term (struct nn_cuckoo *self);
+
+/*  Add the key with hash 'hash'. Returns 0, or -ENOSPC if the filter is
+    full and nothing was added. */
+int nn_cuckoo_insert (struct nn_cuckoo *self, uint64_t hash);
+
+/*  Return 0 if the key with hash 'hash' is not in the filter, 1 if it may
+    be. */
+int nn_cuckoo_check (const struct nn_cuckoo *self, uint64_t hash);
+
+/*  Remove one copy of the key with hash 'hash'. Returns 0 or -ENOENT. */
+int nn_cuckoo_remove (struct nn_cuckoo *self, uint64_t hash);
+
+/*  The same for 'len' bytes at 'key', hashed with nn_hash64(). */
+int nn_cuckoo_insert_key (struct nn_cuckoo *self, const void *key,
+    size_t len);
+int nn_cuckoo_check_key (const struct nn_cuckoo *self, const void *key,
+    size_t len);
+int nn_cuckoo_remove_key (struct nn_cuckoo *self, const void *key,
+    size_t len);
+
+/*  Estimated false positive rate of a check for a key that is not in the
+    filter, from the number of fingerprints stored. */
+double nn_cuckoo_fpr (const struct nn_cuckoo *self);
+
+/*  Number of keys in the filter. */
+#define nn_cuckoo_count(self) ((self)->items)
+
+/*  Size of the filter in bytes. */
+#define nn_cuckoo_bytes(self) (((self)->mask + 1) * 8)
+
+#endif
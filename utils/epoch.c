@@ -0,0 +1,318 @@
+#include <pthread.h>
+#include <sched.h>
+
+#include "epoch.h"
+#include "alloc.h"
+#include "err.h"
+#include "std.h"
+
+/*  Run the reclamation pass after this many retirements. */
+#define NN_EPOCH_BATCH 64
+
+struct nn_epoch_limbo {
+    struct nn_epoch_limbo *next;
+    uint64_t stamp;
+    void *ptr;
+    void (*fn) (void*);
+};
+
+/*  Process wide thread numbering, shared by all the domains. A thread
+    gives its number back when it exits. nn_epoch_nthreads is one more than
+    the highest number ever handed out, the scans stop there. */
+#define NN_EPOCH_WORDS (NN_EPOCH_MAX_THREADS / 64)
+static uint64_t nn_epoch_used [NN_EPOCH_WORDS];
+static uint32_t nn_epoch_nthreads;
+static pthread_key_t nn_epoch_key;
+static pthread_once_t nn_epoch_once = PTHREAD_ONCE_INIT;
+static __thread int nn_epoch_tid = -1;
+
+/*  Thread exit. The thread is outside of every section, so its slots are
+    clear in all the domains and the next owner of the number can use them
+    as they are. */
+static void nn_epoch_tid_release (void *arg)
+{
+    int tid = (int) (intptr_t) arg - 1;
+
+    __atomic_fetch_and (&nn_epoch_used [tid / 64],
+        ~((uint64_t) 1 << (tid % 64)), __ATOMIC_RELEASE);
+}
+
+static void nn_epoch_setup (void)
+{
+    int rc;
+
+    rc = pthread_key_create (&nn_epoch_key, nn_epoch_tid_release);
+    errnum_assert (rc == 0, rc);
+}
+
+static int nn_epoch_tid_alloc (void)
+{
+    uint64_t used;
+    uint32_t n;
+    int i, tid = -1;
+
+    pthread_once (&nn_epoch_once, nn_epoch_setup);
+    for (i = 0; tid < 0 && i != NN_EPOCH_WORDS; i++) {
+        used = __atomic_load_n (&nn_epoch_used [i], __ATOMIC_RELAXED);
+        while (~used) {
+            tid = __builtin_ctzll (~used);
+            if (__atomic_compare_exchange_n (&nn_epoch_used [i], &used,
+                  used | ((uint64_t) 1 << tid), 1, __ATOMIC_ACQUIRE,
+                  __ATOMIC_RELAXED)) {
+                tid += i * 64;
+                break;
+            }
+            tid = -1;
+        }
+    }
+    /*  More threads inside the domains at once than there are slots. */
+    nn_assert (tid >= 0);
+
+    n = __atomic_load_n (&nn_epoch_nthreads, __ATOMIC_RELAXED);
+    while (n <= (uint32_t) tid && !__atomic_compare_exchange_n (
+          &nn_epoch_nthreads, &n, tid + 1, 1, __ATOMIC_RELEASE,
+          __ATOMIC_RELAXED))
+        ;
+    pthread_setspecific (nn_epoch_key, (void*) (intptr_t) (tid + 1));
+    return tid;
+}
+
+static struct nn_epoch_slot *nn_epoch_slot (struct nn_epoch *self)
+{
+    if (nn_slow (nn_epoch_tid < 0))
+        nn_epoch_tid = nn_epoch_tid_alloc ();
+    return &self->slots [nn_epoch_tid];
+}
+
+void nn_epoch_init (struct nn_epoch *self)
+{
+    int i;
+
+    /*  0 stands for a thread outside any section. */
+    self->global = 1;
+    for (i = 0; i != NN_EPOCH_MAX_THREADS; i++) {
+        self->slots [i].local = 0;
+        self->slots [i].depth = 0;
+    }
+    nn_mutex_init (&self->sync);
+    self->limbo = NULL;
+    self->tail = &self->limbo;
+    self->pending = 0;
+    self->threshold = NN_EPOCH_BATCH;
+}
+
+static void nn_epoch_free_list (struct nn_epoch_limbo *l)
+{
+    struct nn_epoch_limbo *next;
+
+    for (; l; l = next) {
+        next = l->next;
+        l->fn (l->ptr);
+        nn_free (l);
+    }
+}
+
+void nn_epoch_term (struct nn_epoch *self)
+{
+    nn_epoch_free_list (self->limbo);
+    nn_mutex_term (&self->sync);
+}
+
+void nn_epoch_enter (struct nn_epoch *self)
+{
+    struct nn_epoch_slot *slot = nn_epoch_slot (self);
+
+    if (slot->depth++)
+        return;
+    __atomic_store_n (&slot->local,
+        __atomic_load_n (&self->global, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+
+    /*  The slot must be visible before any pointer of the structure is
+        read, or a writer could miss this reader. */
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+}
+
+void nn_epoch_exit (struct nn_epoch *self)
+{
+    struct nn_epoch_slot *slot = &self->slots [nn_epoch_tid];
+
+    nn_assert (slot->depth > 0);
+    if (--slot->depth)
+        return;
+    __atomic_store_n (&slot->local, 0, __ATOMIC_RELEASE);
+}
+
+/*  Oldest epoch an active reader is in, UINT64_MAX if there is none.
+    Advances the global epoch if every active reader is in the current
+    one. Called with the mutex held. */
+static uint64_t nn_epoch_scan (struct nn_epoch *self)
+{
+    uint64_t global, local, oldest = UINT64_MAX;
+    uint32_t i, n;
+
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+    global = self->global;
+    n = __atomic_load_n (&nn_epoch_nthreads, __ATOMIC_ACQUIRE);
+    for (i = 0; i != n; i++) {
+        local = __atomic_load_n (&self->slots [i].local, __ATOMIC_ACQUIRE);
+        if (local && local < oldest)
+            oldest = local;
+    }
+    if (oldest == UINT64_MAX || oldest == global)
+        __atomic_store_n (&self->global, global + 1, __ATOMIC_RELEASE);
+    return oldest;
+}
+
+/*  Detach the objects retired before epoch 'oldest'. Called with the mutex
+    held; the callbacks are run by the caller after unlocking. */
+static struct nn_epoch_limbo *nn_epoch_collect (struct nn_epoch *self,
+    uint64_t oldest)
+{
+    struct nn_epoch_limbo *ready = self->limbo;
+    struct nn_epoch_limbo **l = &ready;
+
+    /*  The list is ordered by stamp, oldest first. */
+    while (*l && (*l)->stamp < oldest) {
+        l = &(*l)->next;
+        self->pending--;
+    }
+    self->limbo = *l;
+    if (!self->limbo)
+        self->tail = &self->limbo;
+    *l = NULL;
+
+    /*  A stalled reader can keep everything in limbo; do not scan again
+        before another batch has been retired. */
+    self->threshold = self->pending + NN_EPOCH_BATCH;
+    return ready;
+}
+
+void nn_epoch_retire (struct nn_epoch *self, void *ptr, void (*fn) (void*))
+{
+    struct nn_epoch_limbo *l;
+    struct nn_epoch_limbo *ready = NULL;
+
+    l = nn_malloc (sizeof (struct nn_epoch_limbo));
+    alloc_assert (l);
+    l->ptr = ptr;
+    l->fn = fn;
+
+    nn_mutex_lock (&self->sync);
+    /*  Stamped after the unlink: readers that entered before it are at
+        this epoch or older. */
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+    l->stamp = self->global;
+    l->next = NULL;
+    *self->tail = l;
+    self->tail = &l->next;
+    if (++self->pending >= self->threshold)
+        ready = nn_epoch_collect (self, nn_epoch_scan (self));
+    nn_mutex_unlock (&self->sync);
+    nn_epoch_free_list (ready);
+}
+
+void nn_epoch_synchronize (struct nn_epoch *self)
+{
+    struct nn_epoch_limbo *ready;
+    uint64_t target;
+    uint64_t oldest;
+
+    nn_mutex_lock (&self->sync);
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+    target = self->global;
+    nn_mutex_unlock (&self->sync);
+
+    for (;;) {
+        nn_mutex_lock (&self->sync);
+        oldest = nn_epoch_scan (self);
+        ready = nn_epoch_collect (self, oldest);
+        nn_mutex_unlock (&self->sync);
+        nn_epoch_free_list (ready);
+        if (oldest > target && !self->pending)
+            break;
+        sched_yield ();
+    }
+}
+
+#if defined EPOCH_TEST_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+#include "thread.h"
+#include "testhelp.h"
+
+static struct nn_epoch domain;
+static int *volatile shared;
+static volatile int stop;
+static volatile int bad;
+
+static void freeInt(void *p) {
+    *(int *)p = -1;
+    free(p);
+}
+
+static void reader(void *arg) {
+    int v;
+
+    (void)arg;
+    while (!stop) {
+        nn_epoch_enter(&domain);
+        v = *__atomic_load_n(&shared, __ATOMIC_ACQUIRE);
+        if (v < 0) bad = 1;
+        nn_epoch_exit(&domain);
+    }
+}
+
+static int freed;
+static void countFree(void *p) { (void)p; freed++; }
+
+static void enterOnce(void *arg) {
+    (void)arg;
+    nn_epoch_enter(&domain);
+    nn_epoch_exit(&domain);
+}
+
+int main(void) {
+    struct nn_thread threads[3];
+    int j, *p, *old;
+
+    nn_epoch_init(&domain);
+    nn_epoch_retire(&domain, NULL, countFree);
+    nn_epoch_synchronize(&domain);
+    test_cond("Retired objects are freed without readers", freed == 1);
+
+    nn_epoch_enter(&domain);
+    nn_epoch_enter(&domain);
+    nn_epoch_exit(&domain);
+    nn_epoch_retire(&domain, NULL, countFree);
+    for (j = 0; j < 100; j++) nn_epoch_retire(&domain, NULL, countFree);
+    test_cond("Nothing retired inside a section is freed before it ends",
+        freed == 1);
+    nn_epoch_exit(&domain);
+    nn_epoch_synchronize(&domain);
+    test_cond("Everything is freed after it ends", freed == 102);
+
+    shared = malloc(sizeof(int));
+    *shared = 0;
+    for (j = 0; j < 3; j++) nn_thread_init(&threads[j], reader, NULL);
+    for (j = 1; j < 200000; j++) {
+        p = malloc(sizeof(int));
+        *p = j;
+        old = __atomic_exchange_n(&shared, p, __ATOMIC_SEQ_CST);
+        nn_epoch_retire(&domain, old, freeInt);
+    }
+    stop = 1;
+    for (j = 0; j < 3; j++) nn_thread_term(&threads[j]);
+    test_cond("Readers never see a freed object", !bad);
+    nn_epoch_retire(&domain, shared, freeInt);
+
+    for (j = 0; j < NN_EPOCH_MAX_THREADS*3; j++) {
+        nn_thread_init(&threads[0], enterOnce, NULL);
+        nn_thread_term(&threads[0]);
+    }
+    test_cond("Threads that exited give their slot back",
+        nn_epoch_nthreads <= 4);
+    nn_epoch_term(&domain);
+    test_report()
+    return 0;
+}
+#endif
@@ -0,0 +1,64 @@
+#ifndef NN_EPOCH_INCLUDED
+#define NN_EPOCH_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mutex.h"
+
+/*  Epoch based reclamation. Readers bracket their accesses to a shared
+    structure with nn_epoch_enter() and nn_epoch_exit() and take no lock.
+    A writer that unlinks an object hands it to nn_epoch_retire() instead of
+    freeing it; the object is destroyed once every reader that could still
+    see it has left its critical section. Entering records the global epoch
+    in the calling thread's slot, and the epoch is advanced only when all
+    the active readers have caught up with it. An object retired in epoch e
+    is freed when no active reader is at epoch e or older.
+
+    A thread gets a slot on its first entry and gives it back when it exits,
+    so at most NN_EPOCH_MAX_THREADS threads can use the domains at the same
+    time. */
+
+#define NN_EPOCH_MAX_THREADS 128
+
+/*  One cache line per thread. */
+struct nn_epoch_slot {
+    volatile uint64_t local;        /* Epoch seen on entry, 0 if outside */
+    uint32_t depth;                 /* Nesting of enter calls */
+    char pad [64 - sizeof (uint64_t) - sizeof (uint32_t)];
+};
+
+struct nn_epoch_limbo;
+
+struct nn_epoch {
+    volatile uint64_t global;
+    struct nn_epoch_slot slots [NN_EPOCH_MAX_THREADS];
+
+    /*  Retired objects, oldest first. */
+    nn_mutex_t sync;
+    struct nn_epoch_limbo *limbo;
+    struct nn_epoch_limbo **tail;
+    size_t pending;
+    size_t threshold;               /* Scan once pending reaches it */
+};
+
+void nn_epoch_init (struct nn_epoch *self);
+
+/*  Destroy the domain, freeing whatever is still retired. No reader may be
+    inside. */
+void nn_epoch_term (struct nn_epoch *self);
+
+/*  Start and end a read side critical section. Sections nest. */
+void nn_epoch_enter (struct nn_epoch *self);
+void nn_epoch_exit (struct nn_epoch *self);
+
+/*  Call 'fn' with 'ptr' once no reader can reach 'ptr' any more. 'ptr' must
+    already be unreachable for new readers. */
+void nn_epoch_retire (struct nn_epoch *self, void *ptr, void (*fn) (void*));
+
+/*  Wait until every reader that was inside when called has left, then run
+    the callbacks of everything retired so far. Must not be called from
+    inside a read side section. */
+void nn_epoch_synchronize (struct nn_epoch *self);
+
+#endif
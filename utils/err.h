@@ -158,6 +158,10 @@
     typedef int CT_ASSERT_HELPER1(ct_assert_,__LINE__) [(x) ? 1 : -1]
 #endif
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 NN_NORETURN void nn_err_abort (void);
 int nn_err_errno (void);
 const char *nn_err_strerror (int errnum);
@@ -168,4 +172,8 @@ int nn_err_wsa_to_posix (int wsaerr);
 void nn_win_error (int err, char *buf, size_t bufsize);
 #endif
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,360 @@
+#include <errno.h>
+#include <string.h>
+
+#include "flathash.h"
+#include "alloc.h"
+#include "err.h"
+#include "std.h"
+
+#if defined __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*  Slots compared at once. The control array repeats its first GROUP bytes
+    after the end so that a group can start at any slot. */
+#define NN_FLATHASH_GROUP 16
+#define NN_FLATHASH_EMPTY 0x80
+
+/*  MurmurHash3 finalizer: the low bits pick the control byte, the rest the
+    home slot, so every bit of the key has to reach both. */
+static inline uint64_t nn_flathash_mix (uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+#define nn_flathash_h2(h) ((uint8_t) ((h) & 0x7f))
+#define nn_flathash_home(self, h) (((h) >> 7) & (self)->mask)
+
+#if defined __SSE2__
+
+/*  Bit i is set if control byte i of the group equals 'h2'. */
+static inline uint32_t nn_flathash_match (const uint8_t *g, uint8_t h2)
+{
+    __m128i v = _mm_loadu_si128 ((const __m128i*) g);
+
+    return (uint32_t) _mm_movemask_epi8 (_mm_cmpeq_epi8 (v,
+        _mm_set1_epi8 ((char) h2)));
+}
+
+/*  Bit i is set if slot i of the group is empty. */
+static inline uint32_t nn_flathash_match_empty (const uint8_t *g)
+{
+    return (uint32_t) _mm_movemask_epi8 (_mm_loadu_si128 (
+        (const __m128i*) g));
+}
+
+#else
+
+static inline uint32_t nn_flathash_match (const uint8_t *g, uint8_t h2)
+{
+    uint32_t m = 0;
+    int i;
+
+    for (i = 0; i != NN_FLATHASH_GROUP; i++)
+        m |= (uint32_t) (g [i] == h2) << i;
+    return m;
+}
+
+static inline uint32_t nn_flathash_match_empty (const uint8_t *g)
+{
+    uint32_t m = 0;
+    int i;
+
+    for (i = 0; i != NN_FLATHASH_GROUP; i++)
+        m |= (uint32_t) (g [i] >> 7) << i;
+    return m;
+}
+
+#endif
+
+static inline void nn_flathash_set_ctrl (struct nn_flathash *self,
+    size_t i, uint8_t c)
+{
+    self->ctrl [i] = c;
+    self->ctrl [((i - NN_FLATHASH_GROUP) & self->mask) + NN_FLATHASH_GROUP] =
+        c;
+}
+
+/*  Smallest capacity that holds 'n' items at a load factor of 7/8. */
+static size_t nn_flathash_capacity (size_t n)
+{
+    size_t cap = NN_FLATHASH_GROUP;
+
+    while (cap - cap / 8 < n)
+        cap *= 2;
+    return cap;
+}
+
+static int nn_flathash_alloc (struct nn_flathash *self, size_t cap)
+{
+    struct nn_flathash_slot *slots;
+
+    slots = nn_malloc_tagged (cap * sizeof (struct nn_flathash_slot) + cap +
+        NN_FLATHASH_GROUP, self->tag);
+    if (nn_slow (!slots))
+        return -ENOMEM;
+    self->slots = slots;
+    self->ctrl = (uint8_t*) (slots + cap);
+    self->mask = cap - 1;
+    memset (self->ctrl, NN_FLATHASH_EMPTY, cap + NN_FLATHASH_GROUP);
+    return 0;
+}
+
+/*  Find 'key'. Return its slot, or the slot it would be inserted in with
+    '*found' cleared. */
+static inline size_t nn_flathash_find (struct nn_flathash *self,
+    uint64_t key, uint64_t h, int *found)
+{
+    size_t pos = nn_flathash_home (self, h);
+    uint8_t h2 = nn_flathash_h2 (h);
+    const uint8_t *g;
+    uint32_t m;
+    size_t i;
+
+    /*  Every slot between the home slot and the key is full, so the search
+        ends at the first group with an empty slot, and that slot is where
+        the key belongs. */
+    for (;;) {
+        g = self->ctrl + pos;
+        for (m = nn_flathash_match (g, h2); m; m &= m - 1) {
+            i = (pos + __builtin_ctz (m)) & self->mask;
+            if (nn_fast (self->slots [i].key == key)) {
+                *found = 1;
+                return i;
+            }
+        }
+        m = nn_flathash_match_empty (g);
+        if (nn_fast (m)) {
+            *found = 0;
+            return (pos + __builtin_ctz (m)) & self->mask;
+        }
+        pos = (pos + NN_FLATHASH_GROUP) & self->mask;
+    }
+}
+
+static int nn_flathash_resize (struct nn_flathash *self, size_t cap)
+{
+    struct nn_flathash old = *self;
+    size_t i, j;
+    uint64_t h;
+    int found;
+    int rc;
+
+    rc = nn_flathash_alloc (self, cap);
+    if (nn_slow (rc < 0))
+        return rc;
+    for (i = 0; i <= old.mask; i++) {
+        if (old.ctrl [i] & NN_FLATHASH_EMPTY)
+            continue;
+        h = nn_flathash_mix (old.slots [i].key);
+        j = nn_flathash_find (self, old.slots [i].key, h, &found);
+        self->slots [j] = old.slots [i];
+        nn_flathash_set_ctrl (self, j, old.ctrl [i]);
+    }
+    nn_free_tagged (old.slots, self->tag);
+    return 0;
+}
+
+void nn_flathash_init (struct nn_flathash *self, size_t hint, int tag)
+{
+    int rc;
+
+    self->items = 0;
+    self->tag = tag;
+    rc = nn_flathash_alloc (self, nn_flathash_capacity (hint));
+    errnum_assert (rc == 0, -rc);
+}
+
+void nn_flathash_term (struct nn_flathash *self)
+{
+    nn_free_tagged (self->slots, self->tag);
+}
+
+int nn_flathash_reserve (struct nn_flathash *self, size_t n)
+{
+    size_t cap = nn_flathash_capacity (n);
+
+    return cap > self->mask + 1 ? nn_flathash_resize (self, cap) : 0;
+}
+
+/*  Slot for 'key', growing the table first if a new item would not fit. */
+static inline size_t nn_flathash_slot_for (struct nn_flathash *self,
+    uint64_t key, uint64_t h, int *found)
+{
+    size_t i;
+
+    i = nn_flathash_find (self, key, h, found);
+    if (*found ||
+          nn_fast (self->items < self->mask + 1 - (self->mask + 1) / 8))
+        return i;
+    if (nn_slow (nn_flathash_resize (self, (self->mask + 1) * 2) < 0))
+        return (size_t) -1;
+    return nn_flathash_find (self, key, h, found);
+}
+
+int nn_flathash_insert (struct nn_flathash *self, uint64_t key,
+    uint64_t value)
+{
+    uint64_t h = nn_flathash_mix (key);
+    int found;
+    size_t i;
+
+    i = nn_flathash_slot_for (self, key, h, &found);
+    if (nn_slow (i == (size_t) -1))
+        return -ENOMEM;
+    if (found)
+        return -EEXIST;
+    self->slots [i].key = key;
+    self->slots [i].value = value;
+    nn_flathash_set_ctrl (self, i, nn_flathash_h2 (h));
+    self->items++;
+    return 0;
+}
+
+int nn_flathash_set (struct nn_flathash *self, uint64_t key, uint64_t value)
+{
+    uint64_t h = nn_flathash_mix (key);
+    int found;
+    size_t i;
+
+    i = nn_flathash_slot_for (self, key, h, &found);
+    if (nn_slow (i == (size_t) -1))
+        return -ENOMEM;
+    if (!found) {
+        self->slots [i].key = key;
+        nn_flathash_set_ctrl (self, i, nn_flathash_h2 (h));
+        self->items++;
+    }
+    self->slots [i].value = value;
+    return 0;
+}
+
+uint64_t *nn_flathash_get (struct nn_flathash *self, uint64_t key)
+{
+    int found;
+    size_t i;
+
+    i = nn_flathash_find (self, key, nn_flathash_mix (key), &found);
+    return found ? &self->slots [i].value : NULL;
+}
+
+int nn_flathash_erase (struct nn_flathash *self, uint64_t key)
+{
+    size_t hole, home, j;
+    int found;
+
+    hole = nn_flathash_find (self, key, nn_flathash_mix (key), &found);
+    if (!found)
+        return -ENOENT;
+
+    /*  Backward shift: move each following item of the run into the hole
+        unless that would put it before its home slot. The run then has no
+        gap and no tombstone is needed. */
+    for (j = (hole + 1) & self->mask;
+          !(self->ctrl [j] & NN_FLATHASH_EMPTY);
+          j = (j + 1) & self->mask) {
+        home = nn_flathash_home (self,
+            nn_flathash_mix (self->slots [j].key));
+        if (((j - home) & self->mask) >= ((j - hole) & self->mask)) {
+            self->slots [hole] = self->slots [j];
+            nn_flathash_set_ctrl (self, hole, self->ctrl [j]);
+            hole = j;
+        }
+    }
+    nn_flathash_set_ctrl (self, hole, NN_FLATHASH_EMPTY);
+    self->items--;
+    return 0;
+}
+
+int nn_flathash_next (struct nn_flathash *self, size_t *pos, uint64_t *key,
+    uint64_t *value)
+{
+    size_t i;
+
+    for (i = *pos; i <= self->mask; i++) {
+        if (self->ctrl [i] & NN_FLATHASH_EMPTY)
+            continue;
+        *key = self->slots [i].key;
+        *value = self->slots [i].value;
+        *pos = i + 1;
+        return 1;
+    }
+    *pos = i;
+    return 0;
+}
+
+#if defined FLATHASH_TEST_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+#include "testhelp.h"
+
+#define KEYS 5000
+
+int main(void) {
+    static unsigned char present[KEYS];
+    struct nn_flathash h;
+    unsigned long long x = 88172645463325252ULL;
+    uint64_t key, value, *v;
+    size_t pos, count;
+    int j, ok, rc;
+
+    nn_flathash_init(&h, 0, NN_ALLOC_TAG_NONE);
+    test_cond("Insert and get",
+        nn_flathash_insert(&h, 42, 1) == 0 &&
+        nn_flathash_insert(&h, 42, 2) == -EEXIST &&
+        (v = nn_flathash_get(&h, 42)) && *v == 1 &&
+        nn_flathash_get(&h, 43) == NULL);
+    test_cond("Set updates in place",
+        nn_flathash_set(&h, 42, 3) == 0 && *nn_flathash_get(&h, 42) == 3 &&
+        nn_flathash_count(&h) == 1);
+    test_cond("Erase",
+        nn_flathash_erase(&h, 42) == 0 && nn_flathash_erase(&h, 42) == -ENOENT &&
+        nn_flathash_get(&h, 42) == NULL && nn_flathash_count(&h) == 0);
+
+    /* Random inserts and erases over a small key space keep long runs of
+     * full slots in play, checked against a plain array. The keys are
+     * multiples of a large power of two to make the hash do the work. */
+    ok = 1;
+    for (j = 0; j < 400000 && ok; j++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        key = x % KEYS;
+        if (x & (1ULL << 40)) {
+            rc = nn_flathash_insert(&h, key << 32, key);
+            ok = present[key] ? rc == -EEXIST : rc == 0;
+            present[key] = 1;
+        } else {
+            rc = nn_flathash_erase(&h, key << 32);
+            ok = present[key] ? rc == 0 : rc == -ENOENT;
+            present[key] = 0;
+        }
+    }
+    for (count = 0, key = 0; key < KEYS && ok; key++) {
+        v = nn_flathash_get(&h, key << 32);
+        ok = present[key] ? v && *v == key : v == NULL;
+        count += present[key];
+    }
+    test_cond("Random inserts and erases match a reference",
+        ok && nn_flathash_count(&h) == count);
+
+    for (pos = 0, count = 0; nn_flathash_next(&h, &pos, &key, &value); count++)
+        if (!present[key >> 32] || value != key >> 32) ok = 0;
+    test_cond("Iteration visits every item once",
+        ok && count == nn_flathash_count(&h));
+
+    rc = nn_flathash_reserve(&h, 100000);
+    for (key = 0; key < KEYS && ok; key++) {
+        v = nn_flathash_get(&h, key << 32);
+        ok = present[key] ? v && *v == key : v == NULL;
+    }
+    test_cond("Reserve keeps the items",
+        rc == 0 && ok && h.mask + 1 >= 100000);
+    nn_flathash_term(&h);
+    test_report()
+    return 0;
+}
+#endif
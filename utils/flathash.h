@@ -0,0 +1,63 @@
+#ifndef NN_FLATHASH_INCLUDED
+#define NN_FLATHASH_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  Open addressing hash table from 64-bit keys (integers or pointers) to
+    64-bit values, an alternative to nn_hash when the key fits in a word.
+    Keys and values are stored in the slot array itself and every slot has
+    a control byte: empty, or 7 bits of the key's hash. A lookup hashes the
+    key once, then compares the control bytes of 16 slots at a time with
+    SSE2 (plain C elsewhere) and only touches the slots whose bits match.
+    Probing is linear from the home slot and the capacity is a power of two.
+    Erasing shifts the following slots back instead of leaving tombstones,
+    so lookups never slow down after many deletions. The table is not
+    thread-safe. */
+
+struct nn_flathash_slot {
+    uint64_t key;
+    uint64_t value;
+};
+
+struct nn_flathash {
+    struct nn_flathash_slot *slots;
+    uint8_t *ctrl;
+    size_t mask;
+    size_t items;
+    int tag;
+};
+
+/*  Initialise an empty table with room for 'hint' items before it grows.
+    Memory is accounted to allocation tag 'tag'. */
+void nn_flathash_init (struct nn_flathash *self, size_t hint, int tag);
+void nn_flathash_term (struct nn_flathash *self);
+
+/*  Number of items in the table. */
+#define nn_flathash_count(self) ((self)->items)
+
+/*  Make room for 'n' items in total. Return 0 or -ENOMEM. */
+int nn_flathash_reserve (struct nn_flathash *self, size_t n);
+
+/*  Add 'key'. Return 0, -EEXIST if it is already there (its value is left
+    alone) or -ENOMEM. */
+int nn_flathash_insert (struct nn_flathash *self, uint64_t key,
+    uint64_t value);
+
+/*  Add 'key' or update its value. Return 0 or -ENOMEM. */
+int nn_flathash_set (struct nn_flathash *self, uint64_t key, uint64_t value);
+
+/*  Return a pointer to the value of 'key' or NULL. It is valid until the
+    table is next modified. */
+uint64_t *nn_flathash_get (struct nn_flathash *self, uint64_t key);
+
+/*  Remove 'key'. Return 0 or -ENOENT. */
+int nn_flathash_erase (struct nn_flathash *self, uint64_t key);
+
+/*  Iterate over the items. '*pos' starts at 0; each call stores the next
+    item and returns 1, or returns 0 at the end. The table must not be
+    modified during the iteration. */
+int nn_flathash_next (struct nn_flathash *self, size_t *pos, uint64_t *key,
+    uint64_t *value);
+
+#endif
@@ -0,0 +1,168 @@
+#include "futex.h"
+
+#if defined NN_HAVE_FUTEX
+
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "err.h"
+
+/*  CPUs online, looked up once. 0 until then. */
+static int nn_futex_ncpus;
+
+int nn_futex_wait (volatile int *addr, int val, int timeout)
+{
+    struct timespec ts;
+    long rc;
+
+    if (timeout >= 0) {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000L;
+    }
+    rc = syscall (SYS_futex, addr, FUTEX_WAIT_PRIVATE, val,
+        timeout >= 0 ? &ts : NULL, NULL, 0);
+    if (nn_fast (rc == 0))
+        return 0;
+    errno_assert (errno == EAGAIN || errno == ETIMEDOUT || errno == EINTR);
+    return -errno;
+}
+
+void nn_futex_wake (volatile int *addr, int n)
+{
+    long rc;
+
+    rc = syscall (SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+    errno_assert (rc >= 0);
+}
+
+int nn_futex_spins (int recent)
+{
+    int ncpus = __atomic_load_n (&nn_futex_ncpus, __ATOMIC_RELAXED);
+    int spins;
+
+    if (nn_slow (ncpus == 0)) {
+        ncpus = (int) sysconf (_SC_NPROCESSORS_ONLN);
+        if (ncpus < 1)
+            ncpus = 1;
+        __atomic_store_n (&nn_futex_ncpus, ncpus, __ATOMIC_RELAXED);
+    }
+    if (ncpus == 1)
+        return 0;
+    spins = recent * 2 + 10;
+    return spins < NN_FUTEX_SPIN_MAX ? spins : NN_FUTEX_SPIN_MAX;
+}
+
+#endif
+
+#if defined FUTEX_TEST_MAIN
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "mutex.h"
+#include "condvar.h"
+#include "sem.h"
+#include "thread.h"
+#include "clock.h"
+#include "testhelp.h"
+
+#define THREADS 4
+#define ROUNDS 100000
+
+static nn_mutex_t mutex;
+static nn_condvar_t cond;
+static struct nn_sem sem;
+static long counter;
+static int turn;
+
+static void count(void *arg) {
+    int j;
+
+    (void)arg;
+    for (j = 0; j < ROUNDS; j++) {
+        nn_mutex_lock(&mutex);
+        counter++;
+        nn_mutex_unlock(&mutex);
+    }
+}
+
+/* Threads take turns: each waits for its number, then passes to the
+ * next, so every wait but the first needs a signal. */
+static void pingPong(void *arg) {
+    long me = (long)arg;
+    int j;
+
+    for (j = 0; j < 1000; j++) {
+        nn_mutex_lock(&mutex);
+        while (turn % 2 != me)
+            nn_condvar_wait(&cond, &mutex, -1);
+        turn++;
+        nn_condvar_broadcast(&cond);
+        nn_mutex_unlock(&mutex);
+    }
+}
+
+static void consume(void *arg) {
+    int j;
+
+    (void)arg;
+    for (j = 0; j < ROUNDS/10; j++) {
+        nn_sem_wait(&sem);
+        __atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED);
+    }
+}
+
+int main(void) {
+    struct nn_thread t[THREADS];
+    uint64_t start;
+    int j, rc;
+
+    nn_mutex_init(&mutex);
+    counter = 0;
+    for (j = 0; j < THREADS; j++) nn_thread_init(&t[j], count, NULL);
+    for (j = 0; j < THREADS; j++) nn_thread_term(&t[j]);
+    test_cond("Mutex excludes", counter == (long)THREADS*ROUNDS);
+
+    test_cond("Spin budget", nn_futex_spins(0) <= 10 &&
+        nn_futex_spins(1000) <= NN_FUTEX_SPIN_MAX);
+
+    nn_condvar_init(&cond);
+    turn = 0;
+    nn_thread_init(&t[0], pingPong, (void *)0);
+    nn_thread_init(&t[1], pingPong, (void *)1);
+    nn_thread_term(&t[0]);
+    nn_thread_term(&t[1]);
+    test_cond("Condvar hands over", turn == 2000);
+
+    nn_mutex_lock(&mutex);
+    start = nn_clock_ms();
+    rc = nn_condvar_wait(&cond, &mutex, 50);
+    nn_mutex_unlock(&mutex);
+    test_cond("Condvar times out", rc == -ETIMEDOUT &&
+        nn_clock_ms() - start >= 40);
+    nn_condvar_term(&cond);
+    nn_mutex_term(&mutex);
+
+    /* Posts run ahead of the waits, the semaphore has to count them. */
+    nn_sem_init(&sem);
+    for (j = 0; j < 3; j++) nn_sem_post(&sem);
+    test_cond("Semaphore counts", nn_sem_trywait(&sem) == 0 &&
+        nn_sem_trywait(&sem) == 0 && nn_sem_trywait(&sem) == 0 &&
+        nn_sem_trywait(&sem) == -EAGAIN);
+
+    counter = 0;
+    for (j = 0; j < THREADS; j++) nn_thread_init(&t[j], consume, NULL);
+    for (j = 0; j < THREADS*ROUNDS/10; j++) {
+        nn_sem_post(&sem);
+        if (j % 64 == 0) sched_yield();
+    }
+    for (j = 0; j < THREADS; j++) nn_thread_term(&t[j]);
+    test_cond("Semaphore wakes sleepers", counter == (long)THREADS*ROUNDS/10 &&
+        nn_sem_trywait(&sem) == -EAGAIN);
+    nn_sem_term(&sem);
+    test_report()
+}
+#endif
@@ -0,0 +1,39 @@
+#ifndef NN_FUTEX_INCLUDED
+#define NN_FUTEX_INCLUDED
+
+#include "std.h"
+
+#if defined NN_HAVE_FUTEX
+
+/*  Thin wrappers around the Linux futex system call, process private, and
+    the spin budget shared by the primitives built on them (nn_mutex,
+    nn_condvar, nn_sem, nn_rwlock). */
+
+/*  Most rounds of busy waiting before a thread sleeps. */
+#define NN_FUTEX_SPIN_MAX 100
+
+/*  Sleep while '*addr' holds 'val', for at most 'timeout' ms, or with no
+    limit if it is negative. Returns 0 when woken (possibly spuriously),
+    -EAGAIN if '*addr' did not hold 'val', -ETIMEDOUT or -EINTR. */
+int nn_futex_wait (volatile int *addr, int val, int timeout);
+
+/*  Wake up to 'n' threads sleeping on 'addr'. */
+void nn_futex_wake (volatile int *addr, int n);
+
+/*  Rounds to spin given the rounds that recently sufficed, 'recent', in the
+    adaptive scheme of glibc: twice that plus some slack, up to
+    NN_FUTEX_SPIN_MAX. 0 on a single CPU, where the holder cannot make
+    progress while we spin. */
+int nn_futex_spins (int recent);
+
+/*  Move 'recent' an eighth of the way towards 'spun'. */
+#define nn_futex_spun(recent, spun) \
+    do { \
+        int nn_old = __atomic_load_n (recent, __ATOMIC_RELAXED); \
+        __atomic_store_n (recent, nn_old + ((spun) - nn_old) / 8, \
+            __ATOMIC_RELAXED); \
+    } while (0)
+
+#endif
+
+#endif
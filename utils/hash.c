@@ -24,13 +24,21 @@
 #include "std.h"
 #include "alloc.h"
 #include "err.h"
+#include "clock.h"
+#include "hash64.h"
 
 #define NN_HASH_INITIAL_SLOTS 32
 
-uint32_t key_gen(const void *key) 
+/*  Buckets moved by every insert, get and erase while rehashing. */
+#define NN_HASH_REHASH_STEP 1
+
+/*  Shrink once there are fewer items than slots/NN_HASH_SHRINK_RATIO. */
+#define NN_HASH_SHRINK_RATIO 8
+
+/*  Pointer keys are hashed on all 64 bits. */
+uint64_t key_gen(const void *key) 
 {
-    uint32_t k = (uint64_t)key;
-    return hash_int_func(k);
+    return nn_hash64_int((uint64_t)(uintptr_t)key);
 }
 
 static struct hash_func default_func = {
@@ -39,26 +47,45 @@ static struct hash_func default_func = {
     NULL,
 };
 
-void nn_hash_init (hash *self)
+/*  The number of slots is always a power of two. */
+#define nn_hash_slot(slots, h) ((h) & ((slots) - 1))
+
+static hash_item **nn_hash_alloc_array (uint32_t slots)
 {
-    uint32_t i;
+    hash_item **array;
+
+    /*  calloc gets large arrays as fresh zero pages instead of clearing
+        them here, which would undo the point of rehashing incrementally. */
+    array = (hash_item **)nn_calloc_tagged (sizeof ( hash_item*) * slots,
+        NN_ALLOC_TAG_HASH);
+    alloc_assert (array);
+    return array;
+}
 
+void nn_hash_init (hash *self)
+{
     self->slots = NN_HASH_INITIAL_SLOTS;
     self->items = 0;
     self->op = &default_func;
-    self->array = (hash_item **)nn_malloc (sizeof ( hash_item*) * NN_HASH_INITIAL_SLOTS);
-    alloc_assert (self->array);
-    for (i = 0; i != NN_HASH_INITIAL_SLOTS; ++i)
-        self->array[i] = NULL;
+    self->array = nn_hash_alloc_array (NN_HASH_INITIAL_SLOTS);
+    self->oldslots = 0;
+    self->oldarray = NULL;
+    self->rehashidx = -1;
+    self->pauserehash = 0;
 }
 
 void nn_hash_term (hash *self)
 {
     uint32_t i;
 
+    nn_assert (self->pauserehash == 0);
     for (i = 0; i != self->slots; ++i)
         nn_assert (self->array [i] == NULL);
-    nn_free (self->array);
+    for (i = 0; i != self->oldslots; ++i)
+        nn_assert (self->oldarray [i] == NULL);
+    if (self->oldarray)
+        nn_free_tagged (self->oldarray, NN_ALLOC_TAG_HASH);
+    nn_free_tagged (self->array, NN_ALLOC_TAG_HASH);
 }
 
 void nn_hash_set_op(hash *self, hash_func *op)
@@ -70,171 +97,254 @@ void nn_hash_free_all(hash *self)
 {
     hash_item *item;
     hash_item **array;
-    int i;
+    uint32_t slots;
+    uint32_t i;
+    int t;
 
-    array = self->array;
-    for (i = 0; i != self->slots; ++i) 
+    for (t = 0; t != 2; ++t)
     {
-        while(array[i] != NULL)
+        array = t ? self->array : self->oldarray;
+        slots = t ? self->slots : self->oldslots;
+        for (i = 0; i != slots; ++i) 
         {
-            item = array[i];
-            array[i] = array[i]->next;
+            while(array[i] != NULL)
+            {
+                item = array[i];
+                array[i] = array[i]->next;
 
-            hash_item_term(self, item);
+                hash_item_term(self, item);
+            }
         }
     }
 }
 
-static void nn_hash_rehash (hash *self) 
+int nn_hash_defrag (hash *self)
+{
+    hash_item **array;
+
+    array = (hash_item **)nn_alloc_defrag (self->array, NN_ALLOC_TAG_HASH);
+    if (!array)
+        return 0;
+    self->array = array;
+    return 1;
+}
+
+/*  Start moving the items to a table of 'slots' slots. The current table
+    becomes the old one and is drained a few buckets at a time. */
+static void nn_hash_resize (hash *self, uint32_t slots)
+{
+    nn_assert (self->rehashidx < 0);
+    self->oldslots = self->slots;
+    self->oldarray = self->array;
+    self->slots = slots;
+    self->array = nn_hash_alloc_array (slots);
+    self->rehashidx = 0;
+}
+
+/*  Move up to 'n' non-empty buckets of the old table to the new one,
+    visiting at most 10*n empty ones. Return 1 if there are buckets left. */
+int nn_hash_rehash_step (hash *self, int n)
 {
-    hash_item **oldarray;
     hash_item *item;
-    hash_item *prev;
-    hash_item *it;
-    uint32_t oldslots;
     uint32_t newslot;
-    uint32_t i;
+    int empty_visits = n * 10;
 
-    /*  Allocate new double-sized array of slots. */
-    oldslots = self->slots;
-    oldarray = self->array;
-    self->slots *= 2;
-    self->array = (hash_item **)nn_malloc (sizeof ( hash_item *) * self->slots);
-    alloc_assert (self->array);
-    for (i = 0; i != self->slots; ++i)
-        self->array [i] = NULL;
+    if (self->rehashidx < 0)
+        return 0;
+    if (self->pauserehash)
+        return 1;
 
-    /*  Move the items from old slot array to new slot array. */
-    for (i = 0; i != oldslots; ++i) 
+    while (n-- && self->rehashidx < self->oldslots)
     {
-        while(oldarray [i] != NULL)
+        while (self->oldarray[self->rehashidx] == NULL)
         {
-            item = oldarray[i];
-            oldarray[i] = item->next;
-
-            newslot = hash_key(self, item->key) % self->slots;
+            self->rehashidx++;
+            if (self->rehashidx == self->oldslots || --empty_visits == 0)
+                goto done;
+        }
+        while (self->oldarray[self->rehashidx] != NULL)
+        {
+            item = self->oldarray[self->rehashidx];
+            self->oldarray[self->rehashidx] = item->next;
 
+            newslot = nn_hash_slot(self->slots, hash_key(self, item->key));
             item->next = self->array[newslot];
             self->array[newslot] = item;
         }
+        self->rehashidx++;
     }
 
+done:
+    if (self->rehashidx < self->oldslots)
+        return 1;
+
     /*  Deallocate the old array of slots. */
-    nn_free (oldarray);
+    nn_free_tagged (self->oldarray, NN_ALLOC_TAG_HASH);
+    self->oldarray = NULL;
+    self->oldslots = 0;
+    self->rehashidx = -1;
+
+    /*  The item count may have moved past a limit in the meantime. */
+    nn_hash_check_size (self);
+    return self->rehashidx >= 0;
 }
 
-int nn_hash_insert (hash *self, void *key, hash_item *item)
+/*  Start growing or shrinking the table if it is too full or too sparse. */
+void nn_hash_check_size (hash *self)
 {
-    hash_item *it;
-    uint32_t i;
+    uint32_t slots;
 
-    nn_assert (item->next == NN_HASH_NOTINHASH);
-    i = hash_key(self, key) % self->slots;
+    if (self->rehashidx >= 0 || self->pauserehash)
+        return;
 
-    for (it = self->array[i]; it != NULL; it = it->next) 
+    /*  If the hash is getting full, double the amount of slots. */
+    if (nn_slow (self->items > self->slots * 2 && self->slots < 0x80000000))
     {
-        if(hash_compare_keys(self, key, it->key))
-            return -1;                 //该key 已经存在
+        nn_hash_resize (self, self->slots * 2);
+        return;
     }
 
-    item->key = key;
-    item->next = self->array[i];
-    self->array[i] = item;
+    /*  If it is mostly empty, shrink to about one item per slot. */
+    if (nn_slow (self->slots > NN_HASH_INITIAL_SLOTS &&
+          self->items < self->slots / NN_HASH_SHRINK_RATIO))
+    {
+        slots = NN_HASH_INITIAL_SLOTS;
+        while (slots < self->items)
+            slots *= 2;
+        nn_hash_resize (self, slots);
+    }
+}
 
-    ++self->items;
+int nn_hash_rehash_ms (hash *self, int ms)
+{
+    uint64_t start;
 
-    /*  If the hash is getting full, double the amount of slots and
-        re-hash all the items. */
-    if (nn_slow (self->items > self->slots * 2 && self->slots < 0x80000000))
-        nn_hash_rehash(self);
+    if (self->rehashidx < 0)
+        return 0;
+    start = nn_clock_ms ();
+    while (nn_hash_rehash_step (self, 100))
+    {
+        if (self->pauserehash || nn_clock_ms () - start >= (uint64_t) ms)
+            return 1;
+    }
     return 0;
 }
-/*  添加一项到hash 返回值 0 插入成功 非0 表示数据已经被更新*/
-hash_item *nn_hash_set (hash *self, void *key, hash_item *item)
+
+int nn_hash_is_rehashing (hash *self)
 {
-    hash_item *prev = NULL;
-    hash_item *it;
-    uint32_t i;
+    return self->rehashidx >= 0;
+}
 
-    nn_assert (item->next == NN_HASH_NOTINHASH);
-    i = hash_key(self, key) % self->slots;
+/*  Link to the item with 'key', in whichever table holds it, or NULL. The
+    buckets of the old table below rehashidx are empty. */
+static hash_item **nn_hash_find_link (hash *self, void *key, uint64_t h)
+{
+    hash_item **link;
 
-    item->key = key;
-    for (it = self->array[i]; it != NULL; it = it->next) 
+    if (self->oldarray)
     {
-        if(hash_compare_keys(self, key, it->key))
+        for (link = &self->oldarray[nn_hash_slot(self->oldslots, h)];
+              *link != NULL; link = &(*link)->next)
         {
-            if(prev == NULL)
-            {
-                item->next = it->next;
-                self->array[i] = item;
-            }
-            else
-            {
-                item->next = it->next;
-                prev->next = item;
-            }
-            return it;
-        }  
-        prev = it;
+            if (hash_compare_keys(self, key, (*link)->key))
+                return link;
+        }
+    }
+    for (link = &self->array[nn_hash_slot(self->slots, h)];
+          *link != NULL; link = &(*link)->next)
+    {
+        if (hash_compare_keys(self, key, (*link)->key))
+            return link;
     }
+    return NULL;
+}
+
+/*  New items always go to the new table. */
+static void nn_hash_link (hash *self, void *key, hash_item *item, uint64_t h)
+{
+    uint32_t i;
 
+    i = nn_hash_slot(self->slots, h);
+    item->key = key;
     item->next = self->array[i];
     self->array[i] = item;
-
     ++self->items;
+    nn_hash_check_size (self);
+}
 
-    /*  If the hash is getting full, double the amount of slots and
-        re-hash all the items. */
-    if (nn_slow (self->items > self->slots * 2 && self->slots < 0x80000000))
-        nn_hash_rehash(self);
+int nn_hash_insert (hash *self, void *key, hash_item *item)
+{
+    uint64_t h;
+
+    nn_assert (item->next == NN_HASH_NOTINHASH);
+    nn_hash_rehash_step (self, NN_HASH_REHASH_STEP);
+    h = hash_key(self, key);
+    if (nn_hash_find_link (self, key, h))
+        return -1;                 //该key 已经存在
+    nn_hash_link (self, key, item, h);
+    return 0;
+}
+/*  添加一项到hash 返回值 0 插入成功 非0 表示数据已经被更新*/
+hash_item *nn_hash_set (hash *self, void *key, hash_item *item)
+{
+    hash_item **link;
+    hash_item *it;
+    uint64_t h;
+
+    nn_assert (item->next == NN_HASH_NOTINHASH);
+    nn_hash_rehash_step (self, NN_HASH_REHASH_STEP);
+    h = hash_key(self, key);
+    link = nn_hash_find_link (self, key, h);
+    if (link)
+    {
+        it = *link;
+        item->key = key;
+        item->next = it->next;
+        *link = item;
+        return it;
+    }
+    nn_hash_link (self, key, item, h);
     return 0;
 }
 
 int nn_hash_erase (hash *self, hash_item *item)
 {
-    hash_item *it;
-    hash_item *prev;
-    uint32_t slot;
+    hash_item **link = NULL;
+    uint64_t h;
 
     nn_assert (item->next != NN_HASH_NOTINHASH);
-    slot = hash_key(self, item->key) % self->slots;
+    nn_hash_rehash_step (self, NN_HASH_REHASH_STEP);
+    h = hash_key(self, item->key);
 
-    prev = NULL;
-    for (it = self->array[slot]; it != NULL; it = it->next) 
+    if (self->oldarray)
     {
-        if(it == item)
-            break;
-        prev = it;
+        for (link = &self->oldarray[nn_hash_slot(self->oldslots, h)];
+              *link != NULL && *link != item; link = &(*link)->next)
+            ;
     }
-    if(it != item)
+    if (link == NULL || *link == NULL)
+    {
+        for (link = &self->array[nn_hash_slot(self->slots, h)];
+              *link != NULL && *link != item; link = &(*link)->next)
+            ;
+    }
+    if (*link != item)
         return -1;
 
-    if(prev == NULL)
-        self->array[slot] = item->next;
-    else
-        prev->next = it->next;
-
+    *link = item->next;
     --self->items;
     item->next = NN_HASH_NOTINHASH;
-
+    nn_hash_check_size (self);
     return 0;    
 }
 
 hash_item *nn_hash_get (hash *self, void *key)
 {
-    hash_item *item;
-    uint32_t slot;
-
-    slot = hash_key(self, key) % self->slots;
-
-    for (item = self->array[slot]; item != NULL; item = item->next) 
-    {
-        if (hash_compare_keys(self, key, item->key))
-            return item;
-    }
+    hash_item **link;
 
-    return NULL;
+    nn_hash_rehash_step (self, NN_HASH_REHASH_STEP);
+    link = nn_hash_find_link (self, key, hash_key(self, key));
+    return link ? *link : NULL;
 }
 
 void nn_hash_item_init (hash_item *self)
@@ -249,7 +359,7 @@ void nn_hash_item_term (hash_item *self)
 }
 
 /*
- *创建hash遍历器
+ *创建hash遍历器 遍历期间暂停rehash 先遍历旧表再遍历新表
  */
 hash_iterator *nn_hash_iter_init(hash *self)
 {
@@ -258,6 +368,7 @@ hash_iterator *nn_hash_iter_init(hash *self)
     iter->index = -1;
     iter->entry = NULL;
     iter->nentry = NULL;
+    self->pauserehash++;
     return iter;
 }
 /*
@@ -265,13 +376,21 @@ hash_iterator *nn_hash_iter_init(hash *self)
  */
 hash_item *nn_hash_item_next( hash_iterator *iter)
 {
+    hash *h = iter->h;
+
     while (1) {
         if (iter->entry == NULL) 
         {
             iter->index++;
-            if(iter->index >= iter->h->slots)
+            /* No resize can start while the iterator pauses rehashing,
+             * but one already in progress leaves the buckets split:
+             * walk the old array first, then the new one. */
+            if (iter->index < h->oldslots)
+                iter->entry = h->oldarray[iter->index];
+            else if (iter->index < (long)h->oldslots + h->slots)
+                iter->entry = h->array[iter->index - h->oldslots];
+            else
                 return NULL;
-            iter->entry = iter->h->array[iter->index];
         } 
         else 
         {
@@ -293,9 +412,102 @@ void nn_hash_iter_term( hash_iterator *iter)
 {
     if(iter == 0)
         return;
+    iter->h->pauserehash--;
     nn_free(iter);
 }
 
+/*  Reverse the bits of 'v'. */
+static uint64_t nn_hash_rev (uint64_t v)
+{
+    uint64_t mask = ~0ULL;
+    unsigned s = 64;
+
+    while ((s >>= 1) > 0)
+    {
+        mask ^= mask << s;
+        v = ((v >> s) & mask) | ((v << s) & ~mask);
+    }
+    return v;
+}
+
+/*  Increment the bits of 'cursor' above 'mask' starting from the top. */
+static uint64_t nn_hash_scan_next (uint64_t cursor, uint64_t mask)
+{
+    cursor |= ~mask;
+    cursor = nn_hash_rev (cursor);
+    cursor++;
+    return nn_hash_rev (cursor);
+}
+
+static void nn_hash_scan_bucket (hash_item *item, hash_scan_func *fn,
+    void *arg)
+{
+    hash_item *next;
+
+    /*  fn may erase the item. */
+    for (; item != NULL; item = next)
+    {
+        next = item->next;
+        fn (arg, item);
+    }
+}
+
+/*
+ *  The cursor counts with its bits reversed, so the buckets are visited
+ *  in an order where the buckets a slot splits into when the table doubles
+ *  come next to each other, and the ones already visited stay visited
+ *  whichever the size of the table at the next call. While rehashing both
+ *  tables hold items: the bucket of the smaller one is visited together
+ *  with every bucket of the larger one it expands to.
+ */
+uint64_t nn_hash_scan (hash *self, uint64_t cursor, hash_scan_func *fn,
+    void *arg, int budget)
+{
+    hash_item **small, **large;
+    uint64_t m0, m1;
+
+    if (self->items == 0)
+        return 0;
+
+    /*  No bucket may move while the callbacks run. */
+    self->pauserehash++;
+    do
+    {
+        if (self->oldarray == NULL)
+        {
+            m0 = self->slots - 1;
+            nn_hash_scan_bucket (self->array[cursor & m0], fn, arg);
+            cursor = nn_hash_scan_next (cursor, m0);
+            continue;
+        }
+        if (self->oldslots <= self->slots)
+        {
+            small = self->oldarray;
+            large = self->array;
+            m0 = self->oldslots - 1;
+            m1 = self->slots - 1;
+        }
+        else
+        {
+            small = self->array;
+            large = self->oldarray;
+            m0 = self->slots - 1;
+            m1 = self->oldslots - 1;
+        }
+        nn_hash_scan_bucket (small[cursor & m0], fn, arg);
+        do
+        {
+            nn_hash_scan_bucket (large[cursor & m1], fn, arg);
+            cursor = nn_hash_scan_next (cursor, m1);
+        } while (cursor & (m0 ^ m1));
+    } while (cursor != 0 && --budget > 0);
+    self->pauserehash--;
+
+    /*  Erasing in the callbacks does not resize while paused. */
+    nn_hash_check_size (self);
+    return cursor;
+}
+
 static uint32_t dict_hash_function_seed = 5381;
 
 void hash_set_func_seed(uint32_t seed) {
@@ -398,6 +610,8 @@ uint32_t hash_string_case_func(const unsigned char *buf, int len)
 
 
 #ifdef HASH_TEST_MAIN
+#include <stdlib.h>
+#include "testhelp.h"
 
 typedef struct hash_entry
 {
@@ -405,6 +619,17 @@ typedef struct hash_entry
     hash_item item;    
 } hash_entry;
 
+static void scanCount(void *arg, hash_item *it)
+{
+    (void)arg;
+    nn_cont(it, hash_entry, item)->v++;
+}
+
+static void scanErase(void *arg, hash_item *it)
+{
+    nn_hash_erase((hash *)arg, it);
+}
+
 int main(int argc, char** argv)
 {
     hash_item *it; 
@@ -445,6 +670,97 @@ int main(int argc, char** argv)
     }
     printf("end!!!!!!!!!!\n");
     nn_hash_term(&hash);
+
+    {
+        hash_entry *entries;
+        int n = 200000, ok = 1, seen = 0, maxslots;
+
+        entries = (hash_entry *)nn_malloc(sizeof(*entries)*n);
+        nn_hash_init(&hash);
+        for (i = 0; i < n && ok; i++) {
+            nn_hash_item_init(&entries[i].item);
+            entries[i].v = i;
+            ok = nn_hash_insert(&hash, (void *)(long)i, &entries[i].item) == 0;
+            /* Every key inserted so far must be found mid-rehash. */
+            if (i % 997 == 0 && nn_hash_is_rehashing(&hash)) {
+                int k;
+                for (k = 0; k <= i && ok; k += 13)
+                    ok = nn_hash_get(&hash, (void *)(long)k) ==
+                        &entries[k].item;
+            }
+        }
+        test_cond("Items stay reachable while rehashing",
+            ok && hash.items == (uint32_t)n);
+
+        iter = nn_hash_iter_init(&hash);
+        while (nn_hash_item_next(iter)) seen++;
+        nn_hash_iter_term(iter);
+        test_cond("Iteration sees every item once", seen == n);
+
+        while (nn_hash_rehash_ms(&hash, 1));
+        maxslots = hash.slots;
+        test_cond("rehash_ms completes the migration",
+            !nn_hash_is_rehashing(&hash) && hash.oldarray == NULL &&
+            maxslots * 2 >= n);
+
+        for (i = 0; i < n-100 && ok; i++)
+            ok = nn_hash_erase(&hash, &entries[i].item) == 0;
+        while (nn_hash_rehash_ms(&hash, 1));
+        for (i = n-100; i < n && ok; i++)
+            ok = nn_hash_get(&hash, (void *)(long)i) == &entries[i].item;
+        test_cond("A sparse table shrinks and keeps its items",
+            ok && hash.slots < (uint32_t)maxslots && hash.slots <= 128 &&
+            hash.items == 100);
+
+        for (i = n-100; i < n; i++)
+            nn_hash_erase(&hash, &entries[i].item);
+        nn_hash_term(&hash);
+        nn_free(entries);
+    }
+
+    {
+        hash_entry *entries;
+        uint64_t cursor = 0;
+        int n = 50000, ok = 1, calls = 0;
+
+        /* Keys below n/2 stay for the whole scan and must all be seen
+         * (v counts the visits). The table grows while the upper half is
+         * inserted, then shrinks as it is erased again. */
+        entries = (hash_entry *)nn_malloc(sizeof(*entries)*n);
+        nn_hash_init(&hash);
+        for (i = 0; i < n; i++) {
+            nn_hash_item_init(&entries[i].item);
+            entries[i].v = 0;
+        }
+        for (i = 0; i < n/2; i++)
+            nn_hash_insert(&hash, (void *)(long)i, &entries[i].item);
+        i = n/2;
+        do {
+            cursor = nn_hash_scan(&hash, cursor, scanCount, NULL, 16);
+            calls++;
+            if (calls < 200) {
+                for (int k = 0; k < 200 && i < n; k++, i++)
+                    nn_hash_insert(&hash, (void *)(long)i, &entries[i].item);
+            } else if (i > n/2) {
+                for (int k = 0; k < 400 && i > n/2; k++)
+                    nn_hash_erase(&hash, &entries[--i].item);
+            }
+        } while (cursor != 0);
+        for (i = 0; i < n/2 && ok; i++) ok = entries[i].v >= 1;
+        test_cond("Scan sees every item across grows and shrinks", ok);
+
+        for (i = 0; i < n; i++) entries[i].v = 0;
+        cursor = 0;
+        do {
+            cursor = nn_hash_scan(&hash, cursor, scanErase, &hash, 100);
+        } while (cursor != 0);
+        test_cond("Scan callbacks may erase the item",
+            hash.items == 0);
+        while (nn_hash_rehash_ms(&hash, 1));
+        nn_hash_term(&hash);
+        nn_free(entries);
+    }
+    test_report()
     return 0;
 }
 #endif
@@ -28,6 +28,10 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /*  Use for initialising a hash item statically. */
 #define NN_HASH_NOTINHASH ((struct hash_item*) -1)
 #define NN_HASH_ITEM_INITIALIZER {0xffff, NN_HASH_NOTINHASH}
@@ -37,8 +41,9 @@ typedef struct hash_item {
     struct hash_item *next;
 } hash_item;
 
+/*  key_gen返回64位hash 槽下标取低位 高位留给调用者(见hash64.h) */
 typedef struct hash_func {
-    uint32_t (*key_gen)(const void *key);
+    uint64_t (*key_gen)(const void *key);
     int (*key_cmp)(const void *key1, const void *key2);
     void (*item_term)(void *key);
 } hash_func;
@@ -48,8 +53,15 @@ typedef struct hash {
     uint32_t items;
     hash_func *op;
     hash_item **array;
+    uint32_t oldslots;
+    hash_item **oldarray;   /* rehash中正在迁出的旧槽数组 否则为NULL */
+    long rehashidx;         /* 旧槽数组中下一个待迁移的槽 -1表示未在rehash */
+    int pauserehash;        /* >0 时暂停迁移(存在遍历器) */
 } hash;
 
+/*  nn_hash_scan的回调 可以在回调中删除传入的项 */
+typedef void hash_scan_func(void *arg, hash_item *item);
+
 typedef struct hash_iterator {
     hash *h;
     long index;
@@ -78,13 +90,32 @@ void nn_hash_free_all(hash *self);
 /*  设置操作函数 */
 void nn_hash_set_op(hash *self, hash_func *op);
 
+/*  碎片整理 槽数组所在内存页利用率低时迁移 返回值 1 已迁移 0 未迁移*/
+int nn_hash_defrag (hash *self);
+
+/*  渐进式rehash 扩容和缩容都只分配新槽数组 之后每次insert/get/erase迁移少量
+    槽 也可以在定时任务中调用本函数 最多迁移ms毫秒 返回值 1 仍在rehash 0 已完成*/
+int nn_hash_rehash_ms (hash *self, int ms);
+
+/*  是否正在rehash */
+int nn_hash_is_rehashing (hash *self);
+
+/*  迁移最多n个非空旧槽 返回值 1 仍在rehash 0 已完成. insert/get/erase内部调用
+    供intrusive.h中内联的实现使用 */
+int nn_hash_rehash_step (hash *self, int n);
+
+/*  项数越过上下限时开始扩容或缩容 供intrusive.h使用 */
+void nn_hash_check_size (hash *self);
+
 /*  添加一项到hash 返回值 0 插入成功 -1 插入值已存在*/
 int nn_hash_insert (hash *self, void *key, hash_item *item);
 
 /*  添加一项到hash 返回值 0 插入成功 非0 表示数据已经被更新*/
 hash_item *nn_hash_set (hash *self, void *key, hash_item *item);
 
-/*  从hash中查找键为key的项 0没找到 非0 为结果*/
+/*  从hash中查找键为key的项 0没找到 非0 为结果
+    rehash期间查找会顺带迁移旧槽 即get也会修改表 多个读者在读锁下共享同一张表时
+    不能并发调用 */
 hash_item *nn_hash_get (hash *self, void *key);
 
 /*  从hash表中删除一项  0 成功 -1  没有找到item*/
@@ -105,6 +136,14 @@ hash_item *nn_hash_item_next(hash_iterator *iter);
 /* 析构hash遍历器 */
 void nn_hash_iter_term(hash_iterator *iter);
 
+/*  无状态增量遍历 从cursor 0开始 每次最多访问budget个槽 对每一项调用fn(arg, item)
+    返回下一次调用的cursor 返回0表示遍历完成. 游标按槽下标的反向二进制位递增
+    所以两次调用之间扩容缩容或rehash都不会漏掉项: 整个遍历期间一直存在的项至少
+    返回一次 缩容时可能重复返回 期间插入或删除的项可能返回也可能不返回.
+    不分配内存 不需要析构 */
+uint64_t nn_hash_scan (hash *self, uint64_t cursor, hash_scan_func *fn,
+    void *arg, int budget);
+
 /* 数字生成hashkey算法 Thomas Wang */
 uint32_t hash_int_func(uint32_t key);
 
@@ -117,5 +156,9 @@ uint32_t hash_string_func(const void *key, int len);
 /* 字符串生成hashkey算法 大小写不敏感 djb hash*/
 uint32_t hash_string_case_func(const unsigned char *buf, int len); 
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
 
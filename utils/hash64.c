@@ -0,0 +1,254 @@
+#include <string.h>
+
+#include "hash64.h"
+
+#if defined __SSE2__ && defined __x86_64__
+#define NN_HASH64_SSE2
+#include <emmintrin.h>
+#endif
+
+#define NN_HASH64_INLINE static inline __attribute__ ((always_inline))
+
+/*  wyhash's default secret: odd constants with 32 bits set in every byte
+    pair, so that no multiply degenerates. */
+static const uint64_t nn_hash64_secret [4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL,
+    0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL
+};
+
+static uint64_t nn_hash64_default_seed = 0x9e3779b97f4a7c15ULL;
+
+void nn_hash64_set_seed (uint64_t seed)
+{
+    nn_hash64_default_seed = seed;
+}
+
+uint64_t nn_hash64_get_seed (void)
+{
+    return nn_hash64_default_seed;
+}
+
+/*  Full 128-bit product of 'a' and 'b', low half in 'a', high in 'b'. */
+NN_HASH64_INLINE void nn_hash64_mum (uint64_t *a, uint64_t *b)
+{
+    __uint128_t r = (__uint128_t) *a * *b;
+
+    *a = (uint64_t) r;
+    *b = (uint64_t) (r >> 64);
+}
+
+NN_HASH64_INLINE uint64_t nn_hash64_mix (uint64_t a, uint64_t b)
+{
+    nn_hash64_mum (&a, &b);
+    return a ^ b;
+}
+
+/*  Set bit 5 of every byte of 'x' that is an ASCII capital. The top bit of
+    each byte is masked off first so that the additions cannot carry into
+    the next byte. */
+NN_HASH64_INLINE uint64_t nn_hash64_fold_word (uint64_t x)
+{
+    const uint64_t ones = 0x0101010101010101ULL;
+    uint64_t low = x & (0x7f * ones);
+    uint64_t ge = low + (0x80 - 'A') * ones;
+    uint64_t gt = low + (0x80 - 'Z' - 1) * ones;
+
+    return x | ((ge & ~gt & ~x & (0x80 * ones)) >> 2);
+}
+
+NN_HASH64_INLINE uint64_t nn_hash64_fold_byte (uint8_t c)
+{
+    return c | ((uint8_t) (c - 'A') < 26) << 5;
+}
+
+NN_HASH64_INLINE uint64_t nn_hash64_r8 (const uint8_t *p, int nocase)
+{
+    uint64_t v;
+
+    memcpy (&v, p, sizeof (v));
+    return nocase ? nn_hash64_fold_word (v) : v;
+}
+
+NN_HASH64_INLINE uint64_t nn_hash64_r4 (const uint8_t *p, int nocase)
+{
+    uint32_t v;
+
+    memcpy (&v, p, sizeof (v));
+    return nocase ? nn_hash64_fold_word (v) : v;
+}
+
+/*  1 to 3 bytes, first, middle and last. */
+NN_HASH64_INLINE uint64_t nn_hash64_r3 (const uint8_t *p, size_t k,
+    int nocase)
+{
+    if (nocase)
+        return nn_hash64_fold_byte (p [0]) << 16 |
+            nn_hash64_fold_byte (p [k >> 1]) << 8 |
+            nn_hash64_fold_byte (p [k - 1]);
+    return (uint64_t) p [0] << 16 | (uint64_t) p [k >> 1] << 8 | p [k - 1];
+}
+
+NN_HASH64_INLINE void nn_hash64_r16 (const uint8_t *p, int nocase,
+    uint64_t *lo, uint64_t *hi)
+{
+#if defined NN_HASH64_SSE2
+    __m128i v, upper;
+
+    if (nocase) {
+
+        /*  Bytes in 'A'..'Z' are the ones below -128 + 26 after shifting
+            'A' to -128. */
+        v = _mm_loadu_si128 ((const __m128i*) p);
+        upper = _mm_cmplt_epi8 (
+            _mm_add_epi8 (v, _mm_set1_epi8 ((char) (0x80 - 'A'))),
+            _mm_set1_epi8 ((char) (0x80 + 26)));
+        v = _mm_or_si128 (v, _mm_and_si128 (upper, _mm_set1_epi8 (0x20)));
+        *lo = (uint64_t) _mm_cvtsi128_si64 (v);
+        *hi = (uint64_t) _mm_cvtsi128_si64 (_mm_unpackhi_epi64 (v, v));
+        return;
+    }
+#endif
+    *lo = nn_hash64_r8 (p, nocase);
+    *hi = nn_hash64_r8 (p + 8, nocase);
+}
+
+NN_HASH64_INLINE uint64_t nn_hash64_impl (const void *key, size_t len,
+    uint64_t seed, int nocase)
+{
+    const uint64_t *s = nn_hash64_secret;
+    const uint8_t *p = (const uint8_t*) key;
+    uint64_t a, b, lo, hi;
+    uint64_t see1, see2;
+    size_t i;
+
+    seed ^= nn_hash64_mix (seed ^ s [0], s [1]);
+    if (len <= 16) {
+        if (len >= 4) {
+            a = nn_hash64_r4 (p, nocase) << 32 |
+                nn_hash64_r4 (p + ((len >> 3) << 2), nocase);
+            b = nn_hash64_r4 (p + len - 4, nocase) << 32 |
+                nn_hash64_r4 (p + len - 4 - ((len >> 3) << 2), nocase);
+        }
+        else if (len > 0) {
+            a = nn_hash64_r3 (p, len, nocase);
+            b = 0;
+        }
+        else
+            a = b = 0;
+    }
+    else {
+        i = len;
+        if (i > 48) {
+            see1 = seed;
+            see2 = seed;
+            do {
+                nn_hash64_r16 (p, nocase, &lo, &hi);
+                seed = nn_hash64_mix (lo ^ s [1], hi ^ seed);
+                nn_hash64_r16 (p + 16, nocase, &lo, &hi);
+                see1 = nn_hash64_mix (lo ^ s [2], hi ^ see1);
+                nn_hash64_r16 (p + 32, nocase, &lo, &hi);
+                see2 = nn_hash64_mix (lo ^ s [3], hi ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            nn_hash64_r16 (p, nocase, &lo, &hi);
+            seed = nn_hash64_mix (lo ^ s [1], hi ^ seed);
+            p += 16;
+            i -= 16;
+        }
+
+        /*  The last 16 bytes, overlapping what was already mixed. */
+        a = nn_hash64_r8 (p + i - 16, nocase);
+        b = nn_hash64_r8 (p + i - 8, nocase);
+    }
+    a ^= s [1];
+    b ^= seed;
+    nn_hash64_mum (&a, &b);
+    return nn_hash64_mix (a ^ s [0] ^ len, b ^ s [1]);
+}
+
+uint64_t nn_hash64_seeded (const void *p, size_t len, uint64_t seed)
+{
+    return nn_hash64_impl (p, len, seed, 0);
+}
+
+uint64_t nn_hash64 (const void *p, size_t len)
+{
+    return nn_hash64_impl (p, len, nn_hash64_default_seed, 0);
+}
+
+uint64_t nn_hash64_case_seeded (const void *p, size_t len, uint64_t seed)
+{
+    return nn_hash64_impl (p, len, seed, 1);
+}
+
+uint64_t nn_hash64_case (const void *p, size_t len)
+{
+    return nn_hash64_impl (p, len, nn_hash64_default_seed, 1);
+}
+
+uint64_t nn_hash64_int (uint64_t key)
+{
+    const uint64_t *s = nn_hash64_secret;
+
+    return nn_hash64_mix (nn_hash64_mix (key ^ s [0], nn_hash64_default_seed ^
+        s [1]) ^ s [2], key ^ s [3]);
+}
+
+#if defined HASH64_TEST_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include "testhelp.h"
+
+int main(void) {
+    char buf[300], low[300];
+    uint64_t h1, h2;
+    int j, len, ok;
+
+    for (j = 0; j < (int)sizeof(buf); j++) buf[j] = 'A' + (j*7) % 58;
+    ok = 1;
+    for (len = 0; len <= 256; len++) {
+        for (j = 0; j < len; j++) low[j] = tolower((unsigned char)buf[j]);
+        ok &= nn_hash64_case(buf, len) == nn_hash64(low, len);
+        ok &= nn_hash64_case_seeded(buf, len, 7) ==
+            nn_hash64_seeded(low, len, 7);
+    }
+    test_cond("The case variant hashes the lowercased string", ok);
+
+    ok = 1;
+    for (len = 1; len <= 256; len++) {
+        memcpy(low, buf, len);
+        low[len-1] ^= 1;
+        ok &= nn_hash64(buf, len) != nn_hash64(low, len);
+        memcpy(low, buf, len);
+        low[0] ^= 0x80;
+        ok &= nn_hash64(buf, len) != nn_hash64(low, len);
+    }
+    test_cond("The first and last byte reach the hash at every length", ok);
+
+    ok = 1;
+    for (j = 0; j < 256; j++) {
+        buf[0] = (char)j;
+        low[0] = (char)tolower(j);
+        ok &= nn_hash64_case(buf, 1) == nn_hash64(low, 1);
+        ok &= (nn_hash64_case(buf, 1) == nn_hash64(buf, 1)) ==
+            (j < 'A' || j > 'Z');
+    }
+    test_cond("Only ASCII capitals are folded", ok);
+
+    h1 = nn_hash64_seeded("key", 3, 1);
+    h2 = nn_hash64_seeded("key", 3, 2);
+    test_cond("The seed changes the hash",
+        h1 != h2 && nn_hash64_int(1) != nn_hash64_int(2));
+    nn_hash64_set_seed(nn_hash64_get_seed() + 1);
+    test_cond("The process seed is used by default",
+        nn_hash64("key", 3) != h1 &&
+        nn_hash64("key", 3) == nn_hash64_seeded("key", 3, nn_hash64_get_seed()));
+    test_report()
+    return 0;
+}
+#endif
@@ -0,0 +1,46 @@
+#ifndef NN_HASH64_INCLUDED
+#define NN_HASH64_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*  Seeded 64-bit hash functions for keys, of the wyhash family: 64x64->128
+    bit multiplies that fold each 16 byte block into the state, three
+    independent lanes for inputs over 48 bytes and overlapping reads for the
+    tail, so short keys are hashed without a byte loop. Lower bits are as
+    good as upper ones, so tables can index with a mask.
+
+    The case-insensitive variant hashes the input as if it were lowercased
+    (ASCII only, as the C locale does) without copying it: blocks are folded
+    16 bytes at a time with SSE2, words with SWAR arithmetic elsewhere. It is
+    equal to nn_hash64() of the lowercased string.
+
+    The process wide seed is fixed at startup so that hashes cannot be
+    predicted by clients. Changing it invalidates every stored hash: set it
+    before any table is filled. The values are not portable between
+    processes nor between little and big endian machines. */
+
+/*  Process wide seed used by the unseeded forms. */
+void nn_hash64_set_seed (uint64_t seed);
+uint64_t nn_hash64_get_seed (void);
+
+/*  Hash of 'len' bytes at 'p'. */
+uint64_t nn_hash64_seeded (const void *p, size_t len, uint64_t seed);
+uint64_t nn_hash64 (const void *p, size_t len);
+
+/*  Hash of 'len' bytes at 'p' ignoring ASCII case. */
+uint64_t nn_hash64_case_seeded (const void *p, size_t len, uint64_t seed);
+uint64_t nn_hash64_case (const void *p, size_t len);
+
+/*  Hash of a 64-bit integer or pointer. */
+uint64_t nn_hash64_int (uint64_t key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
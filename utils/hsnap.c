@@ -0,0 +1,572 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hsnap.h"
+#include "hash64.h"
+#include "alloc.h"
+#include "err.h"
+#include "std.h"
+
+#define NN_HSNAP_MAGIC "NNHSNAP"
+#define NN_HSNAP_VERSION 1
+#define NN_HSNAP_ORDER 0x0102030405060708ULL
+#define NN_HSNAP_MIN_SLOTS 16
+
+struct nn_hsnap_header {
+    char magic [8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t order;                 /* NN_HSNAP_ORDER as the writer stored it */
+    uint64_t seed;
+    uint64_t slots;
+    uint64_t count;
+    uint64_t heap;                  /* Offset of the entry heap */
+    uint64_t size;                  /* Of the whole file */
+};
+
+/*  Packed entry. The key and the value follow, padded to 8 bytes. Entries
+    are appended and a chain links each one to the previous head of its
+    slot, so 'next' is always lower than the entry's own offset. */
+struct nn_hsnap_rec {
+    uint64_t next;                  /* 0 at the end of the chain */
+    uint64_t hash;
+    uint32_t keylen;
+    uint32_t vallen;
+};
+
+#define nn_hsnap_rec_key(rec) ((const char*) ((rec) + 1))
+#define nn_hsnap_rec_val(rec) (nn_hsnap_rec_key (rec) + (rec)->keylen)
+#define nn_hsnap_pad(len) ((8 - ((len) & 7)) & 7)
+
+struct nn_hsnap_key {
+    const void *ptr;
+    size_t len;
+    uint64_t hash;
+};
+
+/*  Overlay entry. The key and the value follow. */
+struct nn_hsnap_item {
+    hash_item item;
+    struct nn_hsnap_key key;
+    size_t vallen;
+    int dead;                       /* Tombstone of a mapped key */
+};
+
+#define nn_hsnap_item_key(e) ((char*) ((e) + 1))
+#define nn_hsnap_item_val(e) (nn_hsnap_item_key (e) + (e)->key.len)
+
+static uint64_t nn_hsnap_key_gen (const void *key)
+{
+    return ((const struct nn_hsnap_key*) key)->hash;
+}
+
+static int nn_hsnap_key_cmp (const void *key1, const void *key2)
+{
+    const struct nn_hsnap_key *k1 = key1;
+    const struct nn_hsnap_key *k2 = key2;
+
+    return k1->hash == k2->hash && k1->len == k2->len &&
+        memcmp (k1->ptr, k2->ptr, k1->len) == 0;
+}
+
+static void nn_hsnap_key_init (struct nn_hsnap *self,
+    struct nn_hsnap_key *key, const void *ptr, size_t len)
+{
+    key->ptr = ptr;
+    key->len = len;
+    key->hash = nn_hash64_seeded (ptr, len, self->seed);
+}
+
+void nn_hsnap_init (struct nn_hsnap *self)
+{
+    self->base = NULL;
+    self->size = 0;
+    self->hdr = NULL;
+    self->heads = NULL;
+    self->mask = 0;
+    self->op.key_gen = nn_hsnap_key_gen;
+    self->op.key_cmp = nn_hsnap_key_cmp;
+    self->op.item_term = NULL;
+    nn_hash_init (&self->overlay);
+    nn_hash_set_op (&self->overlay, &self->op);
+    self->seed = nn_hash64_get_seed ();
+    self->items = 0;
+}
+
+void nn_hsnap_term (struct nn_hsnap *self)
+{
+    hash_iterator *iter;
+    hash_item *it;
+
+    iter = nn_hash_iter_init (&self->overlay);
+    while ((it = nn_hash_item_next (iter)) != NULL) {
+        nn_hash_erase (&self->overlay, it);
+        nn_free (nn_cont (it, struct nn_hsnap_item, item));
+    }
+    nn_hash_iter_term (iter);
+    nn_hash_term (&self->overlay);
+    if (self->base)
+        munmap ((void*) self->base, self->size);
+}
+
+int nn_hsnap_load (struct nn_hsnap *self, const char *path)
+{
+    const struct nn_hsnap_header *hdr;
+    struct stat st;
+    void *base;
+    int fd;
+    int rc;
+
+    nn_assert (self->base == NULL && self->overlay.items == 0);
+
+    fd = open (path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+    if (fstat (fd, &st) < 0) {
+        rc = -errno;
+        close (fd);
+        return rc;
+    }
+    if ((size_t) st.st_size < sizeof (struct nn_hsnap_header)) {
+        close (fd);
+        return -EINVAL;
+    }
+    base = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    rc = errno;
+    close (fd);
+    if (base == MAP_FAILED)
+        return -rc;
+
+    hdr = base;
+    if (memcmp (hdr->magic, NN_HSNAP_MAGIC, sizeof (hdr->magic)) != 0 ||
+          hdr->version != NN_HSNAP_VERSION || hdr->order != NN_HSNAP_ORDER ||
+          hdr->size != (uint64_t) st.st_size || hdr->slots == 0 ||
+          (hdr->slots & (hdr->slots - 1)) != 0 ||
+          hdr->slots > (hdr->size - sizeof (*hdr)) / sizeof (uint64_t) ||
+          hdr->heap != sizeof (*hdr) + hdr->slots * sizeof (uint64_t)) {
+        munmap (base, st.st_size);
+        return -EINVAL;
+    }
+
+    self->base = base;
+    self->size = st.st_size;
+    self->hdr = hdr;
+    self->heads = (const uint64_t*) (hdr + 1);
+    self->mask = hdr->slots - 1;
+    self->seed = hdr->seed;
+    self->items = hdr->count;
+    return 0;
+}
+
+/*  Entry at 'off' or NULL if it does not fit in the heap. */
+static const struct nn_hsnap_rec *nn_hsnap_rec_at (struct nn_hsnap *self,
+    uint64_t off)
+{
+    const struct nn_hsnap_rec *rec;
+
+    if (off < self->hdr->heap || (off & 7) ||
+          off > self->size - sizeof (struct nn_hsnap_rec))
+        return NULL;
+    rec = (const struct nn_hsnap_rec*) (self->base + off);
+    if ((uint64_t) rec->keylen + rec->vallen >
+          self->size - off - sizeof (struct nn_hsnap_rec))
+        return NULL;
+    return rec;
+}
+
+/*  Next entry of the chain. Requiring 'next' to go backwards keeps a
+    damaged file from looping. */
+static const struct nn_hsnap_rec *nn_hsnap_rec_next (struct nn_hsnap *self,
+    const struct nn_hsnap_rec *rec)
+{
+    if (rec->next >= (uint64_t) ((const uint8_t*) rec - self->base))
+        return NULL;
+    return nn_hsnap_rec_at (self, rec->next);
+}
+
+static const struct nn_hsnap_rec *nn_hsnap_find_mapped (struct nn_hsnap *self,
+    const struct nn_hsnap_key *key)
+{
+    const struct nn_hsnap_rec *rec;
+
+    if (!self->base)
+        return NULL;
+    for (rec = nn_hsnap_rec_at (self, self->heads [key->hash & self->mask]);
+          rec != NULL; rec = nn_hsnap_rec_next (self, rec)) {
+        if (rec->hash == key->hash && rec->keylen == key->len &&
+              memcmp (nn_hsnap_rec_key (rec), key->ptr, key->len) == 0)
+            return rec;
+    }
+    return NULL;
+}
+
+static struct nn_hsnap_item *nn_hsnap_find_overlay (struct nn_hsnap *self,
+    struct nn_hsnap_key *key)
+{
+    hash_item *it;
+
+    if (self->overlay.items == 0)
+        return NULL;
+    it = nn_hash_get (&self->overlay, key);
+    return it ? nn_cont (it, struct nn_hsnap_item, item) : NULL;
+}
+
+static struct nn_hsnap_item *nn_hsnap_item_alloc (
+    const struct nn_hsnap_key *key, const void *val, size_t vallen)
+{
+    struct nn_hsnap_item *e;
+
+    e = nn_malloc (sizeof (struct nn_hsnap_item) + key->len + vallen);
+    if (nn_slow (!e))
+        return NULL;
+    memcpy (nn_hsnap_item_key (e), key->ptr, key->len);
+    e->key.ptr = nn_hsnap_item_key (e);
+    e->key.len = key->len;
+    e->key.hash = key->hash;
+    if (vallen)
+        memcpy (nn_hsnap_item_val (e), val, vallen);
+    e->vallen = vallen;
+    e->dead = 0;
+    nn_hash_item_init (&e->item);
+    return e;
+}
+
+int nn_hsnap_get (struct nn_hsnap *self, const void *key, size_t keylen,
+    const void **val, size_t *vallen)
+{
+    const struct nn_hsnap_rec *rec;
+    struct nn_hsnap_item *e;
+    struct nn_hsnap_key k;
+
+    nn_hsnap_key_init (self, &k, key, keylen);
+    e = nn_hsnap_find_overlay (self, &k);
+    if (e) {
+        if (e->dead)
+            return -ENOENT;
+        *val = nn_hsnap_item_val (e);
+        *vallen = e->vallen;
+        return 0;
+    }
+    rec = nn_hsnap_find_mapped (self, &k);
+    if (!rec)
+        return -ENOENT;
+    *val = nn_hsnap_rec_val (rec);
+    *vallen = rec->vallen;
+    return 0;
+}
+
+int nn_hsnap_set (struct nn_hsnap *self, const void *key, size_t keylen,
+    const void *val, size_t vallen)
+{
+    struct nn_hsnap_item *e;
+    struct nn_hsnap_item *old;
+    struct nn_hsnap_key k;
+    hash_item *it;
+
+    nn_hsnap_key_init (self, &k, key, keylen);
+    e = nn_hsnap_item_alloc (&k, val, vallen);
+    if (nn_slow (!e))
+        return -ENOMEM;
+    it = nn_hash_set (&self->overlay, &e->key, &e->item);
+    if (it) {
+        old = nn_cont (it, struct nn_hsnap_item, item);
+        if (old->dead)
+            self->items++;
+        nn_free (old);
+    }
+    else if (!nn_hsnap_find_mapped (self, &k))
+        self->items++;
+    return 0;
+}
+
+int nn_hsnap_del (struct nn_hsnap *self, const void *key, size_t keylen)
+{
+    struct nn_hsnap_item *e;
+    struct nn_hsnap_key k;
+
+    nn_hsnap_key_init (self, &k, key, keylen);
+    e = nn_hsnap_find_overlay (self, &k);
+    if (e) {
+        if (e->dead)
+            return -ENOENT;
+
+        /*  A promoted key still has its old copy in the mapping. */
+        if (nn_hsnap_find_mapped (self, &k))
+            e->dead = 1;
+        else {
+            nn_hash_erase (&self->overlay, &e->item);
+            nn_free (e);
+        }
+        self->items--;
+        return 0;
+    }
+    if (!nn_hsnap_find_mapped (self, &k))
+        return -ENOENT;
+    e = nn_hsnap_item_alloc (&k, NULL, 0);
+    if (nn_slow (!e))
+        return -ENOMEM;
+    e->dead = 1;
+    nn_hash_insert (&self->overlay, &e->key, &e->item);
+    self->items--;
+    return 0;
+}
+
+int nn_hsnap_save (struct nn_hsnap *self, const char *path)
+{
+    struct nn_hsnap_writer w;
+    const struct nn_hsnap_rec *rec;
+    struct nn_hsnap_item *e;
+    struct nn_hsnap_key k;
+    hash_iterator *iter;
+    hash_item *it;
+    uint64_t i;
+    int rc;
+
+    rc = nn_hsnap_writer_init (&w, path, self->items, self->seed);
+    if (rc != 0)
+        return rc;
+
+    /*  Mapped entries that were not promoted, then the live overlay. */
+    for (i = 0; self->base && i <= self->mask; i++) {
+        for (rec = nn_hsnap_rec_at (self, self->heads [i]); rec != NULL;
+              rec = nn_hsnap_rec_next (self, rec)) {
+            k.ptr = nn_hsnap_rec_key (rec);
+            k.len = rec->keylen;
+            k.hash = rec->hash;
+            if (!nn_hsnap_find_overlay (self, &k))
+                nn_hsnap_writer_add (&w, k.ptr, k.len,
+                    nn_hsnap_rec_val (rec), rec->vallen);
+        }
+    }
+    iter = nn_hash_iter_init (&self->overlay);
+    while ((it = nn_hash_item_next (iter)) != NULL) {
+        e = nn_cont (it, struct nn_hsnap_item, item);
+        if (!e->dead)
+            nn_hsnap_writer_add (&w, e->key.ptr, e->key.len,
+                nn_hsnap_item_val (e), e->vallen);
+    }
+    nn_hash_iter_term (iter);
+    return nn_hsnap_writer_commit (&w);
+}
+
+static void nn_hsnap_writer_free (struct nn_hsnap_writer *self)
+{
+    nn_free (self->heads);
+    nn_free (self->tmp);
+    nn_free (self->path);
+}
+
+int nn_hsnap_writer_init (struct nn_hsnap_writer *self, const char *path,
+    size_t hint, uint64_t seed)
+{
+    uint64_t slots;
+    int rc;
+
+    /*  About one entry per slot. */
+    for (slots = NN_HSNAP_MIN_SLOTS; slots < hint; slots *= 2)
+        ;
+    self->path = nn_strdup (path);
+    self->tmp = nn_malloc (strlen (path) + 5);
+    self->heads = nn_calloc (slots * sizeof (uint64_t));
+    if (nn_slow (!self->path || !self->tmp || !self->heads)) {
+        nn_hsnap_writer_free (self);
+        return -ENOMEM;
+    }
+    strcpy (self->tmp, path);
+    strcat (self->tmp, ".tmp");
+
+    self->f = fopen (self->tmp, "wb");
+    if (!self->f) {
+        rc = -errno;
+        nn_hsnap_writer_free (self);
+        return rc;
+    }
+    self->mask = slots - 1;
+    self->seed = seed;
+    self->count = 0;
+    self->pos = sizeof (struct nn_hsnap_header) + slots * sizeof (uint64_t);
+    self->err = 0;
+    if (fseeko (self->f, self->pos, SEEK_SET) != 0)
+        self->err = -errno;
+    return 0;
+}
+
+int nn_hsnap_writer_add (struct nn_hsnap_writer *self, const void *key,
+    size_t keylen, const void *val, size_t vallen)
+{
+    static const char zeros [8];
+    struct nn_hsnap_rec rec;
+    size_t pad;
+
+    if (self->err)
+        return self->err;
+    if (keylen > UINT32_MAX || vallen > UINT32_MAX)
+        return -EINVAL;
+
+    rec.hash = nn_hash64_seeded (key, keylen, self->seed);
+    rec.next = self->heads [rec.hash & self->mask];
+    rec.keylen = (uint32_t) keylen;
+    rec.vallen = (uint32_t) vallen;
+    pad = nn_hsnap_pad (keylen + vallen);
+    if (fwrite (&rec, sizeof (rec), 1, self->f) != 1 ||
+          fwrite (key, 1, keylen, self->f) != keylen ||
+          fwrite (val, 1, vallen, self->f) != vallen ||
+          fwrite (zeros, 1, pad, self->f) != pad) {
+        self->err = errno ? -errno : -EIO;
+        return self->err;
+    }
+    self->heads [rec.hash & self->mask] = self->pos;
+    self->pos += sizeof (rec) + keylen + vallen + pad;
+    self->count++;
+    return 0;
+}
+
+int nn_hsnap_writer_commit (struct nn_hsnap_writer *self)
+{
+    struct nn_hsnap_header hdr;
+    int rc = self->err;
+
+    if (rc == 0) {
+        memset (&hdr, 0, sizeof (hdr));
+        memcpy (hdr.magic, NN_HSNAP_MAGIC, sizeof (hdr.magic));
+        hdr.version = NN_HSNAP_VERSION;
+        hdr.order = NN_HSNAP_ORDER;
+        hdr.seed = self->seed;
+        hdr.slots = self->mask + 1;
+        hdr.count = self->count;
+        hdr.heap = sizeof (hdr) + hdr.slots * sizeof (uint64_t);
+        hdr.size = self->pos;
+
+        /*  The data must be on disk before the rename makes it the
+            snapshot. */
+        if (fseeko (self->f, 0, SEEK_SET) != 0 ||
+              fwrite (&hdr, sizeof (hdr), 1, self->f) != 1 ||
+              fwrite (self->heads, sizeof (uint64_t), hdr.slots, self->f) !=
+              hdr.slots || fflush (self->f) != 0 ||
+              fsync (fileno (self->f)) != 0)
+            rc = errno ? -errno : -EIO;
+    }
+    if (fclose (self->f) != 0 && rc == 0)
+        rc = -errno;
+    if (rc == 0 && rename (self->tmp, self->path) != 0)
+        rc = -errno;
+    if (rc != 0)
+        unlink (self->tmp);
+    nn_hsnap_writer_free (self);
+    return rc;
+}
+
+void nn_hsnap_writer_abort (struct nn_hsnap_writer *self)
+{
+    fclose (self->f);
+    unlink (self->tmp);
+    nn_hsnap_writer_free (self);
+}
+
+#if defined HSNAP_TEST_MAIN
+#include <stdlib.h>
+#include "testhelp.h"
+
+#define PATH "/tmp/hsnap_test.snap"
+#define N 5000
+
+static int check(struct nn_hsnap *s, int i, const char *want) {
+    char key[32];
+    const void *val;
+    size_t len;
+    int rc;
+
+    rc = nn_hsnap_get(s, key, snprintf(key, sizeof(key), "key:%d", i),
+        &val, &len);
+    if (want == NULL) return rc == -ENOENT;
+    return rc == 0 && len == strlen(want) && memcmp(val, want, len) == 0;
+}
+
+static int set(struct nn_hsnap *s, int i, const char *val) {
+    char key[32];
+
+    return nn_hsnap_set(s, key, snprintf(key, sizeof(key), "key:%d", i),
+        val, strlen(val));
+}
+
+static int del(struct nn_hsnap *s, int i) {
+    char key[32];
+
+    return nn_hsnap_del(s, key, snprintf(key, sizeof(key), "key:%d", i));
+}
+
+int main(void) {
+    struct nn_hsnap s, r;
+    char val[32];
+    FILE *f;
+    int i, ok, lost;
+
+    nn_hsnap_init(&s);
+    for (i = 0; i < N; i++) {
+        snprintf(val, sizeof(val), "value %d", i);
+        set(&s, i, val);
+    }
+    set(&s, 7, "");
+    test_cond("Save writes the table",
+        nn_hsnap_count(&s) == N && nn_hsnap_save(&s, PATH) == 0);
+    nn_hsnap_term(&s);
+
+    nn_hsnap_init(&r);
+    ok = nn_hsnap_load(&r, PATH) == 0 && nn_hsnap_count(&r) == N &&
+        r.overlay.items == 0;
+    for (i = 0; i < N && ok; i++) {
+        snprintf(val, sizeof(val), "value %d", i);
+        ok = check(&r, i, i == 7 ? "" : val);
+    }
+    test_cond("Load serves every entry from the mapping",
+        ok && check(&r, N, NULL));
+
+    ok = set(&r, 1, "changed") == 0 && set(&r, N, "new") == 0 &&
+        del(&r, 2) == 0 && del(&r, 2) == -ENOENT && del(&r, N+1) == -ENOENT &&
+        del(&r, 3) == 0 && set(&r, 3, "back") == 0 &&
+        set(&r, 4, "a") == 0 && del(&r, 4) == 0;
+    test_cond("Writes are promoted to the overlay",
+        ok && check(&r, 1, "changed") && check(&r, N, "new") &&
+        check(&r, 2, NULL) && check(&r, 3, "back") && check(&r, 4, NULL) &&
+        check(&r, 5, "value 5") && nn_hsnap_count(&r) == N-1);
+
+    ok = nn_hsnap_save(&r, PATH) == 0;
+    nn_hsnap_init(&s);
+    ok = ok && nn_hsnap_load(&s, PATH) == 0;
+    test_cond("Saving merges the overlay with the mapping",
+        ok && nn_hsnap_count(&s) == N-1 && check(&s, 1, "changed") &&
+        check(&s, N, "new") && check(&s, 2, NULL) && check(&s, 3, "back") &&
+        check(&s, 4, NULL) && check(&s, N-1, "value 4999"));
+    nn_hsnap_term(&s);
+    nn_hsnap_term(&r);
+
+    /* Point every chain head past the end of the file. */
+    f = fopen(PATH, "r+b");
+    fseek(f, 64, SEEK_SET);
+    for (i = 0; i < 16; i++) fwrite("\xff\xff\xff\xff\xff\xff\xff\x7f", 8, 1, f);
+    fclose(f);
+    nn_hsnap_init(&s);
+    ok = nn_hsnap_load(&s, PATH) == 0;
+    for (i = 10, lost = 0; i < N && ok; i++) {
+        snprintf(val, sizeof(val), "value %d", i);
+        lost += check(&s, i, NULL);
+        ok = check(&s, i, NULL) || check(&s, i, val);
+    }
+    nn_hsnap_term(&s);
+    test_cond("A damaged file only loses the entries it points to",
+        ok && lost > 0 && lost < N/10);
+
+    truncate(PATH, 100);
+    nn_hsnap_init(&s);
+    test_cond("A truncated file is rejected",
+        nn_hsnap_load(&s, PATH) == -EINVAL);
+    nn_hsnap_term(&s);
+    unlink(PATH);
+    test_report()
+    return 0;
+}
+#endif
@@ -0,0 +1,111 @@
+#ifndef NN_HSNAP_INCLUDED
+#define NN_HSNAP_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "hash.h"
+
+/*  Key/value table that can be saved to a file and mapped back in one step
+    at startup instead of being rebuilt an entry at a time.
+
+    The file holds a header, an array of chain heads and a heap of packed
+    entries, each with the offset of the next entry in its chain, its 64-bit
+    hash, key and value. Every reference is an offset from the start of the
+    file, so the mapping can live at any address and is used in place:
+    loading validates the header and maps the file, nothing else, and the
+    pages are read on demand by the lookups.
+
+    The mapping is never written to. Setting or deleting a key promotes it
+    to an overlay nn_hash of heap allocated entries (a deleted mapped key
+    leaves a tombstone), and lookups check the overlay first. Saving writes
+    the merged view to a new file, which the next start maps.
+
+    Offsets are bounds checked when followed, so a damaged file can lose
+    entries but cannot make lookups read outside the mapping. Files are only
+    readable by machines of the same byte order. The store is not
+    thread-safe. */
+
+struct nn_hsnap_header;
+
+struct nn_hsnap {
+
+    /*  Mapped file, or NULL. */
+    const uint8_t *base;
+    size_t size;
+    const struct nn_hsnap_header *hdr;
+    const uint64_t *heads;
+    uint64_t mask;
+
+    /*  Promoted entries and tombstones. */
+    hash overlay;
+    hash_func op;
+
+    /*  Seed the hashes are computed with: the file's once one is loaded,
+        nn_hash64_get_seed() before. */
+    uint64_t seed;
+    size_t items;
+};
+
+/*  Initialise an empty store. */
+void nn_hsnap_init (struct nn_hsnap *self);
+
+/*  Free the overlay and unmap the file. */
+void nn_hsnap_term (struct nn_hsnap *self);
+
+/*  Map the snapshot at 'path' into an empty store. Returns 0, -errno if the
+    file cannot be opened or mapped, or -EINVAL if it is not a snapshot
+    written on a machine of this byte order. */
+int nn_hsnap_load (struct nn_hsnap *self, const char *path);
+
+/*  Find 'key'. On success stores the value in 'val' and 'vallen' and
+    returns 0; the value stays valid until the key is set or deleted, or
+    the store destroyed. Returns -ENOENT if the key is not there. */
+int nn_hsnap_get (struct nn_hsnap *self, const void *key, size_t keylen,
+    const void **val, size_t *vallen);
+
+/*  Add or replace 'key'. Returns 0 or -ENOMEM. */
+int nn_hsnap_set (struct nn_hsnap *self, const void *key, size_t keylen,
+    const void *val, size_t vallen);
+
+/*  Remove 'key'. Returns 0, -ENOENT if it is not there or -ENOMEM. */
+int nn_hsnap_del (struct nn_hsnap *self, const void *key, size_t keylen);
+
+/*  Write the contents to 'path', atomically replacing it. The store keeps
+    serving from its current mapping. Returns 0 or -errno. */
+int nn_hsnap_save (struct nn_hsnap *self, const char *path);
+
+/*  Number of keys. */
+#define nn_hsnap_count(self) ((self)->items)
+
+/*  Low level writer, for dumping other tables. Entries are streamed to a
+    temporary file next to 'path', which replaces 'path' on commit. Keys
+    must be unique. 'hint' is the expected number of entries and sizes the
+    chain array; 'seed' is the one hashes are computed with, normally
+    nn_hash64_get_seed(). */
+struct nn_hsnap_writer {
+    FILE *f;
+    char *path;
+    char *tmp;
+    uint64_t *heads;
+    uint64_t mask;
+    uint64_t seed;
+    uint64_t count;
+    uint64_t pos;
+    int err;
+};
+
+int nn_hsnap_writer_init (struct nn_hsnap_writer *self, const char *path,
+    size_t hint, uint64_t seed);
+int nn_hsnap_writer_add (struct nn_hsnap_writer *self, const void *key,
+    size_t keylen, const void *val, size_t vallen);
+
+/*  Flush, sync and rename over 'path'. Returns 0 or the first error of
+    any add; the writer is destroyed either way. */
+int nn_hsnap_writer_commit (struct nn_hsnap_writer *self);
+
+/*  Destroy the writer and remove the temporary file. */
+void nn_hsnap_writer_abort (struct nn_hsnap_writer *self);
+
+#endif
@@ -0,0 +1,295 @@
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "intern.h"
+#include "alloc.h"
+#include "atomic.h"
+#include "err.h"
+#include "hash64.h"
+#include "std.h"
+
+/*  Hash key of an interned string. Probes use one on the stack; the hash is
+    computed once so that growing the table does not hash the strings
+    again. */
+struct nn_intern_key {
+    const char *ptr;
+    size_t len;
+    uint64_t hash;
+};
+
+struct nn_intern_entry {
+    struct nn_atomic refcount;
+    struct nn_intern_key key;
+    hash_item item;
+    int tag;
+    /*  An sdshdr32 header and the string follow. */
+};
+
+#define nn_intern_entry_hdr(entry) ((struct sdshdr32*) ((entry) + 1))
+#define nn_intern_entry_str(entry) (nn_intern_entry_hdr (entry)->buf)
+#define nn_intern_entry_from_str(s) \
+    (((struct nn_intern_entry*) ((s) - sizeof (struct sdshdr32))) - 1)
+
+static uint64_t nn_intern_key_gen (const void *key)
+{
+    return ((const struct nn_intern_key*) key)->hash;
+}
+
+static int nn_intern_key_cmp (const void *key1, const void *key2)
+{
+    const struct nn_intern_key *k1 = key1;
+    const struct nn_intern_key *k2 = key2;
+
+    return k1->hash == k2->hash && k1->len == k2->len &&
+        memcmp (k1->ptr, k2->ptr, k1->len) == 0;
+}
+
+static int nn_intern_key_casecmp (const void *key1, const void *key2)
+{
+    const struct nn_intern_key *k1 = key1;
+    const struct nn_intern_key *k2 = key2;
+    size_t i;
+
+    if (k1->hash != k2->hash || k1->len != k2->len)
+        return 0;
+    for (i = 0; i != k1->len; i++)
+        if (tolower ((unsigned char) k1->ptr [i]) !=
+              tolower ((unsigned char) k2->ptr [i]))
+            return 0;
+    return 1;
+}
+
+static void nn_intern_key_init (struct nn_intern *self,
+    struct nn_intern_key *key, const void *s, size_t len)
+{
+    key->ptr = s;
+    key->len = len;
+    key->hash = (self->flags & NN_INTERN_NOCASE) ?
+        nn_hash64_case (s, len) : nn_hash64 (s, len);
+}
+
+static struct nn_intern_entry *nn_intern_entry_alloc (struct nn_intern *self,
+    const struct nn_intern_key *key)
+{
+    struct nn_intern_entry *entry;
+    struct sdshdr32 *hdr;
+
+    nn_assert (key->len <= UINT32_MAX);
+    entry = nn_malloc_tagged (sizeof (struct nn_intern_entry) +
+        sizeof (struct sdshdr32) + key->len + 1, self->tag);
+    if (nn_slow (!entry))
+        return NULL;
+
+    /*  No free space: the copy is exactly as large as the string. */
+    hdr = nn_intern_entry_hdr (entry);
+    hdr->len = (uint32_t) key->len;
+    hdr->alloc = (uint32_t) key->len;
+    hdr->flags = SDS_TYPE_32;
+    memcpy (hdr->buf, key->ptr, key->len);
+    hdr->buf [key->len] = '\0';
+
+    nn_atomic_init (&entry->refcount, 1);
+    entry->key.ptr = hdr->buf;
+    entry->key.len = key->len;
+    entry->key.hash = key->hash;
+    nn_hash_item_init (&entry->item);
+    entry->tag = self->tag;
+    return entry;
+}
+
+static void nn_intern_entry_free (struct nn_intern_entry *entry)
+{
+    nn_hash_item_term (&entry->item);
+    nn_atomic_term (&entry->refcount);
+    nn_free_tagged (entry, entry->tag);
+}
+
+void nn_intern_init (struct nn_intern *self, int flags, int tag)
+{
+    self->op.key_gen = nn_intern_key_gen;
+    self->op.key_cmp = (flags & NN_INTERN_NOCASE) ?
+        nn_intern_key_casecmp : nn_intern_key_cmp;
+    self->op.item_term = NULL;
+    nn_hash_init (&self->h);
+    nn_hash_set_op (&self->h, &self->op);
+    nn_mutex_init (&self->sync);
+    self->flags = flags;
+    self->tag = tag;
+}
+
+void nn_intern_term (struct nn_intern *self)
+{
+    nn_assert (self->h.items == 0);
+    nn_mutex_term (&self->sync);
+    nn_hash_term (&self->h);
+}
+
+sds nn_intern_get (struct nn_intern *self, const void *s, size_t len)
+{
+    struct nn_intern_key key;
+    struct nn_intern_entry *entry;
+    hash_item *it;
+
+    nn_intern_key_init (self, &key, s, len);
+    nn_mutex_lock (&self->sync);
+    it = nn_hash_get (&self->h, &key);
+    if (it) {
+        entry = nn_cont (it, struct nn_intern_entry, item);
+
+        /*  A count that reached zero stays there: the release that dropped
+            it runs without the lock and will free the copy. */
+        if (nn_fast (nn_atomic_inc_nonzero (&entry->refcount, 1) != 0)) {
+            nn_mutex_unlock (&self->sync);
+            return nn_intern_entry_str (entry);
+        }
+
+        /*  The last reference was just dropped and its owner is waiting for
+            the lock to free the copy. Leave it to them and intern a new
+            one. */
+        nn_hash_erase (&self->h, it);
+    }
+    entry = nn_intern_entry_alloc (self, &key);
+    if (nn_fast (entry != NULL))
+        nn_hash_insert (&self->h, &entry->key, &entry->item);
+    nn_mutex_unlock (&self->sync);
+    return entry ? nn_intern_entry_str (entry) : NULL;
+}
+
+sds nn_intern_find (struct nn_intern *self, const void *s, size_t len)
+{
+    struct nn_intern_key key;
+    struct nn_intern_entry *entry;
+    hash_item *it;
+    sds res = NULL;
+
+    nn_intern_key_init (self, &key, s, len);
+    nn_mutex_lock (&self->sync);
+    it = nn_hash_get (&self->h, &key);
+    if (it) {
+        entry = nn_cont (it, struct nn_intern_entry, item);
+        if (entry->refcount.n != 0)
+            res = nn_intern_entry_str (entry);
+    }
+    nn_mutex_unlock (&self->sync);
+    return res;
+}
+
+sds nn_intern_ref (sds s)
+{
+    nn_atomic_inc (&nn_intern_entry_from_str (s)->refcount, 1);
+    return s;
+}
+
+void nn_intern_release (struct nn_intern *self, sds s)
+{
+    struct nn_intern_entry *entry;
+
+    /*  Once the count is zero nobody can take a new reference, so only the
+        thread that dropped the last one gets past this point. */
+    entry = nn_intern_entry_from_str (s);
+    if (nn_atomic_dec (&entry->refcount, 1) != 1)
+        return;
+
+    nn_mutex_lock (&self->sync);
+    if (entry->item.next != NN_HASH_NOTINHASH)
+        nn_hash_erase (&self->h, &entry->item);
+    nn_mutex_unlock (&self->sync);
+    nn_intern_entry_free (entry);
+}
+
+#if defined INTERN_TEST_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+#include "thread.h"
+#include "testhelp.h"
+
+static struct nn_intern pool;
+static int mismatches;
+
+static void churn(void *arg) {
+    static const char *words[] = {"get", "set", "del", "incr", "ping"};
+    int j;
+    sds s;
+
+    (void)arg;
+    for (j = 0; j < 200000; j++) {
+        s = nn_intern_get(&pool, words[j%5], strlen(words[j%5]));
+        nn_intern_release(&pool, s);
+    }
+}
+
+/* Nobody else holds the string, so its count keeps dropping to zero. */
+static void race(void *arg) {
+    int j;
+    sds s;
+
+    (void)arg;
+    for (j = 0; j < 100000; j++) {
+        s = nn_intern_get(&pool, "race", 4);
+        if (sds_len(s) != 4 || memcmp(s, "race", 4) != 0)
+            __atomic_add_fetch(&mismatches, 1, __ATOMIC_RELAXED);
+        nn_intern_release(&pool, s);
+    }
+}
+
+int main(void) {
+    struct nn_thread threads[8];
+    sds a, b, c;
+    int j;
+
+    /* The threads below allocate concurrently. */
+    nn_alloc_init(1, 0);
+    nn_intern_init(&pool, 0, NN_ALLOC_TAG_NONE);
+    a = nn_intern_get(&pool, "hello", 5);
+    b = nn_intern_get(&pool, "hello world", 5);
+    c = nn_intern_get(&pool, "Hello", 5);
+    test_cond("Equal strings share one handle",
+        a == b && a != c && nn_intern_count(&pool) == 2 &&
+        sds_len(a) == 5 && strcmp(a, "hello") == 0);
+    test_cond("find does not create strings",
+        nn_intern_find(&pool, "hello", 5) == a &&
+        nn_intern_find(&pool, "help", 4) == NULL &&
+        nn_intern_count(&pool) == 2);
+
+    nn_intern_release(&pool, a);
+    test_cond("A string lives while referenced",
+        nn_intern_find(&pool, "hello", 5) == b);
+    nn_intern_release(&pool, nn_intern_ref(b));
+    nn_intern_release(&pool, b);
+    nn_intern_release(&pool, c);
+    test_cond("Last release frees the string",
+        nn_intern_find(&pool, "hello", 5) == NULL &&
+        nn_intern_count(&pool) == 0);
+    nn_intern_term(&pool);
+
+    nn_intern_init(&pool, NN_INTERN_NOCASE, NN_ALLOC_TAG_NONE);
+    a = nn_intern_get(&pool, "Memory", 6);
+    b = nn_intern_get(&pool, "MEMORY", 6);
+    c = nn_intern_get(&pool, "mem\0ry", 6);
+    test_cond("NOCASE pools fold case and keep the first spelling",
+        a == b && a != c && strcmp(b, "Memory") == 0 &&
+        sds_len(c) == 6 && memcmp(c, "mem\0ry", 6) == 0);
+    nn_intern_release(&pool, a);
+    nn_intern_release(&pool, b);
+    nn_intern_release(&pool, c);
+
+    a = nn_intern_get(&pool, "get", 3);
+    for (j = 0; j < 4; j++) nn_thread_init(&threads[j], churn, NULL);
+    for (j = 0; j < 4; j++) nn_thread_term(&threads[j]);
+    test_cond("Concurrent get/release keeps the pool consistent",
+        nn_intern_count(&pool) == 1 &&
+        nn_intern_find(&pool, "GET", 3) == a);
+    nn_intern_release(&pool, a);
+
+    for (j = 0; j < 8; j++) nn_thread_init(&threads[j], race, NULL);
+    for (j = 0; j < 8; j++) nn_thread_term(&threads[j]);
+    test_cond("Releasing the last reference races with get",
+        mismatches == 0 && nn_intern_count(&pool) == 0);
+    nn_intern_term(&pool);
+    test_cond("Everything is freed",
+        nn_alloc_memory_state(NN_USED_BLOCKS) == 0);
+    test_report()
+    return 0;
+}
+#endif
@@ -0,0 +1,55 @@
+#ifndef NN_INTERN_INCLUDED
+#define NN_INTERN_INCLUDED
+
+#include <stddef.h>
+
+#include "hash.h"
+#include "mutex.h"
+#include "sds.h"
+
+/*  Pool of interned strings. Interning a string returns the single shared
+    copy of it, so equal strings are equal handles and can be compared by
+    pointer instead of with sds_cmp(), and a string seen many times is stored
+    once. Handles are ordinary sds strings for reading but are immutable: they
+    must not be modified or passed to sds_free(), only to
+    nn_intern_release(). Each handle is reference counted; the copy is freed
+    when the last reference is released. The pool is thread-safe. */
+
+/*  Strings that differ only in case are the same string; the handle keeps the
+    spelling it was first interned with. */
+#define NN_INTERN_NOCASE 1
+
+struct nn_intern {
+    hash h;
+    hash_func op;
+    nn_mutex_t sync;
+    int flags;
+    int tag;
+};
+
+/*  Initialise an empty pool. Strings are accounted to allocation tag
+    'tag'. */
+void nn_intern_init (struct nn_intern *self, int flags, int tag);
+
+/*  Destroy the pool. All the handles must have been released. */
+void nn_intern_term (struct nn_intern *self);
+
+/*  Return a new reference to the interned copy of the 'len' bytes at 's',
+    creating it if needed, or NULL if out of memory. */
+sds nn_intern_get (struct nn_intern *self, const void *s, size_t len);
+
+/*  Return the interned copy of the 'len' bytes at 's' if there is one,
+    without taking a reference and without allocating. The handle is only
+    valid for as long as someone else holds a reference to it. */
+sds nn_intern_find (struct nn_intern *self, const void *s, size_t len);
+
+/*  Take one more reference to an interned string. */
+sds nn_intern_ref (sds s);
+
+/*  Drop a reference taken by nn_intern_get() or nn_intern_ref(). */
+void nn_intern_release (struct nn_intern *self, sds s);
+
+/*  Number of distinct strings in the pool. */
+#define nn_intern_count(self) ((self)->h.items)
+
+#endif
@@ -0,0 +1,445 @@
+#ifndef NN_INTRUSIVE_INCLUDED
+#define NN_INTRUSIVE_INCLUDED
+
+#if !defined __cplusplus || __cplusplus < 201703L
+#error "intrusive.h needs C++17"
+#endif
+
+/*  Typed C++ views of nn_hash and nn_list for C++ callers.
+
+        struct cmd_entry {
+            hash_item item;
+            nn_list_item lru;
+            const char *name;
+        };
+        struct cmd_hasher {
+            uint64_t operator() (const cmd_entry &e) const
+                { return nn_hash64 (e.name, strlen (e.name)); }
+            uint64_t operator() (std::string_view k) const
+                { return nn_hash64 (k.data (), k.size ()); }
+        };
+        struct cmd_eq {
+            bool operator() (const cmd_entry &a, const cmd_entry &b) const
+                { return strcmp (a.name, b.name) == 0; }
+            bool operator() (const cmd_entry &a, std::string_view k) const
+                { return k == a.name; }
+        };
+
+        nn::IntrusiveHash<cmd_entry, &cmd_entry::item, cmd_hasher, cmd_eq> h;
+        nn::IntrusiveList<cmd_entry, &cmd_entry::lru> lru;
+        cmd_entry *e = h.get (std::string_view ("get"));
+
+    The objects are linked through the same hash_item and nn_list_item
+    members as with the C API and nothing is allocated per object. The
+    difference is that the lookup, insert and erase paths are compiled into
+    the caller with the hasher and the comparison as plain inlined calls, in
+    place of the key_gen and key_cmp pointers of the hash_func table, and
+    that they take and return T& and T* rather than items to be converted
+    with nn_cont.
+
+    IntrusiveHash wraps a regular hash and keeps its layout and invariants:
+    slot arrays, growth, shrinking and incremental rehashing are those of
+    nn_hash, and the slow paths (moving buckets, resizing) are the C
+    functions, which reach the hasher through a hash_func generated for the
+    type. c_hash() therefore also works with nn_hash_scan(),
+    nn_hash_rehash_ms() and nn_hash_defrag(). The key of an item is the
+    object itself.
+
+    Hasher has to hash T and any other type used for lookups, Eq to compare
+    a stored T with T and with those types; both must be default
+    constructible and equal objects must have equal hashes. Neither
+    container owns its objects: they must be removed before they are freed
+    and before the container is destroyed, clear() helps with that. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "err.h"
+#include "hash.h"
+#include "list.h"
+
+namespace nn {
+
+template <typename T, hash_item T::*Item, typename Hasher, typename Eq>
+class IntrusiveHash {
+public:
+    IntrusiveHash ()
+    {
+        nn_hash_init (&h);
+        nn_hash_set_op (&h, &op);
+    }
+
+    ~IntrusiveHash ()
+    {
+        nn_hash_term (&h);
+    }
+
+    IntrusiveHash (const IntrusiveHash&) = delete;
+    IntrusiveHash &operator= (const IntrusiveHash&) = delete;
+
+    size_t size () const { return h.items; }
+    bool empty () const { return h.items == 0; }
+
+    /*  Add 'obj'. Returns false, leaving it out, if an equal object is
+        there already. */
+    bool insert (T &obj)
+    {
+        hash_item *item = &(obj.*Item);
+        uint64_t hv;
+
+        nn_assert (item->next == NN_HASH_NOTINHASH);
+        step ();
+        hv = Hasher {} (static_cast<const T&> (obj));
+        if (find_link (static_cast<const T&> (obj), hv))
+            return false;
+        link (obj, hv);
+        return true;
+    }
+
+    /*  Add 'obj' in place of the equal object, which is returned, or
+        nullptr if there was none. */
+    T *set (T &obj)
+    {
+        hash_item *item = &(obj.*Item);
+        hash_item **link;
+        hash_item *old;
+        uint64_t hv;
+
+        nn_assert (item->next == NN_HASH_NOTINHASH);
+        step ();
+        hv = Hasher {} (static_cast<const T&> (obj));
+        link = find_link (static_cast<const T&> (obj), hv);
+        if (!link) {
+            this->link (obj, hv);
+            return nullptr;
+        }
+        old = *link;
+        item->key = &obj;
+        item->next = old->next;
+        *link = item;
+        old->next = NN_HASH_NOTINHASH;
+        return object (old);
+    }
+
+    /*  The object equal to 'key' or nullptr. */
+    template <typename K>
+    T *get (const K &key)
+    {
+        hash_item **link;
+
+        step ();
+        link = find_link (key, Hasher {} (key));
+        return link ? object (*link) : nullptr;
+    }
+
+    /*  Remove 'obj', which must be in the table. */
+    void erase (T &obj)
+    {
+        hash_item *item = &(obj.*Item);
+        hash_item **link;
+
+        nn_assert (item->next != NN_HASH_NOTINHASH);
+        step ();
+        link = find_item (item, Hasher {} (static_cast<const T&> (obj)));
+        nn_assert (link);
+        unlink (link);
+    }
+
+    /*  Remove and return the object equal to 'key', nullptr if none. */
+    template <typename K>
+    T *erase_key (const K &key)
+    {
+        hash_item **link;
+        hash_item *item;
+
+        step ();
+        link = find_link (key, Hasher {} (key));
+        if (!link)
+            return nullptr;
+        item = *link;
+        unlink (link);
+        return object (item);
+    }
+
+    /*  Call 'fn' with every object, old buckets first as nn_hash iterators
+        do. Rehashing is paused meanwhile; 'fn' may erase the object it is
+        given but must not insert. */
+    template <typename F>
+    void for_each (F &&fn)
+    {
+        hash_item *it;
+        hash_item *next;
+        uint32_t i;
+
+        h.pauserehash++;
+        for (i = 0; i != h.oldslots; i++)
+            for (it = h.oldarray [i]; it; it = next) {
+                next = it->next;
+                fn (*object (it));
+            }
+        for (i = 0; i != h.slots; i++)
+            for (it = h.array [i]; it; it = next) {
+                next = it->next;
+                fn (*object (it));
+            }
+        h.pauserehash--;
+    }
+
+    /*  Remove every object, passing each to 'dispose' once it is out of the
+        table, so that it can be freed there. */
+    template <typename F>
+    void clear (F &&dispose)
+    {
+        drain (h.oldarray, h.oldslots, dispose);
+        drain (h.array, h.slots, dispose);
+        nn_hash_check_size (&h);
+    }
+
+    /*  The underlying hash, for the C functions that take one. Inserting
+        or erasing through it is allowed as long as the key is the object. */
+    hash *c_hash () { return &h; }
+
+private:
+    static T *object (hash_item *it)
+    {
+        return static_cast<T*> (it->key);
+    }
+
+    /*  Move a bucket per operation while rehashing, as nn_hash does. */
+    void step ()
+    {
+        if (nn_slow (h.rehashidx >= 0))
+            nn_hash_rehash_step (&h, 1);
+    }
+
+    /*  Link to the object equal to 'key' in either table, or nullptr. */
+    template <typename K>
+    hash_item **find_link (const K &key, uint64_t hv)
+    {
+        hash_item **link;
+
+        if (h.oldarray) {
+            for (link = &h.oldarray [hv & (h.oldslots - 1)]; *link;
+                  link = &(*link)->next)
+                if (Eq {} (static_cast<const T&> (*object (*link)), key))
+                    return link;
+        }
+        for (link = &h.array [hv & (h.slots - 1)]; *link;
+              link = &(*link)->next)
+            if (Eq {} (static_cast<const T&> (*object (*link)), key))
+                return link;
+        return nullptr;
+    }
+
+    /*  Link to 'item' itself, or nullptr. */
+    hash_item **find_item (hash_item *item, uint64_t hv)
+    {
+        hash_item **link;
+
+        if (h.oldarray) {
+            for (link = &h.oldarray [hv & (h.oldslots - 1)]; *link;
+                  link = &(*link)->next)
+                if (*link == item)
+                    return link;
+        }
+        for (link = &h.array [hv & (h.slots - 1)]; *link;
+              link = &(*link)->next)
+            if (*link == item)
+                return link;
+        return nullptr;
+    }
+
+    /*  New objects always go to the new table. */
+    void link (T &obj, uint64_t hv)
+    {
+        hash_item *item = &(obj.*Item);
+        hash_item **slot = &h.array [hv & (h.slots - 1)];
+
+        item->key = &obj;
+        item->next = *slot;
+        *slot = item;
+        h.items++;
+        nn_hash_check_size (&h);
+    }
+
+    void unlink (hash_item **link)
+    {
+        hash_item *item = *link;
+
+        *link = item->next;
+        item->next = NN_HASH_NOTINHASH;
+        h.items--;
+        nn_hash_check_size (&h);
+    }
+
+    template <typename F>
+    void drain (hash_item **array, uint32_t slots, F &dispose)
+    {
+        hash_item *item;
+        uint32_t i;
+
+        for (i = 0; i != slots; i++)
+            while ((item = array [i]) != NULL) {
+                array [i] = item->next;
+                item->next = NN_HASH_NOTINHASH;
+                h.items--;
+                dispose (*object (item));
+            }
+    }
+
+    /*  What the C side calls while rehashing or through c_hash(). */
+    static uint64_t key_gen (const void *key)
+    {
+        return Hasher {} (*static_cast<const T*> (key));
+    }
+
+    static int key_cmp (const void *key1, const void *key2)
+    {
+        return Eq {} (*static_cast<const T*> (key1),
+            *static_cast<const T*> (key2));
+    }
+
+    static inline hash_func op = {key_gen, key_cmp, NULL};
+
+    hash h;
+};
+
+/*  Doubly linked list of T through the nn_list_item member 'Item', with the
+    layout and semantics of nn_list and the operations inlined. */
+template <typename T, nn_list_item T::*Item = &T::item>
+class IntrusiveList {
+public:
+    class iterator {
+    public:
+        explicit iterator (nn_list_item *it) : it (it) {}
+        T &operator* () const { return *object (it); }
+        T *operator-> () const { return object (it); }
+        iterator &operator++ () { it = it->next; return *this; }
+        bool operator== (const iterator &o) const { return it == o.it; }
+        bool operator!= (const iterator &o) const { return it != o.it; }
+    private:
+        nn_list_item *it;
+    };
+
+    IntrusiveList ()
+    {
+        l.first = NULL;
+        l.last = NULL;
+    }
+
+    ~IntrusiveList ()
+    {
+        nn_assert (l.first == NULL);
+    }
+
+    IntrusiveList (const IntrusiveList&) = delete;
+    IntrusiveList &operator= (const IntrusiveList&) = delete;
+
+    bool empty () const { return l.first == NULL; }
+    T *front () const { return l.first ? object (l.first) : nullptr; }
+    T *back () const { return l.last ? object (l.last) : nullptr; }
+
+    /*  Neighbours of 'obj', nullptr at the ends. */
+    static T *next (T &obj)
+    {
+        nn_list_item *it = (obj.*Item).next;
+
+        nn_assert (it != NN_LIST_NOTINLIST);
+        return it ? object (it) : nullptr;
+    }
+
+    static T *prev (T &obj)
+    {
+        nn_list_item *it = (obj.*Item).prev;
+
+        nn_assert (it != NN_LIST_NOTINLIST);
+        return it ? object (it) : nullptr;
+    }
+
+    /*  Whether 'obj' is linked in a list. */
+    static bool linked (T &obj)
+    {
+        return (obj.*Item).prev != NN_LIST_NOTINLIST;
+    }
+
+    /*  Add 'obj' before 'before', at the end if that is nullptr. */
+    void insert (T &obj, T *before)
+    {
+        nn_list_item *item = &(obj.*Item);
+        nn_list_item *it = before ? &(before->*Item) : NULL;
+
+        nn_assert (item->prev == NN_LIST_NOTINLIST);
+        item->prev = it ? it->prev : l.last;
+        item->next = it;
+        if (item->prev)
+            item->prev->next = item;
+        if (item->next)
+            item->next->prev = item;
+        if (!l.first || l.first == it)
+            l.first = item;
+        if (!it)
+            l.last = item;
+    }
+
+    void push_back (T &obj) { insert (obj, nullptr); }
+    void push_front (T &obj) { insert (obj, front ()); }
+
+    /*  Remove 'obj' and return the object that followed it. */
+    T *erase (T &obj)
+    {
+        nn_list_item *item = &(obj.*Item);
+        nn_list_item *next;
+
+        nn_assert (item->prev != NN_LIST_NOTINLIST);
+        if (item->prev)
+            item->prev->next = item->next;
+        else
+            l.first = item->next;
+        if (item->next)
+            item->next->prev = item->prev;
+        else
+            l.last = item->prev;
+        next = item->next;
+        item->prev = NN_LIST_NOTINLIST;
+        item->next = NN_LIST_NOTINLIST;
+        return next ? object (next) : nullptr;
+    }
+
+    /*  Remove and return the first object, nullptr if the list is empty. */
+    T *pop_front ()
+    {
+        T *obj = front ();
+
+        if (obj)
+            erase (*obj);
+        return obj;
+    }
+
+    /*  Iterating is read only: erase through the value erase() returns. */
+    iterator begin () const { return iterator (l.first); }
+    iterator end () const { return iterator (NULL); }
+
+    /*  The underlying list, for the C functions that take one. */
+    nn_list *c_list () { return &l; }
+
+    static T *object (nn_list_item *it)
+    {
+        return reinterpret_cast<T*> (reinterpret_cast<char*> (it) - offset ());
+    }
+
+private:
+    /*  offsetof() for a member pointer, folded to a constant. */
+    static size_t offset ()
+    {
+        alignas (T) static const char probe [sizeof (T)] = {};
+        const T *t = reinterpret_cast<const T*> (probe);
+
+        return reinterpret_cast<const char*> (&(t->*Item)) - probe;
+    }
+
+    nn_list l;
+};
+
+}
+
+#endif
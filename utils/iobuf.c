@@ -0,0 +1,351 @@
+#include <errno.h>
+#include <string.h>
+
+#include "iobuf.h"
+#include "alloc.h"
+#include "atomic.h"
+#include "err.h"
+#include "std.h"
+
+struct nn_iobuf_seg {
+    struct nn_atomic refcount;
+    int tag;
+    size_t size;
+    /*  Data follow. */
+};
+
+#define nn_iobuf_seg_data(seg) ((char*) ((seg) + 1))
+
+/*  A segment can be written to only while one window references it. */
+#define nn_iobuf_seg_exclusive(seg) ((seg)->refcount.n == 1)
+
+static struct nn_iobuf_seg *nn_iobuf_seg_alloc (size_t size, int tag)
+{
+    struct nn_iobuf_seg *seg;
+
+    seg = nn_malloc_tagged (sizeof (struct nn_iobuf_seg) + size, tag);
+    if (nn_slow (!seg))
+        return NULL;
+    nn_atomic_init (&seg->refcount, 1);
+    seg->tag = tag;
+    seg->size = size;
+    return seg;
+}
+
+static void nn_iobuf_seg_release (struct nn_iobuf_seg *seg)
+{
+    if (nn_atomic_dec (&seg->refcount, 1) == 1) {
+        nn_atomic_term (&seg->refcount);
+        nn_free_tagged (seg, seg->tag);
+    }
+}
+
+static struct nn_iobuf_ref *nn_iobuf_ref_alloc (struct nn_iobuf *self,
+    struct nn_iobuf_seg *seg, size_t off, size_t len)
+{
+    struct nn_iobuf_ref *ref;
+
+    ref = nn_malloc_tagged (sizeof (struct nn_iobuf_ref), self->tag);
+    if (nn_slow (!ref))
+        return NULL;
+    nn_list_item_init (&ref->item);
+    ref->seg = seg;
+    ref->off = off;
+    ref->len = len;
+    return ref;
+}
+
+static void nn_iobuf_ref_free (struct nn_iobuf *self,
+    struct nn_iobuf_ref *ref)
+{
+    nn_list_erase (&self->refs, &ref->item);
+    nn_list_item_term (&ref->item);
+    nn_iobuf_seg_release (ref->seg);
+    nn_free_tagged (ref, self->tag);
+}
+
+/*  Create a window on a fresh segment and insert it before 'it'. */
+static struct nn_iobuf_ref *nn_iobuf_ref_new (struct nn_iobuf *self,
+    size_t off, struct nn_list_item *it)
+{
+    struct nn_iobuf_seg *seg;
+    struct nn_iobuf_ref *ref;
+
+    seg = nn_iobuf_seg_alloc (self->segsize, self->tag);
+    if (nn_slow (!seg))
+        return NULL;
+    ref = nn_iobuf_ref_alloc (self, seg, off, 0);
+    if (nn_slow (!ref)) {
+        nn_iobuf_seg_release (seg);
+        return NULL;
+    }
+    nn_list_insert (&self->refs, &ref->item, it);
+    return ref;
+}
+
+void nn_iobuf_init (struct nn_iobuf *self, size_t segsize, int tag)
+{
+    nn_list_init (&self->refs);
+    self->len = 0;
+    self->segsize = segsize ? segsize : NN_IOBUF_SEGSIZE;
+    self->tag = tag;
+}
+
+void nn_iobuf_term (struct nn_iobuf *self)
+{
+    nn_iobuf_clear (self);
+    nn_list_term (&self->refs);
+}
+
+void nn_iobuf_clear (struct nn_iobuf *self)
+{
+    while (!nn_list_empty (&self->refs))
+        nn_iobuf_ref_free (self, nn_cont (nn_list_begin (&self->refs),
+            struct nn_iobuf_ref, item));
+    self->len = 0;
+}
+
+void *nn_iobuf_tail (struct nn_iobuf *self, size_t *avail)
+{
+    struct nn_iobuf_ref *ref;
+
+    ref = nn_cont (self->refs.last, struct nn_iobuf_ref, item);
+    if (!ref || !nn_iobuf_seg_exclusive (ref->seg) ||
+          ref->off + ref->len == ref->seg->size) {
+        ref = nn_iobuf_ref_new (self, 0, nn_list_end (&self->refs));
+        if (nn_slow (!ref))
+            return NULL;
+    }
+    *avail = ref->seg->size - ref->off - ref->len;
+    return nn_iobuf_seg_data (ref->seg) + ref->off + ref->len;
+}
+
+void nn_iobuf_commit (struct nn_iobuf *self, size_t n)
+{
+    struct nn_iobuf_ref *ref;
+
+    if (!n)
+        return;
+    ref = nn_cont (self->refs.last, struct nn_iobuf_ref, item);
+    nn_assert (ref && ref->off + ref->len + n <= ref->seg->size);
+    ref->len += n;
+    self->len += n;
+}
+
+int nn_iobuf_append (struct nn_iobuf *self, const void *data, size_t len)
+{
+    const char *p = data;
+    size_t avail;
+    char *tail;
+
+    while (len) {
+        tail = nn_iobuf_tail (self, &avail);
+        if (nn_slow (!tail))
+            return -ENOMEM;
+        if (avail > len)
+            avail = len;
+        memcpy (tail, p, avail);
+        nn_iobuf_commit (self, avail);
+        p += avail;
+        len -= avail;
+    }
+    return 0;
+}
+
+int nn_iobuf_prepend (struct nn_iobuf *self, const void *data, size_t len)
+{
+    struct nn_iobuf_ref *ref;
+    size_t n;
+
+    /*  Fill the headroom of the first segment from the end of 'data'. New
+        segments are filled back to front, which leaves headroom for the
+        next prepend. */
+    while (len) {
+        ref = nn_cont (self->refs.first, struct nn_iobuf_ref, item);
+        if (!ref || !nn_iobuf_seg_exclusive (ref->seg) || !ref->off) {
+            ref = nn_iobuf_ref_new (self, self->segsize,
+                nn_list_begin (&self->refs));
+            if (nn_slow (!ref))
+                return -ENOMEM;
+        }
+        n = ref->off < len ? ref->off : len;
+        ref->off -= n;
+        ref->len += n;
+        memcpy (nn_iobuf_seg_data (ref->seg) + ref->off,
+            (const char*) data + len - n, n);
+        self->len += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int nn_iobuf_slice (struct nn_iobuf *dst, struct nn_iobuf *src, size_t off,
+    size_t len)
+{
+    struct nn_list_item *it;
+    struct nn_iobuf_ref *ref;
+    struct nn_iobuf_ref *copy;
+    struct nn_list_item *mark;
+    size_t n;
+
+    nn_assert (dst != src);
+    if (off > src->len || len > src->len - off)
+        return -EINVAL;
+
+    mark = dst->refs.last;
+    for (it = nn_list_begin (&src->refs);
+          len && it != nn_list_end (&src->refs);
+          it = nn_list_next (&src->refs, it)) {
+        ref = nn_cont (it, struct nn_iobuf_ref, item);
+        if (off >= ref->len) {
+            off -= ref->len;
+            continue;
+        }
+        n = ref->len - off < len ? ref->len - off : len;
+        copy = nn_iobuf_ref_alloc (dst, ref->seg, ref->off + off, n);
+        if (nn_slow (!copy))
+            goto rollback;
+        nn_atomic_inc (&ref->seg->refcount, 1);
+        nn_list_insert (&dst->refs, &copy->item, nn_list_end (&dst->refs));
+        dst->len += n;
+        len -= n;
+        off = 0;
+    }
+    return 0;
+
+rollback:
+    while (dst->refs.last != mark) {
+        copy = nn_cont (dst->refs.last, struct nn_iobuf_ref, item);
+        dst->len -= copy->len;
+        nn_iobuf_ref_free (dst, copy);
+    }
+    return -ENOMEM;
+}
+
+void nn_iobuf_consume (struct nn_iobuf *self, size_t n)
+{
+    struct nn_iobuf_ref *ref;
+
+    nn_assert (n <= self->len);
+    self->len -= n;
+    while (n) {
+        ref = nn_cont (nn_list_begin (&self->refs), struct nn_iobuf_ref,
+            item);
+        if (n < ref->len) {
+            ref->off += n;
+            ref->len -= n;
+            return;
+        }
+        n -= ref->len;
+        nn_iobuf_ref_free (self, ref);
+    }
+}
+
+size_t nn_iobuf_copy (struct nn_iobuf *self, size_t off, void *dst,
+    size_t len)
+{
+    struct nn_list_item *it;
+    struct nn_iobuf_ref *ref;
+    size_t n, copied = 0;
+
+    for (it = nn_list_begin (&self->refs);
+          len && it != nn_list_end (&self->refs);
+          it = nn_list_next (&self->refs, it)) {
+        ref = nn_cont (it, struct nn_iobuf_ref, item);
+        if (off >= ref->len) {
+            off -= ref->len;
+            continue;
+        }
+        n = ref->len - off < len ? ref->len - off : len;
+        memcpy ((char*) dst + copied,
+            nn_iobuf_seg_data (ref->seg) + ref->off + off, n);
+        copied += n;
+        len -= n;
+        off = 0;
+    }
+    return copied;
+}
+
+#if !defined NN_HAVE_WINDOWS
+int nn_iobuf_iovec (struct nn_iobuf *self, struct iovec *iov, int iovcnt)
+{
+    struct nn_list_item *it;
+    struct nn_iobuf_ref *ref;
+    int i = 0;
+
+    for (it = nn_list_begin (&self->refs);
+          i != iovcnt && it != nn_list_end (&self->refs);
+          it = nn_list_next (&self->refs, it)) {
+        ref = nn_cont (it, struct nn_iobuf_ref, item);
+        if (!ref->len)
+            continue;
+        iov [i].iov_base = nn_iobuf_seg_data (ref->seg) + ref->off;
+        iov [i].iov_len = ref->len;
+        i++;
+    }
+    return i;
+}
+#endif
+
+#if defined IOBUF_TEST_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+#include "testhelp.h"
+
+int main(void) {
+    struct nn_iobuf a, b;
+    struct iovec iov[16];
+    char data[1000], out[1000];
+    size_t total;
+    int j, n;
+
+    for (j = 0; j < (int)sizeof(data); j++) data[j] = (char)(j*7);
+    nn_iobuf_init(&a, 64, NN_ALLOC_TAG_NONE);
+    nn_iobuf_init(&b, 64, NN_ALLOC_TAG_NONE);
+
+    nn_iobuf_append(&a, data+100, 500);
+    nn_iobuf_prepend(&a, data, 100);
+    nn_iobuf_append(&a, data+600, 400);
+    test_cond("append/prepend keep the byte order",
+        nn_iobuf_len(&a) == 1000 &&
+        nn_iobuf_copy(&a, 0, out, 1000) == 1000 &&
+        memcmp(out, data, 1000) == 0);
+
+    n = nn_iobuf_iovec(&a, iov, 16);
+    for (total = 0, j = 0; j < n; j++) total += iov[j].iov_len;
+    test_cond("iovec export is capped at iovcnt", n == 16 && total < 1000);
+
+    test_cond("slice shares the range",
+        nn_iobuf_slice(&b, &a, 250, 500) == 0 && nn_iobuf_len(&b) == 500 &&
+        nn_iobuf_copy(&b, 0, out, 500) == 500 &&
+        memcmp(out, data+250, 500) == 0);
+    test_cond("slice out of range is refused",
+        nn_iobuf_slice(&b, &a, 900, 200) == -EINVAL &&
+        nn_iobuf_len(&b) == 500);
+
+    /* Writing to 'a' must not show through the shared segments of 'b'. */
+    nn_iobuf_consume(&a, 300);
+    nn_iobuf_prepend(&a, "xyz", 3);
+    nn_iobuf_append(&a, "tail", 4);
+    test_cond("shared segments are not written to",
+        nn_iobuf_copy(&b, 0, out, 500) == 500 &&
+        memcmp(out, data+250, 500) == 0 &&
+        nn_iobuf_copy(&a, 0, out, 3) == 3 && memcmp(out, "xyz", 3) == 0 &&
+        nn_iobuf_copy(&a, 3, out, 700) == 700 &&
+        memcmp(out, data+300, 700) == 0 &&
+        nn_iobuf_copy(&a, 703, out, 4) == 4 && memcmp(out, "tail", 4) == 0);
+
+    nn_iobuf_term(&a);
+    test_cond("slice outlives its source",
+        nn_iobuf_copy(&b, 0, out, 500) == 500 &&
+        memcmp(out, data+250, 500) == 0);
+    nn_iobuf_consume(&b, 500);
+    test_cond("consume of everything empties the chain",
+        nn_iobuf_len(&b) == 0 && nn_list_empty(&b.refs));
+    nn_iobuf_term(&b);
+    test_cond("segments are freed",
+        nn_alloc_memory_state(NN_USED_BLOCKS) == 0);
+    test_report()
+    return 0;
+}
+#endif
@@ -0,0 +1,80 @@
+#ifndef NN_IOBUF_INCLUDED
+#define NN_IOBUF_INCLUDED
+
+#include <stddef.h>
+
+#if !defined NN_HAVE_WINDOWS
+#include <sys/uio.h>
+#endif
+
+#include "list.h"
+
+/*  Chain of fixed-size, reference counted segments for payloads too large to
+    be grown as a single sds. Appending never moves the data already in the
+    chain, and slices share the segments instead of copying them, so the same
+    payload can be queued in several replies at once. Segments are only
+    written to while a single chain references them. A chain itself is not
+    thread-safe, the segment reference counts are. */
+
+#define NN_IOBUF_SEGSIZE (64 * 1024)
+
+struct nn_iobuf_seg;
+
+/*  A window of 'len' bytes at 'off' in 'seg'. */
+struct nn_iobuf_ref {
+    struct nn_list_item item;
+    struct nn_iobuf_seg *seg;
+    size_t off;
+    size_t len;
+};
+
+struct nn_iobuf {
+    struct nn_list refs;
+    size_t len;
+    size_t segsize;
+    int tag;
+};
+
+/*  Initialise an empty chain. Segments are 'segsize' bytes, or
+    NN_IOBUF_SEGSIZE if zero, and accounted to allocation tag 'tag'. */
+void nn_iobuf_init (struct nn_iobuf *self, size_t segsize, int tag);
+void nn_iobuf_term (struct nn_iobuf *self);
+
+/*  Number of bytes in the chain. */
+#define nn_iobuf_len(self) ((self)->len)
+
+/*  Drop the whole content. */
+void nn_iobuf_clear (struct nn_iobuf *self);
+
+/*  Copy 'len' bytes at the end or at the beginning of the chain. Return 0 or
+    -ENOMEM, in which case the chain may hold part of the data. */
+int nn_iobuf_append (struct nn_iobuf *self, const void *data, size_t len);
+int nn_iobuf_prepend (struct nn_iobuf *self, const void *data, size_t len);
+
+/*  Writable space at the end of the chain, for reading straight into it.
+    '*avail' is set to its size, at least 1. Return NULL if out of memory.
+    nn_iobuf_commit() makes the first 'n' bytes of it part of the chain. */
+void *nn_iobuf_tail (struct nn_iobuf *self, size_t *avail);
+void nn_iobuf_commit (struct nn_iobuf *self, size_t n);
+
+/*  Append 'len' bytes of 'src' starting at 'off' to 'dst' without copying
+    them; both chains then share the segments. Return 0, -EINVAL if the range
+    is out of 'src' or -ENOMEM, in which case 'dst' is unchanged. */
+int nn_iobuf_slice (struct nn_iobuf *dst, struct nn_iobuf *src, size_t off,
+    size_t len);
+
+/*  Remove 'n' bytes from the beginning of the chain. */
+void nn_iobuf_consume (struct nn_iobuf *self, size_t n);
+
+/*  Copy up to 'len' bytes starting at 'off' to 'dst'. Return the number of
+    bytes copied. */
+size_t nn_iobuf_copy (struct nn_iobuf *self, size_t off, void *dst,
+    size_t len);
+
+#if !defined NN_HAVE_WINDOWS
+/*  Describe the first 'iovcnt' pieces of the chain in 'iov', ready for
+    writev(). Return the number of entries filled. */
+int nn_iobuf_iovec (struct nn_iobuf *self, struct iovec *iov, int iovcnt);
+#endif
+
+#endif
@@ -23,6 +23,10 @@
 #ifndef NN_LIST_INCLUDED
 #define NN_LIST_INCLUDED
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 struct nn_list_item {
     struct nn_list_item *next;
     struct nn_list_item *prev;
@@ -83,4 +87,8 @@ void nn_list_item_term (struct nn_list_item *self);
 /*  Returns 1 is the item is part of a list, 0 otherwise. */
 int nn_list_item_isinlist (struct nn_list_item *self);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
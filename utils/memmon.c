@@ -0,0 +1,140 @@
+#include <string.h>
+
+#include "memmon.h"
+#include "alloc.h"
+#include "err.h"
+
+static void nn_memmon_routine (void *arg);
+
+void nn_memmon_init (struct nn_memmon *self, size_t maxmemory, int interval)
+{
+    int rc;
+
+    nn_mutex_init (&self->sync);
+    rc = nn_condvar_init (&self->cond);
+    errnum_assert (rc == 0, -rc);
+    self->running = 0;
+    self->interval = interval > 0 ? interval : NN_MEMMON_DEFAULT_INTERVAL;
+    memset (&self->stats, 0, sizeof (self->stats));
+    self->stats.maxmemory = maxmemory;
+    self->stats.state = NN_MEMMON_NORMAL;
+    self->stats.frag_ratio = 1.0;
+    self->ncallbacks = 0;
+}
+
+void nn_memmon_term (struct nn_memmon *self)
+{
+    nn_memmon_stop (self);
+    nn_condvar_term (&self->cond);
+    nn_mutex_term (&self->sync);
+}
+
+void nn_memmon_start (struct nn_memmon *self)
+{
+    nn_mutex_lock (&self->sync);
+    nn_assert (!self->running);
+    self->running = 1;
+    nn_mutex_unlock (&self->sync);
+    nn_thread_init (&self->thread, nn_memmon_routine, self);
+}
+
+void nn_memmon_stop (struct nn_memmon *self)
+{
+    int running;
+
+    nn_mutex_lock (&self->sync);
+    running = self->running;
+    self->running = 0;
+    nn_condvar_signal (&self->cond);
+    nn_mutex_unlock (&self->sync);
+    if (running)
+        nn_thread_term (&self->thread);
+}
+
+void nn_memmon_set_maxmemory (struct nn_memmon *self, size_t maxmemory)
+{
+    nn_mutex_lock (&self->sync);
+    self->stats.maxmemory = maxmemory;
+    nn_mutex_unlock (&self->sync);
+}
+
+int nn_memmon_register (struct nn_memmon *self, nn_memmon_fn *fn, void *arg)
+{
+    int rc = -1;
+
+    nn_mutex_lock (&self->sync);
+    if (self->ncallbacks < NN_MEMMON_MAX_CALLBACKS) {
+        self->callbacks [self->ncallbacks].fn = fn;
+        self->callbacks [self->ncallbacks].arg = arg;
+        self->ncallbacks++;
+        rc = 0;
+    }
+    nn_mutex_unlock (&self->sync);
+    return rc;
+}
+
+int nn_memmon_sample (struct nn_memmon *self)
+{
+    struct nn_memmon_callback callbacks [NN_MEMMON_MAX_CALLBACKS];
+    int ncallbacks = 0;
+    size_t used, rss, maxmemory;
+    int state, i;
+
+    /*  Read /proc outside of the lock, it is by far the slowest part. */
+    used = nn_alloc_memory_state (NN_USED_MEMORY);
+    rss = nn_alloc_get_rss ();
+
+    nn_mutex_lock (&self->sync);
+    maxmemory = self->stats.maxmemory;
+    state = self->stats.state;
+    if (maxmemory == 0)
+        state = NN_MEMMON_NORMAL;
+    else if (used > maxmemory)
+        state = NN_MEMMON_PRESSURE;
+    else if (used < maxmemory / 100 * NN_MEMMON_HYSTERESIS)
+        state = NN_MEMMON_NORMAL;
+
+    self->stats.used = used;
+    self->stats.rss = rss;
+    if (used > self->stats.peak)
+        self->stats.peak = used;
+    self->stats.frag_ratio = used ? (double) rss / used : 1.0;
+    self->stats.samples++;
+    if (state != self->stats.state) {
+        if (state == NN_MEMMON_PRESSURE)
+            self->stats.pressure_events++;
+        self->stats.state = state;
+        ncallbacks = self->ncallbacks;
+        memcpy (callbacks, self->callbacks, sizeof (callbacks [0]) * ncallbacks);
+    }
+    nn_mutex_unlock (&self->sync);
+
+    /*  Run the callbacks without holding the lock so that they are free to
+        query the monitor. */
+    for (i = 0; i != ncallbacks; ++i)
+        callbacks [i].fn (state, used, maxmemory, callbacks [i].arg);
+    return state;
+}
+
+void nn_memmon_stats (struct nn_memmon *self, struct nn_memmon_stats *stats)
+{
+    nn_mutex_lock (&self->sync);
+    *stats = self->stats;
+    nn_mutex_unlock (&self->sync);
+}
+
+static void nn_memmon_routine (void *arg)
+{
+    struct nn_memmon *self;
+
+    self = (struct nn_memmon*) arg;
+    nn_mutex_lock (&self->sync);
+    while (self->running) {
+        nn_mutex_unlock (&self->sync);
+        nn_memmon_sample (self);
+        nn_mutex_lock (&self->sync);
+        if (self->running)
+            nn_condvar_wait (&self->cond, &self->sync, self->interval);
+    }
+    nn_mutex_unlock (&self->sync);
+}
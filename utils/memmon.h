@@ -0,0 +1,93 @@
+#ifndef NN_MEMMON_INCLUDED
+#define NN_MEMMON_INCLUDED
+
+#include <stddef.h>
+
+#include "thread.h"
+#include "mutex.h"
+#include "condvar.h"
+
+/*  Background memory monitor. A dedicated thread samples the process RSS and
+    the bytes handed out by nn_malloc() every 'interval' milliseconds, derives
+    the fragmentation ratio (rss/used) and compares the used bytes with the
+    configured 'maxmemory'. Whenever the limit is crossed, in either
+    direction, all the registered pressure callbacks are invoked from the
+    monitor thread. Callbacks must therefore be short and thread-safe;
+    typically they just raise a flag that the event loop acts upon. */
+
+/*  Maximum number of pressure callbacks that can be registered. */
+#define NN_MEMMON_MAX_CALLBACKS 8
+
+/*  Default sampling interval in milliseconds. */
+#define NN_MEMMON_DEFAULT_INTERVAL 100
+
+/*  Once under pressure, used memory has to drop below this percentage of
+    'maxmemory' before the monitor reports the normal state again. This
+    keeps the callbacks from flapping around the limit. */
+#define NN_MEMMON_HYSTERESIS 95
+
+/*  States reported to the pressure callbacks. */
+#define NN_MEMMON_NORMAL 0
+#define NN_MEMMON_PRESSURE 1
+
+typedef void (nn_memmon_fn) (int state, size_t used, size_t maxmemory,
+    void *arg);
+
+struct nn_memmon_stats {
+    size_t used;                        /* Bytes allocated via nn_malloc() */
+    size_t rss;                         /* Resident set size */
+    size_t peak;                        /* Highest 'used' seen so far */
+    size_t maxmemory;                   /* Configured limit, 0 = unlimited */
+    double frag_ratio;                  /* rss/used of the last sample */
+    int state;                          /* NN_MEMMON_NORMAL/PRESSURE */
+    unsigned long long samples;         /* Number of samples taken */
+    unsigned long long pressure_events; /* Transitions into pressure */
+};
+
+struct nn_memmon_callback {
+    nn_memmon_fn *fn;
+    void *arg;
+};
+
+struct nn_memmon {
+    /*  NB: The fields of this structure are private to the monitor. */
+    struct nn_thread thread;
+    nn_mutex_t sync;
+    nn_condvar_t cond;
+    int running;
+    int interval;
+    struct nn_memmon_stats stats;
+    int ncallbacks;
+    struct nn_memmon_callback callbacks [NN_MEMMON_MAX_CALLBACKS];
+};
+
+/*  Initialise the monitor. 'maxmemory' of 0 disables the limit, in which
+    case the monitor only collects statistics. 'interval' <= 0 selects
+    NN_MEMMON_DEFAULT_INTERVAL. */
+void nn_memmon_init (struct nn_memmon *self, size_t maxmemory, int interval);
+
+/*  Stop the monitor thread if it is running and release the resources. */
+void nn_memmon_term (struct nn_memmon *self);
+
+/*  Launch the sampling thread. */
+void nn_memmon_start (struct nn_memmon *self);
+
+/*  Stop the sampling thread and wait for it to exit. */
+void nn_memmon_stop (struct nn_memmon *self);
+
+/*  Change the limit. Takes effect on the next sample. */
+void nn_memmon_set_maxmemory (struct nn_memmon *self, size_t maxmemory);
+
+/*  Register a pressure callback. Returns 0 on success, -1 if the callback
+    table is full. */
+int nn_memmon_register (struct nn_memmon *self, nn_memmon_fn *fn, void *arg);
+
+/*  Take one sample synchronously and fire the callbacks on a state change.
+    Called by the monitor thread; exposed so that callers without a
+    monitor thread can drive it from a timer. Returns the current state. */
+int nn_memmon_sample (struct nn_memmon *self);
+
+/*  Copy the statistics of the last sample into 'stats'. */
+void nn_memmon_stats (struct nn_memmon *self, struct nn_memmon_stats *stats);
+
+#endif
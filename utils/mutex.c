@@ -58,6 +58,74 @@ void nn_mutex_unlock (nn_mutex_t *self)
     LeaveCriticalSection (&self->cs);
 }
 
+#elif defined NN_HAVE_FUTEX
+
+#include "futex.h"
+
+/*  The mutex of Drepper, "Futexes are tricky" (2011), with the adaptive
+    spinning of glibc's PTHREAD_MUTEX_ADAPTIVE_NP in front of the sleep. */
+
+void nn_mutex_init (nn_mutex_t *self)
+{
+    self->state = 0;
+    self->spins = 0;
+}
+
+void nn_mutex_term (nn_mutex_t *self)
+{
+    /*  Make sure we don't free a locked mutex. */
+    nn_assert (self->state == 0);
+}
+
+static void nn_mutex_lock_slow (nn_mutex_t *self)
+{
+    int c;
+    int i;
+    int max;
+
+    max = nn_futex_spins (__atomic_load_n (&self->spins, __ATOMIC_RELAXED));
+    for (i = 0; i < max; i++) {
+        nn_cpu_relax ();
+        c = 0;
+        if (__atomic_load_n (&self->state, __ATOMIC_RELAXED) == 0 &&
+              __atomic_compare_exchange_n (&self->state, &c, 1, 0,
+              __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            nn_futex_spun (&self->spins, i);
+            return;
+        }
+    }
+    if (max)
+        nn_futex_spun (&self->spins, max);
+
+    /*  Mark the mutex contended so that the unlock wakes somebody, then
+        sleep until it is free. */
+    c = __atomic_exchange_n (&self->state, 2, __ATOMIC_ACQUIRE);
+    while (c != 0) {
+        nn_futex_wait (&self->state, 2, -1);
+        c = __atomic_exchange_n (&self->state, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+void nn_mutex_lock (nn_mutex_t *self)
+{
+    int c = 0;
+
+    if (nn_fast (__atomic_compare_exchange_n (&self->state, &c, 1, 0,
+          __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)))
+        return;
+    nn_mutex_lock_slow (self);
+}
+
+void nn_mutex_unlock (nn_mutex_t *self)
+{
+    int c;
+
+    c = __atomic_exchange_n (&self->state, 0, __ATOMIC_RELEASE);
+    nn_assert (c != 0);
+    if (nn_slow (c == 2))
+        nn_futex_wake (&self->state, 1);
+}
+
 #else
 
 void nn_mutex_init (nn_mutex_t *self)
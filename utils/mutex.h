@@ -23,6 +23,8 @@
 #ifndef NN_MUTEX_INCLUDED
 #define NN_MUTEX_INCLUDED
 
+#include "std.h"
+
 #ifdef WINDOWS_PLATFORM
 #include "win.h"
 #else
@@ -36,6 +38,11 @@ struct nn_mutex {
     CRITICAL_SECTION cs;
     DWORD owner;
     int debug;
+#elif defined NN_HAVE_FUTEX
+    /*  0 unlocked, 1 locked, 2 locked and someone may be sleeping on it. */
+    volatile int state;
+    /*  Rounds of spinning that recently sufficed to get the lock. */
+    int spins;
 #else
     pthread_mutex_t mutex;
 #endif
@@ -50,7 +57,8 @@ void nn_mutex_init (nn_mutex_t *self);
 void nn_mutex_term (nn_mutex_t *self);
 
 /*  Lock the mutex. Behaviour of multiple locks from the same thread is
-    undefined. */
+    undefined. With futexes a contended lock spins for a while, as long as
+    recent waits suggest the holder releases it soon, before sleeping. */
 void nn_mutex_lock (nn_mutex_t *self);
 
 /*  Unlock the mutex. Behaviour of unlocking an unlocked mutex is undefined */
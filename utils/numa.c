@@ -0,0 +1,227 @@
+#if defined __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+
+#include "numa.h"
+#include "std.h"
+
+#define NN_NUMA_MAX_CPUS 1024
+#define NN_NUMA_LONG_BITS (sizeof (unsigned long) * CHAR_BIT)
+#define NN_NUMA_MASK_LONGS (NN_NUMA_MAX_CPUS / NN_NUMA_LONG_BITS)
+
+int nn_numa_parse_cpulist (const char *list, unsigned long *mask, int nbits)
+{
+    const char *p = list;
+    char *end;
+    long lo, hi, j;
+    int count = 0;
+
+    memset (mask, 0, (nbits + NN_NUMA_LONG_BITS - 1) / NN_NUMA_LONG_BITS *
+        sizeof (unsigned long));
+    while (*p && *p != '\n') {
+        lo = strtol (p, &end, 10);
+        if (end == p || lo < 0)
+            return -1;
+        hi = lo;
+        p = end;
+        if (*p == '-') {
+            p++;
+            hi = strtol (p, &end, 10);
+            if (end == p || hi < lo)
+                return -1;
+            p = end;
+        }
+        for (j = lo; j <= hi && j < nbits; j++) {
+            if (!(mask [j / NN_NUMA_LONG_BITS] & (1UL << (j % NN_NUMA_LONG_BITS))))
+                count++;
+            mask [j / NN_NUMA_LONG_BITS] |= 1UL << (j % NN_NUMA_LONG_BITS);
+        }
+        if (*p == ',')
+            p++;
+        else if (*p && *p != '\n')
+            return -1;
+    }
+    return count;
+}
+
+#if defined __linux__
+
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+/*  From <numaif.h>, kept here to avoid depending on libnuma headers. */
+#define NN_MPOL_PREFERRED 1
+#define NN_MPOL_MF_MOVE (1 << 1)
+
+static pthread_once_t nn_numa_once = PTHREAD_ONCE_INIT;
+static int nn_numa_nnodes = 1;
+static unsigned long nn_numa_cpus [NN_NUMA_MAX_NODES] [NN_NUMA_MASK_LONGS];
+
+static int nn_numa_read_line (const char *path, char *buf, size_t len)
+{
+    FILE *fp;
+    char *rc;
+
+    fp = fopen (path, "r");
+    if (!fp)
+        return -1;
+    rc = fgets (buf, len, fp);
+    fclose (fp);
+    return rc ? 0 : -1;
+}
+
+static void nn_numa_discover (void)
+{
+    unsigned long online [NN_NUMA_MAX_NODES / NN_NUMA_LONG_BITS + 1];
+    char path [128];
+    char buf [4096];
+    int node, last = 0;
+
+    /*  Without sysfs node information treat the machine as a single node
+        owning every cpu. */
+    memset (nn_numa_cpus, 0xff, sizeof (nn_numa_cpus [0]));
+    if (nn_numa_read_line ("/sys/devices/system/node/online", buf,
+          sizeof (buf)) < 0)
+        return;
+    if (nn_numa_parse_cpulist (buf, online, NN_NUMA_MAX_NODES) <= 0)
+        return;
+    for (node = 0; node != NN_NUMA_MAX_NODES; ++node) {
+        if (!(online [node / NN_NUMA_LONG_BITS] &
+              (1UL << (node % NN_NUMA_LONG_BITS))))
+            continue;
+        last = node;
+        snprintf (path, sizeof (path),
+            "/sys/devices/system/node/node%d/cpulist", node);
+        if (nn_numa_read_line (path, buf, sizeof (buf)) < 0 ||
+              nn_numa_parse_cpulist (buf, nn_numa_cpus [node],
+              NN_NUMA_MAX_CPUS) < 0)
+            memset (nn_numa_cpus [node], 0, sizeof (nn_numa_cpus [node]));
+    }
+    nn_numa_nnodes = last + 1;
+}
+
+int nn_numa_nodes (void)
+{
+    pthread_once (&nn_numa_once, nn_numa_discover);
+    return nn_numa_nnodes;
+}
+
+int nn_numa_current_node (void)
+{
+    unsigned cpu, node;
+
+    if (syscall (SYS_getcpu, &cpu, &node, NULL) < 0)
+        return 0;
+    return (int) node;
+}
+
+int nn_numa_node_of_cpu (int cpu)
+{
+    int node;
+
+    if (cpu < 0 || cpu >= NN_NUMA_MAX_CPUS)
+        return -1;
+    pthread_once (&nn_numa_once, nn_numa_discover);
+    for (node = 0; node != nn_numa_nnodes; ++node)
+        if (nn_numa_cpus [node] [cpu / NN_NUMA_LONG_BITS] &
+              (1UL << (cpu % NN_NUMA_LONG_BITS)))
+            return node;
+    return -1;
+}
+
+int nn_numa_bind_thread (int node)
+{
+    unsigned long nodemask [NN_NUMA_MAX_NODES / NN_NUMA_LONG_BITS + 1];
+    cpu_set_t set;
+    int cpu;
+
+    if (node < 0 || node >= nn_numa_nodes ())
+        return -1;
+
+    CPU_ZERO (&set);
+    for (cpu = 0; cpu != NN_NUMA_MAX_CPUS && cpu != CPU_SETSIZE; ++cpu)
+        if (nn_numa_cpus [node] [cpu / NN_NUMA_LONG_BITS] &
+              (1UL << (cpu % NN_NUMA_LONG_BITS)))
+            CPU_SET (cpu, &set);
+    if (sched_setaffinity (0, sizeof (set), &set) < 0)
+        return -1;
+
+    /*  A single node box has nothing to prefer. */
+    if (nn_numa_nnodes == 1)
+        return 0;
+    memset (nodemask, 0, sizeof (nodemask));
+    nodemask [node / NN_NUMA_LONG_BITS] = 1UL << (node % NN_NUMA_LONG_BITS);
+    if (syscall (SYS_set_mempolicy, NN_MPOL_PREFERRED, nodemask,
+          NN_NUMA_MAX_NODES + 1) < 0)
+        return -1;
+    return 0;
+}
+
+int nn_numa_bind_memory (void *addr, size_t len, int node)
+{
+    unsigned long nodemask [NN_NUMA_MAX_NODES / NN_NUMA_LONG_BITS + 1];
+
+    if (node < 0 || node >= nn_numa_nodes ())
+        return -1;
+    if (nn_numa_nnodes == 1)
+        return 0;
+    memset (nodemask, 0, sizeof (nodemask));
+    nodemask [node / NN_NUMA_LONG_BITS] = 1UL << (node % NN_NUMA_LONG_BITS);
+    if (syscall (SYS_mbind, addr, len, NN_MPOL_PREFERRED, nodemask,
+          NN_NUMA_MAX_NODES + 1, NN_MPOL_MF_MOVE) < 0)
+        return -1;
+    return 0;
+}
+
+int nn_numa_page_node (void *addr)
+{
+    void *page;
+    int status = -1;
+
+    page = (void*) ((uintptr_t) addr & ~((uintptr_t) sysconf (_SC_PAGESIZE) - 1));
+    if (syscall (SYS_move_pages, 0, 1UL, &page, NULL, &status, 0) < 0)
+        return -1;
+    return status < 0 ? -1 : status;
+}
+
+#else
+
+int nn_numa_nodes (void)
+{
+    return 1;
+}
+
+int nn_numa_current_node (void)
+{
+    return 0;
+}
+
+int nn_numa_node_of_cpu (int cpu)
+{
+    return cpu < 0 ? -1 : 0;
+}
+
+int nn_numa_bind_thread (int node)
+{
+    return node == 0 ? 0 : -1;
+}
+
+int nn_numa_bind_memory (void *addr, size_t len, int node)
+{
+    return node == 0 ? 0 : -1;
+}
+
+int nn_numa_page_node (void *addr)
+{
+    return -1;
+}
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef NN_NUMA_INCLUDED
+#define NN_NUMA_INCLUDED
+
+#include <stddef.h>
+
+/*  NUMA topology and placement helpers. On Linux they talk to the kernel
+    directly (sysfs, sched_setaffinity, set_mempolicy, mbind, move_pages), so
+    there is no dependency on libnuma. Everywhere else the machine is
+    reported as a single node and the placement calls are no-ops. */
+
+#define NN_NUMA_MAX_NODES 64
+
+/*  Number of configured nodes, at least 1. */
+int nn_numa_nodes (void);
+
+/*  Node the calling thread is currently running on, 0 if unknown. */
+int nn_numa_current_node (void);
+
+/*  Node owning 'cpu', -1 if the cpu does not exist. */
+int nn_numa_node_of_cpu (int cpu);
+
+/*  Parse a kernel style cpu list ("0-3,8,10-11") into a bitmap of 'nbits'
+    bits. Returns the number of cpus set or -1 on a malformed list. */
+int nn_numa_parse_cpulist (const char *list, unsigned long *mask, int nbits);
+
+/*  Restrict the calling thread to the cpus of 'node' and make the node its
+    preferred source of memory, so that pages it touches first land there.
+    Returns 0 on success, -1 otherwise. */
+int nn_numa_bind_thread (int node);
+
+/*  Ask the kernel to place the pages of [addr, addr+len) on 'node'. 'addr'
+    must be page aligned. Pages already faulted in are migrated. Returns 0 on
+    success, -1 otherwise. */
+int nn_numa_bind_memory (void *addr, size_t len, int node);
+
+/*  Node currently holding the page containing 'addr', -1 if the page is not
+    faulted in or the information is unavailable. */
+int nn_numa_page_node (void *addr);
+
+#endif
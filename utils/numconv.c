@@ -0,0 +1,707 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "numconv.h"
+#include "std.h"
+
+#if defined __BYTE_ORDER__ && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define NN_NUM_SWAR
+#endif
+
+static const char nn_num_digits [201] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static const uint64_t nn_num_pow10 [20] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+    100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL,
+    10000000000000000000ULL
+};
+
+static inline int nn_num_clz64 (uint64_t v)
+{
+#if defined __GNUC__
+    return __builtin_clzll (v);
+#else
+    int n = 0;
+
+    while (!(v & (1ULL << 63))) {
+        v <<= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+/******************************************************************************/
+/*  Integers.                                                                 */
+/******************************************************************************/
+
+int nn_num_u64_len (uint64_t v)
+{
+    int t;
+
+    /*  log10(2) ~= 1233/4096 gives the length up to one, the table settles
+        it. Zero counts as one digit. */
+    v |= 1;
+    t = ((64 - nn_num_clz64 (v)) * 1233) >> 12;
+    return t + (v >= nn_num_pow10 [t]);
+}
+
+int nn_num_u64_to_str (char *dst, uint64_t v)
+{
+    int len = nn_num_u64_len (v);
+    int i = len;
+    unsigned idx;
+
+    dst [len] = '\0';
+    while (v >= 100) {
+        idx = (unsigned) (v % 100) * 2;
+        v /= 100;
+        dst [--i] = nn_num_digits [idx + 1];
+        dst [--i] = nn_num_digits [idx];
+    }
+    if (v >= 10) {
+        dst [--i] = nn_num_digits [v * 2 + 1];
+        dst [--i] = nn_num_digits [v * 2];
+    }
+    else
+        dst [--i] = (char) ('0' + v);
+    return len;
+}
+
+int nn_num_i64_to_str (char *dst, int64_t v)
+{
+    if (v >= 0)
+        return nn_num_u64_to_str (dst, (uint64_t) v);
+    dst [0] = '-';
+    return 1 + nn_num_u64_to_str (dst + 1, 0 - (uint64_t) v);
+}
+
+#if defined NN_NUM_SWAR
+
+/*  Eight ASCII digits loaded little endian into one word: check them all and
+    combine them pairwise (10), then by fours (100) and by eights (10000)
+    with three multiplications instead of eight. */
+static inline int nn_num_is_8digits (uint64_t v)
+{
+    return ((v & 0xf0f0f0f0f0f0f0f0ULL) |
+        (((v + 0x0606060606060606ULL) & 0xf0f0f0f0f0f0f0f0ULL) >> 4)) ==
+        0x3333333333333333ULL;
+}
+
+static inline uint32_t nn_num_parse_8digits (uint64_t v)
+{
+    const uint64_t mask = 0x000000ff000000ffULL;
+    const uint64_t mul1 = 0x000f424000000064ULL; /* 100 + (1000000 << 32) */
+    const uint64_t mul2 = 0x0000271000000001ULL; /* 1 + (10000 << 32) */
+
+    v -= 0x3030303030303030ULL;
+    v = (v * 10) + (v >> 8);
+    v = (((v & mask) * mul1) + (((v >> 16) & mask) * mul2)) >> 32;
+    return (uint32_t) v;
+}
+
+static inline int nn_num_is_4digits (uint32_t v)
+{
+    return ((v & 0xf0f0f0f0U) | (((v + 0x06060606U) & 0xf0f0f0f0U) >> 4)) ==
+        0x33333333U;
+}
+
+static inline uint32_t nn_num_parse_4digits (uint32_t v)
+{
+    v -= 0x30303030U;
+    v = (v * 10) + (v >> 8);
+    return ((v & 0xff) * 100) + ((v >> 16) & 0xff);
+}
+
+#endif
+
+/*  Parse up to 19 digits, which cannot overflow. */
+static inline int nn_num_parse_digits (const char *s, size_t len,
+    uint64_t *value)
+{
+    uint64_t v = 0;
+    size_t i = 0;
+#if defined NN_NUM_SWAR
+    uint64_t chunk;
+    uint32_t quad;
+
+    for (; i + 8 <= len; i += 8) {
+        memcpy (&chunk, s + i, 8);
+        if (!nn_num_is_8digits (chunk))
+            return 0;
+        v = v * 100000000 + nn_num_parse_8digits (chunk);
+    }
+    if (i + 4 <= len) {
+        memcpy (&quad, s + i, 4);
+        if (!nn_num_is_4digits (quad))
+            return 0;
+        v = v * 10000 + nn_num_parse_4digits (quad);
+        i += 4;
+    }
+#endif
+    for (; i != len; i++) {
+        if (s [i] < '0' || s [i] > '9')
+            return 0;
+        v = v * 10 + (s [i] - '0');
+    }
+    *value = v;
+    return 1;
+}
+
+static inline int nn_num_parse_u64 (const char *s, size_t len,
+    uint64_t *value)
+{
+    unsigned d;
+
+    if (len == 0 || len > 20 || (s [0] == '0' && len != 1))
+        return 0;
+    if (!nn_num_parse_digits (s, len < 19 ? len : 19, value))
+        return 0;
+    if (len == 20) {
+        d = (unsigned) (s [19] - '0');
+        if (d > 9 || *value > (UINT64_MAX - d) / 10)
+            return 0;
+        *value = *value * 10 + d;
+    }
+    return 1;
+}
+
+int nn_num_str_to_u64 (const char *s, size_t len, uint64_t *value)
+{
+    uint64_t v;
+
+    if (!nn_num_parse_u64 (s, len, &v))
+        return 0;
+    if (value)
+        *value = v;
+    return 1;
+}
+
+int nn_num_str_to_i64 (const char *s, size_t len, int64_t *value)
+{
+    uint64_t v;
+    int negative = 0;
+
+    if (len && s [0] == '-') {
+        negative = 1;
+        s++;
+        len--;
+        /*  "-0" is not a canonical integer. */
+        if (len && s [0] == '0')
+            return 0;
+    }
+    if (!nn_num_parse_u64 (s, len, &v))
+        return 0;
+    if (negative) {
+        if (v > (uint64_t) INT64_MAX + 1)
+            return 0;
+        if (value)
+            *value = v == (uint64_t) INT64_MAX + 1 ? INT64_MIN : -(int64_t) v;
+    }
+    else {
+        if (v > INT64_MAX)
+            return 0;
+        if (value)
+            *value = (int64_t) v;
+    }
+    return 1;
+}
+
+/******************************************************************************/
+/*  Doubles: Grisu3 as described by Florian Loitsch in "Printing             */
+/*  Floating-Point Numbers Quickly and Accurately with Integers".            */
+/******************************************************************************/
+
+/*  f * 2^e */
+struct nn_num_fp {
+    uint64_t f;
+    int e;
+};
+
+/*  Cached powers of ten 10^k, k = -348, -340, ..., 340, as normalized 64
+    bit significands rounded to nearest with their binary exponents. */
+struct nn_num_cached_power {
+    uint64_t f;
+    int16_t e;
+    int16_t k;
+};
+
+static const struct nn_num_cached_power nn_num_cached_powers [] = {
+    {0xfa8fd5a0081c0288ULL, -1220, -348},
+    {0xbaaee17fa23ebf76ULL, -1193, -340},
+    {0x8b16fb203055ac76ULL, -1166, -332},
+    {0xcf42894a5dce35eaULL, -1140, -324},
+    {0x9a6bb0aa55653b2dULL, -1113, -316},
+    {0xe61acf033d1a45dfULL, -1087, -308},
+    {0xab70fe17c79ac6caULL, -1060, -300},
+    {0xff77b1fcbebcdc4fULL, -1034, -292},
+    {0xbe5691ef416bd60cULL, -1007, -284},
+    {0x8dd01fad907ffc3cULL, -980, -276},
+    {0xd3515c2831559a83ULL, -954, -268},
+    {0x9d71ac8fada6c9b5ULL, -927, -260},
+    {0xea9c227723ee8bcbULL, -901, -252},
+    {0xaecc49914078536dULL, -874, -244},
+    {0x823c12795db6ce57ULL, -847, -236},
+    {0xc21094364dfb5637ULL, -821, -228},
+    {0x9096ea6f3848984fULL, -794, -220},
+    {0xd77485cb25823ac7ULL, -768, -212},
+    {0xa086cfcd97bf97f4ULL, -741, -204},
+    {0xef340a98172aace5ULL, -715, -196},
+    {0xb23867fb2a35b28eULL, -688, -188},
+    {0x84c8d4dfd2c63f3bULL, -661, -180},
+    {0xc5dd44271ad3cdbaULL, -635, -172},
+    {0x936b9fcebb25c996ULL, -608, -164},
+    {0xdbac6c247d62a584ULL, -582, -156},
+    {0xa3ab66580d5fdaf6ULL, -555, -148},
+    {0xf3e2f893dec3f126ULL, -529, -140},
+    {0xb5b5ada8aaff80b8ULL, -502, -132},
+    {0x87625f056c7c4a8bULL, -475, -124},
+    {0xc9bcff6034c13053ULL, -449, -116},
+    {0x964e858c91ba2655ULL, -422, -108},
+    {0xdff9772470297ebdULL, -396, -100},
+    {0xa6dfbd9fb8e5b88fULL, -369, -92},
+    {0xf8a95fcf88747d94ULL, -343, -84},
+    {0xb94470938fa89bcfULL, -316, -76},
+    {0x8a08f0f8bf0f156bULL, -289, -68},
+    {0xcdb02555653131b6ULL, -263, -60},
+    {0x993fe2c6d07b7facULL, -236, -52},
+    {0xe45c10c42a2b3b06ULL, -210, -44},
+    {0xaa242499697392d3ULL, -183, -36},
+    {0xfd87b5f28300ca0eULL, -157, -28},
+    {0xbce5086492111aebULL, -130, -20},
+    {0x8cbccc096f5088ccULL, -103, -12},
+    {0xd1b71758e219652cULL, -77, -4},
+    {0x9c40000000000000ULL, -50, 4},
+    {0xe8d4a51000000000ULL, -24, 12},
+    {0xad78ebc5ac620000ULL, 3, 20},
+    {0x813f3978f8940984ULL, 30, 28},
+    {0xc097ce7bc90715b3ULL, 56, 36},
+    {0x8f7e32ce7bea5c70ULL, 83, 44},
+    {0xd5d238a4abe98068ULL, 109, 52},
+    {0x9f4f2726179a2245ULL, 136, 60},
+    {0xed63a231d4c4fb27ULL, 162, 68},
+    {0xb0de65388cc8ada8ULL, 189, 76},
+    {0x83c7088e1aab65dbULL, 216, 84},
+    {0xc45d1df942711d9aULL, 242, 92},
+    {0x924d692ca61be758ULL, 269, 100},
+    {0xda01ee641a708deaULL, 295, 108},
+    {0xa26da3999aef774aULL, 322, 116},
+    {0xf209787bb47d6b85ULL, 348, 124},
+    {0xb454e4a179dd1877ULL, 375, 132},
+    {0x865b86925b9bc5c2ULL, 402, 140},
+    {0xc83553c5c8965d3dULL, 428, 148},
+    {0x952ab45cfa97a0b3ULL, 455, 156},
+    {0xde469fbd99a05fe3ULL, 481, 164},
+    {0xa59bc234db398c25ULL, 508, 172},
+    {0xf6c69a72a3989f5cULL, 534, 180},
+    {0xb7dcbf5354e9beceULL, 561, 188},
+    {0x88fcf317f22241e2ULL, 588, 196},
+    {0xcc20ce9bd35c78a5ULL, 614, 204},
+    {0x98165af37b2153dfULL, 641, 212},
+    {0xe2a0b5dc971f303aULL, 667, 220},
+    {0xa8d9d1535ce3b396ULL, 694, 228},
+    {0xfb9b7cd9a4a7443cULL, 720, 236},
+    {0xbb764c4ca7a44410ULL, 747, 244},
+    {0x8bab8eefb6409c1aULL, 774, 252},
+    {0xd01fef10a657842cULL, 800, 260},
+    {0x9b10a4e5e9913129ULL, 827, 268},
+    {0xe7109bfba19c0c9dULL, 853, 276},
+    {0xac2820d9623bf429ULL, 880, 284},
+    {0x80444b5e7aa7cf85ULL, 907, 292},
+    {0xbf21e44003acdd2dULL, 933, 300},
+    {0x8e679c2f5e44ff8fULL, 960, 308},
+    {0xd433179d9c8cb841ULL, 986, 316},
+    {0x9e19db92b4e31ba9ULL, 1013, 324},
+    {0xeb96bf6ebadf77d9ULL, 1039, 332},
+    {0xaf87023b9bf0ee6bULL, 1066, 340}
+};
+
+#define NN_NUM_CACHED_OFFSET 348
+#define NN_NUM_CACHED_STEP 8
+
+/*  Window for the binary exponent of the scaled value. */
+#define NN_NUM_MIN_TARGET_EXP (-60)
+
+static inline struct nn_num_fp nn_num_fp_normalize (struct nn_num_fp x)
+{
+    int shift = nn_num_clz64 (x.f);
+
+    x.f <<= shift;
+    x.e -= shift;
+    return x;
+}
+
+/*  Product of two normalized values, rounded to 64 bits. */
+static inline struct nn_num_fp nn_num_fp_mul (struct nn_num_fp x,
+    struct nn_num_fp y)
+{
+    const uint64_t m32 = 0xffffffffULL;
+    uint64_t a = x.f >> 32, b = x.f & m32, c = y.f >> 32, d = y.f & m32;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t tmp = (bd >> 32) + (ad & m32) + (bc & m32) + (1ULL << 31);
+    struct nn_num_fp r;
+
+    r.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+    r.e = x.e + y.e + 64;
+    return r;
+}
+
+/*  Pick the cached power 10^k bringing 'e' + 64 into the target window. */
+static void nn_num_cached_power (int e, struct nn_num_fp *power, int *k)
+{
+    int min_exp = NN_NUM_MIN_TARGET_EXP - (e + 64);
+    int dk, idx;
+
+    /*  ceil(min_exp * log10(2)) */
+    dk = (int) ((min_exp + 63) * 0.30102999566398114);
+    if ((min_exp + 63) * 0.30102999566398114 > dk)
+        dk++;
+    idx = (NN_NUM_CACHED_OFFSET + dk - 1) / NN_NUM_CACHED_STEP + 1;
+    power->f = nn_num_cached_powers [idx].f;
+    power->e = nn_num_cached_powers [idx].e;
+    *k = nn_num_cached_powers [idx].k;
+}
+
+static int nn_num_round_weed (char *buf, int len, uint64_t dist_high_w,
+    uint64_t unsafe, uint64_t rest, uint64_t ten_kappa, uint64_t unit)
+{
+    uint64_t small = dist_high_w - unit;
+    uint64_t big = dist_high_w + unit;
+
+    while (rest < small && unsafe - rest >= ten_kappa &&
+          (rest + ten_kappa < small ||
+          small - rest >= rest + ten_kappa - small)) {
+        buf [len - 1]--;
+        rest += ten_kappa;
+    }
+    if (rest < big && unsafe - rest >= ten_kappa &&
+          (rest + ten_kappa < big || big - rest > rest + ten_kappa - big))
+        return 0;
+    return 2 * unit <= rest && rest <= unsafe - 4 * unit;
+}
+
+/*  Generate the shortest digits of 'w' within (low, high). Return 0 if the
+    result cannot be proven to be the shortest and closest. */
+static int nn_num_digit_gen (struct nn_num_fp low, struct nn_num_fp w,
+    struct nn_num_fp high, char *buf, int *len, int *kappa)
+{
+    uint64_t unit = 1;
+    uint64_t too_low = low.f - unit;
+    uint64_t too_high = high.f + unit;
+    uint64_t unsafe = too_high - too_low;
+    int shift = -w.e;
+    uint64_t one = 1ULL << shift;
+    uint32_t integrals = (uint32_t) (too_high >> shift);
+    uint64_t fractionals = too_high & (one - 1);
+    uint64_t rest;
+    uint32_t divisor = 1;
+    int digit;
+
+    *kappa = 1;
+    while ((uint64_t) divisor * 10 <= integrals) {
+        divisor *= 10;
+        (*kappa)++;
+    }
+    *len = 0;
+    while (*kappa > 0) {
+        digit = (int) (integrals / divisor);
+        buf [(*len)++] = (char) ('0' + digit);
+        integrals %= divisor;
+        (*kappa)--;
+        rest = ((uint64_t) integrals << shift) + fractionals;
+        if (rest < unsafe)
+            return nn_num_round_weed (buf, *len, too_high - w.f, unsafe,
+                rest, (uint64_t) divisor << shift, unit);
+        divisor /= 10;
+    }
+    for (;;) {
+        fractionals *= 10;
+        unit *= 10;
+        unsafe *= 10;
+        digit = (int) (fractionals >> shift);
+        buf [(*len)++] = (char) ('0' + digit);
+        fractionals &= one - 1;
+        (*kappa)--;
+        if (fractionals < unsafe)
+            return nn_num_round_weed (buf, *len, (too_high - w.f) * unit,
+                unsafe, fractionals, one, unit);
+    }
+}
+
+/*  Digits of a finite, positive 'v' and the decimal exponent K such that
+    v = digits * 10^K. Return the number of digits, 0 if Grisu3 fails. */
+static int nn_num_grisu3 (double v, char *buf, int *K)
+{
+    struct nn_num_fp w, plus, minus, power;
+    uint64_t bits, sig;
+    int biased, len, kappa, k;
+
+    memcpy (&bits, &v, sizeof (bits));
+    sig = bits & ((1ULL << 52) - 1);
+    biased = (int) ((bits >> 52) & 0x7ff);
+    if (biased) {
+        w.f = sig | (1ULL << 52);
+        w.e = biased - 1075;
+    }
+    else {
+        w.f = sig;
+        w.e = -1074;
+    }
+
+    /*  Boundaries halfway to the neighbouring doubles. The lower one is
+        closer when the significand is a power of two. */
+    plus.f = (w.f << 1) + 1;
+    plus.e = w.e - 1;
+    plus = nn_num_fp_normalize (plus);
+    if (sig == 0 && biased > 1) {
+        minus.f = (w.f << 2) - 1;
+        minus.e = w.e - 2;
+    }
+    else {
+        minus.f = (w.f << 1) - 1;
+        minus.e = w.e - 1;
+    }
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+    w = nn_num_fp_normalize (w);
+
+    nn_num_cached_power (w.e, &power, &k);
+    w = nn_num_fp_mul (w, power);
+    minus = nn_num_fp_mul (minus, power);
+    plus = nn_num_fp_mul (plus, power);
+    if (!nn_num_digit_gen (minus, w, plus, buf, &len, &kappa))
+        return 0;
+    *K = kappa - k;
+    return len;
+}
+
+static int nn_num_roundtrips (double v, int prec, char *tmp, size_t size)
+{
+    snprintf (tmp, size, "%.*e", prec - 1, v);
+    return strtod (tmp, NULL) == v;
+}
+
+/*  Slow path: the shortest %e precision that reads back to 'v'. Grisu3
+    gives up close to 17 digits, so start from 15 and move from there;
+    round tripping is monotonic in the precision. */
+static int nn_num_dtoa_fallback (double v, char *buf, int *K)
+{
+    char tmp [40];
+    char *p;
+    int prec, len, exp;
+
+    if (nn_num_roundtrips (v, 15, tmp, sizeof (tmp))) {
+        for (prec = 14; prec && nn_num_roundtrips (v, prec, tmp,
+              sizeof (tmp)); prec--);
+        nn_num_roundtrips (v, prec + 1, tmp, sizeof (tmp));
+    }
+    else if (!nn_num_roundtrips (v, 16, tmp, sizeof (tmp)))
+        nn_num_roundtrips (v, 17, tmp, sizeof (tmp));
+    len = 0;
+    for (p = tmp; *p != 'e'; p++)
+        if (*p != '.')
+            buf [len++] = *p;
+    exp = atoi (p + 1);
+    while (len > 1 && buf [len - 1] == '0')
+        len--;
+    *K = exp - len + 1;
+    return len;
+}
+
+int nn_num_double_to_str (char *dst, double v)
+{
+    char digits [18];
+    char *p = dst;
+    uint64_t bits;
+    int len, K, point, exp, i;
+
+    if (v != v) {
+        strcpy (dst, "nan");
+        return 3;
+    }
+    memcpy (&bits, &v, sizeof (bits));
+    if (bits >> 63) {
+        *p++ = '-';
+        v = -v;
+    }
+    if (v == 0) {
+        strcpy (p, "0");
+        return (int) (p - dst) + 1;
+    }
+    if (v > 1.7976931348623157e308) {
+        strcpy (p, "inf");
+        return (int) (p - dst) + 3;
+    }
+
+    len = nn_num_grisu3 (v, digits, &K);
+    if (nn_slow (!len))
+        len = nn_num_dtoa_fallback (v, digits, &K);
+
+    /*  'point' is where the decimal point goes relative to the digits. */
+    point = len + K;
+    if (point >= -3 && point <= 17) {
+        if (point <= 0) {
+            *p++ = '0';
+            *p++ = '.';
+            for (i = point; i != 0; i++)
+                *p++ = '0';
+            memcpy (p, digits, len);
+            p += len;
+        }
+        else if (point < len) {
+            memcpy (p, digits, point);
+            p += point;
+            *p++ = '.';
+            memcpy (p, digits + point, len - point);
+            p += len - point;
+        }
+        else {
+            memcpy (p, digits, len);
+            p += len;
+            for (i = len; i != point; i++)
+                *p++ = '0';
+        }
+    }
+    else {
+        *p++ = digits [0];
+        if (len > 1) {
+            *p++ = '.';
+            memcpy (p, digits + 1, len - 1);
+            p += len - 1;
+        }
+        exp = point - 1;
+        *p++ = 'e';
+        *p++ = exp < 0 ? '-' : '+';
+        if (exp < 0)
+            exp = -exp;
+        if (exp >= 100) {
+            *p++ = (char) ('0' + exp / 100);
+            exp %= 100;
+        }
+        *p++ = nn_num_digits [exp * 2];
+        *p++ = nn_num_digits [exp * 2 + 1];
+    }
+    *p = '\0';
+    return (int) (p - dst);
+}
+
+#if defined NUMCONV_TEST_MAIN
+#include <limits.h>
+#include "testhelp.h"
+
+static uint64_t testRand(void) {
+    static uint64_t x = 88172645463325252ULL;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return x;
+}
+
+/* Reference: length of the shortest %e precision that round trips. */
+static int shortestDigits(double v) {
+    char tmp[40];
+    int prec;
+
+    for (prec = 1; prec < 17; prec++) {
+        snprintf(tmp, sizeof(tmp), "%.*e", prec-1, v);
+        if (strtod(tmp, NULL) == v) break;
+    }
+    return prec;
+}
+
+static int countDigits(const char *s) {
+    int n = 0, lead = 1;
+
+    for (; *s && *s != 'e'; s++) {
+        if (*s < '0' || *s > '9') continue;
+        if (lead && *s == '0') continue;
+        lead = 0;
+        n++;
+    }
+    /* Trailing zeros of an integer are not significant. */
+    for (s--; n > 1 && *s == '0'; s--) n--;
+    return n;
+}
+
+int main(void) {
+    char buf[NN_NUM_DSTR_SIZE], ref[64];
+    int j, ok;
+
+    for (ok = 1, j = 0; j < 1000000; j++) {
+        uint64_t u = testRand() >> (testRand() % 64);
+        int64_t i = (int64_t)testRand() >> (testRand() % 64);
+        uint64_t pu;
+        int64_t pi;
+
+        snprintf(ref, sizeof(ref), "%llu", (unsigned long long)u);
+        if (nn_num_u64_to_str(buf, u) != (int)strlen(ref) ||
+            strcmp(buf, ref) != 0 ||
+            !nn_num_str_to_u64(buf, strlen(buf), &pu) || pu != u) ok = 0;
+        snprintf(ref, sizeof(ref), "%lld", (long long)i);
+        if (nn_num_i64_to_str(buf, i) != (int)strlen(ref) ||
+            strcmp(buf, ref) != 0 ||
+            !nn_num_str_to_i64(buf, strlen(buf), &pi) || pi != i) ok = 0;
+    }
+    test_cond("integers format like printf and parse back", ok);
+
+    nn_num_i64_to_str(buf, INT64_MIN);
+    test_cond("INT64_MIN", strcmp(buf, "-9223372036854775808") == 0);
+    test_cond("integer edge cases",
+        nn_num_str_to_u64("18446744073709551615", 20, NULL) &&
+        !nn_num_str_to_u64("18446744073709551616", 20, NULL) &&
+        nn_num_str_to_i64("-9223372036854775808", 20, NULL) &&
+        !nn_num_str_to_i64("9223372036854775808", 19, NULL) &&
+        !nn_num_str_to_i64("-0", 2, NULL) &&
+        !nn_num_str_to_i64("01", 2, NULL) &&
+        !nn_num_str_to_i64("-", 1, NULL) &&
+        !nn_num_str_to_i64("", 0, NULL) &&
+        !nn_num_str_to_i64("1234567a", 8, NULL) &&
+        !nn_num_str_to_i64("12345678:", 9, NULL) &&
+        !nn_num_str_to_i64(" 1", 2, NULL) &&
+        nn_num_str_to_i64("0", 1, NULL));
+
+    for (ok = 1, j = 0; j < 200000; j++) {
+        uint64_t bits = testRand();
+        double v;
+
+        /* Every other value is in the fixed notation range. */
+        if (j & 1)
+            v = (double)(testRand() >> 11) / (double)(1ULL << (testRand()%64));
+        else
+            memcpy(&v, &bits, sizeof(v));
+        if (v != v || v - v != 0) continue;
+        nn_num_double_to_str(buf, v);
+        if (strtod(buf, NULL) != v || countDigits(buf) != shortestDigits(v)) {
+            printf("%.17g -> %s\n", v, buf);
+            ok = 0;
+            break;
+        }
+    }
+    test_cond("doubles round trip with the fewest digits", ok);
+
+    nn_num_double_to_str(buf, 0.1);
+    test_cond("0.1", strcmp(buf, "0.1") == 0);
+    nn_num_double_to_str(buf, 1e21);
+    test_cond("1e21", strcmp(buf, "1e+21") == 0);
+    nn_num_double_to_str(buf, 123456.0);
+    test_cond("123456", strcmp(buf, "123456") == 0);
+    nn_num_double_to_str(buf, -0.0001);
+    test_cond("-0.0001", strcmp(buf, "-0.0001") == 0);
+    nn_num_double_to_str(buf, 5e-324);
+    test_cond("5e-324", strcmp(buf, "5e-324") == 0);
+    nn_num_double_to_str(buf, 1.7976931348623157e308);
+    test_cond("DBL_MAX", strcmp(buf, "1.7976931348623157e+308") == 0);
+    test_report()
+    return 0;
+}
+#endif
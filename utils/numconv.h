@@ -0,0 +1,44 @@
+#ifndef NN_NUMCONV_INCLUDED
+#define NN_NUMCONV_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*  Integer and floating point conversions to and from decimal text.
+    Integers are formatted two digits at a time from a lookup table and
+    parsed eight digits at a time with SWAR arithmetic. Doubles are printed
+    with the fewest digits that read back to the same value (Grisu3, with a
+    printf based fallback for the rare inputs Grisu3 cannot decide). */
+
+/*  Buffer sizes, terminator included. */
+#define NN_NUM_LLSTR_SIZE 21
+#define NN_NUM_DSTR_SIZE 32
+
+/*  Write the decimal representation of 'v' followed by a terminator to
+    'dst'. Return its length. */
+int nn_num_u64_to_str (char *dst, uint64_t v);
+int nn_num_i64_to_str (char *dst, int64_t v);
+
+/*  Number of decimal digits of 'v'. */
+int nn_num_u64_len (uint64_t v);
+
+/*  Parse exactly 'len' bytes as a decimal integer: an optional '-' (signed
+    only) and digits without leading zeros. Return 1 and store the result in
+    '*value' if not NULL, 0 on malformed input or overflow. */
+int nn_num_str_to_u64 (const char *s, size_t len, uint64_t *value);
+int nn_num_str_to_i64 (const char *s, size_t len, int64_t *value);
+
+/*  Shortest representation of 'v' that parses back to the same double, in
+    the style of printf's %g: exponent notation below 1e-4 and from 1e17 up.
+    "inf", "-inf" and "nan" for the special values. Return its length. */
+int nn_num_double_to_str (char *dst, double v);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -20,10 +20,14 @@
     IN THE SOFTWARE.
 */
 
+#include <errno.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "queue.h"
+#include "alloc.h"
 #include "err.h"
+#include "std.h"
 
 void nn_queue_init (struct nn_queue *self)
 {
@@ -107,3 +111,190 @@ int nn_queue_item_isinqueue (struct nn_queue_item *self)
     return self->next == NN_QUEUE_NOTINQUEUE ? 0 : 1;
 }
 
+
+int nn_mpmc_init (struct nn_mpmc *self, size_t capacity)
+{
+    size_t n = 2;
+    size_t i;
+
+    while (n < capacity)
+        n *= 2;
+    self->mem = nn_malloc (n * sizeof (struct nn_mpmc_cell) + NN_MPMC_LINE -
+        1);
+    if (nn_slow (!self->mem))
+        return -ENOMEM;
+    self->cells = (struct nn_mpmc_cell*) (((uintptr_t) self->mem +
+        NN_MPMC_LINE - 1) & ~(uintptr_t) (NN_MPMC_LINE - 1));
+    self->mask = n - 1;
+    for (i = 0; i != n; i++) {
+        self->cells [i].seq = i;
+        self->cells [i].data = NULL;
+    }
+    self->head = 0;
+    self->tail = 0;
+    return 0;
+}
+
+void nn_mpmc_term (struct nn_mpmc *self)
+{
+    nn_free (self->mem);
+    self->mem = NULL;
+    self->cells = NULL;
+}
+
+int nn_mpmc_push (struct nn_mpmc *self, void *item)
+{
+    struct nn_mpmc_cell *cell;
+    size_t pos;
+    size_t seq;
+
+    nn_assert (item);
+    pos = __atomic_load_n (&self->head, __ATOMIC_RELAXED);
+    while (1) {
+        cell = &self->cells [pos & self->mask];
+        seq = __atomic_load_n (&cell->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos) {
+            if (__atomic_compare_exchange_n (&self->head, &pos, pos + 1, 1,
+                  __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if ((intptr_t) (seq - pos) < 0) {
+
+            /*  The cell still holds the item pushed a lap ago. */
+            return -EAGAIN;
+        }
+        else
+            pos = __atomic_load_n (&self->head, __ATOMIC_RELAXED);
+    }
+    cell->data = item;
+    __atomic_store_n (&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void *nn_mpmc_pop (struct nn_mpmc *self)
+{
+    struct nn_mpmc_cell *cell;
+    void *item;
+    size_t pos;
+    size_t seq;
+
+    pos = __atomic_load_n (&self->tail, __ATOMIC_RELAXED);
+    while (1) {
+        cell = &self->cells [pos & self->mask];
+        seq = __atomic_load_n (&cell->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos + 1) {
+            if (__atomic_compare_exchange_n (&self->tail, &pos, pos + 1, 1,
+                  __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if ((intptr_t) (seq - (pos + 1)) < 0) {
+
+            /*  Nothing has been pushed to the cell in this lap. */
+            return NULL;
+        }
+        else
+            pos = __atomic_load_n (&self->tail, __ATOMIC_RELAXED);
+    }
+    item = cell->data;
+
+    /*  Hand the cell to the producer of the next lap. */
+    __atomic_store_n (&cell->seq, pos + self->mask + 1, __ATOMIC_RELEASE);
+    return item;
+}
+
+size_t nn_mpmc_size (struct nn_mpmc *self)
+{
+    size_t head = __atomic_load_n (&self->head, __ATOMIC_RELAXED);
+    size_t tail = __atomic_load_n (&self->tail, __ATOMIC_RELAXED);
+
+    return head > tail ? head - tail : 0;
+}
+
+#if defined QUEUE_TEST_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include "thread.h"
+#include "testhelp.h"
+
+#define THREADS 4
+#define PER_THREAD 200000
+
+static struct nn_mpmc q;
+static uint64_t consumed[THREADS];
+static int ordered[THREADS];
+
+/* Items are (producer << 32 | sequence) + 1 so that none is NULL. */
+static void producer(void *arg) {
+    uint64_t id = (uintptr_t)arg, j;
+
+    for (j = 0; j < PER_THREAD; j++)
+        while (nn_mpmc_push(&q, (void *)(uintptr_t)((id << 32 | j) + 1)) != 0)
+            sched_yield();
+}
+
+/* Sums what it pops and checks that each producer's items come in order. */
+static void consumer(void *arg) {
+    int me = (int)(uintptr_t)arg, n = 0;
+    uint64_t v, last[THREADS];
+    void *item;
+
+    for (v = 0; v < THREADS; v++) last[v] = 0;
+    ordered[me] = 1;
+    while (n < PER_THREAD) {
+        if ((item = nn_mpmc_pop(&q)) == NULL) {
+            sched_yield();
+            continue;
+        }
+        v = (uint64_t)(uintptr_t)item - 1;
+        if (last[v >> 32] > (v & 0xffffffff) + 1) ordered[me] = 0;
+        last[v >> 32] = (v & 0xffffffff) + 1;
+        consumed[me] += v & 0xffffffff;
+        n++;
+    }
+}
+
+int main(void) {
+    struct nn_thread threads[2*THREADS];
+    uint64_t sum = 0;
+    int j, ok;
+
+    test_cond("Init rounds up", nn_mpmc_init(&q, 5) == 0 && q.mask == 7 &&
+        ((uintptr_t)q.cells & 63) == 0 && nn_mpmc_pop(&q) == NULL);
+
+    /* Several laps around the ring. */
+    for (j = 0, ok = 1; j < 100 && ok; j++) {
+        ok = nn_mpmc_push(&q, (void *)(uintptr_t)(j + 1)) == 0 &&
+            nn_mpmc_push(&q, (void *)(uintptr_t)(j + 2)) == 0 &&
+            nn_mpmc_size(&q) == 2 &&
+            nn_mpmc_pop(&q) == (void *)(uintptr_t)(j + 1) &&
+            nn_mpmc_pop(&q) == (void *)(uintptr_t)(j + 2);
+    }
+    test_cond("FIFO across laps", ok && nn_mpmc_pop(&q) == NULL);
+
+    for (j = 0, ok = 1; j < 8 && ok; j++)
+        ok = nn_mpmc_push(&q, (void *)(uintptr_t)(j + 1)) == 0;
+    test_cond("Full", ok && nn_mpmc_push(&q, (void *)1) == -EAGAIN &&
+        nn_mpmc_pop(&q) == (void *)1 && nn_mpmc_push(&q, (void *)9) == 0);
+    while (nn_mpmc_pop(&q));
+    nn_mpmc_term(&q);
+
+    /* A small ring keeps both sides wrapping and hitting full and empty. */
+    nn_mpmc_init(&q, 64);
+    for (j = 0; j < THREADS; j++) {
+        nn_thread_init(&threads[j], consumer, (void *)(uintptr_t)j);
+        nn_thread_init(&threads[THREADS+j], producer, (void *)(uintptr_t)j);
+    }
+    for (j = 0; j < 2*THREADS; j++)
+        nn_thread_term(&threads[j]);
+    for (j = 0, ok = 1; j < THREADS; j++) {
+        sum += consumed[j];
+        ok = ok && ordered[j];
+    }
+    test_cond("Concurrent producers and consumers",
+        sum == (uint64_t)THREADS*PER_THREAD*(PER_THREAD-1)/2 && ok &&
+        nn_mpmc_pop(&q) == NULL && nn_mpmc_size(&q) == 0);
+    nn_mpmc_term(&q);
+    test_report()
+}
+#endif
@@ -23,6 +23,8 @@
 #ifndef NN_QUEUE_INCLUDED
 #define NN_QUEUE_INCLUDED
 
+#include <stddef.h>
+
 /*  Undefined value for initialising a queue item which is not
     part of a queue. */
 #define NN_QUEUE_NOTINQUEUE ((struct nn_queue_item*) -1)
@@ -69,4 +71,56 @@ void nn_queue_item_term (struct nn_queue_item *self);
 /*  Returns 1 if item is a part of a queue. 0 otherwise. */
 int nn_queue_item_isinqueue (struct nn_queue_item *self);
 
+/*  Bounded multi-producer multi-consumer queue of pointers, lock-free (the
+    ring of D. Vyukov). nn_queue above is for a single thread; this one can
+    be pushed and popped by any number of threads at once without a mutex.
+
+    Every cell of the ring has a sequence number telling whose turn it is:
+    a producer claims the cell at the enqueue position when its sequence
+    equals the position, by moving the position on with a compare-and-swap,
+    then stores the pointer and releases the cell to consumers by bumping
+    the sequence; consumers do the mirror image. Threads only contend on the
+    two positions, which sit on cache lines of their own, as does every
+    cell, so neighbouring pushes and pops do not share lines. A push to a
+    full queue and a pop from an empty one fail at once instead of
+    blocking: the caller decides whether to retry, spin or sleep. */
+
+#define NN_MPMC_LINE 64
+
+struct nn_mpmc_cell {
+    volatile size_t seq;
+    void *data;
+    char pad [NN_MPMC_LINE - sizeof (size_t) - sizeof (void*)];
+};
+
+struct nn_mpmc {
+    struct nn_mpmc_cell *cells;
+    size_t mask;
+    void *mem;
+    char pad0 [NN_MPMC_LINE - 2 * sizeof (size_t) - sizeof (void*)];
+    volatile size_t head;           /* Next cell to push to */
+    char pad1 [NN_MPMC_LINE - sizeof (size_t)];
+    volatile size_t tail;           /* Next cell to pop from */
+    char pad2 [NN_MPMC_LINE - sizeof (size_t)];
+};
+
+/*  Initialise an empty queue holding up to 'capacity' pointers, rounded
+    up to a power of two. Returns 0 or -ENOMEM. */
+int nn_mpmc_init (struct nn_mpmc *self, size_t capacity);
+
+/*  Terminate the queue. Pointers still in it are dropped. */
+void nn_mpmc_term (struct nn_mpmc *self);
+
+/*  Add 'item', which must not be NULL. Returns 0 or -EAGAIN if the queue is
+    full. */
+int nn_mpmc_push (struct nn_mpmc *self, void *item);
+
+/*  Remove the oldest pointer and return it. Returns NULL if the queue is
+    empty. */
+void *nn_mpmc_pop (struct nn_mpmc *self);
+
+/*  Number of pointers in the queue. Only a hint while other threads push
+    or pop. */
+size_t nn_mpmc_size (struct nn_mpmc *self);
+
 #endif
@@ -0,0 +1,275 @@
+#include "rwlock.h"
+#include "err.h"
+
+#if defined NN_HAVE_FUTEX
+
+#include <limits.h>
+
+#include "futex.h"
+
+void nn_rwlock_init (struct nn_rwlock *self)
+{
+    self->state = 0;
+    self->writers = 0;
+    self->seq = 0;
+    self->sleepers = 0;
+}
+
+void nn_rwlock_term (struct nn_rwlock *self)
+{
+    nn_assert (self->state == 0 && self->writers == 0);
+}
+
+static int nn_rwlock_blocked (struct nn_rwlock *self, int write)
+{
+    int s = __atomic_load_n (&self->state, __ATOMIC_ACQUIRE);
+
+    if (write)
+        return s != 0;
+    return (s & NN_RWLOCK_WRITER) ||
+        __atomic_load_n (&self->writers, __ATOMIC_ACQUIRE);
+}
+
+/*  Sleep until the next release, unless the lock got free meanwhile. The
+    sequence is read after announcing ourselves, so a release either sees
+    us and wakes us, or changed the sequence or the state already. */
+static void nn_rwlock_park (struct nn_rwlock *self, int write)
+{
+    int seq;
+
+    __atomic_add_fetch (&self->sleepers, 1, __ATOMIC_SEQ_CST);
+    seq = __atomic_load_n (&self->seq, __ATOMIC_SEQ_CST);
+    if (nn_rwlock_blocked (self, write))
+        nn_futex_wait (&self->seq, seq, -1);
+    __atomic_sub_fetch (&self->sleepers, 1, __ATOMIC_RELAXED);
+}
+
+static void nn_rwlock_release (struct nn_rwlock *self)
+{
+    __atomic_add_fetch (&self->seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n (&self->sleepers, __ATOMIC_SEQ_CST))
+        nn_futex_wake (&self->seq, INT_MAX);
+}
+
+void nn_rwlock_rdlock (struct nn_rwlock *self)
+{
+    int s;
+    int i;
+    int max;
+
+    s = __atomic_load_n (&self->state, __ATOMIC_RELAXED);
+    if (nn_fast (!(s & NN_RWLOCK_WRITER) &&
+          !__atomic_load_n (&self->writers, __ATOMIC_RELAXED) &&
+          __atomic_compare_exchange_n (&self->state, &s, s + 1, 0,
+          __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)))
+        return;
+
+    max = nn_futex_spins (NN_FUTEX_SPIN_MAX);
+    for (i = 0;; i++) {
+        s = __atomic_load_n (&self->state, __ATOMIC_RELAXED);
+        if (!(s & NN_RWLOCK_WRITER) &&
+              !__atomic_load_n (&self->writers, __ATOMIC_RELAXED)) {
+            if (__atomic_compare_exchange_n (&self->state, &s, s + 1, 0,
+                  __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                return;
+            continue;
+        }
+        if (i < max)
+            nn_cpu_relax ();
+        else
+            nn_rwlock_park (self, 0);
+    }
+}
+
+void nn_rwlock_rdunlock (struct nn_rwlock *self)
+{
+    int s;
+
+    s = __atomic_sub_fetch (&self->state, 1, __ATOMIC_SEQ_CST);
+    nn_assert (s >= 0 && !(s & NN_RWLOCK_WRITER));
+
+    /*  Only writers wait for readers. A writer counts itself before it
+        looks at the state, so either it sees the lock free or we see it. */
+    if (s == 0 && __atomic_load_n (&self->writers, __ATOMIC_SEQ_CST))
+        nn_rwlock_release (self);
+}
+
+void nn_rwlock_wrlock (struct nn_rwlock *self)
+{
+    int s = 0;
+    int i;
+    int max;
+
+    if (nn_fast (__atomic_compare_exchange_n (&self->state, &s,
+          NN_RWLOCK_WRITER, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)))
+        return;
+
+    /*  Hold new readers back while we wait. */
+    __atomic_add_fetch (&self->writers, 1, __ATOMIC_SEQ_CST);
+    max = nn_futex_spins (NN_FUTEX_SPIN_MAX);
+    for (i = 0;; i++) {
+        s = 0;
+        if (__atomic_compare_exchange_n (&self->state, &s, NN_RWLOCK_WRITER,
+              0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+        if (i < max)
+            nn_cpu_relax ();
+        else
+            nn_rwlock_park (self, 1);
+    }
+    __atomic_sub_fetch (&self->writers, 1, __ATOMIC_RELAXED);
+}
+
+void nn_rwlock_wrunlock (struct nn_rwlock *self)
+{
+    int s;
+
+    s = __atomic_exchange_n (&self->state, 0, __ATOMIC_RELEASE);
+    nn_assert (s == NN_RWLOCK_WRITER);
+    nn_rwlock_release (self);
+}
+
+#else
+
+void nn_rwlock_init (struct nn_rwlock *self)
+{
+    int rc;
+
+    rc = pthread_rwlock_init (&self->rwlock, NULL);
+    errnum_assert (rc == 0, rc);
+}
+
+void nn_rwlock_term (struct nn_rwlock *self)
+{
+    int rc;
+
+    rc = pthread_rwlock_destroy (&self->rwlock);
+    errnum_assert (rc == 0, rc);
+}
+
+void nn_rwlock_rdlock (struct nn_rwlock *self)
+{
+    int rc;
+
+    rc = pthread_rwlock_rdlock (&self->rwlock);
+    errnum_assert (rc == 0, rc);
+}
+
+void nn_rwlock_rdunlock (struct nn_rwlock *self)
+{
+    int rc;
+
+    rc = pthread_rwlock_unlock (&self->rwlock);
+    errnum_assert (rc == 0, rc);
+}
+
+void nn_rwlock_wrlock (struct nn_rwlock *self)
+{
+    int rc;
+
+    rc = pthread_rwlock_wrlock (&self->rwlock);
+    errnum_assert (rc == 0, rc);
+}
+
+void nn_rwlock_wrunlock (struct nn_rwlock *self)
+{
+    int rc;
+
+    rc = pthread_rwlock_unlock (&self->rwlock);
+    errnum_assert (rc == 0, rc);
+}
+
+#endif
+
+#if defined RWLOCK_TEST_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "thread.h"
+#include "testhelp.h"
+
+#define READERS 3
+#define WRITERS 2
+#define ROUNDS 20000
+
+static struct nn_rwlock lock;
+static long a, b;
+static int torn;
+static int acquired;
+
+/* Writers keep a and b equal between their critical sections. */
+static void writer(void *arg) {
+    int j;
+
+    (void)arg;
+    for (j = 0; j < ROUNDS; j++) {
+        nn_rwlock_wrlock(&lock);
+        a++;
+        b++;
+        nn_rwlock_wrunlock(&lock);
+    }
+}
+
+static void reader(void *arg) {
+    int j;
+
+    (void)arg;
+    for (j = 0; j < ROUNDS; j++) {
+        nn_rwlock_rdlock(&lock);
+        if (a != b) __atomic_add_fetch(&torn, 1, __ATOMIC_RELAXED);
+        nn_rwlock_rdunlock(&lock);
+    }
+}
+
+static void readOnce(void *arg) {
+    (void)arg;
+    nn_rwlock_rdlock(&lock);
+    __atomic_store_n(&acquired, 1, __ATOMIC_RELAXED);
+    nn_rwlock_rdunlock(&lock);
+}
+
+static void writeOnce(void *arg) {
+    (void)arg;
+    nn_rwlock_wrlock(&lock);
+    __atomic_store_n(&acquired, 1, __ATOMIC_RELAXED);
+    nn_rwlock_wrunlock(&lock);
+}
+
+int main(void) {
+    struct nn_thread t[READERS+WRITERS];
+    int j, early;
+
+    nn_rwlock_init(&lock);
+    for (j = 0; j < READERS; j++) nn_thread_init(&t[j], reader, NULL);
+    for (j = 0; j < WRITERS; j++)
+        nn_thread_init(&t[READERS+j], writer, NULL);
+    for (j = 0; j < READERS+WRITERS; j++) nn_thread_term(&t[j]);
+    test_cond("Writers exclude readers and each other",
+        torn == 0 && a == (long)WRITERS*ROUNDS && a == b);
+
+    nn_rwlock_rdlock(&lock);
+    acquired = 0;
+    nn_thread_init(&t[0], readOnce, NULL);
+    nn_thread_term(&t[0]);
+    test_cond("Readers share", acquired == 1);
+
+    acquired = 0;
+    nn_thread_init(&t[0], writeOnce, NULL);
+    usleep(50000);
+    early = __atomic_load_n(&acquired, __ATOMIC_RELAXED);
+    nn_rwlock_rdunlock(&lock);
+    nn_thread_term(&t[0]);
+    test_cond("A writer waits for the readers", early == 0 && acquired == 1);
+
+    nn_rwlock_wrlock(&lock);
+    acquired = 0;
+    nn_thread_init(&t[0], readOnce, NULL);
+    usleep(50000);
+    early = __atomic_load_n(&acquired, __ATOMIC_RELAXED);
+    nn_rwlock_wrunlock(&lock);
+    nn_thread_term(&t[0]);
+    test_cond("A reader waits for the writer", early == 0 && acquired == 1);
+    nn_rwlock_term(&lock);
+    test_report()
+}
+#endif
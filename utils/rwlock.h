@@ -0,0 +1,44 @@
+#ifndef NN_RWLOCK_INCLUDED
+#define NN_RWLOCK_INCLUDED
+
+#include "std.h"
+
+#if !defined NN_HAVE_FUTEX
+#include <pthread.h>
+#endif
+
+/*  Reader-writer lock. Any number of readers hold it together, a writer
+    holds it alone. It prefers writers: once one is waiting, new readers
+    wait too, so a steady stream of readers cannot starve it. A reader
+    taking the lock again while holding it may therefore deadlock.
+
+    With futexes the lock is one word and an uncontended lock or unlock is
+    a single atomic operation. Waiters spin a little, then sleep until the
+    next release. Elsewhere it is a pthread rwlock. */
+
+struct nn_rwlock {
+#if defined NN_HAVE_FUTEX
+    /*  Readers holding the lock, or NN_RWLOCK_WRITER. */
+    volatile int state;
+    /*  Writers waiting for the lock. */
+    volatile int writers;
+    /*  Bumped by every release that may let a waiter in. */
+    volatile int seq;
+    volatile int sleepers;
+#else
+    pthread_rwlock_t rwlock;
+#endif
+};
+
+#define NN_RWLOCK_WRITER 0x40000000
+
+void nn_rwlock_init (struct nn_rwlock *self);
+void nn_rwlock_term (struct nn_rwlock *self);
+
+void nn_rwlock_rdlock (struct nn_rwlock *self);
+void nn_rwlock_rdunlock (struct nn_rwlock *self);
+
+void nn_rwlock_wrlock (struct nn_rwlock *self);
+void nn_rwlock_wrunlock (struct nn_rwlock *self);
+
+#endif
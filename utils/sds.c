@@ -6,6 +6,8 @@
 #include <assert.h>
 #include "sds.h"
 #include "alloc.h"
+#include "simd.h"
+#include "numconv.h"
 
 static inline int sds_header_size(char type) {
     switch(type&SDS_TYPE_MASK) {
@@ -48,16 +50,25 @@ static inline char sds_req_type(size_t string_size) {
  * end of the string. However the string is binary safe and can contain
  * \0 characters in the middle, as the length is stored in the sds header. */
 sds sds_new_len(const void *init, size_t initlen) {
+    return sds_new_len_tagged(init, initlen, NN_ALLOC_TAG_NONE);
+}
+
+/* Like sds_new_len(), but the allocation is accounted to the memory 'tag'
+ * (see nn_malloc_tagged()). The tag is kept in the spare bits of the flags
+ * byte so that every later reallocation and the final sds_free() are
+ * charged to it too. Type 5 has no spare bits, tagged strings start at
+ * type 8. */
+sds sds_new_len_tagged(const void *init, size_t initlen, int tag) {
     void *sh;
     sds s;
     char type = sds_req_type(initlen);
     /* Empty strings are usually created in order to append. Use type 8
      * since type 5 is not good at this. */
-    if (type == SDS_TYPE_5 && initlen == 0) type = SDS_TYPE_8;
+    if (type == SDS_TYPE_5 && (initlen == 0 || tag)) type = SDS_TYPE_8;
     int hdrlen = sds_header_size(type);
     unsigned char *fp; /* flags pointer. */
 
-    sh = nn_malloc(hdrlen+initlen+1);
+    sh = nn_malloc_tagged(hdrlen+initlen+1, tag);
     if (!init)
         memset(sh, 0, hdrlen+initlen+1);
     if (sh == NULL) return NULL;
@@ -72,28 +83,28 @@ sds sds_new_len(const void *init, size_t initlen) {
             SDS_HDR_VAR(8,s);
             sh->len = initlen;
             sh->alloc = initlen;
-            *fp = type;
+            *fp = type | (tag << SDS_TYPE_BITS);
             break;
         }
         case SDS_TYPE_16: {
             SDS_HDR_VAR(16,s);
             sh->len = initlen;
             sh->alloc = initlen;
-            *fp = type;
+            *fp = type | (tag << SDS_TYPE_BITS);
             break;
         }
         case SDS_TYPE_32: {
             SDS_HDR_VAR(32,s);
             sh->len = initlen;
             sh->alloc = initlen;
-            *fp = type;
+            *fp = type | (tag << SDS_TYPE_BITS);
             break;
         }
         case SDS_TYPE_64: {
             SDS_HDR_VAR(64,s);
             sh->len = initlen;
             sh->alloc = initlen;
-            *fp = type;
+            *fp = type | (tag << SDS_TYPE_BITS);
             break;
         }
     }
@@ -109,6 +120,30 @@ sds sds_empty(void) {
     return sds_new_len("",0);
 }
 
+/* Create an empty sds string whose whole allocation, header and null term
+ * included, is 'size' bytes taken from the large I/O buffer class (see
+ * nn_malloc_iobuf_node()), on NUMA 'node' or on the caller's node when
+ * 'node' is negative. All of it but the header is available to append
+ * without reallocating, which makes it a good fit for socket buffers. */
+sds sds_new_iobuf(size_t size, int node) {
+    char type = sds_req_type(size);
+    int hdrlen;
+    void *sh;
+    sds s;
+
+    if (type == SDS_TYPE_5) type = SDS_TYPE_8;
+    hdrlen = sds_header_size(type);
+    if (size < (size_t)hdrlen+1) return sds_empty();
+    sh = nn_malloc_iobuf_node(size, node);
+    if (sh == NULL) return NULL;
+    s = (char*)sh+hdrlen;
+    s[-1] = type;
+    sds_set_len(s, 0);
+    sds_set_alloc(s, size-hdrlen-1);
+    s[0] = '\0';
+    return s;
+}
+
 /* Create a new sds string starting from a null terminated C string. */
 sds sds_new(const char *init) {
     size_t initlen = (init == NULL) ? 0 : strlen(init);
@@ -123,7 +158,39 @@ sds sds_dup(const sds s) {
 /* Free an sds string. No operation is performed if 's' is NULL. */
 void sds_free(sds s) {
     if (s == NULL) return;
-    nn_free((char*)s-sds_header_size(s[-1]));
+    nn_free_tagged((char*)s-sds_header_size(s[-1]), sds_tag(s));
+}
+
+/* Account the string to the memory 'tag' from now on. A type 5 string has
+ * nowhere to keep the tag and is copied into a type 8 one, so as with the
+ * other functions that may reallocate, the returned pointer must replace
+ * the passed one. */
+sds sds_set_tag(sds s, int tag) {
+    sds t;
+
+    if ((s[-1]&SDS_TYPE_MASK) == SDS_TYPE_5) {
+        if (!tag) return s;
+        t = sds_new_len_tagged(s, sds_len(s), tag);
+        sds_free(s);
+        return t;
+    }
+    nn_alloc_retag((char*)s-sds_header_size(s[-1]), sds_tag(s), tag);
+    s[-1] = (s[-1]&SDS_TYPE_MASK) | (tag << SDS_TYPE_BITS);
+    return s;
+}
+
+/* Active defragmentation of a long lived string: if the allocator hints
+ * that it sits in a sparsely used page, move it (see nn_alloc_defrag()).
+ * Returns the moved string, 's' being no longer valid, or NULL if it was
+ * left in place. */
+sds sds_defrag(sds s) {
+    int hdrlen;
+    void *newsh;
+
+    if (s == NULL) return NULL;
+    hdrlen = sds_header_size(s[-1]);
+    newsh = nn_alloc_defrag((char*)s-hdrlen, sds_tag(s));
+    return newsh ? (char*)newsh+hdrlen : NULL;
 }
 
 /* Set the sds string length to the length as obtained with strlen(), so
@@ -165,7 +232,7 @@ sds sds_make_room_for(sds s, size_t addlen) {
     size_t avail = sds_avail(s);
     size_t len, newlen;
     char type, oldtype = s[-1] & SDS_TYPE_MASK;
-    int hdrlen;
+    int hdrlen, tag = sds_tag(s);
 
     /* Return ASAP if there is enough space left. */
     if (avail >= addlen) return s;
@@ -187,18 +254,18 @@ sds sds_make_room_for(sds s, size_t addlen) {
 
     hdrlen = sds_header_size(type);
     if (oldtype==type) {
-        newsh = nn_realloc(sh, hdrlen+newlen+1);
+        newsh = nn_realloc_tagged(sh, hdrlen+newlen+1, tag);
         if (newsh == NULL) return NULL;
         s = (char*)newsh+hdrlen;
     } else {
         /* Since the header size changes, need to move the string forward,
          * and can't use realloc */
-        newsh = nn_malloc(hdrlen+newlen+1);
+        newsh = nn_malloc_tagged(hdrlen+newlen+1, tag);
         if (newsh == NULL) return NULL;
         memcpy((char*)newsh+hdrlen, s, len+1);
-        nn_free(sh);
+        nn_free_tagged(sh, tag);
         s = (char*)newsh+hdrlen;
-        s[-1] = type;
+        s[-1] = type | (tag << SDS_TYPE_BITS);
         sds_set_len(s, len);
     }
     sds_set_alloc(s, newlen);
@@ -214,23 +281,24 @@ sds sds_make_room_for(sds s, size_t addlen) {
 sds sds_remove_free_space(sds s) {
     void *sh, *newsh;
     char type, oldtype = s[-1] & SDS_TYPE_MASK;
-    int hdrlen;
+    int hdrlen, tag = sds_tag(s);
     size_t len = sds_len(s);
     sh = (char*)s-sds_header_size(oldtype);
 
     type = sds_req_type(len);
+    if (type == SDS_TYPE_5 && tag) type = SDS_TYPE_8;
     hdrlen = sds_header_size(type);
     if (oldtype==type) {
-        newsh = nn_realloc(sh, hdrlen+len+1);
+        newsh = nn_realloc_tagged(sh, hdrlen+len+1, tag);
         if (newsh == NULL) return NULL;
         s = (char*)newsh+hdrlen;
     } else {
-        newsh = nn_malloc(hdrlen+len+1);
+        newsh = nn_malloc_tagged(hdrlen+len+1, tag);
         if (newsh == NULL) return NULL;
         memcpy((char*)newsh+hdrlen, s, len+1);
-        nn_free(sh);
+        nn_free_tagged(sh, tag);
         s = (char*)newsh+hdrlen;
-        s[-1] = type;
+        s[-1] = type | (tag << SDS_TYPE_BITS);
         sds_set_len(s, len);
     }
     sds_set_alloc(s, len);
@@ -396,126 +464,20 @@ sds sds_copy(sds s, const char *t) {
  * representation stored at 's'. */
 #define SDS_LLSTR_SIZE 21
 int sds_from_long(char *s, long long value) {
-    char *p, aux;
-    unsigned long long v;
-    size_t l;
-
-    /* Generate the string representation, this method produces
-     * an reversed string. */
-    v = (value < 0) ? -value : value;
-    p = s;
-    do {
-        *p++ = '0'+(v%10);
-        v /= 10;
-    } while(v);
-    if (value < 0) *p++ = '-';
-
-    /* Compute length and add null term. */
-    l = p-s;
-    *p = '\0';
-
-    /* Reverse the string. */
-    p--;
-    while(s < p) {
-        aux = *s;
-        *s = *p;
-        *p = aux;
-        s++;
-        p--;
-    }
-    return l;
+    return nn_num_i64_to_str(s,value);
 }
 
 int sds_to_ll(const char *s, size_t slen, long long *value) {
-    const char *p = s;
-    size_t plen = 0;
-    int negative = 0;
-    unsigned long long v;
-
-    if (plen == slen)
-        return 0;
-
-    /* Special case: first and only digit is 0. */
-    if (slen == 1 && p[0] == '0') {
-        if (value != NULL) *value = 0;
-        return 1;
-    }
-
-    if (p[0] == '-') {
-        negative = 1;
-        p++; plen++;
-
-        /* Abort on only a negative sign. */
-        if (plen == slen)
-            return 0;
-    }
-
-    /* First digit should be 1-9, otherwise the string should just be 0. */
-    if (p[0] >= '1' && p[0] <= '9') {
-        v = p[0]-'0';
-        p++; plen++;
-    } else if (p[0] == '0' && slen == 1) {
-        *value = 0;
-        return 1;
-    } else {
-        return 0;
-    }
-
-    while (plen < slen && p[0] >= '0' && p[0] <= '9') {
-        if (v > (ULLONG_MAX / 10)) /* Overflow. */
-            return 0;
-        v *= 10;
+    int64_t v;
 
-        if (v > (ULLONG_MAX - (p[0]-'0'))) /* Overflow. */
-            return 0;
-        v += p[0]-'0';
-
-        p++; plen++;
-    }
-
-    /* Return if not all bytes were used. */
-    if (plen < slen)
-        return 0;
-
-    if (negative) {
-        if (v > ((unsigned long long)(-(LLONG_MIN+1))+1)) /* Overflow. */
-            return 0;
-        if (value != NULL) *value = -v;
-    } else {
-        if (v > LLONG_MAX) /* Overflow. */
-            return 0;
-        if (value != NULL) *value = v;
-    }
+    if (!nn_num_str_to_i64(s,slen,&v)) return 0;
+    if (value != NULL) *value = v;
     return 1;
 }
 
 /* Identical sds_from_long(), but for unsigned long long type. */
 int sds_from_ulong(char *s, unsigned long long v) {
-    char *p, aux;
-    size_t l;
-
-    /* Generate the string representation, this method produces
-     * an reversed string. */
-    p = s;
-    do {
-        *p++ = '0'+(v%10);
-        v /= 10;
-    } while(v);
-
-    /* Compute length and add null term. */
-    l = p-s;
-    *p = '\0';
-
-    /* Reverse the string. */
-    p--;
-    while(s < p) {
-        aux = *s;
-        *s = *p;
-        *p = aux;
-        s++;
-        p--;
-    }
-    return l;
+    return nn_num_u64_to_str(s,v);
 }
 
 /* Create an sds string from a long long value. It is much faster than:
@@ -529,6 +491,15 @@ sds sds_from_ll(long long value) {
     return sds_new_len(buf,len);
 }
 
+/* Create an sds string from a double, using the fewest digits that parse
+ * back to the same value. */
+sds sds_from_double(double value) {
+    char buf[NN_NUM_DSTR_SIZE];
+    int len = nn_num_double_to_str(buf,value);
+
+    return sds_new_len(buf,len);
+}
+
 /* Like sds_append_printf() but gets va_list instead of being variadic. */
 sds sds_append_vprintf(sds s, const char *fmt, va_list ap) {
     va_list cpy;
@@ -650,16 +621,13 @@ sds sds_append_format(sds s, char const *fmt, ...) {
                     num = va_arg(ap,int);
                 else
                     num = va_arg(ap,long long);
-                {
-                    char buf[SDS_LLSTR_SIZE];
-                    l = sds_from_long(buf,num);
-                    if (sds_avail(s) < l) {
-                        s = sds_make_room_for(s,l);
-                    }
-                    memcpy(s+i,buf,l);
-                    sds_inc_len(s,l);
-                    i += l;
+                /* Format straight into the free space. */
+                if (sds_avail(s) < SDS_LLSTR_SIZE) {
+                    s = sds_make_room_for(s,SDS_LLSTR_SIZE);
                 }
+                l = nn_num_i64_to_str(s+i,num);
+                sds_inc_len(s,l);
+                i += l;
                 break;
             case 'u':
             case 'U':
@@ -667,16 +635,12 @@ sds sds_append_format(sds s, char const *fmt, ...) {
                     unum = va_arg(ap,unsigned int);
                 else
                     unum = va_arg(ap,unsigned long long);
-                {
-                    char buf[SDS_LLSTR_SIZE];
-                    l = sds_from_ulong(buf,unum);
-                    if (sds_avail(s) < l) {
-                        s = sds_make_room_for(s,l);
-                    }
-                    memcpy(s+i,buf,l);
-                    sds_inc_len(s,l);
-                    i += l;
+                if (sds_avail(s) < SDS_LLSTR_SIZE) {
+                    s = sds_make_room_for(s,SDS_LLSTR_SIZE);
                 }
+                l = nn_num_u64_to_str(s+i,unum);
+                sds_inc_len(s,l);
+                i += l;
                 break;
             default: /* Handle %% and generally %<unknown>. */
                 s[i++] = next;
@@ -713,15 +677,14 @@ sds sds_append_format(sds s, char const *fmt, ...) {
  * Output will be just "Hello World".
  */
 sds sds_trim(sds s, const char *cset) {
-    char *start, *end, *sp, *ep;
-    size_t len;
-
-    sp = start = s;
-    ep = end = s+sds_len(s)-1;
-    while(sp <= end && strchr(cset, *sp)) sp++;
-    while(ep > sp && strchr(cset, *ep)) ep--;
-    len = (sp > ep) ? 0 : ((ep-sp)+1);
-    if (s != sp) memmove(s, sp, len);
+    size_t len = sds_len(s), left, right;
+    /* Count the terminator as part of the set, like strchr() does. */
+    size_t setlen = strlen(cset)+1;
+
+    left = nn_simd_span(s,len,cset,setlen);
+    right = (left == len) ? 0 : nn_simd_rspan(s+left,len-left,cset,setlen);
+    len -= left+right;
+    if (left) memmove(s, s+left, len);
     s[len] = '\0';
     sds_set_len(s,len);
     return s;
@@ -771,18 +734,46 @@ void sds_range(sds s, int start, int end) {
     sds_set_len(s,newlen);
 }
 
+/* Mark 'n' more bytes at the head of 's' as consumed, '*pos' being the read
+ * cursor, i.e. the number of bytes already consumed. Unlike sds_range() the
+ * remaining data is not moved: the string is reset for free once everything
+ * was consumed, and compacted only when the consumed head is at least
+ * SDS_COMPACT_MIN bytes and no smaller than what is left, so every byte is
+ * moved a bounded number of times however the data is drained.
+ *
+ * The unread data is the 'sds_len(s) - *pos' bytes starting at s+*pos. */
+void sds_consume(sds s, size_t *pos, size_t n) {
+    size_t len = sds_len(s);
+
+    assert(*pos+n <= len);
+    *pos += n;
+    if (*pos == len) {
+        sds_clear(s);
+        *pos = 0;
+    } else if (*pos >= SDS_COMPACT_MIN && *pos >= len-*pos) {
+        sds_compact(s,pos);
+    }
+}
+
+/* Drop the bytes before the read cursor '*pos' and reset it to zero. */
+void sds_compact(sds s, size_t *pos) {
+    size_t len = sds_len(s)-*pos;
+
+    if (*pos == 0) return;
+    memmove(s,s+*pos,len);
+    s[len] = '\0';
+    sds_set_len(s,len);
+    *pos = 0;
+}
+
 /* Apply tolower() to every character of the sds string 's'. */
 void sds_to_lower(sds s) {
-    int len = sds_len(s), j;
-
-    for (j = 0; j < len; j++) s[j] = tolower(s[j]);
+    nn_simd_lower(s,sds_len(s));
 }
 
 /* Apply toupper() to every character of the sds string 's'. */
 void sds_to_upper(sds s) {
-    int len = sds_len(s), j;
-
-    for (j = 0; j < len; j++) s[j] = toupper(s[j]);
+    nn_simd_upper(s,sds_len(s));
 }
 
 /* Compare two sds strings s1 and s2 with memcmp().
@@ -837,7 +828,8 @@ sds *sds_split_len(const char *s, int len, const char *sep, int seplen, int *cou
         *count = 0;
         return tokens;
     }
-    for (j = 0; j < (len-(seplen-1)); j++) {
+    /* search the separator */
+    while ((j = start+(int)nn_simd_find_str(s+start,len-start,sep,seplen)) < len) {
         /* make sure there is room for the next element and the final one */
         if (slots < elements+2) {
             sds *newtokens;
@@ -847,14 +839,10 @@ sds *sds_split_len(const char *s, int len, const char *sep, int seplen, int *cou
             if (newtokens == NULL) goto cleanup;
             tokens = newtokens;
         }
-        /* search the separator */
-        if ((seplen == 1 && *(s+j) == sep[0]) || (memcmp(s+j,sep,seplen) == 0)) {
-            tokens[elements] = sds_new_len(s+start,j-start);
-            if (tokens[elements] == NULL) goto cleanup;
-            elements++;
-            start = j+seplen;
-            j = j+seplen-1; /* skip the separator */
-        }
+        tokens[elements] = sds_new_len(s+start,j-start);
+        if (tokens[elements] == NULL) goto cleanup;
+        elements++;
+        start = j+seplen; /* skip the separator */
     }
     /* Add the final element. We are sure there is room in the tokens array. */
     tokens[elements] = sds_new_len(s+start,len-start);
@@ -888,8 +876,19 @@ void sds_free_splitres(sds *tokens, int count) {
  * After the call, the modified sds string is no longer valid and all the
  * references must be substituted with the new pointer returned by the call. */
 sds sds_append_repr(sds s, const char *p, size_t len) {
+    size_t run;
+
     s = sds_append_len(s,"\"",1);
-    while(len--) {
+    while(len) {
+        /* Copy the longest run that needs no escaping in one go. */
+        run = nn_simd_find_escape(p,len);
+        if (run) {
+            s = sds_append_len(s,p,run);
+            p += run;
+            len -= run;
+            if (!len) break;
+        }
+        len--;
         switch(*p) {
         case '\\':
         case '"':
@@ -1082,16 +1081,7 @@ err:
  * The function returns the sds string pointer, that is always the same
  * as the input pointer since no resize is needed. */
 sds sds_map_chars(sds s, const char *from, const char *to, size_t setlen) {
-    size_t j, i, l = sds_len(s);
-
-    for (j = 0; j < l; j++) {
-        for (i = 0; i < setlen; i++) {
-            if (s[j] == from[i]) {
-                s[j] = to[i];
-                break;
-            }
-        }
-    }
+    nn_simd_map(s,sds_len(s),from,to,setlen);
     return s;
 }
 
@@ -1285,6 +1275,31 @@ int sdsTest(void) {
             sds_free(x);
         }
     }
+    {
+        size_t pos = 0, consumed = 0, total = 0;
+        sds x = sds_empty();
+        int j, ok = 1;
+
+        for (j = 0; j < 2000; j++) {
+            x = sds_append_printf(x,"%08d",j);
+            total += 8;
+            sds_consume(x,&pos,j%3 ? 8 : 4);
+            consumed += j%3 ? 8 : 4;
+            if (sds_len(x)-pos != total-consumed ||
+                (pos && pos >= SDS_COMPACT_MIN && pos >= sds_len(x)-pos))
+                ok = 0;
+        }
+        test_cond("sds_consume() keeps the unread data and bounds the head",
+            ok && memcmp(x+pos,"166600001667",12) == 0);
+        sds_compact(x,&pos);
+        test_cond("sds_compact() moves the unread data to the start",
+            pos == 0 && sds_len(x) == total-consumed &&
+            memcmp(x,"166600001667",12) == 0);
+        sds_consume(x,&pos,sds_len(x));
+        test_cond("sds_consume() of everything empties the string",
+            pos == 0 && sds_len(x) == 0 && x[0] == '\0');
+        sds_free(x);
+    }
     test_report()
     return 0;
 }
@@ -7,6 +7,10 @@
 #include <stdarg.h>
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef char *sds;
 
 /* Note: sdshdr5 is never used, we just access the flags byte directly.
@@ -18,25 +22,25 @@ struct __attribute__ ((__packed__)) sdshdr5 {
 struct __attribute__ ((__packed__)) sdshdr8 {
     uint8_t len; /* used */
     uint8_t alloc; /* excluding the header and null terminator */
-    unsigned char flags; /* 3 lsb of type, 5 unused bits */
+    unsigned char flags; /* 3 lsb of type, 5 msb of memory tag */
     char buf[];
 };
 struct __attribute__ ((__packed__)) sdshdr16 {
     uint16_t len; /* used */
     uint16_t alloc; /* excluding the header and null terminator */
-    unsigned char flags; /* 3 lsb of type, 5 unused bits */
+    unsigned char flags; /* 3 lsb of type, 5 msb of memory tag */
     char buf[];
 };
 struct __attribute__ ((__packed__)) sdshdr32 {
     uint32_t len; /* used */
     uint32_t alloc; /* excluding the header and null terminator */
-    unsigned char flags; /* 3 lsb of type, 5 unused bits */
+    unsigned char flags; /* 3 lsb of type, 5 msb of memory tag */
     char buf[];
 };
 struct __attribute__ ((__packed__)) sdshdr64 {
     uint64_t len; /* used */
     uint64_t alloc; /* excluding the header and null terminator */
-    unsigned char flags; /* 3 lsb of type, 5 unused bits */
+    unsigned char flags; /* 3 lsb of type, 5 msb of memory tag */
     char buf[];
 };
 
@@ -50,6 +54,7 @@ struct __attribute__ ((__packed__)) sdshdr64 {
 #define SDS_HDR_VAR(T,s) struct sdshdr##T *sh = (struct sdshdr##T*)((s)-(sizeof(struct sdshdr##T)));
 #define SDS_HDR(T,s) ((struct sdshdr##T *)((s)-(sizeof(struct sdshdr##T))))
 #define SDS_TYPE_5_LEN(f) ((f)>>SDS_TYPE_BITS)
+#define SDS_TAG(f) ((f)>>SDS_TYPE_BITS)
 
 /*返回s当前使用的长度*/
 static inline size_t sds_len(const sds s) {
@@ -188,21 +193,40 @@ static inline void sds_set_alloc(sds s, size_t newlen) {
     }
 }
 
+/*返回s的内存标签(见alloc.h中NN_ALLOC_TAG_*) type5结构没有标签*/
+static inline int sds_tag(const sds s) {
+    unsigned char flags = s[-1];
+    if ((flags&SDS_TYPE_MASK) == SDS_TYPE_5) return 0;
+    return SDS_TAG(flags);
+}
+
 /*带长度的string结构申请*/
 sds sds_new_len(const void *init, size_t initlen);
 
+/*带长度和内存标签的string结构申请 之后的扩容和释放都计入该标签*/
+sds sds_new_len_tagged(const void *init, size_t initlen, int tag);
+
+/*修改s的内存标签 type5结构会被重新申请*/
+sds sds_set_tag(sds s, int tag);
+
 /*不带长度的string结构请*/
 sds sds_new(const char *init);
 
 /*生成空string结构*/
 sds sds_empty(void);
 
+/*从大块I/O缓冲区中申请总大小为size的空string结构 node<0表示当前线程所在节点*/
+sds sds_new_iobuf(size_t size, int node);
+
 /*复制一个string结构*/
 sds sds_dup(const sds s);
 
 /*注销一个string结构*/
 void sds_free(sds s);
 
+/*碎片整理 s所在内存页利用率低时迁移 返回新的string结构 未迁移返回NULL*/
+sds sds_defrag(sds s);
+
 /*扩展len个空间并赋空置*/
 sds sds_grow_zero(sds s, size_t len);
 
@@ -249,6 +273,13 @@ sds sds_trim(sds s, const char *cset);
 /*范围截取*/
 void sds_range(sds s, int start, int end);
 
+/*读游标: 已消费的头部超过阈值且不少于剩余数据时才整体前移*/
+#define SDS_COMPACT_MIN (16*1024)
+void sds_consume(sds s, size_t *pos, size_t n);
+
+/*丢弃游标之前已消费的数据 游标归零*/
+void sds_compact(sds s, size_t *pos);
+
 /*修改sds中的长度到字符串的长度*/
 void sds_update_len(sds s);
 
@@ -273,6 +304,9 @@ void sds_to_upper(sds s);
 /*转64位数字为sds*/
 sds sds_from_ll(long long value);
 
+/*转double为sds 最短可还原表示*/
+sds sds_from_double(double value);
+
 /*从s中获得long long的数值 */
 int sds_to_ll(const char *s, size_t slen, long long *value); 
 
@@ -306,5 +340,9 @@ size_t sds_alloc_size(sds s);
 /*返回s的头指针*/
 void *sds_alloc_ptr(sds s);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
 
@@ -0,0 +1,253 @@
+#ifndef NN_SDSFMT_INCLUDED
+#define NN_SDSFMT_INCLUDED
+
+#if !defined __cplusplus || __cplusplus < 202002L
+#error "sdsfmt.h needs C++20"
+#endif
+
+/*  Type safe formatting into sds strings for C++ callers.
+
+        s = nn::sds_append_fmt(s, "{} bytes in {} blocks", used, blocks);
+
+    Every "{}" is replaced by the next argument, "{{" and "}}" stand for
+    literal braces. The format string is parsed at compile time: a
+    placeholder count that does not match the arguments, a stray brace or
+    an unsupported argument type fails to compile. At run time the longest
+    possible output is computed first, the string grows once with
+    sds_make_room_for() and every piece is written straight into it.
+
+    Supported arguments: integers, bool, char, float/double (shortest round
+    trip form), C strings, std::string_view/std::string and sds strings
+    wrapped in nn::sds_arg() so that their binary safe length is used. */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+
+#include "sds.h"
+#include "numconv.h"
+
+namespace nn {
+
+/*  An sds argument, formatted with sds_len() rather than strlen(). */
+struct sds_arg {
+    explicit sds_arg (const sds s) : s (s) {}
+    const sds s;
+};
+
+namespace sdsfmt_detail {
+
+/*  Literal text before each placeholder and after the last one. */
+struct piece {
+    size_t off;
+    size_t len;
+    bool escaped;               /* Contains doubled braces */
+};
+
+/*  Never defined. Reached only during constant evaluation, where calling it
+    turns a malformed format string into a compile error naming the problem. */
+void format_error (const char *why);
+
+/*  Like std::format, only plain char is a character, int8_t and uint8_t
+    print as numbers. */
+template <typename T>
+inline constexpr bool is_char_v = std::is_same_v<T, char>;
+
+template <typename T>
+inline constexpr bool is_cstring_v =
+    std::is_same_v<T, char*> || std::is_same_v<T, const char*>;
+
+template <typename T>
+inline constexpr bool is_formattable_v =
+    std::is_integral_v<T> || std::is_floating_point_v<T> ||
+    is_cstring_v<std::decay_t<T>> ||
+    std::is_same_v<T, std::string_view> || std::is_same_v<T, std::string> ||
+    std::is_same_v<T, sds_arg>;
+
+/*  Arguments are first turned into something whose length is known without
+    formatting it: strings into views (strlen() runs once), numbers are kept
+    as they are and bounded by the size of their widest form. */
+template <typename T>
+constexpr auto prepare (const T &v)
+{
+    using D = std::decay_t<T>;
+
+    if constexpr (std::is_same_v<D, sds_arg>)
+        return std::string_view (v.s, sds_len (v.s));
+    else if constexpr (std::is_array_v<T>)
+        return std::string_view (v);
+    else if constexpr (is_cstring_v<D>)
+        return v ? std::string_view (v) : std::string_view ("(null)");
+    else if constexpr (std::is_same_v<D, std::string>)
+        return std::string_view (v);
+    else
+        return v;
+}
+
+template <typename T>
+constexpr size_t max_len (const T &v)
+{
+    if constexpr (std::is_same_v<T, std::string_view>)
+        return v.size ();
+    else if constexpr (std::is_same_v<T, bool>)
+        return 5;
+    else if constexpr (is_char_v<T>)
+        return 1;
+    else if constexpr (std::is_floating_point_v<T>)
+        return NN_NUM_DSTR_SIZE - 1;
+    else
+        return NN_NUM_LLSTR_SIZE - 1;
+}
+
+/*  Write 'v' at 'p', return the number of bytes written. */
+template <typename T>
+inline size_t write (char *p, const T &v)
+{
+    if constexpr (std::is_same_v<T, std::string_view>) {
+        memcpy (p, v.data (), v.size ());
+        return v.size ();
+    }
+    else if constexpr (std::is_same_v<T, bool>) {
+        memcpy (p, v ? "true" : "false", v ? 4 : 5);
+        return v ? 4 : 5;
+    }
+    else if constexpr (is_char_v<T>) {
+        *p = (char) v;
+        return 1;
+    }
+    else if constexpr (std::is_floating_point_v<T>)
+        return nn_num_double_to_str (p, (double) v);
+    else if constexpr (std::is_signed_v<T>)
+        return nn_num_i64_to_str (p, (int64_t) v);
+    else
+        return nn_num_u64_to_str (p, (uint64_t) v);
+}
+
+/*  Copy a literal piece, collapsing doubled braces if it has any. */
+inline size_t write_piece (char *p, const char *fmt, const piece &pc)
+{
+    const char *src = fmt + pc.off;
+    size_t i, n = 0;
+
+    if (!pc.escaped) {
+        memcpy (p, src, pc.len);
+        return pc.len;
+    }
+    for (i = 0; i != pc.len; i++) {
+        p [n++] = src [i];
+        if (src [i] == '{' || src [i] == '}')
+            i++;
+    }
+    return n;
+}
+
+}  /* namespace sdsfmt_detail */
+
+/*  A format string checked against the argument types at compile time. */
+template <typename... Args>
+class format_string {
+public:
+    static constexpr size_t nargs = sizeof... (Args);
+
+    template <size_t N>
+    consteval format_string (const char (&s) [N]) : str (s), pieces {},
+        literal_len (0)
+    {
+        static_assert ((sdsfmt_detail::is_formattable_v<
+            std::remove_cvref_t<Args>> && ...),
+            "nn::sds_append_fmt: unsupported argument type");
+
+        size_t i = 0, start = 0, n = 0;
+        bool escaped = false;
+
+        for (i = 0; i < N - 1; i++) {
+            if (s [i] == '{' && i + 1 < N - 1 && s [i + 1] == '{') {
+                escaped = true;
+                literal_len++;
+                i++;
+            }
+            else if (s [i] == '}' && i + 1 < N - 1 && s [i + 1] == '}') {
+                escaped = true;
+                literal_len++;
+                i++;
+            }
+            else if (s [i] == '{') {
+                if (i + 1 >= N - 1 || s [i + 1] != '}')
+                    sdsfmt_detail::format_error (
+                        "only {} placeholders are supported");
+                if (n == nargs)
+                    sdsfmt_detail::format_error (
+                        "more placeholders than arguments");
+                pieces [n++] = {start, i - start, escaped};
+                escaped = false;
+                start = i + 2;
+                i++;
+            }
+            else if (s [i] == '}')
+                sdsfmt_detail::format_error ("unmatched }");
+            else
+                literal_len++;
+        }
+        if (n != nargs)
+            sdsfmt_detail::format_error ("fewer placeholders than arguments");
+        pieces [n] = {start, N - 1 - start, escaped};
+    }
+
+    const char *str;
+    std::array<sdsfmt_detail::piece, nargs + 1> pieces;
+    size_t literal_len;         /* Output size of all the literal pieces */
+};
+
+/*  Append the formatted arguments to 's', which may be any sds string.
+    Like the C API, returns the possibly moved string or NULL if out of
+    memory. */
+template <typename... Args>
+sds sds_append_fmt (sds s,
+    format_string<std::type_identity_t<Args>...> fmt, const Args&... args)
+{
+    auto prepared = std::make_tuple (sdsfmt_detail::prepare (args)...);
+    size_t len, room = fmt.literal_len;
+
+    std::apply ([&room] (const auto&... a) {
+        ((room += sdsfmt_detail::max_len (a)), ...);
+    }, prepared);
+    /*  One extra byte: the number writers terminate their output. */
+    if (sds_avail (s) < room + 1) {
+        s = sds_make_room_for (s, room + 1);
+        if (s == NULL)
+            return NULL;
+    }
+
+    char *p = s + sds_len (s);
+    size_t k = 0;
+
+    std::apply ([&] (const auto&... a) {
+        ((p += sdsfmt_detail::write_piece (p, fmt.str, fmt.pieces [k++]),
+          p += sdsfmt_detail::write (p, a)), ...);
+    }, prepared);
+    p += sdsfmt_detail::write_piece (p, fmt.str, fmt.pieces [k]);
+    len = p - s;
+    s [len] = '\0';
+    sds_set_len (s, len);
+    return s;
+}
+
+/*  Format into a new sds string. */
+template <typename... Args>
+sds sds_fmt (format_string<std::type_identity_t<Args>...> fmt,
+    const Args&... args)
+{
+    sds s = sds_empty ();
+
+    return s ? sds_append_fmt<Args...> (s, fmt, args...) : NULL;
+}
+
+}  /* namespace nn */
+
+#endif
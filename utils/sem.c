@@ -24,6 +24,8 @@
 #include "err.h"
 #include "std.h"
 
+#include <limits.h>
+
 #if defined NN_HAVE_OSX
 
 void nn_sem_init (struct nn_sem *self)
@@ -53,8 +55,7 @@ void nn_sem_post (struct nn_sem *self)
 
     rc = pthread_mutex_lock (&self->mutex);
     errnum_assert (rc == 0, rc);
-    nn_assert (self->signaled == 0);
-    self->signaled = 1;
+    self->signaled++;
     rc = pthread_cond_signal (&self->cond);
     errnum_assert (rc == 0, rc);
     rc = pthread_mutex_unlock (&self->mutex);
@@ -73,6 +74,7 @@ int nn_sem_wait (struct nn_sem *self)
     rc = pthread_mutex_lock (&self->mutex);
     errnum_assert (rc == 0, rc);
     if (nn_fast (self->signaled)) {
+        self->signaled--;
         rc = pthread_mutex_unlock (&self->mutex);
         errnum_assert (rc == 0, rc);
         return 0;
@@ -84,18 +86,33 @@ int nn_sem_wait (struct nn_sem *self)
         errnum_assert (rc == 0, rc);
         return -EINTR;
     }
-    self->signaled = 0;
+    self->signaled--;
     rc = pthread_mutex_unlock (&self->mutex);
     errnum_assert (rc == 0, rc);
 
     return 0;
 }
 
+int nn_sem_trywait (struct nn_sem *self)
+{
+    int rc;
+    int taken;
+
+    rc = pthread_mutex_lock (&self->mutex);
+    errnum_assert (rc == 0, rc);
+    taken = self->signaled > 0;
+    if (taken)
+        self->signaled--;
+    rc = pthread_mutex_unlock (&self->mutex);
+    errnum_assert (rc == 0, rc);
+    return taken ? 0 : -EAGAIN;
+}
+
 #elif defined WINDOWS_PLATFORM
 
 void nn_sem_init (struct nn_sem *self)
 {
-    self->h = CreateEvent (NULL, FALSE, FALSE, NULL);
+    self->h = CreateSemaphore (NULL, 0, LONG_MAX, NULL);
     win_assert (self->h);
 }
 
@@ -111,7 +128,7 @@ void nn_sem_post (struct nn_sem *self)
 {
     BOOL brc;
 
-    brc = SetEvent (self->h);
+    brc = ReleaseSemaphore (self->h, 1, NULL);
     win_assert (brc);
 }
 
@@ -126,6 +143,82 @@ int nn_sem_wait (struct nn_sem *self)
     return 0;
 }
 
+int nn_sem_trywait (struct nn_sem *self)
+{
+    DWORD rc;
+
+    rc = WaitForSingleObject (self->h, 0);
+    win_assert (rc != WAIT_FAILED);
+    return rc == WAIT_OBJECT_0 ? 0 : -EAGAIN;
+}
+
+#elif defined NN_HAVE_FUTEX
+
+#include "futex.h"
+
+void nn_sem_init (struct nn_sem *self)
+{
+    self->count = 0;
+    self->waiters = 0;
+    self->spins = 0;
+}
+
+void nn_sem_term (struct nn_sem *self)
+{
+    nn_assert (self->waiters == 0);
+}
+
+void nn_sem_post (struct nn_sem *self)
+{
+    __atomic_add_fetch (&self->count, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n (&self->waiters, __ATOMIC_SEQ_CST))
+        nn_futex_wake (&self->count, 1);
+}
+
+int nn_sem_trywait (struct nn_sem *self)
+{
+    int c = __atomic_load_n (&self->count, __ATOMIC_RELAXED);
+
+    while (c > 0)
+        if (__atomic_compare_exchange_n (&self->count, &c, c - 1, 0,
+              __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return 0;
+    return -EAGAIN;
+}
+
+int nn_sem_wait (struct nn_sem *self)
+{
+    int i;
+    int max;
+    int rc;
+
+    if (nn_fast (nn_sem_trywait (self) == 0))
+        return 0;
+    max = nn_futex_spins (__atomic_load_n (&self->spins, __ATOMIC_RELAXED));
+    for (i = 0; i < max; i++) {
+        nn_cpu_relax ();
+        if (nn_sem_trywait (self) == 0) {
+            nn_futex_spun (&self->spins, i);
+            return 0;
+        }
+    }
+    if (max)
+        nn_futex_spun (&self->spins, max);
+
+    /*  A post either sees us counted and wakes us, or comes before the
+        count is read by the kernel and the sleep returns at once. */
+    __atomic_add_fetch (&self->waiters, 1, __ATOMIC_SEQ_CST);
+    while (nn_sem_trywait (self) != 0) {
+        rc = nn_futex_wait (&self->count, 0, -1);
+        if (nn_slow (rc == -EINTR)) {
+            __atomic_sub_fetch (&self->waiters, 1, __ATOMIC_RELAXED);
+            return -EINTR;
+        }
+    }
+    __atomic_sub_fetch (&self->waiters, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
 #elif defined NN_HAVE_SEMAPHORE
 
 void nn_sem_init (struct nn_sem *self)
@@ -163,6 +256,17 @@ int nn_sem_wait (struct nn_sem *self)
     return 0;
 }
 
+int nn_sem_trywait (struct nn_sem *self)
+{
+    int rc;
+
+    rc = sem_trywait (&self->sem);
+    if (rc < 0 && errno == EAGAIN)
+        return -EAGAIN;
+    errno_assert (rc == 0);
+    return 0;
+}
+
 #else
 #error
 #endif
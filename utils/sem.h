@@ -23,22 +23,30 @@
 #ifndef NN_SEM_INCLUDED
 #define NN_SEM_INCLUDED
 
-/*  Simple semaphore. It can have only two values (0/1 i.e. locked/unlocked). */
+#include "std.h"
+
+/*  Counting semaphore. Every post lets exactly one wait through, posts made
+    while nobody waits are kept. */
 
 struct nn_sem;
 
-/*  Initialise the sem object. It is created in locked state. */
+/*  Initialise the sem object. It is created with a count of 0. */
 void nn_sem_init (struct nn_sem *self);
 
 /*  Uninitialise the sem object. */
 void nn_sem_term (struct nn_sem *self);
 
-/*  Unlock the semaphore. */
+/*  Increment the count, waking one waiter if there is any. */
 void nn_sem_post (struct nn_sem *self);
 
-/*  Waits till sem object becomes unlocked and locks it. */
+/*  Waits till the count is positive and decrements it. Returns 0, or -EINTR
+    if interrupted by a signal. With futexes it spins a little first. */
 int nn_sem_wait (struct nn_sem *self);
 
+/*  Decrement the count if it is positive. Returns 0, or -EAGAIN if it is
+    0. Never blocks. */
+int nn_sem_trywait (struct nn_sem *self);
+
 #if defined NN_HAVE_OSX
 
 #include <pthread.h>
@@ -57,6 +65,15 @@ struct nn_sem {
     HANDLE h;
 };
 
+#elif defined NN_HAVE_FUTEX
+
+struct nn_sem {
+    volatile int count;
+    volatile int waiters;
+    /*  Rounds of spinning that recently sufficed to get a post. */
+    int spins;
+};
+
 #elif defined NN_HAVE_SEMAPHORE
 
 #include <semaphore.h>
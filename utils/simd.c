@@ -0,0 +1,841 @@
+#include <string.h>
+
+#include "simd.h"
+#include "std.h"
+
+#if defined __GNUC__ && (defined __x86_64__ || \
+    (defined __i386__ && defined __SSE2__))
+#define NN_SIMD_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+/*  Sets larger than this are matched by the scalar code, the vector code
+    compares every byte against every member of the set. */
+#define NN_SIMD_MAX_SET 16
+
+struct nn_simd_ops {
+    size_t (*find_char) (const char *s, size_t len, char c);
+    size_t (*find_str) (const char *s, size_t len, const char *sep,
+        size_t seplen);
+    size_t (*span) (const char *s, size_t len, const char *set,
+        size_t setlen);
+    size_t (*rspan) (const char *s, size_t len, const char *set,
+        size_t setlen);
+    void (*lower) (char *s, size_t len);
+    void (*upper) (char *s, size_t len);
+    void (*map) (char *s, size_t len, const char *from, const char *to,
+        size_t setlen);
+    size_t (*find_escape) (const char *s, size_t len);
+};
+
+static inline int nn_simd_needs_escape (unsigned char c)
+{
+    return c < 0x20 || c >= 0x7f || c == '\\' || c == '"';
+}
+
+/******************************************************************************/
+/*  Scalar kernels.                                                           */
+/******************************************************************************/
+
+static size_t nn_simd_find_char_scalar (const char *s, size_t len, char c)
+{
+    const char *p;
+
+    p = memchr (s, c, len);
+    return p ? (size_t) (p - s) : len;
+}
+
+static size_t nn_simd_find_str_scalar (const char *s, size_t len,
+    const char *sep, size_t seplen)
+{
+    size_t i;
+
+    if (seplen == 0)
+        return 0;
+    for (i = 0; i + seplen <= len; i++)
+        if (s [i] == sep [0] && memcmp (s + i, sep, seplen) == 0)
+            return i;
+    return len;
+}
+
+static void nn_simd_set_bitmap (unsigned char *map, const char *set,
+    size_t setlen)
+{
+    size_t i;
+
+    memset (map, 0, 32);
+    for (i = 0; i != setlen; i++)
+        map [(unsigned char) set [i] >> 3] |= 1 << (set [i] & 7);
+}
+
+#define nn_simd_in_bitmap(map, c) \
+    ((map) [(unsigned char) (c) >> 3] & (1 << ((c) & 7)))
+
+static size_t nn_simd_span_scalar (const char *s, size_t len,
+    const char *set, size_t setlen)
+{
+    unsigned char map [32];
+    size_t i;
+
+    nn_simd_set_bitmap (map, set, setlen);
+    for (i = 0; i < len && nn_simd_in_bitmap (map, s [i]); i++);
+    return i;
+}
+
+static size_t nn_simd_rspan_scalar (const char *s, size_t len,
+    const char *set, size_t setlen)
+{
+    unsigned char map [32];
+    size_t n;
+
+    nn_simd_set_bitmap (map, set, setlen);
+    for (n = len; n && nn_simd_in_bitmap (map, s [n - 1]); n--);
+    return len - n;
+}
+
+static void nn_simd_lower_scalar (char *s, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i != len; i++)
+        if (s [i] >= 'A' && s [i] <= 'Z')
+            s [i] += 'a' - 'A';
+}
+
+static void nn_simd_upper_scalar (char *s, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i != len; i++)
+        if (s [i] >= 'a' && s [i] <= 'z')
+            s [i] -= 'a' - 'A';
+}
+
+static void nn_simd_map_scalar (char *s, size_t len, const char *from,
+    const char *to, size_t setlen)
+{
+    unsigned char table [256];
+    size_t i;
+
+    for (i = 0; i != 256; i++)
+        table [i] = (unsigned char) i;
+    /*  Fill backwards so that the first occurrence in 'from' wins. */
+    for (i = setlen; i-- != 0;)
+        table [(unsigned char) from [i]] = (unsigned char) to [i];
+    for (i = 0; i != len; i++)
+        s [i] = (char) table [(unsigned char) s [i]];
+}
+
+static size_t nn_simd_find_escape_scalar (const char *s, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i != len; i++)
+        if (nn_simd_needs_escape (s [i]))
+            return i;
+    return len;
+}
+
+static const struct nn_simd_ops nn_simd_scalar_ops = {
+    nn_simd_find_char_scalar,
+    nn_simd_find_str_scalar,
+    nn_simd_span_scalar,
+    nn_simd_rspan_scalar,
+    nn_simd_lower_scalar,
+    nn_simd_upper_scalar,
+    nn_simd_map_scalar,
+    nn_simd_find_escape_scalar
+};
+
+#if defined NN_SIMD_X86
+
+/******************************************************************************/
+/*  SSE2 kernels, 16 bytes per step, the tails are done by the scalar code.   */
+/******************************************************************************/
+
+static size_t nn_simd_find_char_sse2 (const char *s, size_t len, char c)
+{
+    __m128i needle = _mm_set1_epi8 (c);
+    size_t i;
+    int mask;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        mask = _mm_movemask_epi8 (_mm_cmpeq_epi8 (needle,
+            _mm_loadu_si128 ((const __m128i*) (s + i))));
+        if (mask)
+            return i + __builtin_ctz (mask);
+    }
+    return i + nn_simd_find_char_scalar (s + i, len - i, c);
+}
+
+/*  Candidates are positions where both the first and the last byte of the
+    separator match, only those are compared in full. */
+static size_t nn_simd_find_str_sse2 (const char *s, size_t len,
+    const char *sep, size_t seplen)
+{
+    __m128i first, last, eq;
+    size_t i;
+    int mask;
+
+    if (seplen <= 1)
+        return seplen ? nn_simd_find_char_sse2 (s, len, sep [0]) : 0;
+    first = _mm_set1_epi8 (sep [0]);
+    last = _mm_set1_epi8 (sep [seplen - 1]);
+    for (i = 0; i + seplen - 1 + 16 <= len; i += 16) {
+        eq = _mm_and_si128 (
+            _mm_cmpeq_epi8 (first, _mm_loadu_si128 ((const __m128i*) (s + i))),
+            _mm_cmpeq_epi8 (last,
+                _mm_loadu_si128 ((const __m128i*) (s + i + seplen - 1))));
+        mask = _mm_movemask_epi8 (eq);
+        while (mask) {
+            if (memcmp (s + i + __builtin_ctz (mask) + 1, sep + 1,
+                  seplen - 2) == 0)
+                return i + __builtin_ctz (mask);
+            mask &= mask - 1;
+        }
+    }
+    return i + nn_simd_find_str_scalar (s + i, len - i, sep, seplen);
+}
+
+/*  Mask of the bytes of 'v' that are in the set. */
+#define NN_SIMD_SSE2_INSET(m, v, setv, setlen) do { \
+    size_t k_; \
+    (m) = _mm_setzero_si128 (); \
+    for (k_ = 0; k_ != (setlen); k_++) \
+        (m) = _mm_or_si128 ((m), _mm_cmpeq_epi8 ((v), (setv) [k_])); \
+} while (0)
+
+static size_t nn_simd_span_sse2 (const char *s, size_t len,
+    const char *set, size_t setlen)
+{
+    __m128i setv [NN_SIMD_MAX_SET], m;
+    size_t i;
+    int mask;
+
+    if (setlen > NN_SIMD_MAX_SET)
+        return nn_simd_span_scalar (s, len, set, setlen);
+    for (i = 0; i != setlen; i++)
+        setv [i] = _mm_set1_epi8 (set [i]);
+    for (i = 0; i + 16 <= len; i += 16) {
+        NN_SIMD_SSE2_INSET (m, _mm_loadu_si128 ((const __m128i*) (s + i)),
+            setv, setlen);
+        mask = _mm_movemask_epi8 (m) ^ 0xffff;
+        if (mask)
+            return i + __builtin_ctz (mask);
+    }
+    return i + nn_simd_span_scalar (s + i, len - i, set, setlen);
+}
+
+static size_t nn_simd_rspan_sse2 (const char *s, size_t len,
+    const char *set, size_t setlen)
+{
+    __m128i setv [NN_SIMD_MAX_SET], m;
+    size_t i, n;
+    int mask;
+
+    if (setlen > NN_SIMD_MAX_SET)
+        return nn_simd_rspan_scalar (s, len, set, setlen);
+    for (i = 0; i != setlen; i++)
+        setv [i] = _mm_set1_epi8 (set [i]);
+    for (n = len; n >= 16; n -= 16) {
+        NN_SIMD_SSE2_INSET (m,
+            _mm_loadu_si128 ((const __m128i*) (s + n - 16)), setv, setlen);
+        mask = _mm_movemask_epi8 (m) ^ 0xffff;
+        if (mask)
+            return len - (n - 16 + (31 - __builtin_clz (mask)) + 1);
+    }
+    return len - n + nn_simd_rspan_scalar (s, n, set, setlen);
+}
+
+static void nn_simd_lower_sse2 (char *s, size_t len)
+{
+    __m128i lo = _mm_set1_epi8 ('A' - 1);
+    __m128i hi = _mm_set1_epi8 ('Z' + 1);
+    __m128i delta = _mm_set1_epi8 ('a' - 'A');
+    __m128i v, m;
+    size_t i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        v = _mm_loadu_si128 ((const __m128i*) (s + i));
+        m = _mm_and_si128 (_mm_cmpgt_epi8 (v, lo), _mm_cmplt_epi8 (v, hi));
+        v = _mm_add_epi8 (v, _mm_and_si128 (m, delta));
+        _mm_storeu_si128 ((__m128i*) (s + i), v);
+    }
+    nn_simd_lower_scalar (s + i, len - i);
+}
+
+static void nn_simd_upper_sse2 (char *s, size_t len)
+{
+    __m128i lo = _mm_set1_epi8 ('a' - 1);
+    __m128i hi = _mm_set1_epi8 ('z' + 1);
+    __m128i delta = _mm_set1_epi8 ('a' - 'A');
+    __m128i v, m;
+    size_t i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        v = _mm_loadu_si128 ((const __m128i*) (s + i));
+        m = _mm_and_si128 (_mm_cmpgt_epi8 (v, lo), _mm_cmplt_epi8 (v, hi));
+        v = _mm_sub_epi8 (v, _mm_and_si128 (m, delta));
+        _mm_storeu_si128 ((__m128i*) (s + i), v);
+    }
+    nn_simd_upper_scalar (s + i, len - i);
+}
+
+static void nn_simd_map_sse2 (char *s, size_t len, const char *from,
+    const char *to, size_t setlen)
+{
+    __m128i fromv [NN_SIMD_MAX_SET], tov [NN_SIMD_MAX_SET];
+    __m128i v, r, m, done;
+    size_t i, k;
+
+    if (setlen > NN_SIMD_MAX_SET || len < 16) {
+        nn_simd_map_scalar (s, len, from, to, setlen);
+        return;
+    }
+    for (k = 0; k != setlen; k++) {
+        fromv [k] = _mm_set1_epi8 (from [k]);
+        tov [k] = _mm_set1_epi8 (to [k]);
+    }
+    for (i = 0; i + 16 <= len; i += 16) {
+        v = _mm_loadu_si128 ((const __m128i*) (s + i));
+        r = v;
+        done = _mm_setzero_si128 ();
+        for (k = 0; k != setlen; k++) {
+            m = _mm_andnot_si128 (done, _mm_cmpeq_epi8 (v, fromv [k]));
+            r = _mm_or_si128 (_mm_andnot_si128 (m, r),
+                _mm_and_si128 (m, tov [k]));
+            done = _mm_or_si128 (done, m);
+        }
+        _mm_storeu_si128 ((__m128i*) (s + i), r);
+    }
+    nn_simd_map_scalar (s + i, len - i, from, to, setlen);
+}
+
+/*  Signed compare: bytes >= 0x80 are negative and so below 0x20 too. */
+static size_t nn_simd_find_escape_sse2 (const char *s, size_t len)
+{
+    __m128i space = _mm_set1_epi8 (0x20);
+    __m128i del = _mm_set1_epi8 (0x7f);
+    __m128i bslash = _mm_set1_epi8 ('\\');
+    __m128i quote = _mm_set1_epi8 ('"');
+    __m128i v, m;
+    size_t i;
+    int mask;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        v = _mm_loadu_si128 ((const __m128i*) (s + i));
+        m = _mm_or_si128 (
+            _mm_or_si128 (_mm_cmplt_epi8 (v, space), _mm_cmpeq_epi8 (v, del)),
+            _mm_or_si128 (_mm_cmpeq_epi8 (v, bslash),
+                _mm_cmpeq_epi8 (v, quote)));
+        mask = _mm_movemask_epi8 (m);
+        if (mask)
+            return i + __builtin_ctz (mask);
+    }
+    return i + nn_simd_find_escape_scalar (s + i, len - i);
+}
+
+static const struct nn_simd_ops nn_simd_sse2_ops = {
+    nn_simd_find_char_sse2,
+    nn_simd_find_str_sse2,
+    nn_simd_span_sse2,
+    nn_simd_rspan_sse2,
+    nn_simd_lower_sse2,
+    nn_simd_upper_sse2,
+    nn_simd_map_sse2,
+    nn_simd_find_escape_sse2
+};
+
+/******************************************************************************/
+/*  AVX2 kernels, 32 bytes per step. Compiled for AVX2 through the target     */
+/*  attribute so that the rest of the library does not require it.           */
+/******************************************************************************/
+
+#define NN_SIMD_TARGET_AVX2 __attribute__ ((target ("avx2")))
+
+NN_SIMD_TARGET_AVX2
+static size_t nn_simd_find_char_avx2 (const char *s, size_t len,
+    char c)
+{
+    __m256i needle = _mm256_set1_epi8 (c);
+    unsigned mask;
+    size_t i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        mask = (unsigned) _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (needle,
+            _mm256_loadu_si256 ((const __m256i*) (s + i))));
+        if (mask)
+            return i + __builtin_ctz (mask);
+    }
+    return i + nn_simd_find_char_scalar (s + i, len - i, c);
+}
+
+NN_SIMD_TARGET_AVX2
+static size_t nn_simd_find_str_avx2 (const char *s, size_t len,
+    const char *sep, size_t seplen)
+{
+    __m256i first, last, eq;
+    unsigned mask;
+    size_t i;
+
+    if (seplen <= 1)
+        return seplen ? nn_simd_find_char_avx2 (s, len, sep [0]) : 0;
+    first = _mm256_set1_epi8 (sep [0]);
+    last = _mm256_set1_epi8 (sep [seplen - 1]);
+    for (i = 0; i + seplen - 1 + 32 <= len; i += 32) {
+        eq = _mm256_and_si256 (
+            _mm256_cmpeq_epi8 (first,
+                _mm256_loadu_si256 ((const __m256i*) (s + i))),
+            _mm256_cmpeq_epi8 (last,
+                _mm256_loadu_si256 ((const __m256i*) (s + i + seplen - 1))));
+        mask = (unsigned) _mm256_movemask_epi8 (eq);
+        while (mask) {
+            if (memcmp (s + i + __builtin_ctz (mask) + 1, sep + 1,
+                  seplen - 2) == 0)
+                return i + __builtin_ctz (mask);
+            mask &= mask - 1;
+        }
+    }
+    return i + nn_simd_find_str_scalar (s + i, len - i, sep, seplen);
+}
+
+#define NN_SIMD_AVX2_INSET(m, v, setv, setlen) do { \
+    size_t k_; \
+    (m) = _mm256_setzero_si256 (); \
+    for (k_ = 0; k_ != (setlen); k_++) \
+        (m) = _mm256_or_si256 ((m), _mm256_cmpeq_epi8 ((v), (setv) [k_])); \
+} while (0)
+
+NN_SIMD_TARGET_AVX2
+static size_t nn_simd_span_avx2 (const char *s, size_t len,
+    const char *set, size_t setlen)
+{
+    __m256i setv [NN_SIMD_MAX_SET], m;
+    unsigned mask;
+    size_t i;
+
+    if (setlen > NN_SIMD_MAX_SET)
+        return nn_simd_span_scalar (s, len, set, setlen);
+    for (i = 0; i != setlen; i++)
+        setv [i] = _mm256_set1_epi8 (set [i]);
+    for (i = 0; i + 32 <= len; i += 32) {
+        NN_SIMD_AVX2_INSET (m,
+            _mm256_loadu_si256 ((const __m256i*) (s + i)), setv, setlen);
+        mask = ~(unsigned) _mm256_movemask_epi8 (m);
+        if (mask)
+            return i + __builtin_ctz (mask);
+    }
+    return i + nn_simd_span_scalar (s + i, len - i, set, setlen);
+}
+
+NN_SIMD_TARGET_AVX2
+static size_t nn_simd_rspan_avx2 (const char *s, size_t len,
+    const char *set, size_t setlen)
+{
+    __m256i setv [NN_SIMD_MAX_SET], m;
+    unsigned mask;
+    size_t i, n;
+
+    if (setlen > NN_SIMD_MAX_SET)
+        return nn_simd_rspan_scalar (s, len, set, setlen);
+    for (i = 0; i != setlen; i++)
+        setv [i] = _mm256_set1_epi8 (set [i]);
+    for (n = len; n >= 32; n -= 32) {
+        NN_SIMD_AVX2_INSET (m,
+            _mm256_loadu_si256 ((const __m256i*) (s + n - 32)), setv, setlen);
+        mask = ~(unsigned) _mm256_movemask_epi8 (m);
+        if (mask)
+            return len - (n - 32 + (31 - __builtin_clz (mask)) + 1);
+    }
+    return len - n + nn_simd_rspan_scalar (s, n, set, setlen);
+}
+
+NN_SIMD_TARGET_AVX2
+static void nn_simd_lower_avx2 (char *s, size_t len)
+{
+    __m256i lo = _mm256_set1_epi8 ('A' - 1);
+    __m256i hi = _mm256_set1_epi8 ('Z' + 1);
+    __m256i delta = _mm256_set1_epi8 ('a' - 'A');
+    __m256i v, m;
+    size_t i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        v = _mm256_loadu_si256 ((const __m256i*) (s + i));
+        m = _mm256_and_si256 (_mm256_cmpgt_epi8 (v, lo),
+            _mm256_cmpgt_epi8 (hi, v));
+        v = _mm256_add_epi8 (v, _mm256_and_si256 (m, delta));
+        _mm256_storeu_si256 ((__m256i*) (s + i), v);
+    }
+    nn_simd_lower_scalar (s + i, len - i);
+}
+
+NN_SIMD_TARGET_AVX2
+static void nn_simd_upper_avx2 (char *s, size_t len)
+{
+    __m256i lo = _mm256_set1_epi8 ('a' - 1);
+    __m256i hi = _mm256_set1_epi8 ('z' + 1);
+    __m256i delta = _mm256_set1_epi8 ('a' - 'A');
+    __m256i v, m;
+    size_t i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        v = _mm256_loadu_si256 ((const __m256i*) (s + i));
+        m = _mm256_and_si256 (_mm256_cmpgt_epi8 (v, lo),
+            _mm256_cmpgt_epi8 (hi, v));
+        v = _mm256_sub_epi8 (v, _mm256_and_si256 (m, delta));
+        _mm256_storeu_si256 ((__m256i*) (s + i), v);
+    }
+    nn_simd_upper_scalar (s + i, len - i);
+}
+
+NN_SIMD_TARGET_AVX2
+static void nn_simd_map_avx2 (char *s, size_t len,
+    const char *from, const char *to, size_t setlen)
+{
+    __m256i fromv [NN_SIMD_MAX_SET], tov [NN_SIMD_MAX_SET];
+    __m256i v, r, m, done;
+    size_t i, k;
+
+    if (setlen > NN_SIMD_MAX_SET || len < 32) {
+        nn_simd_map_scalar (s, len, from, to, setlen);
+        return;
+    }
+    for (k = 0; k != setlen; k++) {
+        fromv [k] = _mm256_set1_epi8 (from [k]);
+        tov [k] = _mm256_set1_epi8 (to [k]);
+    }
+    for (i = 0; i + 32 <= len; i += 32) {
+        v = _mm256_loadu_si256 ((const __m256i*) (s + i));
+        r = v;
+        done = _mm256_setzero_si256 ();
+        for (k = 0; k != setlen; k++) {
+            m = _mm256_andnot_si256 (done, _mm256_cmpeq_epi8 (v, fromv [k]));
+            r = _mm256_blendv_epi8 (r, tov [k], m);
+            done = _mm256_or_si256 (done, m);
+        }
+        _mm256_storeu_si256 ((__m256i*) (s + i), r);
+    }
+    nn_simd_map_scalar (s + i, len - i, from, to, setlen);
+}
+
+NN_SIMD_TARGET_AVX2
+static size_t nn_simd_find_escape_avx2 (const char *s,
+    size_t len)
+{
+    __m256i space = _mm256_set1_epi8 (0x20);
+    __m256i del = _mm256_set1_epi8 (0x7f);
+    __m256i bslash = _mm256_set1_epi8 ('\\');
+    __m256i quote = _mm256_set1_epi8 ('"');
+    __m256i v, m;
+    unsigned mask;
+    size_t i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        v = _mm256_loadu_si256 ((const __m256i*) (s + i));
+        m = _mm256_or_si256 (
+            _mm256_or_si256 (_mm256_cmpgt_epi8 (space, v),
+                _mm256_cmpeq_epi8 (v, del)),
+            _mm256_or_si256 (_mm256_cmpeq_epi8 (v, bslash),
+                _mm256_cmpeq_epi8 (v, quote)));
+        mask = (unsigned) _mm256_movemask_epi8 (m);
+        if (mask)
+            return i + __builtin_ctz (mask);
+    }
+    return i + nn_simd_find_escape_scalar (s + i, len - i);
+}
+
+static const struct nn_simd_ops nn_simd_avx2_ops = {
+    nn_simd_find_char_avx2,
+    nn_simd_find_str_avx2,
+    nn_simd_span_avx2,
+    nn_simd_rspan_avx2,
+    nn_simd_lower_avx2,
+    nn_simd_upper_avx2,
+    nn_simd_map_avx2,
+    nn_simd_find_escape_avx2
+};
+
+#endif
+
+/******************************************************************************/
+/*  Dispatch.                                                                 */
+/******************************************************************************/
+
+static const struct nn_simd_ops *nn_simd_ops;
+static int nn_simd_current;
+
+static int nn_simd_detect (void)
+{
+#if defined NN_SIMD_X86
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx2"))
+        return NN_SIMD_AVX2;
+    if (__builtin_cpu_supports ("sse2"))
+        return NN_SIMD_SSE2;
+#endif
+    return NN_SIMD_SCALAR;
+}
+
+int nn_simd_force (int level)
+{
+    int best = nn_simd_detect ();
+
+    if (level < 0 || level > best)
+        level = best;
+    switch (level) {
+#if defined NN_SIMD_X86
+    case NN_SIMD_AVX2:
+        nn_simd_ops = &nn_simd_avx2_ops;
+        break;
+    case NN_SIMD_SSE2:
+        nn_simd_ops = &nn_simd_sse2_ops;
+        break;
+#endif
+    default:
+        nn_simd_ops = &nn_simd_scalar_ops;
+        level = NN_SIMD_SCALAR;
+    }
+    nn_simd_current = level;
+    return level;
+}
+
+/*  Detection is idempotent, two threads racing through it store the same
+    values. */
+static inline const struct nn_simd_ops *nn_simd_get (void)
+{
+    if (nn_slow (nn_simd_ops == NULL))
+        nn_simd_force (-1);
+    return nn_simd_ops;
+}
+
+int nn_simd_level (void)
+{
+    nn_simd_get ();
+    return nn_simd_current;
+}
+
+size_t nn_simd_find_char (const char *s, size_t len, char c)
+{
+    return nn_simd_get ()->find_char (s, len, c);
+}
+
+size_t nn_simd_find_str (const char *s, size_t len, const char *sep,
+    size_t seplen)
+{
+    return nn_simd_get ()->find_str (s, len, sep, seplen);
+}
+
+size_t nn_simd_span (const char *s, size_t len, const char *set,
+    size_t setlen)
+{
+    return nn_simd_get ()->span (s, len, set, setlen);
+}
+
+size_t nn_simd_rspan (const char *s, size_t len, const char *set,
+    size_t setlen)
+{
+    return nn_simd_get ()->rspan (s, len, set, setlen);
+}
+
+void nn_simd_lower (char *s, size_t len)
+{
+    nn_simd_get ()->lower (s, len);
+}
+
+void nn_simd_upper (char *s, size_t len)
+{
+    nn_simd_get ()->upper (s, len);
+}
+
+void nn_simd_map (char *s, size_t len, const char *from, const char *to,
+    size_t setlen)
+{
+    nn_simd_get ()->map (s, len, from, to, setlen);
+}
+
+size_t nn_simd_find_escape (const char *s, size_t len)
+{
+    return nn_simd_get ()->find_escape (s, len);
+}
+
+#if defined SIMD_TEST_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include "sds.h"
+#include "alloc.h"
+#include "testhelp.h"
+
+/*  Differential test: the sds functions built on the kernels are compared
+    with the byte at a time code they replaced, at every level the CPU
+    supports, on random inputs whose lengths straddle the vector widths. */
+
+#define SIMD_TEST_ROUNDS 20000
+#define SIMD_TEST_MAXLEN 200
+
+static sds refTrim(sds s, const char *cset) {
+    char *sp, *ep, *end;
+    size_t len;
+
+    sp = s;
+    ep = end = s+sds_len(s)-1;
+    while(sp <= end && strchr(cset, *sp)) sp++;
+    while(ep > sp && strchr(cset, *ep)) ep--;
+    len = (sp > ep) ? 0 : ((ep-sp)+1);
+    if (s != sp) memmove(s, sp, len);
+    s[len] = '\0';
+    sds_set_len(s,len);
+    return s;
+}
+
+static void refCase(sds s, int upper) {
+    size_t j;
+
+    for (j = 0; j < sds_len(s); j++)
+        s[j] = upper ? toupper(s[j]) : tolower(s[j]);
+}
+
+static void refMap(sds s, const char *from, const char *to, size_t setlen) {
+    size_t j, i;
+
+    for (j = 0; j < sds_len(s); j++) {
+        for (i = 0; i < setlen; i++) {
+            if (s[j] == from[i]) {
+                s[j] = to[i];
+                break;
+            }
+        }
+    }
+}
+
+static sds refRepr(sds s, const char *p, size_t len) {
+    s = sds_append_len(s,"\"",1);
+    while(len--) {
+        switch(*p) {
+        case '\\':
+        case '"':
+            s = sds_append_printf(s,"\\%c",*p);
+            break;
+        case '\n': s = sds_append_len(s,"\\n",2); break;
+        case '\r': s = sds_append_len(s,"\\r",2); break;
+        case '\t': s = sds_append_len(s,"\\t",2); break;
+        case '\a': s = sds_append_len(s,"\\a",2); break;
+        case '\b': s = sds_append_len(s,"\\b",2); break;
+        default:
+            if (isprint(*p))
+                s = sds_append_printf(s,"%c",*p);
+            else
+                s = sds_append_printf(s,"\\x%02x",(unsigned char)*p);
+            break;
+        }
+        p++;
+    }
+    return sds_append_len(s,"\"",1);
+}
+
+/* Number of pieces and total length of a split done the old way, compared
+ * with the tokens produced by sds_split_len(). */
+static int refSplitMatches(const char *s, int len, const char *sep,
+                           int seplen, sds *tokens, int count) {
+    int elements = 0, start = 0, j;
+
+    for (j = 0; j < (len-(seplen-1)); j++) {
+        if (memcmp(s+j,sep,seplen) == 0) {
+            if (elements >= count ||
+                sds_len(tokens[elements]) != (size_t)(j-start) ||
+                memcmp(tokens[elements],s+start,j-start) != 0) return 0;
+            elements++;
+            start = j+seplen;
+            j = j+seplen-1;
+        }
+    }
+    if (elements != count-1) return 0;
+    return sds_len(tokens[elements]) == (size_t)(len-start) &&
+           memcmp(tokens[elements],s+start,len-start) == 0;
+}
+
+/* Random bytes drawn from a small alphabet so that sets and separators
+ * actually match, with the odd arbitrary byte mixed in. */
+static void randomFill(char *p, size_t len, const char *alphabet) {
+    size_t j, n = strlen(alphabet);
+
+    for (j = 0; j < len; j++)
+        p[j] = (rand() % 16) ? alphabet[rand()%n] : (char)(rand()%256);
+}
+
+static int checkLevel(void) {
+    static const char *alphabet = "aAzZ@[`{ \t\n\"\\:.-_x";
+    char buf[SIMD_TEST_MAXLEN], cset[24], from[24], to[24], sep[4];
+    int round, ok_trim = 1, ok_case = 1, ok_map = 1, ok_repr = 1;
+    int ok_split = 1, ok_find = 1;
+
+    for (round = 0; round < SIMD_TEST_ROUNDS; round++) {
+        size_t len = rand() % SIMD_TEST_MAXLEN;
+        size_t setlen = 1 + rand() % 20, sl = 1 + rand() % 3, j;
+        sds a, b, *tokens;
+        int count;
+
+        randomFill(buf, len, alphabet);
+        randomFill(cset, setlen, alphabet);
+        for (j = 0; j < setlen; j++) if (!cset[j]) cset[j] = 'x';
+        cset[setlen] = '\0';
+        randomFill(from, setlen, alphabet);
+        randomFill(to, setlen, alphabet);
+        randomFill(sep, sl, alphabet);
+
+        a = sds_trim(sds_new_len(buf,len), cset);
+        b = refTrim(sds_new_len(buf,len), cset);
+        if (sds_cmp(a,b) != 0) ok_trim = 0;
+        sds_free(a); sds_free(b);
+
+        a = sds_new_len(buf,len); b = sds_new_len(buf,len);
+        sds_to_lower(a); refCase(b,0);
+        if (sds_cmp(a,b) != 0) ok_case = 0;
+        sds_to_upper(a); refCase(b,1);
+        if (sds_cmp(a,b) != 0) ok_case = 0;
+        sds_free(a); sds_free(b);
+
+        a = sds_map_chars(sds_new_len(buf,len), from, to, setlen);
+        b = sds_new_len(buf,len);
+        refMap(b, from, to, setlen);
+        if (sds_cmp(a,b) != 0) ok_map = 0;
+        sds_free(a); sds_free(b);
+
+        a = sds_append_repr(sds_empty(), buf, len);
+        b = refRepr(sds_empty(), buf, len);
+        if (sds_cmp(a,b) != 0) ok_repr = 0;
+        sds_free(a); sds_free(b);
+
+        tokens = sds_split_len(buf, (int)len, sep, (int)sl, &count);
+        if (len && !refSplitMatches(buf, (int)len, sep, (int)sl,
+                                    tokens, count)) ok_split = 0;
+        sds_free_splitres(tokens, count);
+
+        j = nn_simd_find_char(buf, len, sep[0]);
+        if (j != (memchr(buf, sep[0], len) ?
+            (size_t)((char*)memchr(buf, sep[0], len)-buf) : len)) ok_find = 0;
+    }
+    test_cond("sds_trim() matches the reference", ok_trim);
+    test_cond("sds_to_lower()/sds_to_upper() match the reference", ok_case);
+    test_cond("sds_map_chars() matches the reference", ok_map);
+    test_cond("sds_append_repr() matches the reference", ok_repr);
+    test_cond("sds_split_len() matches the reference", ok_split);
+    test_cond("nn_simd_find_char() matches memchr()", ok_find);
+    return 0;
+}
+
+int main(void) {
+    static const char *names[] = {"scalar", "sse2", "avx2"};
+    int best = nn_simd_level(), level;
+
+    printf("detected: %s\n", names[best]);
+    for (level = NN_SIMD_SCALAR; level <= best; level++) {
+        srand(1234);
+        printf("level %s\n", names[nn_simd_force(level)]);
+        checkLevel();
+    }
+    test_report()
+    return 0;
+}
+#endif
@@ -0,0 +1,53 @@
+#ifndef NN_SIMD_INCLUDED
+#define NN_SIMD_INCLUDED
+
+#include <stddef.h>
+
+/*  Byte scanning and transformation kernels behind the sds string functions.
+    Each kernel has a scalar, an SSE2 and an AVX2 implementation; the widest
+    one the CPU supports (CPUID) is picked on first use. Off x86 only the
+    scalar code is built. All of them treat bytes as the C locale does:
+    only ASCII letters change case and only 0x20-0x7e are printable. */
+
+#define NN_SIMD_SCALAR 0
+#define NN_SIMD_SSE2 1
+#define NN_SIMD_AVX2 2
+
+/*  Instruction set in use. */
+int nn_simd_level (void);
+
+/*  Use 'level' instead of the detected one, capped at what the CPU
+    supports. Returns the level actually selected. Meant for tests and
+    benchmarks, not thread-safe against concurrent kernel calls. */
+int nn_simd_force (int level);
+
+/*  Offset of the first 'c' in 's', 'len' if there is none. */
+size_t nn_simd_find_char (const char *s, size_t len, char c);
+
+/*  Offset of the first occurrence of 'sep' in 's', 'len' if there is
+    none. */
+size_t nn_simd_find_str (const char *s, size_t len, const char *sep,
+    size_t seplen);
+
+/*  Number of leading bytes of 's' that belong to 'set'. */
+size_t nn_simd_span (const char *s, size_t len, const char *set,
+    size_t setlen);
+
+/*  Number of trailing bytes of 's' that belong to 'set'. */
+size_t nn_simd_rspan (const char *s, size_t len, const char *set,
+    size_t setlen);
+
+/*  ASCII case conversion in place. */
+void nn_simd_lower (char *s, size_t len);
+void nn_simd_upper (char *s, size_t len);
+
+/*  Replace every byte found in 'from' by the byte at the same position in
+    'to'; the first match wins. */
+void nn_simd_map (char *s, size_t len, const char *from, const char *to,
+    size_t setlen);
+
+/*  Offset of the first byte that sds_append_repr() has to escape: a
+    non-printable byte, '\\' or '"'. 'len' if there is none. */
+size_t nn_simd_find_escape (const char *s, size_t len);
+
+#endif
@@ -0,0 +1,196 @@
+#include "spinlock.h"
+#include "err.h"
+#include "std.h"
+
+#if defined NN_HAVE_WINDOWS
+#include "win.h"
+#define nn_spinlock_yield() SwitchToThread ()
+#else
+#include <sched.h>
+#define nn_spinlock_yield() sched_yield ()
+#endif
+
+#if defined NN_HAVE_FUTEX
+#include "futex.h"
+#define nn_spinlock_budget() nn_futex_spins (NN_FUTEX_SPIN_MAX)
+#else
+#define nn_spinlock_budget() 100
+#endif
+
+/*  One round of waiting; 'round' counts them from 0. */
+static void nn_spinlock_pause (int *round, int budget)
+{
+    if ((*round)++ < budget)
+        nn_cpu_relax ();
+    else
+        nn_spinlock_yield ();
+}
+
+void nn_ticketlock_init (struct nn_ticketlock *self)
+{
+    self->next = 0;
+    self->owner = 0;
+}
+
+void nn_ticketlock_term (struct nn_ticketlock *self)
+{
+    nn_assert (self->next == self->owner);
+}
+
+void nn_ticketlock_lock (struct nn_ticketlock *self)
+{
+    uint32_t ticket;
+    int round = 0;
+    int budget;
+
+    ticket = __atomic_fetch_add (&self->next, 1, __ATOMIC_RELAXED);
+    if (nn_fast (__atomic_load_n (&self->owner, __ATOMIC_ACQUIRE) == ticket))
+        return;
+    budget = nn_spinlock_budget ();
+    while (__atomic_load_n (&self->owner, __ATOMIC_ACQUIRE) != ticket)
+        nn_spinlock_pause (&round, budget);
+}
+
+void nn_ticketlock_unlock (struct nn_ticketlock *self)
+{
+    /*  Only the holder writes 'owner'. */
+    __atomic_store_n (&self->owner,
+        __atomic_load_n (&self->owner, __ATOMIC_RELAXED) + 1,
+        __ATOMIC_RELEASE);
+}
+
+/*  Mellor-Crummey and Scott, "Algorithms for scalable synchronization on
+    shared-memory multiprocessors" (1991). */
+
+void nn_mcslock_init (struct nn_mcslock *self)
+{
+    self->tail = NULL;
+}
+
+void nn_mcslock_term (struct nn_mcslock *self)
+{
+    nn_assert (self->tail == NULL);
+}
+
+void nn_mcslock_lock (struct nn_mcslock *self, struct nn_mcslock_node *node)
+{
+    struct nn_mcslock_node *prev;
+    int round = 0;
+    int budget;
+
+    __atomic_store_n (&node->next, NULL, __ATOMIC_RELAXED);
+    __atomic_store_n (&node->locked, 1, __ATOMIC_RELAXED);
+    prev = __atomic_exchange_n (&self->tail, node, __ATOMIC_ACQ_REL);
+    if (nn_fast (prev == NULL))
+        return;
+
+    /*  Queue behind the previous waiter and spin on our own node until it
+        hands the lock over. */
+    __atomic_store_n (&prev->next, node, __ATOMIC_RELEASE);
+    budget = nn_spinlock_budget ();
+    while (__atomic_load_n (&node->locked, __ATOMIC_ACQUIRE))
+        nn_spinlock_pause (&round, budget);
+}
+
+void nn_mcslock_unlock (struct nn_mcslock *self, struct nn_mcslock_node *node)
+{
+    struct nn_mcslock_node *next;
+    struct nn_mcslock_node *expected;
+    int round = 0;
+    int budget;
+
+    next = __atomic_load_n (&node->next, __ATOMIC_ACQUIRE);
+    if (nn_fast (next == NULL)) {
+        expected = node;
+        if (__atomic_compare_exchange_n (&self->tail, &expected, NULL, 0,
+              __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            return;
+
+        /*  A waiter swapped the tail but has not linked itself yet. */
+        budget = nn_spinlock_budget ();
+        while ((next = __atomic_load_n (&node->next, __ATOMIC_ACQUIRE)) ==
+              NULL)
+            nn_spinlock_pause (&round, budget);
+    }
+    __atomic_store_n (&next->locked, 0, __ATOMIC_RELEASE);
+}
+
+#if defined SPINLOCK_TEST_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+#include "thread.h"
+#include "testhelp.h"
+
+#define THREADS 4
+#define ROUNDS 100000
+
+static struct nn_ticketlock ticket;
+static struct nn_mcslock mcs;
+static long counter;
+static int inside;
+static int overlaps;
+
+static void enter(void) {
+    if (__atomic_add_fetch(&inside, 1, __ATOMIC_RELAXED) != 1)
+        overlaps++;
+    counter++;
+    __atomic_sub_fetch(&inside, 1, __ATOMIC_RELAXED);
+}
+
+static void ticketWorker(void *arg) {
+    int j;
+
+    (void)arg;
+    for (j = 0; j < ROUNDS; j++) {
+        nn_ticketlock_lock(&ticket);
+        enter();
+        nn_ticketlock_unlock(&ticket);
+    }
+}
+
+static void mcsWorker(void *arg) {
+    struct nn_mcslock_node node;
+    int j;
+
+    (void)arg;
+    for (j = 0; j < ROUNDS; j++) {
+        nn_mcslock_lock(&mcs, &node);
+        enter();
+        nn_mcslock_unlock(&mcs, &node);
+    }
+}
+
+int main(void) {
+    struct nn_thread t[THREADS];
+    struct nn_mcslock_node a, b;
+    int j;
+
+    nn_ticketlock_init(&ticket);
+    counter = overlaps = 0;
+    for (j = 0; j < THREADS; j++) nn_thread_init(&t[j], ticketWorker, NULL);
+    for (j = 0; j < THREADS; j++) nn_thread_term(&t[j]);
+    test_cond("Ticket lock excludes", counter == (long)THREADS*ROUNDS &&
+        overlaps == 0 && ticket.next == (uint32_t)THREADS*ROUNDS &&
+        ticket.owner == ticket.next);
+    nn_ticketlock_term(&ticket);
+
+    nn_mcslock_init(&mcs);
+    counter = overlaps = 0;
+    for (j = 0; j < THREADS; j++) nn_thread_init(&t[j], mcsWorker, NULL);
+    for (j = 0; j < THREADS; j++) nn_thread_term(&t[j]);
+    test_cond("MCS lock excludes", counter == (long)THREADS*ROUNDS &&
+        overlaps == 0 && mcs.tail == NULL);
+
+    /* Unlocking with a waiter queued hands the lock to it directly. */
+    nn_mcslock_lock(&mcs, &a);
+    b.locked = 1;
+    b.next = NULL;
+    mcs.tail = &b;
+    a.next = &b;
+    nn_mcslock_unlock(&mcs, &a);
+    test_cond("MCS hands over in order", b.locked == 0 && mcs.tail == &b);
+    nn_mcslock_unlock(&mcs, &b);
+    nn_mcslock_term(&mcs);
+    test_report()
+}
+#endif
@@ -0,0 +1,45 @@
+#ifndef NN_SPINLOCK_INCLUDED
+#define NN_SPINLOCK_INCLUDED
+
+#include <stdint.h>
+
+/*  Fair spin locks for short critical sections: the lock goes to the
+    waiters in the order they asked for it, where nn_mutex lets whoever
+    comes first barge in. A waiter busy waits for a bounded number of rounds
+    and then yields the CPU on every round, at once on a single CPU.
+
+    The ticket lock is two counters; every waiter polls the same line, so a
+    release costs a cache miss per waiter. The MCS lock queues the waiters
+    in nodes they provide, each polling its own node, so a release touches
+    the next waiter's line only. */
+
+struct nn_ticketlock {
+    volatile uint32_t next;
+    volatile uint32_t owner;
+};
+
+void nn_ticketlock_init (struct nn_ticketlock *self);
+void nn_ticketlock_term (struct nn_ticketlock *self);
+void nn_ticketlock_lock (struct nn_ticketlock *self);
+void nn_ticketlock_unlock (struct nn_ticketlock *self);
+
+/*  Queue entry of a waiter. It must stay valid from the lock to the
+    unlock, on the stack of the locking function usually. */
+struct nn_mcslock_node {
+    struct nn_mcslock_node *volatile next;
+    volatile int locked;
+    char pad [64 - sizeof (void*) - sizeof (int)];
+};
+
+struct nn_mcslock {
+    struct nn_mcslock_node *volatile tail;
+};
+
+void nn_mcslock_init (struct nn_mcslock *self);
+void nn_mcslock_term (struct nn_mcslock *self);
+void nn_mcslock_lock (struct nn_mcslock *self, struct nn_mcslock_node *node);
+
+/*  'node' is the one passed to the matching nn_mcslock_lock. */
+void nn_mcslock_unlock (struct nn_mcslock *self, struct nn_mcslock_node *node);
+
+#endif
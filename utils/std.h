@@ -58,6 +58,8 @@
 #define HAVE_EPOLL 1
 /* Test for backtrace */
 #define NN_HAVE_BACKTRACE 1
+/* Test for futex, used by the mutex, condvar and semaphore */
+#define NN_HAVE_FUTEX 1
 #define NN_ATOMIC_GCC_BUILTINS
 #endif
     
@@ -71,6 +73,15 @@
 #define nn_slow(x) (x)
 #endif
 
+/*  Hint to the CPU that the thread is busy waiting. */
+#if defined __i386__ || defined __x86_64__
+#define nn_cpu_relax() __builtin_ia32_pause ()
+#elif defined __aarch64__ || defined __arm__
+#define nn_cpu_relax() __asm__ __volatile__ ("yield" ::: "memory")
+#else
+#define nn_cpu_relax() ((void) 0)
+#endif
+
 /*  Takes a pointer to a member variable and computes pointer to the structure
     that contains it. 'type' is type of the structure, not the member. */
 #define nn_cont(ptr, type, member) \
@@ -20,27 +20,167 @@
     IN THE SOFTWARE.
 */
 
+#if defined __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <string.h>
+
 #include "thread.h"
+#include "numa.h"
 #include "err.h"
 
+#define NN_THREAD_LONG_BITS (8 * sizeof (unsigned long))
+
+void nn_thread_attr_init (struct nn_thread_attr *self)
+{
+    memset (self, 0, sizeof (*self));
+    self->node = -1;
+    self->policy = NN_THREAD_SCHED_INHERIT;
+}
+
+int nn_thread_attr_set_cpu (struct nn_thread_attr *self, int cpu)
+{
+    if (cpu < 0 || cpu >= NN_THREAD_MAX_CPUS)
+        return -EINVAL;
+    self->cpus [cpu / NN_THREAD_LONG_BITS] |=
+        1UL << (cpu % NN_THREAD_LONG_BITS);
+    return 0;
+}
+
+int nn_thread_attr_has_cpu (const struct nn_thread_attr *self, int cpu)
+{
+    if (cpu < 0 || cpu >= NN_THREAD_MAX_CPUS)
+        return 0;
+    return (self->cpus [cpu / NN_THREAD_LONG_BITS] >>
+        (cpu % NN_THREAD_LONG_BITS)) & 1;
+}
+
+int nn_thread_attr_set_cpulist (struct nn_thread_attr *self,
+    const char *list)
+{
+    int rc;
+
+    rc = nn_numa_parse_cpulist (list, self->cpus, NN_THREAD_MAX_CPUS);
+    return rc < 0 ? -EINVAL : rc;
+}
+
+void nn_thread_attr_set_name (struct nn_thread_attr *self, const char *name)
+{
+    strncpy (self->name, name, NN_THREAD_NAME_MAX - 1);
+    self->name [NN_THREAD_NAME_MAX - 1] = 0;
+}
+
+static int nn_thread_has_cpus (const struct nn_thread_attr *attr)
+{
+    size_t i;
+
+    for (i = 0; i != sizeof (attr->cpus) / sizeof (attr->cpus [0]); i++)
+        if (attr->cpus [i])
+            return 1;
+    return 0;
+}
+
+void nn_thread_init (struct nn_thread *self,
+    nn_thread_routine *routine, void *arg)
+{
+    nn_thread_init_node (self, routine, arg, -1);
+}
+
+void nn_thread_init_node (struct nn_thread *self,
+    nn_thread_routine *routine, void *arg, int node)
+{
+    struct nn_thread_attr attr;
+    int rc;
+
+    nn_thread_attr_init (&attr);
+    attr.node = node;
+    rc = nn_thread_init_attr (self, routine, arg, &attr);
+    errnum_assert (rc == 0, -rc);
+}
+
 #ifdef NN_HAVE_WINDOWS
+
+/*  Windows: the first 64 cpus, no names, no policies. */
+
+static DWORD_PTR nn_thread_mask (const struct nn_thread_attr *attr)
+{
+    DWORD_PTR mask = 0;
+    int cpu;
+
+    for (cpu = 0; cpu != 8 * sizeof (mask); cpu++)
+        if (nn_thread_attr_has_cpu (attr, cpu))
+            mask |= (DWORD_PTR) 1 << cpu;
+    return mask;
+}
+
+static int nn_thread_check (const struct nn_thread_attr *attr)
+{
+    if (attr->policy != NN_THREAD_SCHED_INHERIT || attr->priority != 0)
+        return -EINVAL;
+    if (nn_thread_has_cpus (attr) && !nn_thread_mask (attr))
+        return -EINVAL;
+    return 0;
+}
+
 static unsigned int __stdcall nn_thread_main_routine (void *arg)
 {
     struct nn_thread *self;
 
     self = (struct nn_thread*) arg;
+    if (self->attr.node >= 0) {
+        nn_numa_bind_thread (self->attr.node);
+        if (nn_thread_has_cpus (&self->attr))
+            SetThreadAffinityMask (GetCurrentThread (),
+                nn_thread_mask (&self->attr));
+    }
     self->routine (self->arg);
     return 0;
 }
 
-void nn_thread_init (struct nn_thread *self,
-    nn_thread_routine *routine, void *arg)
+int nn_thread_init_attr (struct nn_thread *self,
+    nn_thread_routine *routine, void *arg, const struct nn_thread_attr *attr)
 {
+    DWORD rc;
+    int err;
+
+    err = nn_thread_check (attr);
+    if (err < 0)
+        return err;
     self->routine = routine;
     self->arg = arg;
-    self->handle = (HANDLE) _beginthreadex (NULL, 0,
-        nn_thread_main_routine, (void*) self, 0 , NULL);
+    self->attr = *attr;
+
+    /*  Suspended until it is on the right cpus. */
+    self->handle = (HANDLE) _beginthreadex (NULL,
+        (unsigned) attr->stack_size, nn_thread_main_routine, (void*) self,
+        CREATE_SUSPENDED, NULL);
     win_assert (self->handle != NULL);
+    if (nn_thread_has_cpus (attr) &&
+          !SetThreadAffinityMask (self->handle, nn_thread_mask (attr))) {
+        TerminateThread (self->handle, 0);
+        CloseHandle (self->handle);
+        return -EINVAL;
+    }
+    rc = ResumeThread (self->handle);
+    win_assert (rc != (DWORD) -1);
+    return 0;
+}
+
+int nn_thread_place (const struct nn_thread_attr *attr)
+{
+    int err;
+
+    err = nn_thread_check (attr);
+    if (err < 0)
+        return err;
+    if (attr->node >= 0)
+        nn_numa_bind_thread (attr->node);
+    if (nn_thread_has_cpus (attr) &&
+          !SetThreadAffinityMask (GetCurrentThread (), nn_thread_mask (attr)))
+        return -EINVAL;
+    return 0;
 }
 
 void nn_thread_term (struct nn_thread *self)
@@ -55,24 +195,161 @@ void nn_thread_term (struct nn_thread *self)
 }
 
 #else
+#include <sched.h>
 #include <signal.h>
+
+#if defined __linux__
+static void nn_thread_cpuset (const struct nn_thread_attr *attr,
+    cpu_set_t *set)
+{
+    int cpu;
+
+    CPU_ZERO (set);
+    for (cpu = 0; cpu != NN_THREAD_MAX_CPUS && cpu != CPU_SETSIZE; ++cpu)
+        if (nn_thread_attr_has_cpu (attr, cpu))
+            CPU_SET (cpu, set);
+}
+#endif
+
+/*  The pthread policy, -1 if it does not exist here. */
+static int nn_thread_policy (int policy)
+{
+    switch (policy) {
+    case NN_THREAD_SCHED_OTHER:
+        return SCHED_OTHER;
+    case NN_THREAD_SCHED_FIFO:
+        return SCHED_FIFO;
+    case NN_THREAD_SCHED_RR:
+        return SCHED_RR;
+#if defined __linux__
+    case NN_THREAD_SCHED_BATCH:
+        return SCHED_BATCH;
+    case NN_THREAD_SCHED_IDLE:
+        return SCHED_IDLE;
+#endif
+    }
+    return -1;
+}
+
+static int nn_thread_check (const struct nn_thread_attr *attr)
+{
+    int policy;
+
+#if !defined __linux__
+    if (nn_thread_has_cpus (attr))
+        return -EINVAL;
+#endif
+    if (attr->policy == NN_THREAD_SCHED_INHERIT)
+        return attr->priority == 0 ? 0 : -EINVAL;
+    policy = nn_thread_policy (attr->policy);
+    if (policy < 0 || attr->priority < sched_get_priority_min (policy) ||
+          attr->priority > sched_get_priority_max (policy))
+        return -EINVAL;
+    return 0;
+}
+
+/*  What has to be done from the thread itself. */
+static void nn_thread_setup (const struct nn_thread_attr *attr)
+{
+#if defined __linux__
+    cpu_set_t set;
+    int rc;
+
+    /*  The binding moves the thread to the cpus of the node, the cpus
+        asked for win. They were accepted at creation already. */
+    if (attr->node >= 0) {
+        nn_numa_bind_thread (attr->node);
+        if (nn_thread_has_cpus (attr)) {
+            nn_thread_cpuset (attr, &set);
+            rc = pthread_setaffinity_np (pthread_self (), sizeof (set), &set);
+            errnum_assert (rc == 0, rc);
+        }
+    }
+    if (attr->name [0])
+        pthread_setname_np (pthread_self (), attr->name);
+
+    /*  Thread attributes take the standard policies only. These two never
+        need privileges. */
+    if (attr->policy == NN_THREAD_SCHED_BATCH ||
+          attr->policy == NN_THREAD_SCHED_IDLE) {
+        struct sched_param param;
+
+        memset (&param, 0, sizeof (param));
+        rc = pthread_setschedparam (pthread_self (),
+            nn_thread_policy (attr->policy), &param);
+        errnum_assert (rc == 0, rc);
+    }
+#else
+    if (attr->node >= 0)
+        nn_numa_bind_thread (attr->node);
+#if defined NN_HAVE_OSX
+    if (attr->name [0])
+        pthread_setname_np (attr->name);
+#endif
+#endif
+}
+
 static void *nn_thread_main_routine (void *arg)
 {
     struct nn_thread *self;
 
     self = (struct nn_thread*) arg;
 
+    /*  Bind to the requested node before the routine touches any memory,
+        so that its first-touch pages are local. */
+    nn_thread_setup (&self->attr);
+
     /*  Run the thread routine. */
     self->routine (self->arg);
     return NULL;
 }
 
-void nn_thread_init (struct nn_thread *self,
-    nn_thread_routine *routine, void *arg)
+int nn_thread_init_attr (struct nn_thread *self,
+    nn_thread_routine *routine, void *arg, const struct nn_thread_attr *attr)
 {
     int rc;
+    pthread_attr_t pattr;
+    struct sched_param param;
     sigset_t new_sigmask;
     sigset_t old_sigmask;
+#if defined __linux__
+    cpu_set_t set;
+#endif
+
+    rc = nn_thread_check (attr);
+    if (rc < 0)
+        return rc;
+
+    /*  Everything that can be refused is set before the thread exists, so
+        that it never runs with half of it. */
+    rc = pthread_attr_init (&pattr);
+    errnum_assert (rc == 0, rc);
+    if (attr->stack_size) {
+        rc = pthread_attr_setstacksize (&pattr, attr->stack_size);
+        if (rc != 0) {
+            pthread_attr_destroy (&pattr);
+            return -rc;
+        }
+    }
+#if defined __linux__
+    if (nn_thread_has_cpus (attr)) {
+        nn_thread_cpuset (attr, &set);
+        rc = pthread_attr_setaffinity_np (&pattr, sizeof (set), &set);
+        errnum_assert (rc == 0, rc);
+    }
+#endif
+    if (attr->policy != NN_THREAD_SCHED_INHERIT) {
+        memset (&param, 0, sizeof (param));
+        param.sched_priority = attr->priority;
+        rc = pthread_attr_setinheritsched (&pattr, PTHREAD_EXPLICIT_SCHED);
+        errnum_assert (rc == 0, rc);
+        rc = pthread_attr_setschedpolicy (&pattr,
+            nn_thread_policy (attr->policy > NN_THREAD_SCHED_RR ?
+            NN_THREAD_SCHED_OTHER : attr->policy));
+        errnum_assert (rc == 0, rc);
+        rc = pthread_attr_setschedparam (&pattr, &param);
+        errnum_assert (rc == 0, rc);
+    }
  
     /*  No signals should be processed by this thread. The library doesn't
         use signals and thus all the signals should be delivered to application
@@ -84,13 +361,54 @@ void nn_thread_init (struct nn_thread *self,
 
     self->routine = routine;
     self->arg = arg;
-    rc = pthread_create (&self->handle, NULL, nn_thread_main_routine,
+    self->attr = *attr;
+    rc = pthread_create (&self->handle, &pattr, nn_thread_main_routine,
         (void*) self);
-    errnum_assert (rc == 0, rc);
+    errnum_assert (rc == 0 || rc == EINVAL || rc == EPERM, rc);
 
     /*  Restore signal set to what it was before. */
-    rc = pthread_sigmask (SIG_SETMASK, &old_sigmask, NULL);
-    errnum_assert (rc == 0, rc);
+    pthread_sigmask (SIG_SETMASK, &old_sigmask, NULL);
+    pthread_attr_destroy (&pattr);
+    return -rc;
+}
+
+int nn_thread_place (const struct nn_thread_attr *attr)
+{
+    int rc;
+    struct sched_param param;
+#if defined __linux__
+    cpu_set_t set;
+#endif
+
+    rc = nn_thread_check (attr);
+    if (rc < 0)
+        return rc;
+    if (attr->node >= 0)
+        nn_numa_bind_thread (attr->node);
+#if defined __linux__
+    if (nn_thread_has_cpus (attr)) {
+        nn_thread_cpuset (attr, &set);
+        rc = pthread_setaffinity_np (pthread_self (), sizeof (set), &set);
+        if (rc != 0)
+            return -rc;
+    }
+#endif
+    if (attr->policy != NN_THREAD_SCHED_INHERIT) {
+        memset (&param, 0, sizeof (param));
+        param.sched_priority = attr->priority;
+        rc = pthread_setschedparam (pthread_self (),
+            nn_thread_policy (attr->policy), &param);
+        if (rc != 0)
+            return -rc;
+    }
+#if defined __linux__
+    if (attr->name [0])
+        pthread_setname_np (pthread_self (), attr->name);
+#elif defined NN_HAVE_OSX
+    if (attr->name [0])
+        pthread_setname_np (attr->name);
+#endif
+    return 0;
 }
 
 void nn_thread_term (struct nn_thread *self)
@@ -101,3 +419,90 @@ void nn_thread_term (struct nn_thread *self)
     errnum_assert (rc == 0, rc);
 }
 #endif
+
+#if defined THREAD_TEST_MAIN && defined __linux__
+#include <stdio.h>
+#include <stdlib.h>
+#include "testhelp.h"
+
+struct seen {
+    int cpu;
+    char name [NN_THREAD_NAME_MAX];
+    size_t stack;
+    int policy;
+};
+
+static void look(void *arg) {
+    struct seen *seen = arg;
+    pthread_attr_t pattr;
+
+    seen->cpu = sched_getcpu();
+    pthread_getname_np(pthread_self(), seen->name, sizeof(seen->name));
+    pthread_getattr_np(pthread_self(), &pattr);
+    pthread_attr_getstacksize(&pattr, &seen->stack);
+    pthread_attr_destroy(&pattr);
+    seen->policy = sched_getscheduler(0);
+}
+
+int main(void) {
+    struct nn_thread_attr attr;
+    struct nn_thread t;
+    struct seen seen;
+    int rc;
+
+    nn_thread_attr_init(&attr);
+    test_cond("Cpu lists", nn_thread_attr_set_cpulist(&attr, "0,2-3") == 3 &&
+        nn_thread_attr_has_cpu(&attr, 2) && !nn_thread_attr_has_cpu(&attr, 1) &&
+        !nn_thread_attr_has_cpu(&attr, NN_THREAD_MAX_CPUS) &&
+        nn_thread_attr_set_cpulist(&attr, "1-x") == -EINVAL &&
+        nn_thread_attr_set_cpu(&attr, NN_THREAD_MAX_CPUS) == -EINVAL);
+
+    nn_thread_attr_init(&attr);
+    nn_thread_attr_set_cpu(&attr, 0);
+    nn_thread_attr_set_name(&attr, "a-much-too-long-thread-name");
+    attr.stack_size = 1 << 20;
+    attr.policy = NN_THREAD_SCHED_BATCH;
+    rc = nn_thread_init_attr(&t, look, &seen, &attr);
+    if (rc == 0) nn_thread_term(&t);
+    test_cond("Cpu, name, stack and policy", rc == 0 && seen.cpu == 0 &&
+        strcmp(seen.name, "a-much-too-long") == 0 &&
+        seen.stack == (size_t)1 << 20 && seen.policy == SCHED_BATCH);
+
+    /* Bound to node 0, still on the one cpu asked for. */
+    attr.node = 0;
+    attr.policy = NN_THREAD_SCHED_INHERIT;
+    nn_thread_attr_set_name(&attr, "");
+    rc = nn_thread_init_attr(&t, look, &seen, &attr);
+    if (rc == 0) nn_thread_term(&t);
+    test_cond("Node and cpus", rc == 0 && seen.cpu == 0 &&
+        seen.policy == SCHED_OTHER);
+
+    nn_thread_attr_init(&attr);
+    nn_thread_attr_set_cpu(&attr, NN_THREAD_MAX_CPUS-1);
+    test_cond("Offline cpus are refused",
+        nn_thread_init_attr(&t, look, &seen, &attr) == -EINVAL &&
+        nn_thread_place(&attr) == -EINVAL);
+
+    nn_thread_attr_init(&attr);
+    attr.policy = NN_THREAD_SCHED_FIFO;
+    test_cond("Priorities out of range are refused",
+        nn_thread_init_attr(&t, look, &seen, &attr) == -EINVAL);
+
+    /* Real time needs privileges the tests may not have. */
+    attr.priority = 1;
+    rc = nn_thread_init_attr(&t, look, &seen, &attr);
+    if (rc == 0) nn_thread_term(&t);
+    test_cond("Real time policy", (rc == 0 && seen.policy == SCHED_FIFO) ||
+        rc == -EPERM);
+
+    nn_thread_attr_init(&attr);
+    nn_thread_attr_set_cpu(&attr, 0);
+    nn_thread_attr_set_name(&attr, "main-loop");
+    look(&seen);
+    rc = nn_thread_place(&attr);
+    look(&seen);
+    test_cond("Place the calling thread", rc == 0 && seen.cpu == 0 &&
+        strcmp(seen.name, "main-loop") == 0);
+    test_report()
+}
+#endif
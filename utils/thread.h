@@ -25,29 +25,118 @@
 
 /*  Platform independent implementation of threading. */
 
-typedef void (nn_thread_routine) (void*);
+#include <stddef.h>
 
 #if defined NN_HAVE_WINDOWS
 #include "win.h"
+#else
+#include <pthread.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (nn_thread_routine) (void*);
+
+/*  Placement and scheduling of a thread. Start from nn_thread_attr_init,
+    which leaves everything to the system, and set what matters. */
+
+#define NN_THREAD_MAX_CPUS 1024
+
+/*  Names longer than this, terminator included, are cut (the Linux limit). */
+#define NN_THREAD_NAME_MAX 16
+
+/*  Scheduling policies. Inherit keeps the creator's policy and priority. */
+#define NN_THREAD_SCHED_INHERIT 0
+#define NN_THREAD_SCHED_OTHER 1
+#define NN_THREAD_SCHED_FIFO 2
+#define NN_THREAD_SCHED_RR 3
+#define NN_THREAD_SCHED_BATCH 4
+#define NN_THREAD_SCHED_IDLE 5
+
+struct nn_thread_attr {
+
+    /*  CPUs the thread may run on, none set for all. Applied when the
+        thread is created, so it never runs anywhere else. */
+    unsigned long cpus [NN_THREAD_MAX_CPUS / (8 * sizeof (unsigned long))];
+
+    /*  NUMA node to bind to (see nn_numa_bind_thread), -1 for none. The
+        binding sets the memory policy too. When 'cpus' is set as well,
+        'cpus' decides where the thread runs. */
+    int node;
+
+    /*  Shown by top, ps and perf. Empty to inherit the creator's. */
+    char name [NN_THREAD_NAME_MAX];
+
+    /*  Bytes of stack, 0 for the default. */
+    size_t stack_size;
+
+    /*  One of NN_THREAD_SCHED_*. 'priority' is the static priority of the
+        real time policies, FIFO and RR, and must be 0 with the others. */
+    int policy;
+    int priority;
+};
+
+void nn_thread_attr_init (struct nn_thread_attr *self);
+
+/*  Add 'cpu' to the cpus the thread may run on. Returns 0, or -EINVAL if
+    it is out of range. */
+int nn_thread_attr_set_cpu (struct nn_thread_attr *self, int cpu);
+
+/*  Whether 'cpu' is one of the cpus the thread may run on. */
+int nn_thread_attr_has_cpu (const struct nn_thread_attr *self, int cpu);
+
+/*  Replace the cpus by a kernel style list, "0-3,8". Returns the number of
+    cpus, or -EINVAL on a malformed list. */
+int nn_thread_attr_set_cpulist (struct nn_thread_attr *self,
+    const char *list);
+
+void nn_thread_attr_set_name (struct nn_thread_attr *self, const char *name);
+
+#if defined NN_HAVE_WINDOWS
 struct nn_thread
 {
     nn_thread_routine *routine;
     void *arg;
+    struct nn_thread_attr attr;
     HANDLE handle;
 };
 #else
-#include <pthread.h>
 struct nn_thread
 {
     nn_thread_routine *routine;
     void *arg;
+    struct nn_thread_attr attr;
     pthread_t handle;
 };
 #endif
 
 void nn_thread_init (struct nn_thread *self,
     nn_thread_routine *routine, void *arg);
+
+/*  Same as nn_thread_init() but the new thread binds itself to NUMA 'node'
+    (see nn_numa_bind_thread) before running the routine. A negative 'node'
+    leaves the placement to the scheduler. */
+void nn_thread_init_node (struct nn_thread *self,
+    nn_thread_routine *routine, void *arg, int node);
+
+/*  Same as nn_thread_init() with the placement and scheduling of 'attr'.
+    Returns 0, or -EINVAL if the cpus or the priority are not valid here,
+    -EPERM if the policy needs privileges the process lacks. The thread is
+    not started then. */
+int nn_thread_init_attr (struct nn_thread *self,
+    nn_thread_routine *routine, void *arg, const struct nn_thread_attr *attr);
+
+/*  Apply 'attr', but the stack size, to the calling thread, the event loop
+    of the main thread for instance. Returns 0 or the errors above. */
+int nn_thread_place (const struct nn_thread_attr *attr);
+
 void nn_thread_term (struct nn_thread *self);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
 
@@ -0,0 +1,481 @@
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "threadpool.h"
+#include "alloc.h"
+#include "err.h"
+#include "std.h"
+
+/*  Rounds of looking for work, yielding in between, before parking. */
+#define NN_THREADPOOL_SPINS 16
+
+#define NN_THREADPOOL_MASK (NN_THREADPOOL_DEQUE - 1)
+
+/*  Worker running the calling thread, NULL outside of the pools. */
+static __thread struct nn_threadpool_worker *nn_threadpool_current;
+
+/*  The deque operations follow Le, Pop, Cohen and Zappa Nardelli, "Correct
+    and efficient work-stealing for weak memory models" (2013). The array
+    does not grow: a full deque sends tasks to the injection queue. */
+
+static int nn_threadpool_push (struct nn_threadpool_worker *self,
+    struct nn_threadpool_task *task)
+{
+    int64_t b = __atomic_load_n (&self->bottom, __ATOMIC_RELAXED);
+    int64_t t = __atomic_load_n (&self->top, __ATOMIC_ACQUIRE);
+
+    if (nn_slow (b - t >= NN_THREADPOOL_DEQUE))
+        return -EAGAIN;
+    __atomic_store_n (&self->slots [b & NN_THREADPOOL_MASK], task,
+        __ATOMIC_RELAXED);
+    __atomic_store_n (&self->bottom, b + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*  Pop from the bottom, by the owner. */
+static struct nn_threadpool_task *nn_threadpool_take (
+    struct nn_threadpool_worker *self)
+{
+    struct nn_threadpool_task *task = NULL;
+    int64_t b = __atomic_load_n (&self->bottom, __ATOMIC_RELAXED) - 1;
+    int64_t t;
+
+    __atomic_store_n (&self->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+    t = __atomic_load_n (&self->top, __ATOMIC_RELAXED);
+    if (t <= b) {
+        task = __atomic_load_n (&self->slots [b & NN_THREADPOOL_MASK],
+            __ATOMIC_RELAXED);
+        if (t != b)
+            return task;
+
+        /*  The last task: race the thieves for it. */
+        if (!__atomic_compare_exchange_n (&self->top, &t, t + 1, 0,
+              __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            task = NULL;
+    }
+    __atomic_store_n (&self->bottom, b + 1, __ATOMIC_RELAXED);
+    return task;
+}
+
+/*  Pop from the top, by another worker. NULL if the deque is empty or
+    another thief got there first. */
+static struct nn_threadpool_task *nn_threadpool_steal (
+    struct nn_threadpool_worker *victim)
+{
+    struct nn_threadpool_task *task;
+    int64_t t = __atomic_load_n (&victim->top, __ATOMIC_ACQUIRE);
+    int64_t b;
+
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+    b = __atomic_load_n (&victim->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b)
+        return NULL;
+    task = __atomic_load_n (&victim->slots [t & NN_THREADPOOL_MASK],
+        __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n (&victim->top, &t, t + 1, 0,
+          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return NULL;
+    return task;
+}
+
+static struct nn_threadpool_task *nn_threadpool_find (
+    struct nn_threadpool_worker *self)
+{
+    struct nn_threadpool *pool = self->pool;
+    struct nn_threadpool_task *task;
+    int i;
+    int start;
+
+    task = nn_threadpool_take (self);
+    if (task)
+        return task;
+    for (i = 0; i != pool->nodes; i++) {
+        task = nn_mpmc_pop (&pool->inject [(self->node + i) % pool->nodes]);
+        if (task)
+            return task;
+    }
+    self->rand ^= self->rand << 13;
+    self->rand ^= self->rand >> 7;
+    self->rand ^= self->rand << 17;
+    start = (int) (self->rand % pool->nworkers);
+    for (i = 0; i != pool->nworkers; i++) {
+        if (&pool->workers [(start + i) % pool->nworkers] == self)
+            continue;
+        task = nn_threadpool_steal (&pool->workers [(start + i) %
+            pool->nworkers]);
+        if (task) {
+            __atomic_store_n (&self->stolen, self->stolen + 1,
+                __ATOMIC_RELAXED);
+            return task;
+        }
+    }
+    return NULL;
+}
+
+static void nn_threadpool_run (struct nn_threadpool_worker *self,
+    struct nn_threadpool_task *task)
+{
+    __atomic_store_n (&self->executed, self->executed + 1, __ATOMIC_RELAXED);
+    task->fn (task);
+}
+
+static void nn_threadpool_main (void *arg)
+{
+    struct nn_threadpool_worker *self = arg;
+    struct nn_threadpool *pool = self->pool;
+    struct nn_threadpool_task *task;
+    int idle = 0;
+
+    nn_threadpool_current = self;
+    while (1) {
+        task = nn_threadpool_find (self);
+        if (task) {
+            idle = 0;
+            nn_threadpool_run (self, task);
+            continue;
+        }
+        if (++idle < NN_THREADPOOL_SPINS) {
+            sched_yield ();
+            continue;
+        }
+        idle = 0;
+
+        /*  Announce the parking first, then look once more: a submitter
+            either sees the announcement or its task is found here. */
+        __atomic_add_fetch (&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+        task = nn_threadpool_find (self);
+        if (task) {
+            __atomic_sub_fetch (&pool->sleepers, 1, __ATOMIC_RELAXED);
+            nn_threadpool_run (self, task);
+            continue;
+        }
+        nn_mutex_lock (&pool->sync);
+        while (pool->tokens == 0 && !pool->stopping)
+            nn_condvar_wait (&pool->cond, &pool->sync, -1);
+        if (pool->tokens)
+            pool->tokens--;
+        else {
+
+            /*  Stopping and there was nothing left to run. */
+            nn_mutex_unlock (&pool->sync);
+            __atomic_sub_fetch (&pool->sleepers, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        nn_mutex_unlock (&pool->sync);
+        __atomic_sub_fetch (&pool->sleepers, 1, __ATOMIC_RELAXED);
+    }
+    nn_threadpool_current = NULL;
+}
+
+/*  Wake a parked worker after a task was made visible. */
+static void nn_threadpool_wake (struct nn_threadpool *self)
+{
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+    if (nn_fast (__atomic_load_n (&self->sleepers, __ATOMIC_RELAXED) == 0))
+        return;
+    nn_mutex_lock (&self->sync);
+    if (self->tokens < __atomic_load_n (&self->sleepers, __ATOMIC_RELAXED)) {
+        self->tokens++;
+        nn_condvar_signal (&self->cond);
+    }
+    nn_mutex_unlock (&self->sync);
+}
+
+/*  Stop and join the first 'started' workers and free everything. The
+    deques go last, any running worker may be stealing from them. */
+static void nn_threadpool_stop (struct nn_threadpool *self, int started)
+{
+    int i;
+
+    nn_mutex_lock (&self->sync);
+    self->stopping = 1;
+    nn_condvar_broadcast (&self->cond);
+    nn_mutex_unlock (&self->sync);
+    for (i = 0; i != started; i++)
+        nn_thread_term (&self->workers [i].thread);
+    for (i = 0; i != self->nworkers; i++)
+        nn_free (self->workers [i].slots);
+    for (i = 0; i != self->nodes; i++)
+        nn_mpmc_term (&self->inject [i]);
+    nn_condvar_term (&self->cond);
+    nn_mutex_term (&self->sync);
+    nn_free (self->mem);
+}
+
+/*  Node of worker 'i'. A worker pinned to cpus takes the node of the first
+    of them, so that the memory it binds to is next to where it runs. The
+    others take the nodes in turn. */
+static int nn_threadpool_node (struct nn_threadpool *self,
+    const struct nn_thread_attr *attr, int i)
+{
+    int cpu;
+    int node;
+
+    if (attr) {
+        for (cpu = 0; cpu != NN_THREAD_MAX_CPUS; cpu++) {
+            if (!nn_thread_attr_has_cpu (attr, cpu))
+                continue;
+            node = nn_numa_node_of_cpu (cpu);
+            if (node >= 0 && node < self->nodes)
+                return node;
+            break;
+        }
+    }
+    return i % self->nodes;
+}
+
+int nn_threadpool_init (struct nn_threadpool *self, int nthreads, int nodes,
+    size_t capacity)
+{
+    return nn_threadpool_init_attr (self, nthreads, nodes, capacity, NULL);
+}
+
+int nn_threadpool_init_attr (struct nn_threadpool *self, int nthreads,
+    int nodes, size_t capacity, const struct nn_thread_attr *attrs)
+{
+    struct nn_threadpool_worker *w;
+    struct nn_thread_attr attr;
+    int i;
+    int rc;
+
+    nn_assert (nthreads > 0 && nodes >= 0 && nodes <= NN_NUMA_MAX_NODES);
+    self->nworkers = nthreads;
+    self->nodes = nodes ? nodes : 1;
+    self->sleepers = 0;
+    self->tokens = 0;
+    self->stopping = 0;
+    self->mem = nn_calloc (nthreads * sizeof (*w) + 63);
+    if (nn_slow (!self->mem))
+        return -ENOMEM;
+    self->workers = (struct nn_threadpool_worker*) (((uintptr_t) self->mem +
+        63) & ~(uintptr_t) 63);
+    for (i = 0; i != self->nodes; i++) {
+        rc = nn_mpmc_init (&self->inject [i], capacity);
+        if (nn_slow (rc != 0)) {
+            while (i--)
+                nn_mpmc_term (&self->inject [i]);
+            nn_free (self->mem);
+            return rc;
+        }
+    }
+
+    /*  Every deque has to exist before the first worker starts stealing. */
+    for (i = 0; i != nthreads; i++) {
+        w = &self->workers [i];
+        w->slots = nn_malloc (NN_THREADPOOL_DEQUE * sizeof (*w->slots));
+        if (nn_slow (!w->slots)) {
+            while (i--)
+                nn_free (self->workers [i].slots);
+            for (i = 0; i != self->nodes; i++)
+                nn_mpmc_term (&self->inject [i]);
+            nn_free (self->mem);
+            return -ENOMEM;
+        }
+        w->top = 0;
+        w->bottom = 0;
+        w->pool = self;
+        w->id = i;
+        w->node = nn_threadpool_node (self, attrs ? &attrs [i] : NULL, i);
+        w->rand = 0x9e3779b97f4a7c15ULL * (i + 1);
+        w->executed = 0;
+        w->stolen = 0;
+    }
+    nn_mutex_init (&self->sync);
+    rc = nn_condvar_init (&self->cond);
+    errnum_assert (rc == 0, -rc);
+
+    for (i = 0; i != nthreads; i++) {
+        if (attrs)
+            attr = attrs [i];
+        else
+            nn_thread_attr_init (&attr);
+        attr.node = nodes ? self->workers [i].node : attr.node;
+        if (!attr.name [0])
+            snprintf (attr.name, sizeof (attr.name), "nn-worker-%u",
+                (unsigned) i % 100000);
+        rc = nn_thread_init_attr (&self->workers [i].thread,
+            nn_threadpool_main, &self->workers [i], &attr);
+        if (nn_slow (rc < 0)) {
+            nn_threadpool_stop (self, i);
+            return rc;
+        }
+    }
+    return 0;
+}
+
+void nn_threadpool_term (struct nn_threadpool *self)
+{
+    nn_threadpool_stop (self, self->nworkers);
+}
+
+int nn_threadpool_submit_node (struct nn_threadpool *self,
+    struct nn_threadpool_task *task, nn_threadpool_fn *fn, int node)
+{
+    struct nn_threadpool_worker *w = nn_threadpool_current;
+
+    task->fn = fn;
+    if (w && w->pool == self) {
+        if (nn_slow (nn_threadpool_push (w, task) != 0 &&
+              nn_mpmc_push (&self->inject [w->node], task) != 0)) {
+            nn_threadpool_run (w, task);
+            return 0;
+        }
+    }
+    else if (nn_slow (nn_mpmc_push (&self->inject [(unsigned) node %
+          self->nodes], task) != 0))
+        return -EAGAIN;
+    nn_threadpool_wake (self);
+    return 0;
+}
+
+int nn_threadpool_submit (struct nn_threadpool *self,
+    struct nn_threadpool_task *task, nn_threadpool_fn *fn)
+{
+    return nn_threadpool_submit_node (self, task, fn, 0);
+}
+
+void nn_threadpool_stats (struct nn_threadpool *self, uint64_t *executed,
+    uint64_t *stolen)
+{
+    int i;
+
+    *executed = 0;
+    *stolen = 0;
+    for (i = 0; i != self->nworkers; i++) {
+        *executed += __atomic_load_n (&self->workers [i].executed,
+            __ATOMIC_RELAXED);
+        *stolen += __atomic_load_n (&self->workers [i].stolen,
+            __ATOMIC_RELAXED);
+    }
+}
+
+#if defined THREADPOOL_TEST_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "testhelp.h"
+
+#define TASKS 100000
+
+struct counted {
+    struct nn_threadpool_task task;
+    long value;
+};
+
+static struct nn_threadpool pool;
+static long total;
+
+static void add(struct nn_threadpool_task *task) {
+    __atomic_add_fetch(&total, nn_cont(task, struct counted, task)->value,
+        __ATOMIC_RELAXED);
+}
+
+/* A binary tree of tasks: each splits its range in two until it is one
+ * element long, submitting the halves from inside the pool. */
+struct range {
+    struct nn_threadpool_task task;
+    long lo, hi;
+};
+
+static void split(struct nn_threadpool_task *task) {
+    struct range *r = nn_cont(task, struct range, task), *a, *b;
+    long mid;
+
+    if (r->hi - r->lo == 1) {
+        __atomic_add_fetch(&total, r->lo, __ATOMIC_RELAXED);
+        free(r);
+        return;
+    }
+    mid = (r->lo + r->hi) / 2;
+    a = malloc(sizeof(*a));
+    b = malloc(sizeof(*b));
+    a->lo = r->lo; a->hi = mid;
+    b->lo = mid; b->hi = r->hi;
+    free(r);
+    nn_threadpool_submit(&pool, &a->task, split);
+    nn_threadpool_submit(&pool, &b->task, split);
+}
+
+static void slow(struct nn_threadpool_task *task) {
+    usleep(1000);
+    add(task);
+}
+
+int main(void) {
+    static struct counted tasks[TASKS];
+    struct range *root;
+    uint64_t executed, stolen;
+    int j, rc;
+
+    test_cond("Init", nn_threadpool_init(&pool, 4, 0, 1024) == 0);
+
+    /* More than the injection queue holds: retry when it is full. */
+    __atomic_store_n(&total, 0, __ATOMIC_RELAXED);
+    for (j = 0; j < TASKS; j++) {
+        tasks[j].value = j;
+        while ((rc = nn_threadpool_submit(&pool, &tasks[j].task, add)) ==
+            -EAGAIN)
+            sched_yield();
+    }
+    while (__atomic_load_n(&total, __ATOMIC_ACQUIRE) !=
+        (long)TASKS*(TASKS-1)/2)
+        sched_yield();
+    nn_threadpool_stats(&pool, &executed, &stolen);
+    test_cond("External submissions", executed == TASKS);
+
+    __atomic_store_n(&total, 0, __ATOMIC_RELAXED);
+    root = malloc(sizeof(*root));
+    root->lo = 0;
+    root->hi = TASKS;
+    nn_threadpool_submit(&pool, &root->task, split);
+    while (__atomic_load_n(&total, __ATOMIC_ACQUIRE) !=
+        (long)TASKS*(TASKS-1)/2)
+        sched_yield();
+    nn_threadpool_stats(&pool, &executed, &stolen);
+    printf("%llu stolen\n", (unsigned long long)stolen);
+    test_cond("Nested submissions", executed == TASKS + 2*TASKS - 1);
+
+    /* Let every worker park, then wake them with new work. */
+    usleep(100000);
+    test_cond("Idle workers park",
+        __atomic_load_n(&pool.sleepers, __ATOMIC_RELAXED) == 4);
+    __atomic_store_n(&total, 0, __ATOMIC_RELAXED);
+    for (j = 0; j < 100; j++)
+        nn_threadpool_submit(&pool, &tasks[j].task, slow);
+
+    /* Terminating runs what is still queued. */
+    nn_threadpool_term(&pool);
+    test_cond("Term drains the queues", total == 99*100/2);
+
+    test_cond("NUMA layout", nn_threadpool_init(&pool, 3, 2, 16) == 0 &&
+        pool.nodes == 2 && pool.workers[2].node == 0 &&
+        nn_threadpool_submit_node(&pool, &tasks[1].task, add, 1) == 0);
+    nn_threadpool_term(&pool);
+
+    /* The third worker cannot start, the two before it are stopped. */
+    {
+        struct nn_thread_attr attrs[3];
+
+        for (j = 0; j < 3; j++) nn_thread_attr_init(&attrs[j]);
+        nn_thread_attr_set_cpu(&attrs[2], NN_THREAD_MAX_CPUS-1);
+        test_cond("A worker failing to start fails the pool",
+            nn_threadpool_init_attr(&pool, 3, 0, 16, attrs) == -EINVAL);
+
+        /* Workers pinned to cpu 0 all serve its node. */
+        for (j = 0; j < 3; j++) {
+            nn_thread_attr_init(&attrs[j]);
+            if (j != 1) nn_thread_attr_set_cpu(&attrs[j], 0);
+        }
+        test_cond("Pinned workers serve the node of their cpu",
+            nn_threadpool_init_attr(&pool, 3, 2, 16, attrs) == 0 &&
+            pool.workers[0].node == nn_numa_node_of_cpu(0) &&
+            pool.workers[1].node == 1 &&
+            pool.workers[2].node == nn_numa_node_of_cpu(0));
+        nn_threadpool_term(&pool);
+    }
+    test_report()
+}
+#endif
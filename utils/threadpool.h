@@ -0,0 +1,125 @@
+#ifndef NN_THREADPOOL_INCLUDED
+#define NN_THREADPOOL_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "condvar.h"
+#include "mutex.h"
+#include "numa.h"
+#include "queue.h"
+#include "thread.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*  Work-stealing thread pool. A task is a struct nn_threadpool_task
+    embedded in the caller's object, nothing is allocated per task.
+
+    Every worker owns a Chase-Lev deque: tasks submitted from inside a task
+    are pushed to the bottom of the current worker's deque and the worker
+    pops from the bottom too (last in, first out, hot in its cache), while
+    idle workers steal from the top of the others' deques with a single
+    compare-and-swap. Tasks submitted from other threads go to an nn_mpmc
+    injection queue, one per NUMA node the pool spans. A worker looks in
+    its own deque, then the queue of its node, the queues of the other
+    nodes and finally the deques of the other workers, starting from a
+    random one.
+
+    A worker that finds nothing yields a few times, then parks on a
+    condition variable. Submitting wakes one parked worker if there is any;
+    the check costs a fence and a load when every worker is busy. A worker
+    announces itself as parking before looking for work one last time, so
+    a task pushed meanwhile is either seen by that look or wakes it. */
+
+/*  Tasks a worker's deque holds before further local submissions go to the
+    injection queue. */
+#define NN_THREADPOOL_DEQUE 1024
+
+struct nn_threadpool_task;
+typedef void nn_threadpool_fn (struct nn_threadpool_task *task);
+
+struct nn_threadpool_task {
+    nn_threadpool_fn *fn;
+};
+
+struct nn_threadpool;
+
+struct nn_threadpool_worker {
+
+    /*  The deque. The owner moves 'bottom', thieves move 'top'. */
+    volatile int64_t top;
+    char pad0 [64 - sizeof (int64_t)];
+    volatile int64_t bottom;
+    struct nn_threadpool_task **slots;
+
+    struct nn_threadpool *pool;
+    struct nn_thread thread;
+    int id;
+    int node;
+    uint64_t rand;
+
+    /*  Counters, written by the worker only. */
+    uint64_t executed;
+    uint64_t stolen;
+    char pad1 [64];
+};
+
+struct nn_threadpool {
+    struct nn_threadpool_worker *workers;
+    void *mem;
+    int nworkers;
+    int nodes;
+    struct nn_mpmc inject [NN_NUMA_MAX_NODES];
+
+    /*  Parking. 'tokens' are wakeups not yet consumed by a worker. */
+    volatile int sleepers;
+    int tokens;
+    volatile int stopping;
+    nn_mutex_t sync;
+    nn_condvar_t cond;
+};
+
+/*  Start 'nthreads' workers. With 'nodes' > 0 the workers are bound to NUMA
+    nodes 0 to 'nodes'-1 in turn and every node gets an injection queue,
+    with 0 they are left to the scheduler and share one. Each injection
+    queue holds 'capacity' tasks. Returns 0 or -ENOMEM. */
+int nn_threadpool_init (struct nn_threadpool *self, int nthreads, int nodes,
+    size_t capacity);
+
+/*  The same with the placement and scheduling of every worker, 'attrs'
+    holding 'nthreads' of them, or NULL. A worker pinned to cpus serves the
+    node of the first of them instead of taking its turn. The node of the
+    worker, if any, replaces the one of its attribute, and workers without
+    a name are called "nn-worker-<n>". Returns 0, -ENOMEM or an error of
+    nn_thread_init_attr. */
+int nn_threadpool_init_attr (struct nn_threadpool *self, int nthreads,
+    int nodes, size_t capacity, const struct nn_thread_attr *attrs);
+
+/*  Run the tasks still queued, then stop and join the workers. */
+void nn_threadpool_term (struct nn_threadpool *self);
+
+/*  Run 'fn' on 'task' on some worker. From inside a task the task goes to
+    the current worker's deque and cannot fail; it is run inline if both
+    the deque and the injection queue are full. From another thread it goes
+    to the injection queue of the first node. Returns 0, or -EAGAIN if that
+    queue is full. */
+int nn_threadpool_submit (struct nn_threadpool *self,
+    struct nn_threadpool_task *task, nn_threadpool_fn *fn);
+
+/*  The same, but from another thread the task goes to the injection queue
+    of 'node', so that a worker bound to that node is likely to run it. */
+int nn_threadpool_submit_node (struct nn_threadpool *self,
+    struct nn_threadpool_task *task, nn_threadpool_fn *fn, int node);
+
+/*  Tasks run and tasks stolen from another worker's deque so far, summed
+    over the workers. Only a hint while they are running. */
+void nn_threadpool_stats (struct nn_threadpool *self, uint64_t *executed,
+    uint64_t *stolen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif